@@ -0,0 +1,513 @@
+/**
+ * Micro-benchmarks of the codecs on the request path: base64, url decoding, cJSON and the HTTP message
+ * framing, over payloads from 100 bytes to 1 GB.
+ *
+ * Every case runs once untimed, then in batches of doubling size until --min-time seconds are spent. Reported
+ * are the input bytes of one operation, MB/s and ns/byte over them, and the heap allocations of one operation
+ * (counted with glibc only, n/a elsewhere). --json writes the results as one JSON document for comparing runs.
+ *
+ * Usage: ck-crowdnode-bench [--filter <name>] [--min-size <bytes>] [--max-size <bytes>] [--min-time <seconds>]
+ *                           [--json <file>|-]
+ * Sizes take a K, M or G suffix (powers of ten, the payload sizes are too).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#endif
+
+#include "../src/base64.h"
+#include "../src/urldecoder.h"
+#include "../src/cJSON.h"
+#include "../src/httpmessage.h"
+
+#define BENCH_MIN_SIZE 100LL
+#define BENCH_MAX_SIZE 1000000000LL
+#define BENCH_MIN_TIME 0.2
+
+/* allocations, counted by replacing the allocator of glibc */
+
+static unsigned long long allocCount = 0;
+static unsigned long long allocBytes = 0;
+
+#if defined(__GLIBC__) && !defined(BENCH_NO_ALLOC_COUNT)
+#define BENCH_ALLOC_COUNT 1
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size) {
+    allocCount++;
+    allocBytes += size;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    allocCount++;
+    allocBytes += count * size;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    allocCount++;
+    allocBytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+#else
+#define BENCH_ALLOC_COUNT 0
+#endif
+
+static double now_seconds() {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double) counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+#endif
+}
+
+/* the same data on every run */
+static unsigned long long randomState = 0x9e3779b97f4a7c15ULL;
+
+static unsigned long long next_random() {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return randomState;
+}
+
+static void fill_random(unsigned char *buf, size_t size) {
+    size_t i;
+    for (i = 0; i < size; i++) {
+        buf[i] = (unsigned char) next_random();
+    }
+}
+
+/**
+ * data of one case, prepared outside the timing
+ */
+typedef struct {
+    size_t size;            /* payload size */
+    size_t inputSize;       /* bytes one operation consumes */
+    unsigned char *raw;
+    char *text;
+    char *out;
+    size_t outSize;
+    cJSON *json;
+} BenchData;
+
+typedef struct {
+    const char *name;
+    int (*setup)(BenchData *data);
+    int (*run)(BenchData *data);    /* 0 if the operation failed */
+} Benchmark;
+
+/* URL safe base64 text of size random bytes, as the clients send file contents */
+static char *encoded_payload(size_t size, size_t *encodedSize) {
+    unsigned char *raw = malloc(size ? size : 1);
+    if (!raw) {
+        return NULL;
+    }
+    fill_random(raw, size);
+    size_t bufSize = (size + 2) / 3 * 4 + 1;
+    char *encoded = malloc(bufSize);
+    if (encoded && !base64_encode(raw, size, encoded, bufSize)) {
+        free(encoded);
+        encoded = NULL;
+    }
+    free(raw);
+    if (encoded) {
+        char *p;
+        for (p = encoded; *p; p++) {
+            if ('+' == *p) {
+                *p = '-';
+            } else if ('/' == *p) {
+                *p = '_';
+            }
+        }
+        *encodedSize = bufSize - 1;
+    }
+    return encoded;
+}
+
+/* a push request of size bytes of file content, as the client sends it */
+static char *push_document(size_t size, size_t *docSize) {
+    size_t encodedSize;
+    char *encoded = encoded_payload(size, &encodedSize);
+    if (!encoded) {
+        return NULL;
+    }
+    const char *format = "{\"action\":\"push\",\"secretkey\":\"c4e3fb6b-0e1b-4d0c-9e6f-2d1a6b0f3b0e\","
+            "\"filename\":\"bench/payload.bin\",\"extra_path\":\"\",\"file_content_base64\":\"%s\"}";
+    size_t bufSize = strlen(format) + encodedSize + 1;
+    char *doc = malloc(bufSize);
+    if (doc) {
+        *docSize = (size_t) snprintf(doc, bufSize, format, encoded);
+    }
+    free(encoded);
+    return doc;
+}
+
+static int setup_base64_encode(BenchData *data) {
+    data->raw = malloc(data->size);
+    data->outSize = (data->size + 2) / 3 * 4 + 1;
+    data->out = malloc(data->outSize);
+    if (!data->raw || !data->out) {
+        return 0;
+    }
+    fill_random(data->raw, data->size);
+    data->inputSize = data->size;
+    return 1;
+}
+
+static int run_base64_encode(BenchData *data) {
+    return base64_encode(data->raw, data->size, data->out, data->outSize);
+}
+
+static int setup_base64_decode(BenchData *data) {
+    data->text = encoded_payload(data->size, &data->inputSize);
+    data->outSize = data->size + 3;
+    data->out = malloc(data->outSize);
+    return data->text && data->out;
+}
+
+static int run_base64_decode(BenchData *data) {
+    return data->size == base64_decode(data->text, (unsigned char *) data->out, data->outSize);
+}
+
+static int setup_url_decode(BenchData *data) {
+    size_t docSize;
+    char *doc = push_document(data->size, &docSize);
+    if (!doc) {
+        return 0;
+    }
+    char *encoded = url_encode(doc);
+    free(doc);
+    if (!encoded) {
+        return 0;
+    }
+    data->inputSize = strlen(encoded) + 8;
+    data->text = malloc(data->inputSize + 1);
+    if (data->text) {
+        sprintf(data->text, "ck_json=%s", encoded);
+    }
+    free(encoded);
+    return NULL != data->text;
+}
+
+static int run_url_decode(BenchData *data) {
+    char *decoded = url_decode(data->text, data->inputSize + 1);
+    if (!decoded) {
+        return 0;
+    }
+    free(decoded);
+    return 1;
+}
+
+static int setup_cjson_parse(BenchData *data) {
+    data->text = push_document(data->size, &data->inputSize);
+    return NULL != data->text;
+}
+
+/* includes the cJSON_Delete of the parsed document */
+static int run_cjson_parse(BenchData *data) {
+    cJSON *json = cJSON_Parse(data->text);
+    if (!json) {
+        return 0;
+    }
+    cJSON_Delete(json);
+    return 1;
+}
+
+static int setup_cjson_print(BenchData *data) {
+    if (!setup_cjson_parse(data)) {
+        return 0;
+    }
+    data->json = cJSON_Parse(data->text);
+    return NULL != data->json;
+}
+
+/* includes the free of the printed text */
+static int run_cjson_print(BenchData *data) {
+    char *text = cJSON_PrintUnformatted(data->json);
+    if (!text) {
+        return 0;
+    }
+    free(text);
+    return 1;
+}
+
+static int setup_detect_message_length(BenchData *data) {
+    const char *format = "POST / HTTP/1.1\r\nHost: localhost:3333\r\nUser-Agent: Python-urllib/3.11\r\n"
+            "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %lu\r\n\r\n";
+    char header[512];
+    int headerSize = snprintf(header, sizeof(header), format, (unsigned long) data->size);
+    data->inputSize = headerSize + data->size;
+    if (data->inputSize > 0x7fffffff) {
+        return 0;
+    }
+    data->text = malloc(data->inputSize + 1);
+    if (!data->text) {
+        return 0;
+    }
+    memcpy(data->text, header, headerSize);
+    memset(data->text + headerSize, 'x', data->size);
+    return 1;
+}
+
+static int run_detect_message_length(BenchData *data) {
+    return (int) data->inputSize == detectMessageLength(data->text, (int) data->inputSize);
+}
+
+static const Benchmark BENCHMARKS[] = {
+    { "base64_encode", setup_base64_encode, run_base64_encode },
+    { "base64_decode", setup_base64_decode, run_base64_decode },
+    { "url_decode", setup_url_decode, run_url_decode },
+    { "cJSON_Parse", setup_cjson_parse, run_cjson_parse },
+    { "cJSON_PrintUnformatted", setup_cjson_print, run_cjson_print },
+    { "detectMessageLength", setup_detect_message_length, run_detect_message_length }
+};
+
+#define BENCHMARK_COUNT (sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]))
+
+static void teardown(BenchData *data) {
+    free(data->raw);
+    free(data->text);
+    free(data->out);
+    if (data->json) {
+        cJSON_Delete(data->json);
+    }
+    memset(data, 0, sizeof(BenchData));
+}
+
+typedef struct {
+    const char *name;
+    size_t size;
+    size_t inputSize;
+    long long iterations;
+    double seconds;
+    double allocs;          /* per operation, -1 if not counted */
+    double allocBytes;
+    const char *error;      /* skipped or failed case */
+} BenchResult;
+
+static void run_case(const Benchmark *bench, size_t size, double minTime, BenchResult *result) {
+    BenchData data;
+    memset(&data, 0, sizeof(data));
+    memset(result, 0, sizeof(BenchResult));
+    result->name = bench->name;
+    result->size = size;
+    result->allocs = -1;
+    result->allocBytes = -1;
+
+    data.size = size;
+    if (!bench->setup(&data)) {
+        result->error = "no memory for the input";
+        teardown(&data);
+        return;
+    }
+    result->inputSize = data.inputSize;
+    if (!bench->run(&data)) {
+        result->error = "operation failed";
+        teardown(&data);
+        return;
+    }
+
+    long long batch = 1;
+    unsigned long long allocsBefore = allocCount;
+    unsigned long long bytesBefore = allocBytes;
+    while (1) {
+        long long i;
+        double started = now_seconds();
+        for (i = 0; i < batch; i++) {
+            if (!bench->run(&data)) {
+                result->error = "operation failed";
+                teardown(&data);
+                return;
+            }
+        }
+        result->seconds += now_seconds() - started;
+        result->iterations += batch;
+        if (result->seconds >= minTime) {
+            break;
+        }
+        batch *= 2;
+    }
+    if (BENCH_ALLOC_COUNT) {
+        result->allocs = (double) (allocCount - allocsBefore) / result->iterations;
+        result->allocBytes = (double) (allocBytes - bytesBefore) / result->iterations;
+    }
+    teardown(&data);
+}
+
+static double mb_per_second(const BenchResult *result) {
+    return (double) result->inputSize * result->iterations / result->seconds / 1e6;
+}
+
+static double ns_per_byte(const BenchResult *result) {
+    return result->seconds * 1e9 / ((double) result->inputSize * result->iterations);
+}
+
+static void print_header(FILE *file) {
+    fprintf(file, "%-24s %12s %12s %10s %12s %10s %10s %14s\n", "benchmark", "size", "input", "iterations", "MB/s",
+           "ns/byte", "allocs/op", "alloc bytes/op");
+}
+
+static void print_result(FILE *file, const BenchResult *result) {
+    if (result->error) {
+        fprintf(file, "%-24s %12lu %12s %s\n", result->name, (unsigned long) result->size, "-", result->error);
+    } else if (result->allocs < 0) {
+        fprintf(file, "%-24s %12lu %12lu %10lld %12.1f %10.3f %10s %14s\n", result->name, (unsigned long) result->size,
+               (unsigned long) result->inputSize, result->iterations, mb_per_second(result), ns_per_byte(result),
+               "n/a", "n/a");
+    } else {
+        fprintf(file, "%-24s %12lu %12lu %10lld %12.1f %10.3f %10.1f %14.0f\n", result->name, (unsigned long) result->size,
+               (unsigned long) result->inputSize, result->iterations, mb_per_second(result), ns_per_byte(result),
+               result->allocs, result->allocBytes);
+    }
+    fflush(file);
+}
+
+static void write_json(FILE *file, const BenchResult *results, int count, double minTime) {
+    int i;
+    fprintf(file, "{\"min_time\":%g,\"alloc_count\":%s,\"results\":[", minTime, BENCH_ALLOC_COUNT ? "true" : "false");
+    for (i = 0; i < count; i++) {
+        const BenchResult *result = &results[i];
+        fprintf(file, "%s\n{\"benchmark\":\"%s\",\"size\":%lu", i ? "," : "", result->name,
+                (unsigned long) result->size);
+        if (result->error) {
+            fprintf(file, ",\"error\":\"%s\"}", result->error);
+            continue;
+        }
+        fprintf(file, ",\"input_bytes\":%lu,\"iterations\":%lld,\"seconds\":%.9f,\"mb_per_s\":%.3f,\"ns_per_byte\":%.6f",
+                (unsigned long) result->inputSize, result->iterations, result->seconds, mb_per_second(result),
+                ns_per_byte(result));
+        if (result->allocs < 0) {
+            fprintf(file, ",\"allocs_per_op\":null,\"alloc_bytes_per_op\":null}");
+        } else {
+            fprintf(file, ",\"allocs_per_op\":%.3f,\"alloc_bytes_per_op\":%.1f}", result->allocs, result->allocBytes);
+        }
+    }
+    fprintf(file, "\n]}\n");
+}
+
+/* bytes with an optional K, M or G suffix, -1 if malformed */
+static long long parse_size(const char *text) {
+    char *end;
+    double value = strtod(text, &end);
+    switch (*end) {
+        case 'K': case 'k': value *= 1e3; end++; break;
+        case 'M': case 'm': value *= 1e6; end++; break;
+        case 'G': case 'g': value *= 1e9; end++; break;
+    }
+    if (end == text || *end || value < 1) {
+        return -1;
+    }
+    return (long long) value;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [--filter <name>] [--min-size <bytes>] [--max-size <bytes>] [--min-time <seconds>] "
+            "[--json <file>|-]\n", program);
+}
+
+int main(int argc, char **argv) {
+    const char *filter = NULL;
+    const char *jsonPath = NULL;
+    long long minSize = BENCH_MIN_SIZE;
+    long long maxSize = BENCH_MAX_SIZE;
+    double minTime = BENCH_MIN_TIME;
+
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (0 == strcmp(argv[i - 1], "--filter")) {
+            filter = value;
+        } else if (0 == strcmp(argv[i - 1], "--min-size")) {
+            minSize = parse_size(value);
+        } else if (0 == strcmp(argv[i - 1], "--max-size")) {
+            maxSize = parse_size(value);
+        } else if (0 == strcmp(argv[i - 1], "--min-time")) {
+            minTime = atof(value);
+        } else if (0 == strcmp(argv[i - 1], "--json")) {
+            jsonPath = value;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (minSize < 1 || maxSize < minSize || minTime <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int sizeCount = 0;
+    long long size;
+    for (size = BENCH_MIN_SIZE; size <= BENCH_MAX_SIZE; size *= 10) {
+        if (size >= minSize && size <= maxSize) {
+            sizeCount++;
+        }
+    }
+    BenchResult *results = malloc(sizeof(BenchResult) * BENCHMARK_COUNT * (sizeCount ? sizeCount : 1));
+    if (!results) {
+        perror("[ERROR]: No memory for the results");
+        return 1;
+    }
+
+    // the table goes to stderr when the JSON takes stdout
+    FILE *table = jsonPath && 0 == strcmp(jsonPath, "-") ? stderr : stdout;
+    print_header(table);
+
+    int count = 0;
+    int failed = 0;
+    size_t b;
+    for (b = 0; b < BENCHMARK_COUNT; b++) {
+        if (filter && !strstr(BENCHMARKS[b].name, filter)) {
+            continue;
+        }
+        for (size = BENCH_MIN_SIZE; size <= BENCH_MAX_SIZE; size *= 10) {
+            if (size < minSize || size > maxSize) {
+                continue;
+            }
+            run_case(&BENCHMARKS[b], (size_t) size, minTime, &results[count]);
+            if (results[count].error && 0 == strcmp("operation failed", results[count].error)) {
+                failed = 1;
+            }
+            print_result(table, &results[count]);
+            count++;
+        }
+    }
+
+    if (jsonPath) {
+        FILE *file = 0 == strcmp(jsonPath, "-") ? stdout : fopen(jsonPath, "w");
+        if (!file) {
+            perror("[ERROR]: Can't write the JSON results");
+            free(results);
+            return 1;
+        }
+        write_json(file, results, count, minTime);
+        if (file != stdout) {
+            fclose(file);
+        }
+    }
+    free(results);
+    return failed;
+}
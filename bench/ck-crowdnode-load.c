@@ -0,0 +1,1173 @@
+/**
+ * Load generator for a running ck-crowdnode-server: sends a mix of actions with the ck_json= protocol from
+ * concurrent connections, one request per connection like the CK client, and reports throughput and latency
+ * percentiles per action.
+ *
+ * Closed loop (default): every connection sends its next request when the previous one is answered.
+ * Open loop (--rate): requests are due at a fixed total rate whatever the server does, the latency counts from
+ * the time a request was due, so a server falling behind shows in the percentiles instead of lowering the rate.
+ * --connections caps the requests in flight in both modes.
+ *
+ * With --pid (Linux) the CPU time and RSS of the server process and its request processes (fork mode) are
+ * sampled over the run.
+ *
+ * Soak mode (--soak, needs --pid): a long run, usually --requests in the millions against a thread mode
+ * server, that samples the RSS and the open descriptors of the server process and the files in path_to_files
+ * every --sample-interval seconds. Their growth from the end of --warmup to the end of the run must stay
+ * within --max-rss-growth (MB), --max-fd-growth and --max-files-growth, otherwise the exit code is 3.
+ *
+ * Push requests write ck-crowdnode-load-<connection>.bin, pull requests read ck-crowdnode-load-seed.bin pushed
+ * before the run; any other action of the mix is sent with the secret key as its only parameter.
+ *
+ * Usage: ck-crowdnode-load [--host <host>] [--port <port>] [--secret-key <key>] [--config <file>]
+ *                          [--mix <action:weight,...>] [--size <bytes>] [--connections <n>] [--duration <s>]
+ *                          [--requests <n>] [--rate <requests/s>] [--shell-cmd <cmd>] [--pid <server pid>]
+ *                          [--label <text>] [--json <file>|-]
+ *                          [--soak [--warmup <s>] [--sample-interval <s>] [--max-rss-growth <MB>]
+ *                                  [--max-fd-growth <n>] [--max-files-growth <n>] [--files-dir <path_to_files>]]
+ * The run ends after --duration seconds (10 without --requests) or --requests requests, whichever comes first.
+ * The secret key, the port and path_to_files are read from the server's configuration file unless given.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #include <windows.h>
+#else
+    #include <unistd.h>
+    #include <dirent.h>
+    #include <sys/stat.h>
+    #include <sys/socket.h>
+    #include <netdb.h>
+#endif
+
+#include "../src/cJSON.h"
+#include "../src/base64.h"
+#include "../src/urldecoder.h"
+#include "../src/ckthread.h"
+
+#define LOAD_MAX_ACTIONS 8
+#define LOAD_MAX_CONNECTIONS 1024
+#define LOAD_SAMPLE_INTERVAL_MS 100
+#define LOAD_SOAK_WARMUP 10
+#define LOAD_SOAK_SAMPLE_INTERVAL 10
+#define LOAD_SOAK_MAX_RSS_GROWTH_MB 16
+#define LOAD_SOAK_MAX_FD_GROWTH 8
+#define LOAD_SOAK_MAX_FILES_GROWTH 64
+#define LOAD_SEED_FILE "ck-crowdnode-load-seed.bin"
+
+#ifdef _WIN32
+#define LOAD_CONFIG_FILE_PATH "%s\\.ck-crowdnode\\ck-crowdnode-config.json"
+#define LOAD_HOME_ENV_KEY "LOCALAPPDATA"
+#define LOAD_HOME_TEMPLATE "%LOCALAPPDATA%"
+#else
+#define LOAD_CONFIG_FILE_PATH "%s/.ck-crowdnode/ck-crowdnode-config.json"
+#define LOAD_HOME_ENV_KEY "HOME"
+#define LOAD_HOME_TEMPLATE "$HOME"
+#endif
+
+typedef struct {
+    char name[64];
+    int weight;
+} MixEntry;
+
+typedef struct {
+    const char *host;
+    int port;
+    const char *secretKey;
+    const char *configPath;
+    const char *mixText;
+    MixEntry mix[LOAD_MAX_ACTIONS];
+    int mixCount;
+    int mixTotal;
+    long long size;
+    int connections;
+    double duration;
+    long long requests;     /* to send in total, 0 for no limit */
+    double rate;            /* requests per second, 0 for closed loop */
+    const char *shellCommand;
+    int pid;
+    const char *label;
+    const char *jsonPath;
+    int soak;
+    double warmup;
+    double sampleInterval;
+    double maxRssGrowthMb;
+    long long maxFdGrowth;
+    long long maxFilesGrowth;
+    char *filesDir;
+} LoadConfig;
+
+/* latencies in microseconds */
+typedef struct {
+    long long *values;
+    long long count;
+    long long capacity;
+} LatencyLog;
+
+typedef struct {
+    int index;
+    char *requests[LOAD_MAX_ACTIONS];
+    size_t requestSizes[LOAD_MAX_ACTIONS];
+    unsigned long long random;
+    LatencyLog latencies[LOAD_MAX_ACTIONS];
+    long long errors[LOAD_MAX_ACTIONS];
+    long long bytesSent;
+    long long bytesReceived;
+    char *response;
+    size_t responseCapacity;
+} Worker;
+
+/* CPU and memory of the server over the run */
+typedef struct {
+    int available;
+    double cpuStart;        /* seconds */
+    double cpuEnd;
+    double rssStart;        /* bytes */
+    double rssEnd;
+    double rssPeak;
+    double rssSum;
+    long long samples;
+    int processesPeak;
+} ServerUsage;
+
+/* state of the server process for the soak check, -1 where not known */
+typedef struct {
+    double seconds;         /* since the start of the run */
+    long long requests;     /* sent so far */
+    double rss;             /* bytes, the server process alone */
+    long long fds;
+    long long files;        /* in path_to_files */
+    long long fileBytes;
+} SoakSample;
+
+typedef struct {
+    SoakSample *samples;
+    int count;
+    int capacity;
+    int baseline;           /* first sample after the warmup, -1 before */
+} SoakLog;
+
+static LoadConfig config;
+static struct sockaddr_storage serverAddress;
+static int serverAddressSize;
+static long long runStarted;
+static long long runEnd;
+
+static ck_mutex_t workersMutex;
+static ck_cond_t workersDone;
+static int workersRunning;
+static ck_mutex_t firstErrorMutex;
+static int firstErrorReported = 0;
+static ck_mutex_t requestsMutex;
+static long long requestsTaken = 0;
+static volatile int sampling;
+static int samplerRunning = 0;
+static ServerUsage serverUsage;
+static SoakLog soakLog;
+static FILE *table;
+
+static long long now_micros() {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (long long) (counter.QuadPart * 1e6 / frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
+static void sleep_micros(long long micros) {
+    if (micros <= 0) {
+        return;
+    }
+#ifdef _WIN32
+    Sleep((DWORD) ((micros + 999) / 1000));
+#else
+    struct timespec delay;
+    delay.tv_sec = micros / 1000000;
+    delay.tv_nsec = (micros % 1000000) * 1000;
+    nanosleep(&delay, NULL);
+#endif
+}
+
+static void close_socket(int sock) {
+#ifdef _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+}
+
+static unsigned long long next_random(unsigned long long *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void report_error(Worker *worker, const char *action, const char *message) {
+    ck_mutex_lock(&firstErrorMutex);
+    if (!firstErrorReported) {
+        firstErrorReported = 1;
+        fprintf(stderr, "[WARN]: %s failed on connection %i: %s (further errors only counted)\n", action,
+                worker->index, message);
+    }
+    ck_mutex_unlock(&firstErrorMutex);
+}
+
+/* URL safe base64 text of size random bytes, as the CK client sends file contents */
+static char *encoded_payload(long long size, unsigned long long seed) {
+    unsigned char *raw = malloc(size ? (size_t) size : 1);
+    size_t bufSize = ((size_t) size + 2) / 3 * 4 + 1;
+    char *encoded = malloc(bufSize);
+    if (!raw || !encoded) {
+        free(raw);
+        free(encoded);
+        return NULL;
+    }
+    long long i;
+    for (i = 0; i < size; i++) {
+        raw[i] = (unsigned char) next_random(&seed);
+    }
+    base64_encode(raw, (size_t) size, encoded, bufSize);
+    free(raw);
+    char *p;
+    for (p = encoded; *p; p++) {
+        if ('+' == *p) {
+            *p = '-';
+        } else if ('/' == *p) {
+            *p = '_';
+        }
+    }
+    return encoded;
+}
+
+/* the whole HTTP request of an action, NULL if out of memory */
+static char *build_request(const char *action, int workerIndex, size_t *requestSize) {
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "action", action);
+    cJSON_AddStringToObject(json, "secretkey", config.secretKey);
+    if (0 == strcmp("push", action)) {
+        char filename[64];
+        char *content = encoded_payload(config.size, 0x9e3779b97f4a7c15ULL + workerIndex);
+        if (!content) {
+            cJSON_Delete(json);
+            return NULL;
+        }
+        if (workerIndex < 0) {
+            strcpy(filename, LOAD_SEED_FILE);
+        } else {
+            sprintf(filename, "ck-crowdnode-load-%i.bin", workerIndex);
+        }
+        cJSON_AddStringToObject(json, "filename", filename);
+        cJSON_AddStringToObject(json, "file_content_base64", content);
+        free(content);
+    } else if (0 == strcmp("pull", action)) {
+        cJSON_AddStringToObject(json, "filename", LOAD_SEED_FILE);
+    } else if (0 == strcmp("shell", action)) {
+        cJSON_AddStringToObject(json, "cmd", config.shellCommand);
+    }
+    char *text = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    if (!text) {
+        return NULL;
+    }
+    char *encoded = url_encode(text);
+    free(text);
+    if (!encoded) {
+        return NULL;
+    }
+
+    size_t bodySize = strlen("ck_json=") + strlen(encoded);
+    char header[256];
+    int headerSize = snprintf(header, sizeof(header), "POST / HTTP/1.1\r\nHost: %s:%i\r\n"
+            "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n",
+            config.host, config.port, (unsigned long) bodySize);
+    char *request = malloc(headerSize + bodySize + 1);
+    if (request) {
+        sprintf(request, "%sck_json=%s", header, encoded);
+        *requestSize = headerSize + bodySize;
+    }
+    free(encoded);
+    return request;
+}
+
+/**
+ * send one request and read the whole response
+ *
+ * @return NULL on success, what failed otherwise
+ */
+static const char *send_request(Worker *worker, const char *request, size_t requestSize) {
+    int sock = (int) socket(serverAddress.ss_family, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return "socket() failed";
+    }
+    if (connect(sock, (struct sockaddr *) &serverAddress, serverAddressSize) < 0) {
+        close_socket(sock);
+        return "connect() failed";
+    }
+    size_t sent = 0;
+    while (sent < requestSize) {
+        int n = send(sock, request + sent, (int) (requestSize - sent), 0);
+        if (n <= 0) {
+            close_socket(sock);
+            return "send() failed";
+        }
+        sent += n;
+    }
+    worker->bytesSent += sent;
+
+    size_t received = 0;
+    while (1) {
+        if (received + 65536 + 1 > worker->responseCapacity) {
+            size_t capacity = worker->responseCapacity * 2 + 65536 + 1;
+            char *response = realloc(worker->response, capacity);
+            if (!response) {
+                close_socket(sock);
+                return "no memory for the response";
+            }
+            worker->response = response;
+            worker->responseCapacity = capacity;
+        }
+        int n = recv(sock, worker->response + received, 65536, 0);
+        if (n < 0) {
+            close_socket(sock);
+            return "recv() failed";
+        }
+        if (0 == n) {
+            break;
+        }
+        received += n;
+    }
+    close_socket(sock);
+    worker->bytesReceived += received;
+    worker->response[received] = 0;
+
+    const char *body = strstr(worker->response, "\r\n\r\n");
+    if (!body) {
+        return "incomplete HTTP response";
+    }
+    if (!strstr(body, "\"return\":\"0\"") && !strstr(body, "\"return\":0")) {
+        return body + 4;
+    }
+    return NULL;
+}
+
+static void record_latency(LatencyLog *log, long long micros) {
+    if (log->count == log->capacity) {
+        long long capacity = log->capacity ? log->capacity * 2 : 4096;
+        long long *values = realloc(log->values, sizeof(long long) * capacity);
+        if (!values) {
+            return;
+        }
+        log->values = values;
+        log->capacity = capacity;
+    }
+    log->values[log->count++] = micros;
+}
+
+static int pick_action(Worker *worker) {
+    int ticket = (int) (next_random(&worker->random) % config.mixTotal);
+    int i;
+    for (i = 0; i < config.mixCount - 1; i++) {
+        ticket -= config.mix[i].weight;
+        if (ticket < 0) {
+            break;
+        }
+    }
+    return i;
+}
+
+/* @return 1 if one more request may be sent */
+static int take_request() {
+    ck_mutex_lock(&requestsMutex);
+    int allowed = 0 == config.requests || requestsTaken < config.requests;
+    if (allowed) {
+        requestsTaken++;
+    }
+    ck_mutex_unlock(&requestsMutex);
+    return allowed;
+}
+
+static long long requests_taken() {
+    ck_mutex_lock(&requestsMutex);
+    long long taken = requestsTaken;
+    ck_mutex_unlock(&requestsMutex);
+    return taken;
+}
+
+static void worker_thread(void *arg) {
+    Worker *worker = arg;
+    long long sequence = 0;
+    while (1) {
+        long long started = now_micros();
+        if (config.rate > 0) {
+            // this connection's share of the schedule: every connections-th request
+            long long due = runStarted + (long long) ((sequence * config.connections + worker->index) * 1e6 / config.rate);
+            if (due >= runEnd) {
+                break;
+            }
+            sleep_micros(due - started);
+            started = due;
+            sequence++;
+        } else if (started >= runEnd) {
+            break;
+        }
+        if (!take_request()) {
+            break;
+        }
+
+        int action = pick_action(worker);
+        const char *error = send_request(worker, worker->requests[action], worker->requestSizes[action]);
+        if (error) {
+            worker->errors[action]++;
+            report_error(worker, config.mix[action].name, error);
+        } else {
+            record_latency(&worker->latencies[action], now_micros() - started);
+        }
+    }
+
+    ck_mutex_lock(&workersMutex);
+    workersRunning--;
+    ck_cond_signal(&workersDone);
+    ck_mutex_unlock(&workersMutex);
+}
+
+#ifdef __linux__
+/**
+ * add the CPU ticks and resident pages of a process from /proc/<pid>/stat
+ *
+ * @return parent pid of the process, -1 if it is gone
+ */
+static int read_process_stat(int pid, int withChildren, unsigned long long *ticks, unsigned long long *pages) {
+    char path[64];
+    char buf[1024];
+    sprintf(path, "/proc/%i/stat", pid);
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    size_t n = fread(buf, 1, sizeof(buf) - 1, file);
+    fclose(file);
+    buf[n] = 0;
+
+    // the fields after the command name, which may contain anything but ends with the last ')'
+    char *p = strrchr(buf, ')');
+    if (!p) {
+        return -1;
+    }
+    int ppid;
+    unsigned long long utime, stime, cutime, cstime, rss;
+    if (6 != sscanf(p + 2, "%*c %i %*s %*s %*s %*s %*s %*s %*s %*s %*s %llu %llu %llu %llu %*s %*s %*s %*s %*s %*s %llu",
+                    &ppid, &utime, &stime, &cutime, &cstime, &rss)) {
+        return -1;
+    }
+    *ticks += utime + stime + (withChildren ? cutime + cstime : 0);
+    *pages += rss;
+    return ppid;
+}
+
+/* the server process, its reaped request processes and the ones still around */
+static int sample_server(double *cpuSeconds, double *rssBytes) {
+    unsigned long long ticks = 0;
+    unsigned long long pages = 0;
+    if (read_process_stat(config.pid, 1, &ticks, &pages) < 0) {
+        return -1;
+    }
+    int processes = 1;
+    DIR *dir = opendir("/proc");
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir))) {
+            int pid = atoi(entry->d_name);
+            if (pid <= 0 || pid == config.pid) {
+                continue;
+            }
+            unsigned long long childTicks = 0;
+            unsigned long long childPages = 0;
+            if (config.pid == read_process_stat(pid, 0, &childTicks, &childPages)) {
+                ticks += childTicks;
+                pages += childPages;
+                processes++;
+            }
+        }
+        closedir(dir);
+    }
+    *cpuSeconds = (double) ticks / sysconf(_SC_CLK_TCK);
+    *rssBytes = (double) pages * sysconf(_SC_PAGESIZE);
+    return processes;
+}
+#else
+static int sample_server(double *cpuSeconds, double *rssBytes) {
+    return -1;
+}
+#endif
+
+#ifdef __linux__
+static long long count_fds(int pid) {
+    char path[64];
+    sprintf(path, "/proc/%i/fd", pid);
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return -1;
+    }
+    long long fds = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if ('.' != entry->d_name[0]) {
+            fds++;
+        }
+    }
+    closedir(dir);
+    return fds;
+}
+#endif
+
+#ifndef _WIN32
+static void count_files(const char *path, long long *files, long long *bytes) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return;
+    }
+    char child[4096];
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (0 == strcmp(".", entry->d_name) || 0 == strcmp("..", entry->d_name)) {
+            continue;
+        }
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        struct stat st;
+        if (0 != lstat(child, &st)) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            count_files(child, files, bytes);
+        } else {
+            (*files)++;
+            *bytes += st.st_size;
+        }
+    }
+    closedir(dir);
+}
+#endif
+
+static void take_soak_sample(SoakSample *sample) {
+    sample->seconds = (now_micros() - runStarted) / 1e6;
+    sample->requests = requests_taken();
+    sample->rss = -1;
+    sample->fds = -1;
+    sample->files = -1;
+    sample->fileBytes = -1;
+#ifdef __linux__
+    unsigned long long ticks = 0;
+    unsigned long long pages = 0;
+    if (read_process_stat(config.pid, 0, &ticks, &pages) >= 0) {
+        sample->rss = (double) pages * sysconf(_SC_PAGESIZE);
+    }
+    sample->fds = count_fds(config.pid);
+#endif
+#ifndef _WIN32
+    struct stat st;
+    if (config.filesDir && 0 == stat(config.filesDir, &st) && S_ISDIR(st.st_mode)) {
+        sample->files = 0;
+        sample->fileBytes = 0;
+        count_files(config.filesDir, &sample->files, &sample->fileBytes);
+    }
+#endif
+}
+
+static void add_soak_sample() {
+    if (soakLog.count == soakLog.capacity) {
+        int capacity = soakLog.capacity ? soakLog.capacity * 2 : 64;
+        SoakSample *samples = realloc(soakLog.samples, sizeof(SoakSample) * capacity);
+        if (!samples) {
+            return;
+        }
+        soakLog.samples = samples;
+        soakLog.capacity = capacity;
+    }
+    SoakSample *sample = &soakLog.samples[soakLog.count];
+    take_soak_sample(sample);
+    if (soakLog.baseline < 0 && sample->seconds >= config.warmup) {
+        soakLog.baseline = soakLog.count;
+    }
+    soakLog.count++;
+    fprintf(table, "soak %8.1f s %12lld requests  rss %8.1f MB  fds %5lld  files %8lld (%.1f MB)\n",
+            sample->seconds, sample->requests, sample->rss / 1e6, sample->fds, sample->files,
+            sample->fileBytes / 1e6);
+    fflush(table);
+}
+
+static void add_sample(ServerUsage *usage, int last) {
+    double cpu, rss;
+    int processes = sample_server(&cpu, &rss);
+    if (processes < 0) {
+        return;
+    }
+    if (!usage->available) {
+        usage->available = 1;
+        usage->cpuStart = cpu;
+        usage->rssStart = rss;
+    }
+    if (last) {
+        usage->cpuEnd = cpu;
+        usage->rssEnd = rss;
+    }
+    if (rss > usage->rssPeak) {
+        usage->rssPeak = rss;
+    }
+    if (processes > usage->processesPeak) {
+        usage->processesPeak = processes;
+    }
+    usage->rssSum += rss;
+    usage->samples++;
+}
+
+static void sampler_thread(void *arg) {
+    long long nextSoakSample = runStarted + (long long) (config.sampleInterval * 1e6);
+    while (sampling) {
+        sleep_micros(LOAD_SAMPLE_INTERVAL_MS * 1000);
+        add_sample(&serverUsage, 0);
+        if (config.soak && now_micros() >= nextSoakSample) {
+            add_soak_sample();
+            nextSoakSample += (long long) (config.sampleInterval * 1e6);
+        }
+    }
+
+    ck_mutex_lock(&workersMutex);
+    samplerRunning = 0;
+    ck_cond_broadcast(&workersDone);
+    ck_mutex_unlock(&workersMutex);
+}
+
+static cJSON *soak_sample_json(const SoakSample *sample) {
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "seconds", sample->seconds);
+    cJSON_AddNumberToObject(json, "requests", (double) sample->requests);
+    cJSON_AddNumberToObject(json, "rss_bytes", sample->rss);
+    cJSON_AddNumberToObject(json, "fds", (double) sample->fds);
+    cJSON_AddNumberToObject(json, "files", (double) sample->files);
+    cJSON_AddNumberToObject(json, "file_bytes", (double) sample->fileBytes);
+    return json;
+}
+
+/* checks the growth of one quantity, -1 where not known */
+static int check_growth(double baseline, double end, double limit, const char *name, double unit,
+                        const char *unitName, cJSON *growthJSON) {
+    if (baseline < 0 || end < 0) {
+        fprintf(table, ", %s n/a", name);
+        return 1;
+    }
+    double growth = end - baseline;
+    int passed = growth <= limit * unit;
+    fprintf(table, ", %s %+.1f%s (limit %.1f%s)", name, growth / unit, unitName, limit, unitName);
+    cJSON_AddNumberToObject(growthJSON, name, growth);
+    return passed;
+}
+
+/**
+ * @return 1 if the growth from the baseline to the last sample is within the limits
+ */
+static int report_soak(cJSON *json) {
+    cJSON *soakJSON = cJSON_CreateObject();
+    cJSON_AddItemToObject(json, "soak", soakJSON);
+    cJSON_AddNumberToObject(soakJSON, "warmup", config.warmup);
+    cJSON_AddNumberToObject(soakJSON, "max_rss_growth_bytes", config.maxRssGrowthMb * 1e6);
+    cJSON_AddNumberToObject(soakJSON, "max_fd_growth", (double) config.maxFdGrowth);
+    cJSON_AddNumberToObject(soakJSON, "max_files_growth", (double) config.maxFilesGrowth);
+    cJSON *samplesJSON = cJSON_CreateArray();
+    int i;
+    for (i = 0; i < soakLog.count; i++) {
+        cJSON_AddItemToArray(samplesJSON, soak_sample_json(&soakLog.samples[i]));
+    }
+    cJSON_AddItemToObject(soakJSON, "samples", samplesJSON);
+
+    if (soakLog.baseline < 0 || soakLog.baseline == soakLog.count - 1) {
+        fprintf(table, "soak: FAILED, the run ended before the %.1f s warmup, nothing to compare\n", config.warmup);
+        cJSON_AddFalseToObject(soakJSON, "passed");
+        return 0;
+    }
+    const SoakSample *baseline = &soakLog.samples[soakLog.baseline];
+    const SoakSample *end = &soakLog.samples[soakLog.count - 1];
+    cJSON *growthJSON = cJSON_CreateObject();
+    cJSON_AddItemToObject(soakJSON, "growth", growthJSON);
+
+    fprintf(table, "soak: %lld requests after the warmup", end->requests - baseline->requests);
+    int passed = check_growth(baseline->rss, end->rss, config.maxRssGrowthMb, "rss_bytes", 1e6, " MB", growthJSON);
+    passed &= check_growth((double) baseline->fds, (double) end->fds, (double) config.maxFdGrowth, "fds", 1, "",
+                           growthJSON);
+    passed &= check_growth((double) baseline->files, (double) end->files, (double) config.maxFilesGrowth, "files", 1,
+                           "", growthJSON);
+    fprintf(table, ": %s\n", passed ? "passed" : "FAILED");
+    cJSON_AddItemToObject(soakJSON, "passed", cJSON_CreateBool(passed));
+    return passed;
+}
+
+static int compare_latencies(const void *a, const void *b) {
+    long long x = *(const long long *) a;
+    long long y = *(const long long *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* nearest rank, in milliseconds */
+static double percentile(const LatencyLog *log, double p) {
+    if (0 == log->count) {
+        return 0;
+    }
+    long long rank = (long long) (p * log->count + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    return log->values[rank - 1] / 1000.0;
+}
+
+static void merge_latencies(Worker *workers, int action, LatencyLog *merged) {
+    int w;
+    merged->count = 0;
+    for (w = 0; w < config.connections; w++) {
+        merged->count += workers[w].latencies[action].count;
+    }
+    merged->values = malloc(sizeof(long long) * (merged->count ? merged->count : 1));
+    merged->count = 0;
+    for (w = 0; w < config.connections && merged->values; w++) {
+        memcpy(merged->values + merged->count, workers[w].latencies[action].values,
+               sizeof(long long) * workers[w].latencies[action].count);
+        merged->count += workers[w].latencies[action].count;
+    }
+    if (!merged->values) {
+        merged->count = 0;
+        return;
+    }
+    qsort(merged->values, (size_t) merged->count, sizeof(long long), compare_latencies);
+}
+
+static cJSON *report_action(FILE *table, const char *name, const LatencyLog *log, long long errors, double seconds) {
+    double max = log->count ? log->values[log->count - 1] / 1000.0 : 0;
+    fprintf(table, "%-12s %10lld %8lld %10.1f %10.3f %10.3f %10.3f %10.3f\n", name, log->count, errors,
+            log->count / seconds, percentile(log, 0.5), percentile(log, 0.99), percentile(log, 0.999), max);
+
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "action", name);
+    cJSON_AddNumberToObject(json, "requests", (double) log->count);
+    cJSON_AddNumberToObject(json, "errors", (double) errors);
+    cJSON_AddNumberToObject(json, "requests_per_s", log->count / seconds);
+    cJSON_AddNumberToObject(json, "p50_ms", percentile(log, 0.5));
+    cJSON_AddNumberToObject(json, "p99_ms", percentile(log, 0.99));
+    cJSON_AddNumberToObject(json, "p999_ms", percentile(log, 0.999));
+    cJSON_AddNumberToObject(json, "max_ms", max);
+    return json;
+}
+
+static int parse_mix(const char *text) {
+    config.mixCount = 0;
+    config.mixTotal = 0;
+    const char *p = text;
+    while (*p) {
+        const char *end = strchr(p, ',');
+        size_t length = end ? (size_t) (end - p) : strlen(p);
+        if (LOAD_MAX_ACTIONS == config.mixCount || length >= sizeof(config.mix[0].name)) {
+            return 0;
+        }
+        MixEntry *entry = &config.mix[config.mixCount];
+        memcpy(entry->name, p, length);
+        entry->name[length] = 0;
+        entry->weight = 1;
+        char *colon = strchr(entry->name, ':');
+        if (colon) {
+            *colon = 0;
+            entry->weight = atoi(colon + 1);
+        }
+        if (!entry->name[0] || entry->weight <= 0) {
+            return 0;
+        }
+        config.mixTotal += entry->weight;
+        config.mixCount++;
+        p += length + (end ? 1 : 0);
+    }
+    return config.mixCount > 0;
+}
+
+/* bytes with an optional K, M or G suffix (powers of ten), -1 if malformed */
+static long long parse_size(const char *text) {
+    char *end;
+    double value = strtod(text, &end);
+    switch (*end) {
+        case 'K': case 'k': value *= 1e3; end++; break;
+        case 'M': case 'm': value *= 1e6; end++; break;
+        case 'G': case 'g': value *= 1e9; end++; break;
+    }
+    if (end == text || *end || value < 0) {
+        return -1;
+    }
+    return (long long) value;
+}
+
+/* secret key, port and path_to_files from the server's configuration file where not given, 0 if not read */
+static int load_server_config() {
+    char defaultPath[1024];
+    const char *home = getenv(LOAD_HOME_ENV_KEY);
+    const char *path = config.configPath;
+    if (!path) {
+        if (!home) {
+            return 0;
+        }
+        snprintf(defaultPath, sizeof(defaultPath), LOAD_CONFIG_FILE_PATH, home);
+        path = defaultPath;
+    }
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return 0;
+    }
+    char text[65536];
+    size_t n = fread(text, 1, sizeof(text) - 1, file);
+    fclose(file);
+    text[n] = 0;
+
+    cJSON *json = cJSON_Parse(text);
+    if (!json) {
+        return 0;
+    }
+    cJSON *keyJSON = cJSON_GetObjectItem(json, "secret_key");
+    cJSON *portJSON = cJSON_GetObjectItem(json, "port");
+    cJSON *pathJSON = cJSON_GetObjectItem(json, "path_to_files");
+    if (keyJSON && keyJSON->valuestring && !config.secretKey) {
+        config.secretKey = strdup(keyJSON->valuestring);
+    }
+    if (portJSON && 0 == config.port) {
+        config.port = portJSON->valuestring ? atoi(portJSON->valuestring) : portJSON->valueint;
+    }
+    if (pathJSON && pathJSON->valuestring && !config.filesDir) {
+        const char *pathToFiles = pathJSON->valuestring;
+        size_t templateLength = strlen(LOAD_HOME_TEMPLATE);
+        if (home && 0 == strncmp(pathToFiles, LOAD_HOME_TEMPLATE, templateLength)) {
+            config.filesDir = malloc(strlen(home) + strlen(pathToFiles) + 1);
+            if (config.filesDir) {
+                sprintf(config.filesDir, "%s%s", home, pathToFiles + templateLength);
+            }
+        } else {
+            config.filesDir = strdup(pathToFiles);
+        }
+    }
+    cJSON_Delete(json);
+    return 1;
+}
+
+static int resolve_server() {
+    char port[16];
+    struct addrinfo hints;
+    struct addrinfo *result;
+    sprintf(port, "%i", config.port);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (0 != getaddrinfo(config.host, port, &hints, &result)) {
+        return 0;
+    }
+    memcpy(&serverAddress, result->ai_addr, result->ai_addrlen);
+    serverAddressSize = (int) result->ai_addrlen;
+    freeaddrinfo(result);
+    return 1;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [--host <host>] [--port <port>] [--secret-key <key>] [--config <file>]\n"
+            "    [--mix <action:weight,...>] [--size <bytes>] [--connections <n>] [--duration <s>]\n"
+            "    [--requests <n>] [--rate <requests/s>] [--shell-cmd <cmd>] [--pid <server pid>] [--label <text>]\n"
+            "    [--json <file>|-] [--soak [--warmup <s>] [--sample-interval <s>] [--max-rss-growth <MB>]\n"
+            "    [--max-fd-growth <n>] [--max-files-growth <n>] [--files-dir <path_to_files>]]\n", program);
+}
+
+int main(int argc, char **argv) {
+    memset(&config, 0, sizeof(config));
+    config.host = "127.0.0.1";
+    config.mixText = "push:1,pull:1";
+    config.size = 10000;
+    config.connections = 8;
+    config.shellCommand = "echo ck-crowdnode-load";
+    config.warmup = LOAD_SOAK_WARMUP;
+    config.sampleInterval = LOAD_SOAK_SAMPLE_INTERVAL;
+    config.maxRssGrowthMb = LOAD_SOAK_MAX_RSS_GROWTH_MB;
+    config.maxFdGrowth = LOAD_SOAK_MAX_FD_GROWTH;
+    config.maxFilesGrowth = LOAD_SOAK_MAX_FILES_GROWTH;
+
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--soak")) {
+            config.soak = 1;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *option = argv[i];
+        const char *value = argv[++i];
+        if (0 == strcmp(option, "--host")) {
+            config.host = value;
+        } else if (0 == strcmp(option, "--port")) {
+            config.port = atoi(value);
+        } else if (0 == strcmp(option, "--secret-key")) {
+            config.secretKey = value;
+        } else if (0 == strcmp(option, "--config")) {
+            config.configPath = value;
+        } else if (0 == strcmp(option, "--mix")) {
+            config.mixText = value;
+        } else if (0 == strcmp(option, "--size")) {
+            config.size = parse_size(value);
+        } else if (0 == strcmp(option, "--connections")) {
+            config.connections = atoi(value);
+        } else if (0 == strcmp(option, "--duration")) {
+            config.duration = atof(value);
+            if (config.duration <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (0 == strcmp(option, "--requests")) {
+            config.requests = parse_size(value);
+        } else if (0 == strcmp(option, "--rate")) {
+            config.rate = atof(value);
+        } else if (0 == strcmp(option, "--shell-cmd")) {
+            config.shellCommand = value;
+        } else if (0 == strcmp(option, "--pid")) {
+            config.pid = atoi(value);
+        } else if (0 == strcmp(option, "--label")) {
+            config.label = value;
+        } else if (0 == strcmp(option, "--json")) {
+            config.jsonPath = value;
+        } else if (0 == strcmp(option, "--warmup")) {
+            config.warmup = atof(value);
+        } else if (0 == strcmp(option, "--sample-interval")) {
+            config.sampleInterval = atof(value);
+        } else if (0 == strcmp(option, "--max-rss-growth")) {
+            config.maxRssGrowthMb = atof(value);
+        } else if (0 == strcmp(option, "--max-fd-growth")) {
+            config.maxFdGrowth = atoll(value);
+        } else if (0 == strcmp(option, "--max-files-growth")) {
+            config.maxFilesGrowth = atoll(value);
+        } else if (0 == strcmp(option, "--files-dir")) {
+            config.filesDir = strdup(value);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!parse_mix(config.mixText) || config.size < 0 || config.connections < 1
+        || config.connections > LOAD_MAX_CONNECTIONS || config.requests < 0 || config.rate < 0
+        || config.warmup < 0 || config.sampleInterval <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (0 == config.duration && 0 == config.requests) {
+        config.duration = 10;
+    }
+    load_server_config();
+    if (!config.secretKey) {
+        fprintf(stderr, "[ERROR]: No --secret-key and none found in the server configuration file\n");
+        return 1;
+    }
+    if (0 == config.port) {
+        config.port = 3333;
+    }
+
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (0 != WSAStartup(MAKEWORD(2, 0), &wsaData)) {
+        fprintf(stderr, "[ERROR]: WSAStartup() failed\n");
+        return 1;
+    }
+#endif
+    if (!resolve_server()) {
+        fprintf(stderr, "[ERROR]: Can't resolve %s:%i\n", config.host, config.port);
+        return 1;
+    }
+
+    Worker *workers = calloc(config.connections, sizeof(Worker));
+    if (!workers) {
+        fprintf(stderr, "[ERROR]: No memory for the connections\n");
+        return 1;
+    }
+    int w, a;
+    for (w = 0; w < config.connections; w++) {
+        workers[w].index = w;
+        workers[w].random = 0x2545f4914f6cdd1dULL * (w + 1);
+        for (a = 0; a < config.mixCount; a++) {
+            workers[w].requests[a] = build_request(config.mix[a].name, w, &workers[w].requestSizes[a]);
+            if (!workers[w].requests[a]) {
+                fprintf(stderr, "[ERROR]: No memory for the %s requests\n", config.mix[a].name);
+                return 1;
+            }
+        }
+    }
+
+    // the file the pull requests read, pushing it checks the server and the secret key too
+    size_t seedSize;
+    char *seed = build_request("push", -1, &seedSize);
+    const char *error = seed ? send_request(&workers[0], seed, seedSize) : "no memory for the request";
+    free(seed);
+    if (error) {
+        fprintf(stderr, "[ERROR]: Pushing %s to %s:%i failed: %s\n", LOAD_SEED_FILE, config.host, config.port, error);
+        return 1;
+    }
+    workers[0].bytesSent = 0;
+    workers[0].bytesReceived = 0;
+
+    table = config.jsonPath && 0 == strcmp(config.jsonPath, "-") ? stderr : stdout;
+    memset(&serverUsage, 0, sizeof(serverUsage));
+    memset(&soakLog, 0, sizeof(soakLog));
+    soakLog.baseline = -1;
+    if (config.pid > 0) {
+        add_sample(&serverUsage, 0);
+        if (!serverUsage.available) {
+            fprintf(stderr, "[WARN]: CPU and memory of process %i can't be sampled\n", config.pid);
+        }
+    }
+    if (config.soak && !serverUsage.available) {
+        fprintf(stderr, "[ERROR]: --soak needs the --pid of the server (Linux)\n");
+        return 1;
+    }
+
+    ck_mutex_init(&workersMutex);
+    ck_cond_init(&workersDone);
+    ck_mutex_init(&firstErrorMutex);
+    ck_mutex_init(&requestsMutex);
+    workersRunning = config.connections;
+    runStarted = now_micros();
+    // without --duration, --requests ends the run
+    runEnd = config.duration > 0 ? runStarted + (long long) (config.duration * 1e6) : 0x7fffffffffffffffLL;
+    if (config.soak) {
+        add_soak_sample();
+    }
+    if (serverUsage.available) {
+        sampling = 1;
+        samplerRunning = 1;
+        if (0 != ck_thread_start(sampler_thread, NULL)) {
+            sampling = 0;
+            samplerRunning = 0;
+        }
+    }
+    for (w = 0; w < config.connections; w++) {
+        if (0 != ck_thread_start(worker_thread, &workers[w])) {
+            fprintf(stderr, "[ERROR]: Can't start connection thread %i\n", w);
+            return 1;
+        }
+    }
+    ck_mutex_lock(&workersMutex);
+    while (workersRunning > 0) {
+        ck_cond_wait(&workersDone, &workersMutex);
+    }
+    double seconds = (now_micros() - runStarted) / 1e6;
+    sampling = 0;
+    while (samplerRunning) {
+        ck_cond_wait(&workersDone, &workersMutex);
+    }
+    ck_mutex_unlock(&workersMutex);
+    if (serverUsage.available) {
+        add_sample(&serverUsage, 1);
+    }
+    if (config.soak) {
+        add_soak_sample();
+    }
+
+    fprintf(table, "%s loop, %i connections, %.1f s, mix %s, payload %lld bytes%s%s\n",
+            config.rate > 0 ? "open" : "closed", config.connections, seconds, config.mixText, config.size,
+            config.label ? ", " : "", config.label ? config.label : "");
+    if (config.rate > 0) {
+        fprintf(table, "target rate %.1f requests/s\n", config.rate);
+    }
+    fprintf(table, "%-12s %10s %8s %10s %10s %10s %10s %10s\n", "action", "requests", "errors", "req/s", "p50 ms",
+            "p99 ms", "p99.9 ms", "max ms");
+
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "mode", config.rate > 0 ? "open" : "closed");
+    if (config.label) {
+        cJSON_AddStringToObject(json, "label", config.label);
+    }
+    cJSON_AddStringToObject(json, "mix", config.mixText);
+    cJSON_AddNumberToObject(json, "payload_bytes", (double) config.size);
+    cJSON_AddNumberToObject(json, "connections", config.connections);
+    cJSON_AddNumberToObject(json, "rate", config.rate);
+    cJSON_AddNumberToObject(json, "seconds", seconds);
+    cJSON *actionsJSON = cJSON_CreateArray();
+    cJSON_AddItemToObject(json, "actions", actionsJSON);
+
+    LatencyLog all;
+    memset(&all, 0, sizeof(all));
+    long long allErrors = 0;
+    for (a = 0; a < config.mixCount; a++) {
+        LatencyLog merged;
+        long long errors = 0;
+        merge_latencies(workers, a, &merged);
+        for (w = 0; w < config.connections; w++) {
+            errors += workers[w].errors[a];
+        }
+        cJSON_AddItemToArray(actionsJSON, report_action(table, config.mix[a].name, &merged, errors, seconds));
+        for (i = 0; i < merged.count; i++) {
+            record_latency(&all, merged.values[i]);
+        }
+        allErrors += errors;
+        free(merged.values);
+    }
+    if (all.count) {
+        qsort(all.values, (size_t) all.count, sizeof(long long), compare_latencies);
+    }
+    cJSON_AddItemToObject(json, "total", report_action(table, "total", &all, allErrors, seconds));
+    free(all.values);
+
+    long long bytesSent = 0;
+    long long bytesReceived = 0;
+    for (w = 0; w < config.connections; w++) {
+        bytesSent += workers[w].bytesSent;
+        bytesReceived += workers[w].bytesReceived;
+    }
+    fprintf(table, "sent %.1f MB/s, received %.1f MB/s\n", bytesSent / seconds / 1e6, bytesReceived / seconds / 1e6);
+    cJSON_AddNumberToObject(json, "sent_bytes", (double) bytesSent);
+    cJSON_AddNumberToObject(json, "received_bytes", (double) bytesReceived);
+
+    if (serverUsage.available) {
+        double cpu = serverUsage.cpuEnd - serverUsage.cpuStart;
+        double rssAverage = serverUsage.rssSum / serverUsage.samples;
+        fprintf(table, "server: cpu %.2f s (%.1f%%), rss start %.1f MB, average %.1f MB, peak %.1f MB, end %.1f MB, "
+                "up to %i processes\n", cpu, cpu / seconds * 100, serverUsage.rssStart / 1e6, rssAverage / 1e6,
+                serverUsage.rssPeak / 1e6, serverUsage.rssEnd / 1e6, serverUsage.processesPeak);
+        cJSON *serverJSON = cJSON_CreateObject();
+        cJSON_AddNumberToObject(serverJSON, "pid", config.pid);
+        cJSON_AddNumberToObject(serverJSON, "cpu_seconds", cpu);
+        cJSON_AddNumberToObject(serverJSON, "cpu_percent", cpu / seconds * 100);
+        cJSON_AddNumberToObject(serverJSON, "rss_start_bytes", serverUsage.rssStart);
+        cJSON_AddNumberToObject(serverJSON, "rss_average_bytes", rssAverage);
+        cJSON_AddNumberToObject(serverJSON, "rss_peak_bytes", serverUsage.rssPeak);
+        cJSON_AddNumberToObject(serverJSON, "rss_end_bytes", serverUsage.rssEnd);
+        cJSON_AddNumberToObject(serverJSON, "processes_peak", serverUsage.processesPeak);
+        cJSON_AddItemToObject(json, "server", serverJSON);
+    }
+
+    int result = allErrors ? 2 : 0;
+    if (config.soak && !report_soak(json)) {
+        result = 3;
+    }
+    if (config.jsonPath) {
+        FILE *file = 0 == strcmp(config.jsonPath, "-") ? stdout : fopen(config.jsonPath, "w");
+        char *text = cJSON_Print(json);
+        if (!file || !text) {
+            perror("[ERROR]: Can't write the JSON results");
+            result = 1;
+        } else {
+            fprintf(file, "%s\n", text);
+        }
+        free(text);
+        if (file && file != stdout) {
+            fclose(file);
+        }
+    }
+    cJSON_Delete(json);
+    return result;
+}
@@ -0,0 +1,862 @@
+/**
+ * Replays the requests captured by a ck-crowdnode-server (capture_file, see src/capture.h) against a running
+ * server, and compares the latency distribution of each action with the captured one.
+ *
+ * The requests are due at the times they were captured, relative to the first one and divided by --speed (2
+ * replays twice as fast, 0 sends them as fast as --connections allow). As in the open loop of
+ * ck-crowdnode-load the latency counts from the time a request was due, so a server falling behind the
+ * captured rate shows in the percentiles. --connections caps the requests in flight. The secret key, blanked
+ * out in the captured bodies, is replaced by the one of the target server.
+ *
+ * Only the requests captured with their bodies (capture_bodies) can be sent, the others are counted as
+ * skipped. --summary describes any capture without sending anything: the action mix, the request sizes and
+ * the captured latencies.
+ *
+ * The target should start from the files the captured requests found (a copy of path_to_files taken when the
+ * capture started): replayed requests answering with another return code than captured are counted as
+ * mismatches.
+ *
+ * Usage: ck-crowdnode-replay <capture file> [--host <host>] [--port <port>] [--secret-key <key>]
+ *                            [--config <file>] [--speed <factor>] [--connections <n>] [--requests <n>]
+ *                            [--summary] [--label <text>] [--json <file>|-]
+ * The secret key and the port are read from the server's configuration file unless given. The exit code is 2
+ * if requests got no response, 1 on setup errors.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #include <windows.h>
+#else
+    #include <unistd.h>
+    #include <sys/socket.h>
+    #include <netdb.h>
+#endif
+
+#include "../src/cJSON.h"
+#include "../src/ckthread.h"
+#include "../src/capture.h"
+
+#define REPLAY_MAX_ACTIONS 64
+#define REPLAY_MAX_CONNECTIONS 1024
+/* replayed latency of requests not replayed */
+#define REPLAY_SKIPPED -1
+#define REPLAY_FAILED -2
+
+#ifdef _WIN32
+#define REPLAY_CONFIG_FILE_PATH "%s\\.ck-crowdnode\\ck-crowdnode-config.json"
+#define REPLAY_HOME_ENV_KEY "LOCALAPPDATA"
+#else
+#define REPLAY_CONFIG_FILE_PATH "%s/.ck-crowdnode/ck-crowdnode-config.json"
+#define REPLAY_HOME_ENV_KEY "HOME"
+#endif
+
+typedef struct {
+    const char *capturePath;
+    const char *host;
+    int port;
+    const char *secretKey;
+    const char *configPath;
+    double speed;           /* 0 for as fast as possible */
+    int connections;
+    long long requests;     /* the first ones to replay, 0 for all */
+    int summary;
+    const char *label;
+    const char *jsonPath;
+} ReplayConfig;
+
+typedef struct {
+    long long start;        /* microseconds after the first captured request */
+    long long latency;      /* captured, microseconds */
+    long long requestBytes;
+    int result;
+    int flags;
+    int keyLength;
+    int action;             /* index in actionNames */
+    const unsigned char *body;
+    size_t bodySize;
+    long long replayed;     /* latency, REPLAY_SKIPPED or REPLAY_FAILED */
+    int mismatch;           /* replayed return code differs from the captured one */
+} CapturedRequest;
+
+/* latencies in microseconds */
+typedef struct {
+    long long *values;
+    long long count;
+    long long capacity;
+} LatencyLog;
+
+typedef struct {
+    int index;
+    char *request;
+    size_t requestCapacity;
+    char *response;
+    size_t responseCapacity;
+    long long bytesSent;
+    long long bytesReceived;
+} Worker;
+
+static ReplayConfig config;
+static struct sockaddr_storage serverAddress;
+static int serverAddressSize;
+static long long runStarted;
+
+static char actionNames[REPLAY_MAX_ACTIONS][256];
+static int actionCount = 0;
+static CapturedRequest *captured = NULL;
+static long long capturedCount = 0;
+
+static ck_mutex_t workersMutex;
+static ck_cond_t workersDone;
+static int workersRunning;
+static ck_mutex_t nextMutex;
+static long long nextRequest = 0;
+static ck_mutex_t firstErrorMutex;
+static int firstErrorReported = 0;
+static FILE *table;
+
+static long long now_micros() {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (long long) (counter.QuadPart * 1e6 / frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
+static void sleep_micros(long long micros) {
+    if (micros <= 0) {
+        return;
+    }
+#ifdef _WIN32
+    Sleep((DWORD) ((micros + 999) / 1000));
+#else
+    struct timespec delay;
+    delay.tv_sec = micros / 1000000;
+    delay.tv_nsec = (micros % 1000000) * 1000;
+    nanosleep(&delay, NULL);
+#endif
+}
+
+static void close_socket(int sock) {
+#ifdef _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+}
+
+static unsigned long long get_u64(const unsigned char *p) {
+    unsigned long long value = 0;
+    int i;
+    for (i = 7; i >= 0; i--) {
+        value = value << 8 | p[i];
+    }
+    return value;
+}
+
+static int action_index(const unsigned char *name, int length) {
+    int i;
+    for (i = 0; i < actionCount; i++) {
+        if ((int) strlen(actionNames[i]) == length && 0 == memcmp(actionNames[i], name, length)) {
+            return i;
+        }
+    }
+    if (REPLAY_MAX_ACTIONS == actionCount) {
+        return REPLAY_MAX_ACTIONS - 1;
+    }
+    memcpy(actionNames[actionCount], name, length);
+    actionNames[actionCount][length] = 0;
+    return actionCount++;
+}
+
+static int compare_starts(const void *a, const void *b) {
+    long long x = ((const CapturedRequest *) a)->start;
+    long long y = ((const CapturedRequest *) b)->start;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * read the whole capture, its records sorted by start
+ *
+ * @return 0 on success
+ */
+static int load_capture(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror("[ERROR]: Can't open the capture");
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char *data = malloc(size > 0 ? (size_t) size : 1);
+    if (!data || (size > 0 && 1 != fread(data, (size_t) size, 1, file))) {
+        fprintf(stderr, "[ERROR]: Can't read the capture %s\n", path);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    if (size < CAPTURE_MAGIC_SIZE || 0 != memcmp(data, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE)) {
+        fprintf(stderr, "[ERROR]: %s is not a ck-crowdnode capture\n", path);
+        return -1;
+    }
+
+    long long capacity = 0;
+    long long offset = CAPTURE_MAGIC_SIZE;
+    while (offset < size) {
+        const unsigned char *p = data + offset;
+        if (size - offset < CAPTURE_HEADER_SIZE) {
+            fprintf(stderr, "[WARN]: The capture ends with a truncated record\n");
+            break;
+        }
+        unsigned long long recordSize = get_u64(p);
+        unsigned long long bodySize = get_u64(p + 39);
+        int actionLength = p[38];
+        if (recordSize > (unsigned long long) (size - offset - 8)
+            || CAPTURE_HEADER_SIZE - 8 + bodySize + actionLength != recordSize) {
+            fprintf(stderr, "[WARN]: The capture ends with a truncated record\n");
+            break;
+        }
+        if (capturedCount == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            CapturedRequest *requests = realloc(captured, sizeof(CapturedRequest) * capacity);
+            if (!requests) {
+                fprintf(stderr, "[ERROR]: No memory for the capture\n");
+                return -1;
+            }
+            captured = requests;
+        }
+        CapturedRequest *request = &captured[capturedCount++];
+        request->start = (long long) get_u64(p + 8);
+        request->latency = (long long) get_u64(p + 16);
+        request->requestBytes = (long long) get_u64(p + 24);
+        request->result = (int) (p[32] | p[33] << 8 | p[34] << 16 | (unsigned int) p[35] << 24);
+        request->flags = p[36];
+        request->keyLength = p[37];
+        request->body = p + CAPTURE_HEADER_SIZE;
+        request->bodySize = (size_t) bodySize;
+        request->action = action_index(p + CAPTURE_HEADER_SIZE + bodySize, actionLength);
+        request->replayed = REPLAY_SKIPPED;
+        request->mismatch = 0;
+        offset += 8 + recordSize;
+    }
+    if (0 == capturedCount) {
+        fprintf(stderr, "[ERROR]: No requests in the capture %s\n", path);
+        return -1;
+    }
+
+    // in order of completion in the file
+    qsort(captured, (size_t) capturedCount, sizeof(CapturedRequest), compare_starts);
+    long long first = captured[0].start;
+    long long i;
+    for (i = 0; i < capturedCount; i++) {
+        captured[i].start -= first;
+    }
+    return 0;
+}
+
+static void report_error(Worker *worker, const char *action, const char *message) {
+    ck_mutex_lock(&firstErrorMutex);
+    if (!firstErrorReported) {
+        firstErrorReported = 1;
+        fprintf(stderr, "[WARN]: %s failed on connection %i: %s (further errors only counted)\n", action,
+                worker->index, message);
+    }
+    ck_mutex_unlock(&firstErrorMutex);
+}
+
+static int ensure_capacity(char **buffer, size_t *capacity, size_t size) {
+    if (size <= *capacity) {
+        return 1;
+    }
+    char *grown = realloc(*buffer, size);
+    if (!grown) {
+        return 0;
+    }
+    *buffer = grown;
+    *capacity = size;
+    return 1;
+}
+
+/* the length of a CBOR text string header, 0 if it is none of the short forms */
+static int cbor_text_header(const char *body, const char *text, int length) {
+    if (length < 24 && text - body >= 1 && (unsigned char) text[-1] == 0x60 + length) {
+        return 1;
+    }
+    if (text - body >= 2 && 0x78 == (unsigned char) text[-2] && (unsigned char) text[-1] == length) {
+        return 2;
+    }
+    return 0;
+}
+
+static char *put_cbor_text_header(char *p, int length) {
+    if (length < 24) {
+        *p++ = (char) (0x60 + length);
+    } else {
+        *p++ = (char) 0x78;
+        *p++ = (char) length;
+    }
+    return p;
+}
+
+/**
+ * the HTTP request of a captured body, with the target's secret key in place of the blanked out one
+ *
+ * @return its size, 0 if out of memory
+ */
+static size_t build_request(Worker *worker, const CapturedRequest *request) {
+    int cbor = 0 != (request->flags & CAPTURE_FLAG_CBOR);
+    const char *body = (const char *) request->body;
+    int keyLength = request->keyLength;
+    int newLength = (int) strlen(config.secretKey);
+    size_t worst = request->bodySize + (keyLength ? request->bodySize / keyLength + 1 : 0) * (newLength + 2);
+    if (!ensure_capacity(&worker->request, &worker->requestCapacity, worst + 512)) {
+        return 0;
+    }
+
+    // the body after room for the headers, which depend on its final length
+    char *start = worker->request + 512;
+    char *out = start;
+    size_t i = 0;
+    while (i < request->bodySize) {
+        size_t run = 0;
+        if (keyLength && '*' == body[i]) {
+            while (i + run < request->bodySize && '*' == body[i + run] && run < (size_t) keyLength) {
+                run++;
+            }
+        }
+        if (keyLength && run == (size_t) keyLength) {
+            if (cbor && newLength != keyLength) {
+                int header = cbor_text_header(body, body + i, keyLength);
+                if (header && newLength < 256) {
+                    out = put_cbor_text_header(out - header, newLength);
+                }
+            }
+            memcpy(out, config.secretKey, newLength);
+            out += newLength;
+            i += run;
+        } else {
+            *out++ = body[i++];
+        }
+    }
+    size_t bodySize = out - start;
+
+    char header[512];
+    int headerSize = snprintf(header, sizeof(header), "POST / HTTP/1.1\r\nHost: %s:%i\r\nContent-Type: %s\r\n"
+            "Content-Length: %lu\r\nConnection: close\r\n\r\n", config.host, config.port,
+            cbor ? "application/cbor" : "application/x-www-form-urlencoded", (unsigned long) bodySize);
+    if (headerSize < 0 || headerSize >= (int) sizeof(header)) {
+        return 0;
+    }
+    memcpy(start - headerSize, header, headerSize);
+    memmove(worker->request, start - headerSize, headerSize + bodySize);
+    return headerSize + bodySize;
+}
+
+/* the return code of a response, -1 if there is none */
+static int response_result(const char *body, size_t size, int cbor) {
+    if (cbor) {
+        static const char key[] = "\x66return";
+        const char *end = body + size;
+        const char *p = body;
+        while ((p = memchr(p, key[0], end - p)) && end - p > (long) sizeof(key)) {
+            if (0 == memcmp(p, key, sizeof(key) - 1)) {
+                unsigned char type = (unsigned char) p[sizeof(key) - 1];
+                int length = type - 0x60;
+                if (length > 0 && length < 24 && end - p >= (long) sizeof(key) + length) {
+                    return atoi(p + sizeof(key));
+                }
+                return -1;
+            }
+            p++;
+        }
+        return -1;
+    }
+    const char *value = strstr(body, "\"return\":");
+    if (!value) {
+        return -1;
+    }
+    value += strlen("\"return\":");
+    if ('"' == *value) {
+        value++;
+    }
+    return atoi(value);
+}
+
+/**
+ * send one request and read the whole response
+ *
+ * @return NULL on success, what failed otherwise
+ */
+static const char *send_request(Worker *worker, size_t requestSize, int cbor, int *result) {
+    int sock = (int) socket(serverAddress.ss_family, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return "socket() failed";
+    }
+    if (connect(sock, (struct sockaddr *) &serverAddress, serverAddressSize) < 0) {
+        close_socket(sock);
+        return "connect() failed";
+    }
+    size_t sent = 0;
+    while (sent < requestSize) {
+        int n = send(sock, worker->request + sent, (int) (requestSize - sent), 0);
+        if (n <= 0) {
+            close_socket(sock);
+            return "send() failed";
+        }
+        sent += n;
+    }
+    worker->bytesSent += sent;
+
+    size_t received = 0;
+    while (1) {
+        if (!ensure_capacity(&worker->response, &worker->responseCapacity, received + 65536 + 1)) {
+            close_socket(sock);
+            return "no memory for the response";
+        }
+        int n = recv(sock, worker->response + received, 65536, 0);
+        if (n < 0) {
+            close_socket(sock);
+            return "recv() failed";
+        }
+        if (0 == n) {
+            break;
+        }
+        received += n;
+    }
+    close_socket(sock);
+    worker->bytesReceived += received;
+    worker->response[received] = 0;
+
+    const char *body = strstr(worker->response, "\r\n\r\n");
+    if (!body) {
+        return "incomplete HTTP response";
+    }
+    body += 4;
+    *result = response_result(body, received - (body - worker->response), cbor);
+    return NULL;
+}
+
+static void worker_thread(void *arg) {
+    Worker *worker = arg;
+    while (1) {
+        ck_mutex_lock(&nextMutex);
+        long long index = nextRequest++;
+        ck_mutex_unlock(&nextMutex);
+        if (index >= capturedCount) {
+            break;
+        }
+        CapturedRequest *request = &captured[index];
+        if (!(request->flags & CAPTURE_FLAG_BODY)) {
+            continue;
+        }
+
+        long long due = now_micros();
+        if (config.speed > 0) {
+            due = runStarted + (long long) (request->start / config.speed);
+            sleep_micros(due - now_micros());
+        }
+        size_t requestSize = build_request(worker, request);
+        int result = -1;
+        const char *error = requestSize ? send_request(worker, requestSize, request->flags & CAPTURE_FLAG_CBOR, &result)
+                                        : "no memory for the request";
+        if (error) {
+            request->replayed = REPLAY_FAILED;
+            report_error(worker, actionNames[request->action], error);
+        } else {
+            request->replayed = now_micros() - due;
+            request->mismatch = result != request->result;
+        }
+    }
+
+    ck_mutex_lock(&workersMutex);
+    workersRunning--;
+    ck_cond_signal(&workersDone);
+    ck_mutex_unlock(&workersMutex);
+}
+
+static void record_latency(LatencyLog *log, long long micros) {
+    if (log->count == log->capacity) {
+        long long capacity = log->capacity ? log->capacity * 2 : 4096;
+        long long *values = realloc(log->values, sizeof(long long) * capacity);
+        if (!values) {
+            return;
+        }
+        log->values = values;
+        log->capacity = capacity;
+    }
+    log->values[log->count++] = micros;
+}
+
+static int compare_latencies(const void *a, const void *b) {
+    long long x = *(const long long *) a;
+    long long y = *(const long long *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* nearest rank of the sorted log, in milliseconds */
+static double percentile(const LatencyLog *log, double p) {
+    if (0 == log->count) {
+        return 0;
+    }
+    long long rank = (long long) (p * log->count + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    return log->values[rank - 1] / 1000.0;
+}
+
+static double max_latency(const LatencyLog *log) {
+    return log->count ? log->values[log->count - 1] / 1000.0 : 0;
+}
+
+static cJSON *latency_json(const LatencyLog *log) {
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "p50_ms", percentile(log, 0.5));
+    cJSON_AddNumberToObject(json, "p99_ms", percentile(log, 0.99));
+    cJSON_AddNumberToObject(json, "p999_ms", percentile(log, 0.999));
+    cJSON_AddNumberToObject(json, "max_ms", max_latency(log));
+    return json;
+}
+
+/**
+ * one line and JSON object per action, and the total with action -1
+ *
+ * @return failed requests
+ */
+static long long report_action(int action, double capturedSeconds, double seconds, cJSON *json) {
+    LatencyLog capturedLog, replayedLog;
+    memset(&capturedLog, 0, sizeof(capturedLog));
+    memset(&replayedLog, 0, sizeof(replayedLog));
+    long long requests = 0, skipped = 0, errors = 0, mismatches = 0, bytes = 0, maxBytes = 0;
+    long long i;
+    for (i = 0; i < capturedCount; i++) {
+        const CapturedRequest *request = &captured[i];
+        if (action >= 0 && request->action != action) {
+            continue;
+        }
+        requests++;
+        bytes += request->requestBytes;
+        if (request->requestBytes > maxBytes) {
+            maxBytes = request->requestBytes;
+        }
+        if (REPLAY_SKIPPED == request->replayed) {
+            skipped++;
+            continue;
+        }
+        if (REPLAY_FAILED == request->replayed) {
+            errors++;
+            continue;
+        }
+        // the latencies of the requests replayed, to compare like with like
+        record_latency(&capturedLog, request->latency);
+        record_latency(&replayedLog, request->replayed);
+        mismatches += request->mismatch;
+    }
+    if (config.summary) {
+        for (i = 0; i < capturedCount; i++) {
+            if (action < 0 || captured[i].action == action) {
+                record_latency(&capturedLog, captured[i].latency);
+            }
+        }
+    }
+    qsort(capturedLog.values, (size_t) capturedLog.count, sizeof(long long), compare_latencies);
+    qsort(replayedLog.values, (size_t) replayedLog.count, sizeof(long long), compare_latencies);
+
+    const char *name = action >= 0 ? actionNames[action] : "total";
+    cJSON_AddStringToObject(json, "action", name);
+    cJSON_AddNumberToObject(json, "requests", (double) requests);
+    cJSON_AddNumberToObject(json, "captured_requests_per_s", capturedSeconds > 0 ? requests / capturedSeconds : 0);
+    cJSON_AddNumberToObject(json, "request_bytes_average", requests ? (double) bytes / requests : 0);
+    cJSON_AddNumberToObject(json, "request_bytes_max", (double) maxBytes);
+    cJSON_AddItemToObject(json, "captured", latency_json(&capturedLog));
+    if (config.summary) {
+        fprintf(table, "%-12s %10lld %6.1f%% %12.0f %12lld %10.3f %10.3f %10.3f %10.3f\n", name, requests,
+                100.0 * requests / capturedCount, requests ? (double) bytes / requests : 0, maxBytes,
+                percentile(&capturedLog, 0.5), percentile(&capturedLog, 0.99), percentile(&capturedLog, 0.999),
+                max_latency(&capturedLog));
+    } else {
+        double ratio = percentile(&capturedLog, 0.99) > 0
+                       ? percentile(&replayedLog, 0.99) / percentile(&capturedLog, 0.99) : 0;
+        fprintf(table, "%-12s %9lld %8lld %7lld %8lld  %9.3f %9.3f %9.3f  %9.3f %9.3f %9.3f %9.3f %8.2f\n", name,
+                replayedLog.count, skipped, errors, mismatches, percentile(&capturedLog, 0.5),
+                percentile(&capturedLog, 0.99), percentile(&capturedLog, 0.999), percentile(&replayedLog, 0.5),
+                percentile(&replayedLog, 0.99), percentile(&replayedLog, 0.999), max_latency(&replayedLog), ratio);
+        cJSON_AddNumberToObject(json, "replayed_requests", (double) replayedLog.count);
+        cJSON_AddNumberToObject(json, "replayed_requests_per_s", seconds > 0 ? replayedLog.count / seconds : 0);
+        cJSON_AddNumberToObject(json, "skipped", (double) skipped);
+        cJSON_AddNumberToObject(json, "errors", (double) errors);
+        cJSON_AddNumberToObject(json, "mismatches", (double) mismatches);
+        cJSON_AddItemToObject(json, "replayed", latency_json(&replayedLog));
+        cJSON_AddNumberToObject(json, "p99_ratio", ratio);
+    }
+    free(capturedLog.values);
+    free(replayedLog.values);
+    return errors;
+}
+
+/* secret key and port from the server's configuration file where not given, 0 if not read */
+static int load_server_config() {
+    char defaultPath[1024];
+    const char *path = config.configPath;
+    if (!path) {
+        const char *home = getenv(REPLAY_HOME_ENV_KEY);
+        if (!home) {
+            return 0;
+        }
+        snprintf(defaultPath, sizeof(defaultPath), REPLAY_CONFIG_FILE_PATH, home);
+        path = defaultPath;
+    }
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return 0;
+    }
+    char text[65536];
+    size_t n = fread(text, 1, sizeof(text) - 1, file);
+    fclose(file);
+    text[n] = 0;
+
+    cJSON *json = cJSON_Parse(text);
+    if (!json) {
+        return 0;
+    }
+    cJSON *keyJSON = cJSON_GetObjectItem(json, "secret_key");
+    cJSON *portJSON = cJSON_GetObjectItem(json, "port");
+    if (keyJSON && keyJSON->valuestring && !config.secretKey) {
+        config.secretKey = strdup(keyJSON->valuestring);
+    }
+    if (portJSON && 0 == config.port) {
+        config.port = portJSON->valuestring ? atoi(portJSON->valuestring) : portJSON->valueint;
+    }
+    cJSON_Delete(json);
+    return 1;
+}
+
+static int resolve_server() {
+    char port[16];
+    struct addrinfo hints;
+    struct addrinfo *result;
+    sprintf(port, "%i", config.port);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (0 != getaddrinfo(config.host, port, &hints, &result)) {
+        return 0;
+    }
+    memcpy(&serverAddress, result->ai_addr, result->ai_addrlen);
+    serverAddressSize = (int) result->ai_addrlen;
+    freeaddrinfo(result);
+    return 1;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s <capture file> [--host <host>] [--port <port>] [--secret-key <key>]\n"
+            "    [--config <file>] [--speed <factor>] [--connections <n>] [--requests <n>] [--summary]\n"
+            "    [--label <text>] [--json <file>|-]\n", program);
+}
+
+/* replays the capture, @return seconds it took, -1 on setup errors */
+static double replay(Worker *workers) {
+    if (!config.secretKey) {
+        fprintf(stderr, "[ERROR]: No --secret-key and none found in the server configuration file\n");
+        return -1;
+    }
+    if (0 == config.port) {
+        config.port = 3333;
+    }
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (0 != WSAStartup(MAKEWORD(2, 0), &wsaData)) {
+        fprintf(stderr, "[ERROR]: WSAStartup() failed\n");
+        return -1;
+    }
+#endif
+    if (!resolve_server()) {
+        fprintf(stderr, "[ERROR]: Can't resolve %s:%i\n", config.host, config.port);
+        return -1;
+    }
+
+    ck_mutex_init(&workersMutex);
+    ck_cond_init(&workersDone);
+    ck_mutex_init(&nextMutex);
+    ck_mutex_init(&firstErrorMutex);
+    workersRunning = config.connections;
+    runStarted = now_micros();
+    int w;
+    for (w = 0; w < config.connections; w++) {
+        workers[w].index = w;
+        if (0 != ck_thread_start(worker_thread, &workers[w])) {
+            fprintf(stderr, "[ERROR]: Can't start connection thread %i\n", w);
+            return -1;
+        }
+    }
+    ck_mutex_lock(&workersMutex);
+    while (workersRunning > 0) {
+        ck_cond_wait(&workersDone, &workersMutex);
+    }
+    ck_mutex_unlock(&workersMutex);
+    return (now_micros() - runStarted) / 1e6;
+}
+
+int main(int argc, char **argv) {
+    memset(&config, 0, sizeof(config));
+    config.host = "127.0.0.1";
+    config.speed = 1;
+    config.connections = 64;
+
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--summary")) {
+            config.summary = 1;
+            continue;
+        }
+        if (0 != strncmp(argv[i], "--", 2) && !config.capturePath) {
+            config.capturePath = argv[i];
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *option = argv[i];
+        const char *value = argv[++i];
+        if (0 == strcmp(option, "--host")) {
+            config.host = value;
+        } else if (0 == strcmp(option, "--port")) {
+            config.port = atoi(value);
+        } else if (0 == strcmp(option, "--secret-key")) {
+            config.secretKey = value;
+        } else if (0 == strcmp(option, "--config")) {
+            config.configPath = value;
+        } else if (0 == strcmp(option, "--speed")) {
+            config.speed = atof(value);
+        } else if (0 == strcmp(option, "--connections")) {
+            config.connections = atoi(value);
+        } else if (0 == strcmp(option, "--requests")) {
+            config.requests = atoll(value);
+        } else if (0 == strcmp(option, "--label")) {
+            config.label = value;
+        } else if (0 == strcmp(option, "--json")) {
+            config.jsonPath = value;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!config.capturePath || config.speed < 0 || config.connections < 1
+        || config.connections > REPLAY_MAX_CONNECTIONS || config.requests < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (0 != load_capture(config.capturePath)) {
+        return 1;
+    }
+    if (config.requests > 0 && config.requests < capturedCount) {
+        capturedCount = config.requests;
+    }
+    load_server_config();
+
+    long long withBodies = 0;
+    for (i = 0; i < capturedCount; i++) {
+        withBodies += 0 != (captured[i].flags & CAPTURE_FLAG_BODY);
+    }
+    double capturedSeconds = (captured[capturedCount - 1].start + captured[capturedCount - 1].latency) / 1e6;
+    table = config.jsonPath && 0 == strcmp(config.jsonPath, "-") ? stderr : stdout;
+    fprintf(table, "capture %s: %lld requests over %.1f s (%.1f requests/s), %lld with bodies%s%s\n",
+            config.capturePath, capturedCount, capturedSeconds,
+            capturedSeconds > 0 ? capturedCount / capturedSeconds : 0, withBodies, config.label ? ", " : "", config.label ? config.label : "");
+
+    double seconds = 0;
+    Worker *workers = NULL;
+    if (!config.summary) {
+        if (0 == withBodies) {
+            fprintf(stderr, "[ERROR]: The capture has no bodies to replay (capture_bodies), see --summary\n");
+            return 1;
+        }
+        workers = calloc(config.connections, sizeof(Worker));
+        if (!workers) {
+            fprintf(stderr, "[ERROR]: No memory for the connections\n");
+            return 1;
+        }
+        seconds = replay(workers);
+        if (seconds < 0) {
+            return 1;
+        }
+        fprintf(table, "replayed to %s:%i in %.1f s at %s, %i connections\n", config.host, config.port, seconds,
+                config.speed > 0 ? "the captured rate" : "full speed", config.connections);
+        if (config.speed > 0 && 1 != config.speed) {
+            fprintf(table, "speed %gx\n", config.speed);
+        }
+        fprintf(table, "%-12s %9s %8s %7s %8s  %9s %9s %9s  %9s %9s %9s %9s %8s\n", "action", "requests", "skipped",
+                "errors", "mismatch", "cap p50", "cap p99", "cap p99.9", "p50 ms", "p99 ms", "p99.9 ms", "max ms",
+                "p99 x");
+    } else {
+        fprintf(table, "%-12s %10s %7s %12s %12s %10s %10s %10s %10s\n", "action", "requests", "share", "avg bytes",
+                "max bytes", "p50 ms", "p99 ms", "p99.9 ms", "max ms");
+    }
+
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "capture", config.capturePath);
+    if (config.label) {
+        cJSON_AddStringToObject(json, "label", config.label);
+    }
+    cJSON_AddNumberToObject(json, "captured_seconds", capturedSeconds);
+    if (!config.summary) {
+        cJSON_AddNumberToObject(json, "speed", config.speed);
+        cJSON_AddNumberToObject(json, "connections", config.connections);
+        cJSON_AddNumberToObject(json, "seconds", seconds);
+    }
+    cJSON *actionsJSON = cJSON_CreateArray();
+    cJSON_AddItemToObject(json, "actions", actionsJSON);
+    int a;
+    for (a = 0; a < actionCount; a++) {
+        cJSON *actionJSON = cJSON_CreateObject();
+        report_action(a, capturedSeconds, seconds, actionJSON);
+        cJSON_AddItemToArray(actionsJSON, actionJSON);
+    }
+    cJSON *totalJSON = cJSON_CreateObject();
+    long long errors = report_action(-1, capturedSeconds, seconds, totalJSON);
+    cJSON_AddItemToObject(json, "total", totalJSON);
+
+    if (workers) {
+        long long bytesSent = 0;
+        long long bytesReceived = 0;
+        int w;
+        for (w = 0; w < config.connections; w++) {
+            bytesSent += workers[w].bytesSent;
+            bytesReceived += workers[w].bytesReceived;
+        }
+        fprintf(table, "sent %.1f MB/s, received %.1f MB/s\n", bytesSent / seconds / 1e6,
+                bytesReceived / seconds / 1e6);
+        cJSON_AddNumberToObject(json, "sent_bytes", (double) bytesSent);
+        cJSON_AddNumberToObject(json, "received_bytes", (double) bytesReceived);
+    }
+
+    int result = errors ? 2 : 0;
+    if (config.jsonPath) {
+        FILE *file = 0 == strcmp(config.jsonPath, "-") ? stdout : fopen(config.jsonPath, "w");
+        char *text = cJSON_Print(json);
+        if (!file || !text) {
+            perror("[ERROR]: Can't write the JSON results");
+            result = 1;
+        } else {
+            fprintf(file, "%s\n", text);
+        }
+        free(text);
+        if (file && file != stdout) {
+            fclose(file);
+        }
+    }
+    cJSON_Delete(json);
+    return result;
+}
@@ -9,6 +9,7 @@ import unittest
 import time
 import platform
 import argparse
+import json
 
 def safe_remove(fname):
     try:
@@ -16,13 +17,28 @@ def safe_remove(fname):
     except Exception:
         pass
 
+# Server configurations the whole suite runs against, on top of the sample configuration.
+# On Windows the server always runs in thread mode, fork is the same as thread there.
+VARIANTS = {
+    'fork': {},
+    'thread': {'server_mode': 'thread'},
+    'durability': {'server_mode': 'thread', 'durability': 'batched'},
+}
+
 arg_parser = argparse.ArgumentParser(description='Run crowdnode tests')
-arg_parser.add_argument('--server_executable', default='build/ck-crowdnode-server', 
+arg_parser.add_argument('--server_executable', default='build/ck-crowdnode-server',
     help='path to the crowdnode executable')
-arg_parser.add_argument('--ck_dir', 
-    help='path to the CK kernel directory. If not given, the newest kernel will be downloaded')
+arg_parser.add_argument('--ck_dir',
+    help='path to a CK kernel directory to run the tests through. If not given, the client bundled in tests/ is used')
+arg_parser.add_argument('--variants', default='fork,thread,durability',
+    help='comma separated server configurations to run the tests against: ' + ', '.join(sorted(VARIANTS)))
 args = arg_parser.parse_args()
 
+variants = args.variants.split(',')
+for variant in variants:
+    if variant not in VARIANTS:
+        arg_parser.error('unknown variant: ' + variant)
+
 script_dir = os.path.dirname(os.path.realpath(__file__))
 os.chdir(script_dir)
 
@@ -32,58 +48,113 @@ config_file_sample_windows = os.path.join(config_dir, 'ck-crowdnode-config.json.
 config_file_sample_linux = os.path.join(config_dir, 'ck-crowdnode-config.json.linux.sample')
 
 files_dir = os.path.join(script_dir, 'ck-crowdnode-files')
-if not os.path.exists(files_dir):
-    os.makedirs(files_dir)
+
+# home of the nodes the tests start themselves, see start_custom_node
+custom_home = os.path.join(script_dir, '.ck-crowdnode-custom')
+custom_port = 3334
 
 node_process = None
-remove_ck_dir = args.ck_dir is None
+custom_processes = []
+node_cfg = None
+
+def stop_node():
+    global node_process
+    if node_process is not None:
+        node_process.kill()
+        node_process.wait()
+        node_process = None
+
+def stop_custom_nodes():
+    while custom_processes:
+        p = custom_processes.pop()
+        p.kill()
+        p.wait()
+    shutil.rmtree(custom_home, ignore_errors=True)
 
 def die(retcode):
     os.chdir(script_dir)
-    if remove_ck_dir:
-        shutil.rmtree(ck_dir, ignore_errors=True)
+    stop_node()
+    stop_custom_nodes()
     shutil.rmtree(files_dir, ignore_errors=True)
     safe_remove(config_file)
-    if node_process is not None:
-        node_process.kill()
     exit(retcode)
 
-safe_remove(config_file)
-node_env = os.environ.copy()
-if 'Windows' == platform.system():
-    node_env['LOCALAPPDATA'] = script_dir
-    shutil.copyfile(config_file_sample_windows, config_file)
-else:
-    node_env['HOME'] = script_dir
-    shutil.copyfile(config_file_sample_linux, config_file)
-
-node_process = subprocess.Popen([args.server_executable], env=node_env)
+def run_node(home, config):
+    """
+    Start the server with the given configuration, written to the configuration file under home, on empty
+    path_to_files home/ck-crowdnode-files
+    """
+    home_files_dir = os.path.join(home, 'ck-crowdnode-files')
+    home_config_dir = os.path.join(home, '.ck-crowdnode')
+    shutil.rmtree(home_files_dir, ignore_errors=True)
+    os.makedirs(home_files_dir)
+    if not os.path.isdir(home_config_dir):
+        os.makedirs(home_config_dir)
+    with open(os.path.join(home_config_dir, 'ck-crowdnode-config.json'), 'w') as f:
+        json.dump(config, f, indent=1)
+    node_env = os.environ.copy()
+    node_env['LOCALAPPDATA' if 'Windows' == platform.system() else 'HOME'] = home
+    # the tests run in tests/
+    return subprocess.Popen([os.path.join(script_dir, args.server_executable)], env=node_env)
+
+def start_node(variant):
+    """
+    Start the server with the sample configuration and the settings of the variant
+    """
+    global node_process, node_cfg
+    sample = config_file_sample_windows if 'Windows' == platform.system() else config_file_sample_linux
+    with open(sample) as f:
+        node_cfg = json.load(f)
+    node_cfg.update(VARIANTS[variant])
+    node_process = run_node(script_dir, node_cfg)
+
+def start_custom_node(config):
+    """
+    Start another server, for the tests of settings the variants do not cover: the configuration of the node
+    under test updated with config, on port 3334 and with path_to_files of its own. Stop it with
+    stop_custom_nodes.
+
+    @return (client, path_to_files) of the node, once it answers
+    """
+    stop_custom_nodes()
+    custom_cfg = dict(node_cfg)
+    custom_cfg.update(config)
+    custom_cfg['port'] = custom_port
+    custom_processes.append(run_node(custom_home, custom_cfg))
+    custom_client = CrowdnodeClient('http://localhost:%d' % custom_port, secret_key)
+    if not custom_client.wait_ready():
+        raise AssertionError('The custom crowdnode server does not answer on port %d' % custom_port)
+    return custom_client, os.path.join(custom_home, 'ck-crowdnode-files')
 
-ck_dir=args.ck_dir
-if args.ck_dir is None:
-    ck_dir='test-ck-master'
-    shutil.rmtree(ck_dir, ignore_errors=True)
-    r = subprocess.call('git clone https://github.com/ctuning/ck.git ' + ck_dir, shell=True)
-    if 0 < r:
-        print('Error: failed to clone CK!')
-        die(1)
-
-sys.path.append(ck_dir)
+tests_dir = os.path.join(script_dir, 'tests')
+sys.path.append(tests_dir)
 
-import ck.kernel as ck
+from crowdnode_client import CrowdnodeClient, CkHelpers
 
 test_repo_name = 'ck-crowdnode-auto-tests'
 test_repo_cid = test_repo_name + '::'
-r = ck.access({'module_uoa': 'repo', 'data_uoa': test_repo_name, 'action': 'remove', 'force': 'yes', 'all': 'yes'})
-r = ck.access({'remote': 'yes', 'module_uoa': 'repo', 'url': 'http://localhost:3333', 'quiet': 'yes', 'data_uoa': test_repo_name, 'action': 'add'})
-if r['return']>0:
-    print('Unable to create test repo. ' + r.get('error', ''))
-    die(1)
+secret_key = 'c4e239b4-8471-11e6-b24d-cbfef11692ca'
 
-tests_dir = os.path.join(script_dir, 'tests')
+client = CrowdnodeClient('http://localhost:3333', secret_key)
+
+if args.ck_dir is None:
+    ck = CkHelpers()
+    access = client.access
+else:
+    sys.path.append(args.ck_dir)
+
+    import ck.kernel as ck
+    access = ck.access
+
+def add_test_repo():
+    r = ck.access({'module_uoa': 'repo', 'data_uoa': test_repo_name, 'action': 'remove', 'force': 'yes', 'all': 'yes'})
+    r = ck.access({'remote': 'yes', 'module_uoa': 'repo', 'url': 'http://localhost:3333', 'quiet': 'yes', 'data_uoa': test_repo_name, 'action': 'add'})
+    if r['return']>0:
+        print('Unable to create test repo. ' + r.get('error', ''))
+        die(1)
 
 module_cfg = {
-    'secret_key': 'c4e239b4-8471-11e6-b24d-cbfef11692ca',
+    'secret_key': secret_key,
     'platform': platform.system(),
     'repo_name': test_repo_name,
     'cid': test_repo_cid
@@ -92,7 +163,7 @@ module_cfg = {
 def access_test_repo(param_dict, checkFail=True):
     d = {'secretkey': module_cfg['secret_key'], 'cid': module_cfg['cid']}
     d.update(param_dict)
-    r = ck.access(d)
+    r = access(d)
     if checkFail and r['return']>0:
         raise AssertionError('Failed to access test repo. Call parameters:\n ' + str(d) + '\n')
     return r
@@ -102,12 +173,30 @@ class CkTestLoader(unittest.TestLoader):
         module.ck = ck
         module.cfg = module_cfg
         module.access_test_repo = access_test_repo
+        module.client = client
         module.files_dir = files_dir
+        module.start_custom_node = start_custom_node
+        module.stop_custom_nodes = stop_custom_nodes
         return unittest.TestLoader.loadTestsFromModule(self, module, pattern)
 
-suite = CkTestLoader().discover(tests_dir, pattern='test_*.py')
+failed = []
+for variant in variants:
+    print('Running the tests against the %s server configuration %s' % (variant, json.dumps(VARIANTS[variant])))
+    start_node(variant)
+    if not client.wait_ready():
+        print('Error: the crowdnode server does not answer on port 3333!')
+        die(1)
+    if args.ck_dir is not None:
+        add_test_repo()
 
-os.chdir(tests_dir)
-test_result = unittest.TextTestRunner().run(suite)
+    suite = CkTestLoader().discover(tests_dir, pattern='test_*.py')
+    os.chdir(tests_dir)
+    test_result = unittest.TextTestRunner().run(suite)
+    os.chdir(script_dir)
+    if not test_result.wasSuccessful():
+        failed.append(variant)
+    stop_node()
 
-die(0 if test_result.wasSuccessful() else 1)
+if failed:
+    print('Failed configurations: ' + ', '.join(failed))
+die(1 if failed else 0)
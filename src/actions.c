@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "actions.h"
+#include "logger.h"
+
+#define ACTION_TABLE_SIZE 64
+#define ACTION_MAX_SEED 100000
+
+static const ActionDescriptor *registeredActions = NULL;
+static int registeredCount = 0;
+static unsigned int hashSeed = 0;
+static int hashValid = 0;
+static const ActionDescriptor *slots[ACTION_TABLE_SIZE];
+
+static unsigned int action_hash(const char *name, unsigned int seed) {
+    unsigned int h = 2166136261u ^ seed;
+    while (*name) {
+        h = (h ^ (unsigned char) *name++) * 16777619u;
+    }
+    return (h ^ (h >> 15)) & (ACTION_TABLE_SIZE - 1);
+}
+
+int action_registry_build(const ActionDescriptor *actions, int count) {
+    unsigned int seed;
+    int i;
+
+    registeredActions = actions;
+    registeredCount = count;
+    hashValid = 0;
+    if (count > ACTION_TABLE_SIZE) {
+        return 0;
+    }
+
+    for (seed = 0; seed < ACTION_MAX_SEED; seed++) {
+        memset(slots, 0, sizeof(slots));
+        for (i = 0; i < count; i++) {
+            unsigned int slot = action_hash(actions[i].name, seed);
+            if (slots[slot]) {
+                break;
+            }
+            slots[slot] = &actions[i];
+        }
+        if (i == count) {
+            hashSeed = seed;
+            hashValid = 1;
+            return 1;
+        }
+    }
+    LOG_WARN("No perfect hash found for %i actions, falling back to linear lookup", count);
+    return 0;
+}
+
+const ActionDescriptor *action_registry_find(const char *name) {
+    int i;
+    if (!name) {
+        return NULL;
+    }
+    if (hashValid) {
+        const ActionDescriptor *action = slots[action_hash(name, hashSeed)];
+        return action && strcmp(action->name, name) == 0 ? action : NULL;
+    }
+    for (i = 0; i < registeredCount; i++) {
+        if (strcmp(registeredActions[i].name, name) == 0) {
+            return &registeredActions[i];
+        }
+    }
+    return NULL;
+}
+
+const char *action_missing_param(const ActionDescriptor *action, cJSON *commandJSON) {
+    int i;
+    for (i = 0; i < ACTION_MAX_PARAMS && action->params[i].name; i++) {
+        cJSON *param = cJSON_GetObjectItem(commandJSON, action->params[i].name);
+        if (!param || (param->type & 255) != action->params[i].type) {
+            return action->params[i].name;
+        }
+        if (action->params[i].type == cJSON_String && !param->valuestring) {
+            return action->params[i].name;
+        }
+    }
+    return NULL;
+}
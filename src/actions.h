@@ -0,0 +1,59 @@
+#ifndef ACTIONS_H
+#define ACTIONS_H
+
+#include "cJSON.h"
+
+/**
+ * Cost class of an action, used by the scheduler:
+ *   ACTION_CHEAP    - answered from memory, always run inline
+ *   ACTION_BLOCKING - does disk I/O or runs processes, admitted through the blocking jobs gate
+ */
+typedef enum {
+    ACTION_CHEAP,
+    ACTION_BLOCKING
+} ActionCost;
+
+typedef void (*ActionHandler)(int sock, char *baseDir, cJSON *commandJSON);
+
+/**
+ * Required parameter of an action and its cJSON type
+ */
+typedef struct {
+    const char *name;
+    int type;
+} ActionParam;
+
+#define ACTION_MAX_PARAMS 4
+
+typedef struct {
+    const char *name;
+    ActionHandler handler;
+    ActionCost cost;
+    ActionParam params[ACTION_MAX_PARAMS];   /* required parameters, terminated by an entry with NULL name */
+} ActionDescriptor;
+
+/**
+ * build the registry for the given table of actions
+ *
+ * Names are mapped through a perfect hash: the hash seed is searched once so that every action gets
+ * its own slot, a lookup then costs one hash and one string comparison.
+ *
+ * @param actions the action table, must stay valid while the registry is used
+ * @param count number of actions in the table
+ * @return 1 on success, 0 if no perfect hash was found (lookups fall back to a linear scan)
+ */
+int action_registry_build(const ActionDescriptor *actions, int count);
+
+/**
+ * @return descriptor of the action with exactly the given name, NULL if unknown
+ */
+const ActionDescriptor *action_registry_find(const char *name);
+
+/**
+ * check the command against the parameter schema of the action
+ *
+ * @return name of the first missing (or mistyped) required parameter, NULL if the command is valid
+ */
+const char *action_missing_param(const ActionDescriptor *action, cJSON *commandJSON);
+
+#endif
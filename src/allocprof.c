@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocprof.h"
+
+#ifdef CK_ALLOC_PROFILE
+
+#include <errno.h>
+
+#include "cJSON.h"
+#include "arena.h"
+
+#if defined(__GLIBC__)
+    #include <malloc.h>
+    #define ALLOCPROF_HEAP 1
+#else
+    #define ALLOCPROF_HEAP 0
+#endif
+
+static ARENA_THREAD_LOCAL long long heapAllocations = 0;
+static ARENA_THREAD_LOCAL long long heapBytes = 0;
+/* may go negative in a thread that frees what others allocated, only the differences matter */
+static ARENA_THREAD_LOCAL long long heapLive = 0;
+static ARENA_THREAD_LOCAL long long heapPeak = 0;
+static ARENA_THREAD_LOCAL long long jsonAllocations = 0;
+static ARENA_THREAD_LOCAL long long jsonBytes = 0;
+
+/* the counters at allocprof_begin */
+static ARENA_THREAD_LOCAL AllocStats requestStart;
+static ARENA_THREAD_LOCAL long long requestStartLive = 0;
+
+#if ALLOCPROF_HEAP
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+static void *counted(void *ptr, size_t size) {
+    if (ptr) {
+        heapAllocations++;
+        heapBytes += size;
+        heapLive += malloc_usable_size(ptr);
+        if (heapLive > heapPeak) {
+            heapPeak = heapLive;
+        }
+    }
+    return ptr;
+}
+
+void *malloc(size_t size) {
+    return counted(__libc_malloc(size), size);
+}
+
+void *calloc(size_t count, size_t size) {
+    return counted(__libc_calloc(count, size), count * size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    size_t previous = ptr ? malloc_usable_size(ptr) : 0;
+    void *result = __libc_realloc(ptr, size);
+    if (result || 0 == size) {
+        // moved, resized or, for size 0, freed
+        heapLive -= previous;
+    }
+    return counted(result, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    return counted(__libc_memalign(alignment, size), size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    if (0 == alignment || 0 != (alignment & (alignment - 1)) || 0 != alignment % sizeof(void *)) {
+        return EINVAL;
+    }
+    void *result = memalign(alignment, size);
+    if (!result) {
+        return ENOMEM;
+    }
+    *ptr = result;
+    return 0;
+}
+
+void free(void *ptr) {
+    if (ptr) {
+        heapLive -= malloc_usable_size(ptr);
+        __libc_free(ptr);
+    }
+}
+
+#endif
+
+static void *json_alloc(size_t size) {
+    jsonAllocations++;
+    jsonBytes += size;
+    return ck_alloc(size);
+}
+
+void allocprof_init() {
+    cJSON_Hooks hooks;
+    hooks.malloc_fn = json_alloc;
+    hooks.free_fn = ck_free;
+    cJSON_InitHooks(&hooks);
+}
+
+int allocprof_enabled() {
+    return 1;
+}
+
+int allocprof_heap_enabled() {
+    return ALLOCPROF_HEAP;
+}
+
+void allocprof_begin() {
+    requestStart.heapAllocations = heapAllocations;
+    requestStart.heapBytes = heapBytes;
+    requestStart.jsonAllocations = jsonAllocations;
+    requestStart.jsonBytes = jsonBytes;
+    requestStartLive = heapLive;
+    heapPeak = heapLive;
+}
+
+void allocprof_get(AllocStats *stats) {
+    if (ALLOCPROF_HEAP) {
+        stats->heapAllocations = heapAllocations - requestStart.heapAllocations;
+        stats->heapBytes = heapBytes - requestStart.heapBytes;
+        stats->heapPeakBytes = heapPeak - requestStartLive;
+    } else {
+        stats->heapAllocations = -1;
+        stats->heapBytes = -1;
+        stats->heapPeakBytes = -1;
+    }
+    stats->jsonAllocations = jsonAllocations - requestStart.jsonAllocations;
+    stats->jsonBytes = jsonBytes - requestStart.jsonBytes;
+}
+
+#else
+
+void allocprof_init() {
+}
+
+int allocprof_enabled() {
+    return 0;
+}
+
+int allocprof_heap_enabled() {
+    return 0;
+}
+
+void allocprof_begin() {
+}
+
+void allocprof_get(AllocStats *stats) {
+    memset(stats, 0, sizeof(AllocStats));
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef ALLOCPROF_H
+#define ALLOCPROF_H
+
+/**
+ * Allocation profiling of the requests, built in with -DCK_ALLOC_PROFILE=ON (cmake).
+ *
+ * Two kinds of allocations are counted, each thread counts its own:
+ * - heap: with glibc, malloc, calloc, realloc, memalign, posix_memalign, aligned_alloc and free of the whole
+ *   process are replaced by counting wrappers of the glibc allocator, which also keep the peak of the bytes
+ *   live (as malloc_usable_size). Not available with other C libraries.
+ * - json: the cJSON nodes and strings, through cJSON_InitHooks around ck_alloc, so whether they come from the
+ *   request arena or from the heap.
+ *
+ * allocprof_begin starts the profile of a new request, allocprof_get returns it so far. Without
+ * CK_ALLOC_PROFILE the functions cost a call and allocprof_enabled is 0.
+ */
+
+typedef struct {
+    long long heapAllocations;  /* -1 if the heap is not profiled */
+    long long heapBytes;        /* requested */
+    long long heapPeakBytes;    /* most bytes live at once on top of those live at the start of the request */
+    long long jsonAllocations;
+    long long jsonBytes;
+} AllocStats;
+
+/**
+ * route the cJSON allocations through the counters, call after arena_install_cjson_hooks
+ */
+void allocprof_init();
+
+/**
+ * @return 1 if built with CK_ALLOC_PROFILE, 0 otherwise
+ */
+int allocprof_enabled();
+
+/**
+ * @return 1 if the heap allocations are counted
+ */
+int allocprof_heap_enabled();
+
+/**
+ * start profiling a new request in the current thread
+ */
+void allocprof_begin();
+
+/**
+ * @param stats receives the allocations of the current request so far, all 0 without CK_ALLOC_PROFILE
+ */
+void allocprof_get(AllocStats *stats);
+
+#endif
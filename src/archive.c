@@ -0,0 +1,1082 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+    #define archive_seek _fseeki64
+    #define archive_tell _ftelli64
+#else
+    #include <unistd.h>
+    #define archive_seek fseeko
+    #define archive_tell ftello
+#endif
+
+#include "archive.h"
+#include "flate.h"
+#include "arena.h"
+#include "ckthread.h"
+#include "dircache.h"
+#include "paths.h"
+#include "fileindex.h"
+#include "pullcache.h"
+#include "logger.h"
+
+#define ARCHIVE_BUFFER_SIZE 65536
+#define TAR_BLOCK 512
+#define TAR_MAX_RECORD 65536
+#define ZIP_LOCAL_HEADER 0x04034b50UL
+#define ZIP_CENTRAL_HEADER 0x02014b50UL
+#define ZIP_END_OF_DIRECTORY 0x06054b50UL
+#define ZIP_DATA_DESCRIPTOR 0x08074b50UL
+#define ZIP_LOCAL_HEADER_SIZE 30
+#define ZIP_CENTRAL_HEADER_SIZE 46
+#define ZIP_END_SIZE 22
+#define ZIP_MAX_COMMENT 65535
+#define ZIP_FLAG_ENCRYPTED 1
+#define ZIP_FLAG_DESCRIPTOR 8
+#define ZIP_FLAG_UTF8 0x800
+#define ZIP_STORED 0
+#define ZIP_DEFLATED 8
+#define ZIP_VERSION 20
+#define ZIP_MADE_BY_UNIX 3
+#define ZIP_LIMIT 0xffffffffUL
+
+#define MODE_TYPE 0170000
+#define MODE_DIRECTORY 0040000
+#define MODE_REGULAR 0100000
+
+static unsigned int get16(const unsigned char *p) {
+    return p[0] | p[1] << 8;
+}
+
+static unsigned long get32(const unsigned char *p) {
+    return get16(p) | (unsigned long) get16(p + 2) << 16;
+}
+
+static void put16(unsigned char *p, unsigned int value) {
+    p[0] = (unsigned char) value;
+    p[1] = (unsigned char) (value >> 8);
+}
+
+static void put32(unsigned char *p, unsigned long value) {
+    put16(p, (unsigned int) (value & 0xffff));
+    put16(p + 2, (unsigned int) (value >> 16));
+}
+
+static int ends_with(const char *name, const char *suffix) {
+    size_t nameLen = strlen(name), suffixLen = strlen(suffix), i;
+    if (nameLen < suffixLen) {
+        return 0;
+    }
+    for (i = 0; i < suffixLen; i++) {
+        if (tolower((unsigned char) name[nameLen - suffixLen + i]) != suffix[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int archive_format(const char *fileName) {
+    if (ends_with(fileName, ".zip")) {
+        return ARCHIVE_ZIP;
+    }
+    if (ends_with(fileName, ".tar")) {
+        return ARCHIVE_TAR;
+    }
+    if (ends_with(fileName, ".tar.gz") || ends_with(fileName, ".tgz")) {
+        return ARCHIVE_TAR_GZ;
+    }
+    return -1;
+}
+
+/*
+ * Extraction
+ */
+
+typedef struct {
+    const char *baseDir;
+    const char *targetDir;  /* normalized, "" for baseDir */
+} ExtractTarget;
+
+typedef struct {
+    FileStoreWriter writer;
+    char *path;             /* absolute */
+    long long sizeLeft;     /* of the declared size */
+} ExtractedFile;
+
+/* no more than the declared size: an entry inflating beyond it fails before filling the disk */
+static int write_output(void *ctx, const void *data, size_t size) {
+    ExtractedFile *file = ctx;
+    if ((long long) size > file->sizeLeft) {
+        return -1;
+    }
+    file->sizeLeft -= (long long) size;
+    return filestore_write(&file->writer, data, size);
+}
+
+/* path of the entry relative to baseDir, NULL if it would lead outside of the target directory */
+static char *entry_path(const ExtractTarget *target, const char *name) {
+    while ('.' == name[0] && path_is_separator(name[1])) {
+        name += 2;
+    }
+    if (!*name || !path_valid(name)) {
+        return NULL;
+    }
+    return path_join(target->targetDir, path_normalize(name));
+}
+
+static int make_dir(const char *path) {
+    DirHandle *dir = dircache_get(path, 1);
+    if (!dir) {
+        return -1;
+    }
+    dircache_release(dir);
+    return 0;
+}
+
+static int make_parent_dir(const char *path) {
+    const char *slash = strrchr(path, PATH_SEPARATOR);
+    if (!slash) {
+        return 0;
+    }
+    char *parent = ck_alloc(slash - path + 1);
+    if (!parent) {
+        return -1;
+    }
+    memcpy(parent, path, slash - path);
+    parent[slash - path] = '\0';
+    return make_dir(parent);
+}
+
+static int begin_file(const ExtractTarget *target, const char *name, long long size, ExtractedFile *file,
+                      const char **error) {
+    char *path = entry_path(target, name);
+    if (!path) {
+        *error = "Archive entry leads outside of the target directory";
+        return -1;
+    }
+    file->path = path_join(target->baseDir, path);
+    if (!file->path || 0 != make_parent_dir(path)) {
+        *error = "Could not create directory for archive entry";
+        return -1;
+    }
+    if (0 != filestore_begin(target->baseDir, &file->writer, size)) {
+        filestore_abort(&file->writer);
+        *error = "Could not write file content to store";
+        return -1;
+    }
+    return 0;
+}
+
+/* store the content and copy it into place, like a push */
+static int finish_file(const ExtractTarget *target, ExtractedFile *file, unsigned int mode, const char **error) {
+    char hash[FILESTORE_HASH_SIZE];
+    if (0 != filestore_commit(&file->writer, hash)) {
+        *error = "Could not write file content to store";
+        return -1;
+    }
+    // scripts stay executable
+    if (0 != filestore_place(target->baseDir, hash, file->path, mode & 0100 ? 0755 : -1)) {
+        *error = "Could not write extracted file";
+        return -1;
+    }
+    pullcache_invalidate(file->path);
+    fileindex_file_written(file->path, hash);
+    return 0;
+}
+
+typedef struct {
+    char *name;
+    unsigned int flags;
+    unsigned int method;
+    unsigned int time;
+    unsigned int date;
+    unsigned long crc;
+    unsigned long compressedSize;
+    unsigned long size;
+    unsigned long offset;
+    unsigned int mode;      /* unix mode, 0 if not made on unix */
+} ZipEntry;
+
+typedef struct {
+    ExtractTarget target;
+    const char *archivePath;
+    ZipEntry *entries;
+    int count;
+    int next;
+    int extracted;
+    int running;            /* worker threads not finished */
+    const char *error;
+    ck_mutex_t mutex;
+    ck_cond_t finished;
+} ZipJob;
+
+static int read_zip_directory(FILE *in, ZipEntry **entries, const char **error) {
+    unsigned char *end = NULL;
+    long long i;
+    *error = "Corrupt zip archive";
+    if (0 != archive_seek(in, 0, SEEK_END)) {
+        return -1;
+    }
+    long long fileSize = archive_tell(in);
+    long long tailSize = fileSize < ZIP_END_SIZE + ZIP_MAX_COMMENT ? fileSize : ZIP_END_SIZE + ZIP_MAX_COMMENT;
+    unsigned char *tail = ck_alloc((size_t) tailSize + 1);
+    if (!tail || tailSize < ZIP_END_SIZE || 0 != archive_seek(in, fileSize - tailSize, SEEK_SET) ||
+        fread(tail, 1, (size_t) tailSize, in) != (size_t) tailSize) {
+        return -1;
+    }
+    for (i = tailSize - ZIP_END_SIZE; i >= 0 && !end; i--) {
+        if (get32(tail + i) == ZIP_END_OF_DIRECTORY) {
+            end = tail + i;
+        }
+    }
+    if (!end) {
+        return -1;
+    }
+    int count = (int) get16(end + 10);
+    unsigned long directorySize = get32(end + 12);
+    unsigned long directoryOffset = get32(end + 16);
+    if (0xffff == count || ZIP_LIMIT == directorySize || ZIP_LIMIT == directoryOffset) {
+        *error = "ZIP64 archives are not supported";
+        return -1;
+    }
+    unsigned char *directory = ck_alloc(directorySize + 1);
+    *entries = ck_alloc(sizeof(ZipEntry) * (count + 1));
+    if (!directory || !*entries || 0 != archive_seek(in, (long long) directoryOffset, SEEK_SET) ||
+        fread(directory, 1, directorySize, in) != directorySize) {
+        return -1;
+    }
+
+    unsigned char *p = directory;
+    for (i = 0; i < count; i++) {
+        ZipEntry *entry = &(*entries)[i];
+        if (p + ZIP_CENTRAL_HEADER_SIZE > directory + directorySize || get32(p) != ZIP_CENTRAL_HEADER) {
+            return -1;
+        }
+        unsigned int nameLength = get16(p + 28);
+        unsigned int skip = nameLength + get16(p + 30) + get16(p + 32);
+        if (p + ZIP_CENTRAL_HEADER_SIZE + skip > directory + directorySize) {
+            return -1;
+        }
+        entry->flags = get16(p + 8);
+        entry->method = get16(p + 10);
+        entry->time = get16(p + 12);
+        entry->date = get16(p + 14);
+        entry->crc = get32(p + 16);
+        entry->compressedSize = get32(p + 20);
+        entry->size = get32(p + 24);
+        entry->mode = ZIP_MADE_BY_UNIX == (get16(p + 4) >> 8) ? (unsigned int) (get32(p + 38) >> 16) : 0;
+        entry->offset = get32(p + 42);
+        if (ZIP_LIMIT == entry->compressedSize || ZIP_LIMIT == entry->size || ZIP_LIMIT == entry->offset) {
+            *error = "ZIP64 archives are not supported";
+            return -1;
+        }
+        entry->name = ck_alloc(nameLength + 1);
+        if (!entry->name) {
+            return -1;
+        }
+        memcpy(entry->name, p + ZIP_CENTRAL_HEADER_SIZE, nameLength);
+        entry->name[nameLength] = '\0';
+        p += ZIP_CENTRAL_HEADER_SIZE + skip;
+    }
+    *error = NULL;
+    return count;
+}
+
+/*
+ * @return 1 if a file was extracted, 0 for directories and skipped entries, -1 on failure
+ */
+static int extract_zip_entry(const ExtractTarget *target, FILE *in, const ZipEntry *entry, const char **error) {
+    unsigned char header[ZIP_LOCAL_HEADER_SIZE];
+    unsigned char *buffer = NULL;
+    unsigned long crc = 0;
+    long long written = 0;
+    size_t nameLength = strlen(entry->name);
+    ExtractedFile file;
+
+    if ((nameLength > 0 && path_is_separator(entry->name[nameLength - 1])) || MODE_DIRECTORY == (entry->mode & MODE_TYPE)) {
+        char *path = entry_path(target, entry->name);
+        if (path && 0 == make_dir(path)) {
+            return 0;
+        }
+        *error = path ? "Could not create directory for archive entry" : "Archive entry leads outside of the target directory";
+        return -1;
+    }
+    if (entry->mode & MODE_TYPE && MODE_REGULAR != (entry->mode & MODE_TYPE)) {
+        LOG_WARN("Archive entry skipped, not a regular file: %s", entry->name);
+        return 0;
+    }
+    if (entry->flags & ZIP_FLAG_ENCRYPTED) {
+        *error = "Encrypted zip entries are not supported";
+        return -1;
+    }
+    if (ZIP_STORED != entry->method && ZIP_DEFLATED != entry->method) {
+        *error = "Unsupported zip compression method";
+        return -1;
+    }
+    if (0 != archive_seek(in, (long long) entry->offset, SEEK_SET) || fread(header, 1, sizeof(header), in) != sizeof(header) ||
+        get32(header) != ZIP_LOCAL_HEADER ||
+        0 != archive_seek(in, (long long) entry->offset + ZIP_LOCAL_HEADER_SIZE + get16(header + 26) + get16(header + 28), SEEK_SET)) {
+        *error = "Corrupt zip archive";
+        return -1;
+    }
+    if (0 != begin_file(target, entry->name, (long long) entry->size, &file, error)) {
+        return -1;
+    }
+
+    if (ZIP_DEFLATED == entry->method) {
+        file.sizeLeft = (long long) entry->size;
+        written = flate_inflate(in, (long long) entry->compressedSize, 0, write_output, &file, &crc);
+    } else if (!(buffer = malloc(ARCHIVE_BUFFER_SIZE))) {
+        written = -1;
+    } else {
+        unsigned long remaining = entry->compressedSize;
+        while (remaining > 0 && written >= 0) {
+            size_t n = remaining < ARCHIVE_BUFFER_SIZE ? remaining : ARCHIVE_BUFFER_SIZE;
+            if (fread(buffer, 1, n, in) != n || 0 != filestore_write(&file.writer, buffer, n)) {
+                written = -1;
+                break;
+            }
+            crc = flate_crc32(crc, buffer, n);
+            written += n;
+            remaining -= n;
+        }
+        free(buffer);
+    }
+    if (written != (long long) entry->size || crc != entry->crc) {
+        filestore_abort(&file.writer);
+        *error = "Corrupt zip archive entry";
+        return -1;
+    }
+    return 0 == finish_file(target, &file, entry->mode, error) ? 1 : -1;
+}
+
+static void run_zip_worker(ZipJob *job) {
+    const char *error = NULL;
+    int extracted = 0;
+    FILE *in = fopen(job->archivePath, "rb");
+    Arena *arena = arena_create(0);
+    if (!in || !arena) {
+        error = "Could not open archive";
+    }
+    Arena *previous = arena_set_current(arena);
+    while (!error) {
+        ck_mutex_lock(&job->mutex);
+        int i = job->error ? job->count : job->next++;
+        ck_mutex_unlock(&job->mutex);
+        if (i >= job->count) {
+            break;
+        }
+        int result = extract_zip_entry(&job->target, in, &job->entries[i], &error);
+        if (result > 0) {
+            extracted++;
+        } else if (result < 0) {
+            LOG_ERROR("%s: %s", error, job->entries[i].name);
+        }
+        arena_reset(arena);
+    }
+    arena_set_current(previous);
+    if (arena) {
+        arena_destroy(arena);
+    }
+    if (in) {
+        fclose(in);
+    }
+    ck_mutex_lock(&job->mutex);
+    job->extracted += extracted;
+    if (error && !job->error) {
+        job->error = error;
+    }
+    ck_mutex_unlock(&job->mutex);
+}
+
+static void zip_worker_thread(void *arg) {
+    ZipJob *job = arg;
+    run_zip_worker(job);
+    ck_mutex_lock(&job->mutex);
+    job->running--;
+    ck_cond_signal(&job->finished);
+    ck_mutex_unlock(&job->mutex);
+}
+
+/* entries are independent, workers take them one by one from the central directory */
+static int extract_zip(const ExtractTarget *target, const char *archivePath, const char **error) {
+    ZipJob job;
+    FILE *in = fopen(archivePath, "rb");
+    if (!in) {
+        *error = "Could not open archive";
+        return -1;
+    }
+    memset(&job, 0, sizeof(job));
+    job.count = read_zip_directory(in, &job.entries, error);
+    fclose(in);
+    if (job.count < 0) {
+        return -1;
+    }
+    job.target = *target;
+    job.archivePath = archivePath;
+    ck_mutex_init(&job.mutex);
+    ck_cond_init(&job.finished);
+
+    int workers = ck_cpu_count();
+    workers = workers < ARCHIVE_MAX_WORKERS ? workers : ARCHIVE_MAX_WORKERS;
+    workers = workers < job.count ? workers : job.count;
+    int i;
+    for (i = 1; i < workers; i++) {
+        ck_mutex_lock(&job.mutex);
+        job.running++;
+        ck_mutex_unlock(&job.mutex);
+        if (0 != ck_thread_start(zip_worker_thread, &job)) {
+            ck_mutex_lock(&job.mutex);
+            job.running--;
+            ck_mutex_unlock(&job.mutex);
+            break;
+        }
+    }
+    run_zip_worker(&job);
+    ck_mutex_lock(&job.mutex);
+    while (job.running > 0) {
+        ck_cond_wait(&job.finished, &job.mutex);
+    }
+    ck_mutex_unlock(&job.mutex);
+    ck_cond_destroy(&job.finished);
+    ck_mutex_destroy(&job.mutex);
+
+    *error = job.error;
+    return job.error ? -1 : job.extracted;
+}
+
+#define TAR_HEADER 0
+#define TAR_DATA 1
+#define TAR_PADDING 2
+#define TAR_END 3
+
+#define TAR_ENTRY_FILE 0
+#define TAR_ENTRY_RECORD 1  /* GNU long name or pax extended header, applies to the next entry */
+#define TAR_ENTRY_SKIP 2
+
+typedef struct {
+    const ExtractTarget *target;
+    Arena *arena;               /* reset for every entry */
+    unsigned char header[TAR_BLOCK];
+    size_t headerSize;
+    int state;
+    int entryType;
+    char recordType;
+    long long remaining;        /* entry data not read yet */
+    size_t padding;             /* up to the next block after the data */
+    ExtractedFile file;
+    unsigned int mode;
+    char *record;               /* malloc'ed, recordSize bytes read */
+    size_t recordSize;
+    char *longName;             /* malloc'ed, name of the next entry */
+    int zeroBlocks;
+    int extracted;
+    const char *error;
+} TarReader;
+
+static int parse_octal(const unsigned char *field, size_t size, long long *value) {
+    size_t i = 0;
+    *value = 0;
+    if (field[0] & 0x80) {
+        // base-256 for sizes that do not fit the octal digits
+        *value = field[0] & 0x7f;
+        for (i = 1; i < size; i++) {
+            *value = (*value << 8) | field[i];
+        }
+        return 0;
+    }
+    while (i < size && ' ' == field[i]) {
+        i++;
+    }
+    while (i < size && field[i] >= '0' && field[i] <= '7') {
+        *value = (*value << 3) | (field[i++] - '0');
+    }
+    return i < size && field[i] && ' ' != field[i] ? -1 : 0;
+}
+
+static char *field_string(const unsigned char *field, size_t size) {
+    size_t length = 0;
+    while (length < size && field[length]) {
+        length++;
+    }
+    char *result = ck_alloc(length + 1);
+    if (result) {
+        memcpy(result, field, length);
+        result[length] = '\0';
+    }
+    return result;
+}
+
+static char *tar_entry_name(TarReader *r) {
+    if (r->longName) {
+        char *name = field_string((unsigned char *) r->longName, strlen(r->longName));
+        free(r->longName);
+        r->longName = NULL;
+        return name;
+    }
+    char *name = field_string(r->header, 100);
+    if (name && 0 == memcmp(r->header + 257, "ustar", 5) && r->header[345]) {
+        char *prefix = field_string(r->header + 345, 155);
+        name = path_join(prefix, name);
+    }
+    return name;
+}
+
+/* path from a pax extended header: records "<length> <key>=<value>\n" */
+static void parse_pax_record(TarReader *r) {
+    size_t pos = 0;
+    while (pos < r->recordSize) {
+        char *end;
+        long length = strtol(r->record + pos, &end, 10);
+        if (length <= 0 || pos + (size_t) length > r->recordSize || ' ' != *end) {
+            return;
+        }
+        char *key = end + 1;
+        char *recordEnd = r->record + pos + length - 1;
+        if (0 == strncmp(key, "path=", 5) && '\n' == *recordEnd) {
+            size_t valueLength = recordEnd - (key + 5);
+            free(r->longName);
+            r->longName = malloc(valueLength + 1);
+            if (r->longName) {
+                memcpy(r->longName, key + 5, valueLength);
+                r->longName[valueLength] = '\0';
+            }
+        }
+        pos += length;
+    }
+}
+
+static void end_entry(TarReader *r) {
+    if (TAR_ENTRY_FILE == r->entryType) {
+        if (0 == finish_file(r->target, &r->file, r->mode, &r->error)) {
+            r->extracted++;
+        }
+    } else if (TAR_ENTRY_RECORD == r->entryType) {
+        if ('L' == r->recordType) {
+            free(r->longName);
+            r->longName = r->record;
+            r->record = NULL;
+            r->longName[r->recordSize] = '\0';
+        } else {
+            parse_pax_record(r);
+        }
+        free(r->record);
+        r->record = NULL;
+    }
+    r->entryType = TAR_ENTRY_SKIP;
+    r->state = r->padding > 0 ? TAR_PADDING : TAR_HEADER;
+}
+
+static int is_zero_block(const unsigned char *block) {
+    size_t i;
+    for (i = 0; i < TAR_BLOCK; i++) {
+        if (block[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void process_tar_header(TarReader *r) {
+    long long checksum, size, mode;
+    unsigned long sum = 0;
+    size_t i;
+
+    arena_reset(r->arena);
+    if (is_zero_block(r->header)) {
+        if (++r->zeroBlocks == 2) {
+            r->state = TAR_END;
+        }
+        return;
+    }
+    r->zeroBlocks = 0;
+    for (i = 0; i < TAR_BLOCK; i++) {
+        sum += i >= 148 && i < 156 ? ' ' : r->header[i];
+    }
+    if (0 != parse_octal(r->header + 148, 8, &checksum) || (unsigned long) checksum != sum ||
+        0 != parse_octal(r->header + 124, 12, &size) || 0 != parse_octal(r->header + 100, 8, &mode) || size < 0) {
+        r->error = "Not a tar archive or corrupt tar header";
+        return;
+    }
+
+    char type = (char) r->header[156];
+    char *name = tar_entry_name(r);
+    if (!name) {
+        r->error = "Could not allocate memory for tar entry";
+        return;
+    }
+    r->remaining = size;
+    r->padding = (size_t) ((TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK);
+    r->mode = (unsigned int) mode;
+    r->entryType = TAR_ENTRY_SKIP;
+    r->state = TAR_DATA;
+
+    size_t nameLength = strlen(name);
+    if ('5' == type || (('0' == type || '\0' == type) && nameLength > 0 && path_is_separator(name[nameLength - 1]))) {
+        char *path = entry_path(r->target, name);
+        if (!path || 0 != make_dir(path)) {
+            r->error = path ? "Could not create directory for archive entry" : "Archive entry leads outside of the target directory";
+            return;
+        }
+    } else if ('0' == type || '\0' == type || '7' == type) {
+        if (0 != begin_file(r->target, name, size, &r->file, &r->error)) {
+            return;
+        }
+        r->entryType = TAR_ENTRY_FILE;
+    } else if ('L' == type || 'x' == type) {
+        if (size >= TAR_MAX_RECORD || !(r->record = malloc((size_t) size + 1))) {
+            r->error = "Tar extended header too large";
+            return;
+        }
+        r->recordSize = 0;
+        r->recordType = type;
+        r->entryType = TAR_ENTRY_RECORD;
+    } else if ('g' != type) {
+        LOG_WARN("Archive entry skipped, not a regular file: %s", name);
+    }
+    if (0 == r->remaining) {
+        end_entry(r);
+    }
+}
+
+static int tar_feed(void *ctx, const void *data, size_t size) {
+    TarReader *r = ctx;
+    const unsigned char *p = data;
+    while (size > 0 && !r->error && TAR_END != r->state) {
+        size_t n;
+        if (TAR_HEADER == r->state) {
+            n = TAR_BLOCK - r->headerSize;
+            n = n < size ? n : size;
+            memcpy(r->header + r->headerSize, p, n);
+            r->headerSize += n;
+            if (TAR_BLOCK == r->headerSize) {
+                r->headerSize = 0;
+                process_tar_header(r);
+            }
+        } else if (TAR_DATA == r->state) {
+            n = (long long) size < r->remaining ? size : (size_t) r->remaining;
+            if (TAR_ENTRY_FILE == r->entryType && 0 != filestore_write(&r->file.writer, p, n)) {
+                r->error = "Could not write file content to store";
+            } else if (TAR_ENTRY_RECORD == r->entryType) {
+                memcpy(r->record + r->recordSize, p, n);
+                r->recordSize += n;
+            }
+            r->remaining -= n;
+            if (0 == r->remaining && !r->error) {
+                end_entry(r);
+            }
+        } else {
+            n = size < r->padding ? size : r->padding;
+            r->padding -= n;
+            if (0 == r->padding) {
+                r->state = TAR_HEADER;
+            }
+        }
+        p += n;
+        size -= n;
+    }
+    return r->error ? -1 : 0;
+}
+
+static int extract_tar(const ExtractTarget *target, FILE *in, int gzip, const char **error) {
+    TarReader r;
+    memset(&r, 0, sizeof(r));
+    r.target = target;
+    r.state = TAR_HEADER;
+    r.entryType = TAR_ENTRY_SKIP;
+    r.arena = arena_create(0);
+    if (!r.arena) {
+        *error = "Could not allocate memory for tar entry";
+        return -1;
+    }
+    Arena *previous = arena_set_current(r.arena);
+
+    if (gzip) {
+        if (flate_inflate(in, -1, 1, tar_feed, &r, NULL) < 0 && !r.error) {
+            r.error = "Corrupt gzip stream";
+        }
+    } else {
+        unsigned char *buffer = malloc(ARCHIVE_BUFFER_SIZE);
+        size_t n;
+        if (!buffer) {
+            r.error = "Could not allocate memory for tar entry";
+        }
+        while (buffer && (n = fread(buffer, 1, ARCHIVE_BUFFER_SIZE, in)) > 0 && 0 == tar_feed(&r, buffer, n));
+        free(buffer);
+    }
+    if (!r.error && (TAR_DATA == r.state || TAR_PADDING == r.state || r.headerSize > 0)) {
+        r.error = "Truncated tar archive";
+    }
+    if (TAR_DATA == r.state && TAR_ENTRY_FILE == r.entryType) {
+        filestore_abort(&r.file.writer);
+    }
+    free(r.record);
+    free(r.longName);
+    arena_set_current(previous);
+    arena_destroy(r.arena);
+
+    *error = r.error;
+    return r.error ? -1 : r.extracted;
+}
+
+int archive_extract(const char *baseDir, const char *archivePath, const char *targetDir, const char **error) {
+    unsigned char magic[4];
+    ExtractTarget target;
+    target.baseDir = baseDir;
+    target.targetDir = path_normalize(targetDir ? targetDir : "");
+    if (!target.targetDir || (*target.targetDir && 0 != make_dir(target.targetDir))) {
+        *error = "Could not create target directory";
+        return -1;
+    }
+
+    FILE *in = fopen(archivePath, "rb");
+    if (!in) {
+        *error = "Could not open archive";
+        return -1;
+    }
+    size_t n = fread(magic, 1, sizeof(magic), in);
+    if (n == sizeof(magic) && 'P' == magic[0] && 'K' == magic[1]) {
+        fclose(in);
+        return extract_zip(&target, archivePath, error);
+    }
+    rewind(in);
+    int result = extract_tar(&target, in, n >= 2 && 0x1f == magic[0] && 0x8b == magic[1], error);
+    fclose(in);
+    return result;
+}
+
+/*
+ * Creation
+ */
+
+typedef struct {
+    FileStoreWriter *writer;
+    FlateWriter *gzip;          /* compressing the tar stream, NULL otherwise */
+    unsigned long long offset;  /* bytes written to writer */
+    int failed;
+} ArchiveSink;
+
+static int sink_output(void *ctx, const void *data, size_t size) {
+    ArchiveSink *sink = ctx;
+    sink->offset += size;
+    return filestore_write(sink->writer, data, size);
+}
+
+static void sink_write(ArchiveSink *sink, const void *data, size_t size) {
+    if (sink->failed) {
+        return;
+    }
+    if (0 != (sink->gzip ? flate_deflate_write(sink->gzip, data, size) : sink_output(sink, data, size))) {
+        sink->failed = 1;
+    }
+}
+
+static void octal_field(unsigned char *field, size_t size, long long value) {
+    char digits[24];
+    if (value >= 1LL << (3 * (size - 1))) {
+        // base-256, big endian with the top bit set
+        size_t i;
+        for (i = size; i > 1; i--) {
+            field[i - 1] = (unsigned char) value;
+            value >>= 8;
+        }
+        field[0] = 0x80;
+        return;
+    }
+    snprintf(digits, sizeof(digits), "%0*llo", (int) size - 1, value);
+    memcpy(field, digits, size);
+}
+
+static void tar_header(unsigned char *header, const char *name, long long size, unsigned int mode, long long mtime,
+                       char type) {
+    size_t nameLength = strlen(name);
+    unsigned long sum = 0;
+    size_t i;
+    memset(header, 0, TAR_BLOCK);
+    if (nameLength <= 100) {
+        memcpy(header, name, nameLength);
+    } else {
+        // ustar prefix when the name splits at a separator, otherwise preceded by a GNU long name
+        const char *split = name + nameLength - 101;
+        while (*split && '/' != *split) {
+            split++;
+        }
+        if (*split && split - name <= 155 && split != name) {
+            memcpy(header + 345, name, split - name);
+            memcpy(header, split + 1, nameLength - (split + 1 - name));
+        } else {
+            memcpy(header, name, 100);
+        }
+    }
+    octal_field(header + 100, 8, mode & 07777);
+    octal_field(header + 108, 8, 0);
+    octal_field(header + 116, 8, 0);
+    octal_field(header + 124, 12, size);
+    octal_field(header + 136, 12, mtime);
+    header[156] = (unsigned char) type;
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+    memset(header + 148, ' ', 8);
+    for (i = 0; i < TAR_BLOCK; i++) {
+        sum += header[i];
+    }
+    octal_field(header + 148, 7, (long long) sum);
+}
+
+static int fits_ustar(const char *name) {
+    size_t nameLength = strlen(name);
+    if (nameLength <= 100) {
+        return 1;
+    }
+    const char *split = name + nameLength - 101;
+    while (*split && '/' != *split) {
+        split++;
+    }
+    return *split && split != name && split - name <= 155;
+}
+
+static void write_padding(ArchiveSink *sink, unsigned long long size) {
+    static const unsigned char zeros[TAR_BLOCK];
+    size_t padding = (size_t) ((TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK);
+    sink_write(sink, zeros, padding);
+}
+
+/* copy size bytes of the file, zero filled if it became shorter meanwhile */
+static void write_file_content(ArchiveSink *sink, FILE *file, long long size, FlateWriter *deflater,
+                               unsigned long *crc, unsigned char *buffer) {
+    while (size > 0 && !sink->failed) {
+        size_t n = size < ARCHIVE_BUFFER_SIZE ? (size_t) size : ARCHIVE_BUFFER_SIZE;
+        size_t read = file ? fread(buffer, 1, n, file) : 0;
+        memset(buffer + read, 0, n - read);
+        if (crc) {
+            *crc = flate_crc32(*crc, buffer, n);
+        }
+        if (deflater) {
+            if (0 != flate_deflate_write(deflater, buffer, n)) {
+                sink->failed = 1;
+            }
+        } else {
+            sink_write(sink, buffer, n);
+        }
+        size -= n;
+    }
+}
+
+static void write_tar_file(ArchiveSink *sink, const char *name, FILE *file, const struct stat *st,
+                           unsigned char *buffer) {
+    unsigned char header[TAR_BLOCK];
+    if (!fits_ustar(name)) {
+        size_t nameLength = strlen(name) + 1;
+        tar_header(header, "././@LongLink", (long long) nameLength, 0, 0, 'L');
+        sink_write(sink, header, TAR_BLOCK);
+        sink_write(sink, name, nameLength);
+        write_padding(sink, nameLength);
+    }
+    tar_header(header, name, (long long) st->st_size, (unsigned int) st->st_mode, (long long) st->st_mtime, '0');
+    sink_write(sink, header, TAR_BLOCK);
+    write_file_content(sink, file, (long long) st->st_size, NULL, NULL, buffer);
+    write_padding(sink, (unsigned long long) st->st_size);
+}
+
+static void dos_time(long long mtime, unsigned int *time, unsigned int *date) {
+    time_t t = (time_t) mtime;
+    struct tm tm;
+#ifdef _WIN32
+    localtime_s(&tm, &t);
+#else
+    localtime_r(&t, &tm);
+#endif
+    if (tm.tm_year < 80) {
+        *time = 0;
+        *date = (1 << 5) | 1;
+        return;
+    }
+    *time = (unsigned int) (tm.tm_hour << 11 | tm.tm_min << 5 | tm.tm_sec / 2);
+    *date = (unsigned int) ((tm.tm_year - 80) << 9 | (tm.tm_mon + 1) << 5 | tm.tm_mday);
+}
+
+/* local header without sizes, the deflated data and a data descriptor: written in one pass */
+static int write_zip_file(ArchiveSink *sink, ZipEntry *entry, FILE *file, const struct stat *st,
+                          unsigned char *buffer, const char **error) {
+    unsigned char header[ZIP_LOCAL_HEADER_SIZE];
+    unsigned char descriptor[16];
+    size_t nameLength = strlen(entry->name);
+    if ((unsigned long long) st->st_size >= ZIP_LIMIT || sink->offset >= ZIP_LIMIT) {
+        *error = "Archive too large for zip, use .tar or .tar.gz";
+        return -1;
+    }
+    entry->flags = ZIP_FLAG_DESCRIPTOR | ZIP_FLAG_UTF8;
+    entry->method = ZIP_DEFLATED;
+    entry->offset = (unsigned long) sink->offset;
+    entry->size = (unsigned long) st->st_size;
+    entry->mode = (unsigned int) st->st_mode;
+    entry->crc = 0;
+    dos_time((long long) st->st_mtime, &entry->time, &entry->date);
+
+    memset(header, 0, sizeof(header));
+    put32(header, ZIP_LOCAL_HEADER);
+    put16(header + 4, ZIP_VERSION);
+    put16(header + 6, entry->flags);
+    put16(header + 8, entry->method);
+    put16(header + 10, entry->time);
+    put16(header + 12, entry->date);
+    put16(header + 26, (unsigned int) nameLength);
+    sink_write(sink, header, sizeof(header));
+    sink_write(sink, entry->name, nameLength);
+
+    unsigned long long dataOffset = sink->offset;
+    FlateWriter *deflater = flate_deflate_begin(0, sink_output, sink);
+    if (!deflater) {
+        *error = "Could not allocate memory for compression";
+        return -1;
+    }
+    write_file_content(sink, file, (long long) st->st_size, deflater, &entry->crc, buffer);
+    if (0 != flate_deflate_end(deflater)) {
+        sink->failed = 1;
+    }
+    if (sink->offset - dataOffset >= ZIP_LIMIT) {
+        *error = "Archive too large for zip, use .tar or .tar.gz";
+        return -1;
+    }
+    entry->compressedSize = (unsigned long) (sink->offset - dataOffset);
+
+    put32(descriptor, ZIP_DATA_DESCRIPTOR);
+    put32(descriptor + 4, entry->crc);
+    put32(descriptor + 8, entry->compressedSize);
+    put32(descriptor + 12, entry->size);
+    sink_write(sink, descriptor, sizeof(descriptor));
+    return 0;
+}
+
+static int write_zip_directory(ArchiveSink *sink, const ZipEntry *entries, int count, const char **error) {
+    unsigned char header[ZIP_CENTRAL_HEADER_SIZE];
+    unsigned char end[ZIP_END_SIZE];
+    unsigned long long directoryOffset = sink->offset;
+    int i;
+    if (count > 0xfffe || directoryOffset >= ZIP_LIMIT) {
+        *error = "Archive too large for zip, use .tar or .tar.gz";
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        const ZipEntry *entry = &entries[i];
+        size_t nameLength = strlen(entry->name);
+        memset(header, 0, sizeof(header));
+        put32(header, ZIP_CENTRAL_HEADER);
+        put16(header + 4, ZIP_MADE_BY_UNIX << 8 | ZIP_VERSION);
+        put16(header + 6, ZIP_VERSION);
+        put16(header + 8, entry->flags);
+        put16(header + 10, entry->method);
+        put16(header + 12, entry->time);
+        put16(header + 14, entry->date);
+        put32(header + 16, entry->crc);
+        put32(header + 20, entry->compressedSize);
+        put32(header + 24, entry->size);
+        put16(header + 28, (unsigned int) nameLength);
+        put32(header + 38, (unsigned long) entry->mode << 16);
+        put32(header + 42, entry->offset);
+        sink_write(sink, header, sizeof(header));
+        sink_write(sink, entry->name, nameLength);
+    }
+    memset(end, 0, sizeof(end));
+    put32(end, ZIP_END_OF_DIRECTORY);
+    put16(end + 8, (unsigned int) count);
+    put16(end + 10, (unsigned int) count);
+    put32(end + 12, (unsigned long) (sink->offset - directoryOffset));
+    put32(end + 16, (unsigned long) directoryOffset);
+    sink_write(sink, end, sizeof(end));
+    return 0;
+}
+
+int archive_create(const char *baseDir, const char *sourceDir, int format, const char *excludePath,
+                   FileStoreWriter *writer, const char **error) {
+    static const unsigned char endBlocks[2 * TAR_BLOCK];
+    ArchiveSink sink = { writer, NULL, 0, 0 };
+    FileIndexItem *items;
+    ZipEntry *entries = NULL;
+    int packed = 0;
+    int i;
+
+    char *source = path_normalize(sourceDir ? sourceDir : "");
+    int count = source ? fileindex_list(source, 0, &items) : -1;
+    if (count < 0) {
+        *error = "Could not list files";
+        return -1;
+    }
+    size_t prefixLength = *source ? strlen(source) + 1 : 0;
+
+    // the file index names of the archive being replaced
+    char *excluded = NULL;
+    size_t baseLength = strlen(baseDir);
+    if (excludePath && 0 == strncmp(excludePath, baseDir, baseLength) && path_is_separator(excludePath[baseLength])) {
+        excluded = path_normalize(excludePath + baseLength + 1);
+    }
+
+    unsigned char *buffer = malloc(ARCHIVE_BUFFER_SIZE);
+    if (ARCHIVE_ZIP == format) {
+        entries = ck_alloc(sizeof(ZipEntry) * (count + 1));
+    } else if (ARCHIVE_TAR_GZ == format) {
+        sink.gzip = flate_deflate_begin(1, sink_output, &sink);
+    }
+    if (!buffer || (ARCHIVE_ZIP == format && !entries) || (ARCHIVE_TAR_GZ == format && !sink.gzip)) {
+        *error = "Could not allocate memory for archive";
+        free(buffer);
+        if (sink.gzip) {
+            flate_deflate_end(sink.gzip);
+        }
+        return -1;
+    }
+
+    *error = NULL;
+    for (i = 0; i < count && !*error && !sink.failed; i++) {
+        struct stat st;
+        char *name = items[i].name;
+        if (!name || (excluded && 0 == strcmp(name, excluded))) {
+            continue;
+        }
+        char *path = path_join(baseDir, name);
+        if (!path || stat(path, &st) != 0 || MODE_REGULAR != (st.st_mode & MODE_TYPE)) {
+            // removed since listed
+            continue;
+        }
+        FILE *file = fopen(path, "rb");
+        if (!file) {
+            LOG_WARN("Could not read file for archive: %s", path);
+            continue;
+        }
+        char *entryName = name + prefixLength;
+#ifdef _WIN32
+        char *c;
+        for (c = entryName; *c; c++) {
+            if (PATH_SEPARATOR == *c) {
+                *c = '/';
+            }
+        }
+#endif
+        if (ARCHIVE_ZIP == format) {
+            entries[packed].name = entryName;
+            write_zip_file(&sink, &entries[packed], file, &st, buffer, error);
+        } else {
+            write_tar_file(&sink, entryName, file, &st, buffer);
+        }
+        fclose(file);
+        packed++;
+    }
+
+    if (!*error && ARCHIVE_ZIP == format) {
+        write_zip_directory(&sink, entries, packed, error);
+    } else if (ARCHIVE_ZIP != format) {
+        sink_write(&sink, endBlocks, sizeof(endBlocks));
+    }
+    if (sink.gzip && 0 != flate_deflate_end(sink.gzip)) {
+        sink.failed = 1;
+    }
+    free(buffer);
+    if (!*error && sink.failed) {
+        *error = "Could not write archive";
+    }
+    return *error ? -1 : packed;
+}
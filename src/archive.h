@@ -0,0 +1,51 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "filestore.h"
+
+/**
+ * Zip and tar archives of directories under path_to_files, for the extract and archive actions.
+ *
+ * Extracted files go through the content store like pushed files: each one is written aside, linked into
+ * place and recorded in the file index. Zip entries are extracted by up to ARCHIVE_MAX_WORKERS threads
+ * from the central directory, tar streams (plain or gzip) in one pass. Entries leading outside of the
+ * target directory (absolute names, ".." components) are refused, links and devices are skipped.
+ *
+ * Created zip entries are deflated, a .tar.gz/.tgz archive is a gzip compressed tar (see flate.h).
+ */
+
+#define ARCHIVE_ZIP 0
+#define ARCHIVE_TAR 1
+#define ARCHIVE_TAR_GZ 2
+
+#define ARCHIVE_MAX_WORKERS 8
+
+/**
+ * @return ARCHIVE_* format by the extension of the file name, -1 if not an archive
+ */
+int archive_format(const char *fileName);
+
+/**
+ * unpack the archive, its format detected from the content
+ *
+ * @param archivePath absolute path of the archive
+ * @param targetDir directory relative to baseDir, created if missing, NULL or empty for baseDir itself
+ * @param error receives a message on failure
+ * @return number of files extracted, -1 on failure (files extracted before the failure are kept)
+ */
+int archive_extract(const char *baseDir, const char *archivePath, const char *targetDir, const char **error);
+
+/**
+ * pack the files under the directory
+ *
+ * @param sourceDir directory relative to baseDir, NULL or empty for all files
+ * @param format ARCHIVE_*
+ * @param excludePath absolute path of a file left out (the previous archive being replaced), may be NULL
+ * @param writer receives the archive
+ * @param error receives a message on failure
+ * @return number of files packed, -1 on failure
+ */
+int archive_create(const char *baseDir, const char *sourceDir, int format, const char *excludePath,
+                   FileStoreWriter *writer, const char **error);
+
+#endif
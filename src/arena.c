@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "cJSON.h"
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1))
+
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t size;
+    size_t used;
+};
+
+struct ArenaLarge {
+    ArenaLarge *next;
+};
+
+#define ARENA_BLOCK_HEADER ARENA_ALIGN(sizeof(ArenaBlock))
+#define ARENA_LARGE_HEADER ARENA_ALIGN(sizeof(ArenaLarge))
+
+static ARENA_THREAD_LOCAL Arena *currentArena = NULL;
+
+static ArenaBlock *arena_new_block(size_t size) {
+    ArenaBlock *block = malloc(ARENA_BLOCK_HEADER + size);
+    if (!block) {
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+Arena *arena_create(size_t blockSize) {
+    Arena *arena = malloc(sizeof(Arena));
+    if (!arena) {
+        return NULL;
+    }
+    arena->blockSize = blockSize ? ARENA_ALIGN(blockSize) : ARENA_DEFAULT_BLOCK_SIZE;
+    arena->first = arena->current = arena_new_block(arena->blockSize);
+    arena->large = NULL;
+    if (!arena->first) {
+        free(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+static void *arena_alloc_large(Arena *arena, size_t size) {
+    ArenaLarge *large = malloc(ARENA_LARGE_HEADER + size);
+    if (!large) {
+        return NULL;
+    }
+    large->next = arena->large;
+    arena->large = large;
+    return (char *) large + ARENA_LARGE_HEADER;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = ARENA_ALIGN(size ? size : 1);
+    if (size > arena->blockSize / 4) {
+        return arena_alloc_large(arena, size);
+    }
+
+    ArenaBlock *block = arena->current;
+    if (block->used + size > block->size) {
+        /* blocks kept from previous requests are reused before allocating new ones */
+        if (block->next) {
+            block = block->next;
+            block->used = 0;
+        } else {
+            ArenaBlock *next = arena_new_block(arena->blockSize);
+            if (!next) {
+                return NULL;
+            }
+            block->next = next;
+            block = next;
+        }
+        arena->current = block;
+    }
+
+    void *ptr = (char *) block + ARENA_BLOCK_HEADER + block->used;
+    block->used += size;
+    return ptr;
+}
+
+char *arena_strdup(Arena *arena, const char *str) {
+    size_t len = strlen(str) + 1;
+    char *copy = arena_alloc(arena, len);
+    if (copy) {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+void arena_reset(Arena *arena) {
+    ArenaLarge *large = arena->large;
+    while (large) {
+        ArenaLarge *next = large->next;
+        free(large);
+        large = next;
+    }
+    arena->large = NULL;
+    arena->current = arena->first;
+    arena->first->used = 0;
+}
+
+void arena_destroy(Arena *arena) {
+    if (!arena) {
+        return;
+    }
+    arena_reset(arena);
+    ArenaBlock *block = arena->first;
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    if (currentArena == arena) {
+        currentArena = NULL;
+    }
+    free(arena);
+}
+
+Arena *arena_set_current(Arena *arena) {
+    Arena *previous = currentArena;
+    currentArena = arena;
+    return previous;
+}
+
+Arena *arena_current() {
+    return currentArena;
+}
+
+void *ck_alloc(size_t size) {
+    if (currentArena) {
+        return arena_alloc(currentArena, size);
+    }
+    return malloc(size);
+}
+
+void ck_free(void *ptr) {
+    if (!currentArena) {
+        free(ptr);
+    }
+}
+
+void arena_install_cjson_hooks() {
+    cJSON_Hooks hooks;
+    hooks.malloc_fn = ck_alloc;
+    hooks.free_fn = ck_free;
+    cJSON_InitHooks(&hooks);
+}
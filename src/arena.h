@@ -0,0 +1,81 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#if defined(_MSC_VER)
+    #define ARENA_THREAD_LOCAL __declspec(thread)
+#else
+    #define ARENA_THREAD_LOCAL __thread
+#endif
+
+#define ARENA_DEFAULT_BLOCK_SIZE 65536
+
+typedef struct ArenaBlock ArenaBlock;
+typedef struct ArenaLarge ArenaLarge;
+
+/**
+ * Request-scoped bump allocator.
+ *
+ * Small allocations are carved out of a chain of fixed size blocks, allocations bigger than
+ * a quarter of the block size fall back to malloc and are tracked separately. Nothing is freed
+ * individually: arena_reset() rewinds the block chain in O(1) (blocks are kept for the next request)
+ * and releases the large allocations.
+ */
+typedef struct Arena {
+    ArenaBlock *first;
+    ArenaBlock *current;
+    ArenaLarge *large;
+    size_t blockSize;
+} Arena;
+
+/**
+ * create an arena
+ *
+ * @param blockSize size of the bump blocks, 0 means ARENA_DEFAULT_BLOCK_SIZE
+ * @return the arena, NULL if memory could not be allocated
+ */
+Arena *arena_create(size_t blockSize);
+
+/**
+ * allocate memory from the arena, the memory is aligned to 16 bytes
+ *
+ * @return pointer to the memory, NULL if memory could not be allocated
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+char *arena_strdup(Arena *arena, const char *str);
+
+/**
+ * release everything allocated from the arena, the blocks are kept for reuse
+ */
+void arena_reset(Arena *arena);
+
+void arena_destroy(Arena *arena);
+
+/**
+ * make the arena current for the calling thread
+ *
+ * @param arena the arena, NULL to go back to plain malloc/free
+ * @return the previously current arena
+ */
+Arena *arena_set_current(Arena *arena);
+
+Arena *arena_current();
+
+/**
+ * allocate from the current arena of the calling thread or with malloc if there is none
+ */
+void *ck_alloc(size_t size);
+
+/**
+ * release memory obtained from ck_alloc: a no-op while an arena is current, free() otherwise
+ */
+void ck_free(void *ptr);
+
+/**
+ * route cJSON allocations through ck_alloc/ck_free
+ */
+void arena_install_cjson_hooks();
+
+#endif
@@ -41,11 +41,16 @@ static const char *ep;
 
 const char *cJSON_GetErrorPtr() {return ep;}
 
-static int cJSON_strcasecmp(const char *s1,const char *s2)
+/* Equality of object keys: case insensitive, but bytes that match exactly skip tolower(). */
+static int cJSON_keycmp(const char *s1,const char *s2)
 {
-	if (!s1) return (s1==s2)?0:1;if (!s2) return 1;
-	for(; tolower(*s1) == tolower(*s2); ++s1, ++s2)	if(*s1 == 0)	return 0;
-	return tolower(*(const unsigned char *)s1) - tolower(*(const unsigned char *)s2);
+	if (!s1) return (s1==s2)?0:1;
+	if (!s2) return 1;
+	for(;; ++s1, ++s2)
+	{
+		if (*s1 == *s2) {if (*s1 == 0) return 0; continue;}
+		if (tolower(*(const unsigned char *)s1) != tolower(*(const unsigned char *)s2)) return 1;
+	}
 }
 
 static void *(*cJSON_malloc)(size_t sz) = malloc;
@@ -82,6 +87,63 @@ static cJSON *cJSON_New_Item()
 	return node;
 }
 
+/* Key index for large objects: open addressing over the case folded key hash.
+   Only the first item for every key is indexed, so lookups return the same item as a list walk. */
+#define cJSON_INDEX_THRESHOLD 16
+
+typedef struct cJSON_Index {
+	unsigned int mask;
+	unsigned int count;
+	cJSON *slots[1];
+} cJSON_Index;
+
+static unsigned int cJSON_keyhash(const char *str)
+{
+	unsigned int h=2166136261u;
+	while (*str) h=(h^(unsigned char)tolower(*(const unsigned char *)str++))*16777619u;
+	return h;
+}
+
+static void cJSON_DropIndex(cJSON *object) {if (object->index) {cJSON_free(object->index);object->index=0;}}
+
+/* Insert item unless an item with the same key is already indexed. */
+static void cJSON_IndexInsert(cJSON_Index *index,cJSON *item)
+{
+	unsigned int i;
+	if (!item->string) return;
+	i=cJSON_keyhash(item->string)&index->mask;
+	while (index->slots[i])
+	{
+		if (!cJSON_keycmp(index->slots[i]->string,item->string)) return;
+		i=(i+1)&index->mask;
+	}
+	index->slots[i]=item;index->count++;
+}
+
+static void cJSON_BuildIndex(cJSON *object)
+{
+	cJSON *c;unsigned int size=16;int count=0;cJSON_Index *index;
+	for (c=object->child;c;c=c->next) count++;
+	while (size<(unsigned int)count*2) size<<=1;	/* keep the load factor under 1/2 */
+	index=(cJSON_Index*)cJSON_malloc(sizeof(cJSON_Index)+(size-1)*sizeof(cJSON*));
+	if (!index) return;
+	memset(index->slots,0,size*sizeof(cJSON*));
+	index->mask=size-1;index->count=0;
+	for (c=object->child;c;c=c->next) cJSON_IndexInsert(index,c);
+	object->index=index;
+}
+
+static cJSON *cJSON_IndexLookup(cJSON_Index *index,const char *string)
+{
+	unsigned int i=cJSON_keyhash(string)&index->mask;
+	while (index->slots[i])
+	{
+		if (!cJSON_keycmp(index->slots[i]->string,string)) return index->slots[i];
+		i=(i+1)&index->mask;
+	}
+	return 0;
+}
+
 /* Delete a cJSON structure. */
 void cJSON_Delete(cJSON *c)
 {
@@ -89,6 +151,7 @@ void cJSON_Delete(cJSON *c)
 	while (c)
 	{
 		next=c->next;
+		if (c->index) cJSON_free(c->index);
 		if (!(c->type&cJSON_IsReference) && c->child) cJSON_Delete(c->child);
 		if (!(c->type&cJSON_IsReference) && c->valuestring) cJSON_free(c->valuestring);
 		if (c->string) cJSON_free(c->string);
@@ -311,7 +374,7 @@ static const char *parse_array(cJSON *item,const char *value)
 	value=skip(value+1);
 	if (*value==']') return value+1;	/* empty array. */
 
-	item->child=child=cJSON_New_Item();
+	item->child=item->last=child=cJSON_New_Item();
 	if (!item->child) return 0;		 /* memory fail */
 	value=skip(parse_value(child,skip(value)));	/* skip any spacing, get the value. */
 	if (!value) return 0;
@@ -324,6 +387,7 @@ static const char *parse_array(cJSON *item,const char *value)
 		value=skip(parse_value(child,skip(value+1)));
 		if (!value) return 0;	/* memory fail */
 	}
+	item->last=child;
 
 	if (*value==']') return value+1;	/* end of array */
 	ep=value;return 0;	/* malformed. */
@@ -390,7 +454,7 @@ static const char *parse_object(cJSON *item,const char *value)
 	value=skip(value+1);
 	if (*value=='}') return value+1;	/* empty array. */
 	
-	item->child=child=cJSON_New_Item();
+	item->child=item->last=child=cJSON_New_Item();
 	if (!item->child) return 0;
 	value=skip(parse_string(child,skip(value)));
 	if (!value) return 0;
@@ -411,6 +475,7 @@ static const char *parse_object(cJSON *item,const char *value)
 		value=skip(parse_value(child,skip(value+1)));	/* skip any spacing, get the value. */
 		if (!value) return 0;
 	}
+	item->last=child;
 	
 	if (*value=='}') return value+1;	/* end of array */
 	ep=value;return 0;	/* malformed. */
@@ -482,30 +547,72 @@ int    cJSON_GetArraySize(cJSON *array)							{cJSON *c=array->child;int i=0;whi
 cJSON *cJSON_GetArrayItem(cJSON *array,int item)				{cJSON *c=array->child;  while (c && item>0) item--,c=c->next; return c;}
 /* FGG update to support update of json objects with other json objects */
 char *cJSON_GetArrayItemName(cJSON *array,int item)				{cJSON *c=array->child;  while (c && item>0) item--,c=c->next; return c->string;}
-cJSON *cJSON_GetObjectItem(cJSON *object,const char *string)	{cJSON *c=object->child; while (c && cJSON_strcasecmp(c->string,string)) c=c->next; return c;}
+cJSON *cJSON_GetObjectItem(cJSON *object,const char *string)
+{
+	cJSON *c;int visited=0;
+	if (object->index && string) return cJSON_IndexLookup(object->index,string);
+	c=object->child;
+	while (c && cJSON_keycmp(c->string,string)) visited++,c=c->next;
+	/* Walked a long chain: index the object so that the next lookups are O(1). References share the chain of another item, never index them. */
+	if (visited>=cJSON_INDEX_THRESHOLD && !(object->type&cJSON_IsReference) && (object->type&255)==cJSON_Object) cJSON_BuildIndex(object);
+	return c;
+}
 
 /* Utility for array list handling. */
 static void suffix_object(cJSON *prev,cJSON *item) {prev->next=item;item->prev=prev;}
 /* Utility for handling references. */
-static cJSON *create_reference(cJSON *item) {cJSON *ref=cJSON_New_Item();if (!ref) return 0;memcpy(ref,item,sizeof(cJSON));ref->string=0;ref->type|=cJSON_IsReference;ref->next=ref->prev=0;return ref;}
+static cJSON *create_reference(cJSON *item) {cJSON *ref=cJSON_New_Item();if (!ref) return 0;memcpy(ref,item,sizeof(cJSON));ref->string=0;ref->type|=cJSON_IsReference;ref->next=ref->prev=0;ref->last=0;ref->index=0;return ref;}
+
+/* Tail of the child chain: the cached one when it is still valid, otherwise walk (chains built outside of cJSON, references). */
+static cJSON *last_child(cJSON *array)
+{
+	cJSON *c=array->last;
+	if (!c || c->next || (array->type&cJSON_IsReference)) {c=array->child;while (c && c->next) c=c->next;}
+	return c;
+}
 
 /* Add item to array/object. */
-void   cJSON_AddItemToArray(cJSON *array, cJSON *item)						{cJSON *c=array->child;if (!item) return; if (!c) {array->child=item;} else {while (c && c->next) c=c->next; suffix_object(c,item);}}
+void   cJSON_AddItemToArray(cJSON *array, cJSON *item)
+{
+	cJSON *c;
+	if (!item) return;
+	c=last_child(array);
+	if (!c) array->child=item; else suffix_object(c,item);
+	array->last=item;
+	if (array->index)
+	{
+		cJSON_IndexInsert(array->index,item);
+		if (array->index->count*2>array->index->mask+1) cJSON_DropIndex(array);	/* too full, rebuilt on the next lookup */
+	}
+}
 void   cJSON_AddItemToObject(cJSON *object,const char *string,cJSON *item)	{if (!item) return; if (item->string) cJSON_free(item->string);item->string=cJSON_strdup(string);cJSON_AddItemToArray(object,item);}
 void	cJSON_AddItemReferenceToArray(cJSON *array, cJSON *item)						{cJSON_AddItemToArray(array,create_reference(item));}
 void	cJSON_AddItemReferenceToObject(cJSON *object,const char *string,cJSON *item)	{cJSON_AddItemToObject(object,string,create_reference(item));}
 
-cJSON *cJSON_DetachItemFromArray(cJSON *array,int which)			{cJSON *c=array->child;while (c && which>0) c=c->next,which--;if (!c) return 0;
-	if (c->prev) c->prev->next=c->next;if (c->next) c->next->prev=c->prev;if (c==array->child) array->child=c->next;c->prev=c->next=0;return c;}
+static cJSON *detach_item(cJSON *parent,cJSON *c)
+{
+	if (c->prev) c->prev->next=c->next;if (c->next) c->next->prev=c->prev;if (c==parent->child) parent->child=c->next;
+	if (c==parent->last) parent->last=c->prev;
+	cJSON_DropIndex(parent);
+	c->prev=c->next=0;return c;
+}
+
+cJSON *cJSON_DetachItemFromArray(cJSON *array,int which)			{cJSON *c=array->child;while (c && which>0) c=c->next,which--;if (!c) return 0;return detach_item(array,c);}
 void   cJSON_DeleteItemFromArray(cJSON *array,int which)			{cJSON_Delete(cJSON_DetachItemFromArray(array,which));}
-cJSON *cJSON_DetachItemFromObject(cJSON *object,const char *string) {int i=0;cJSON *c=object->child;while (c && cJSON_strcasecmp(c->string,string)) i++,c=c->next;if (c) return cJSON_DetachItemFromArray(object,i);return 0;}
+cJSON *cJSON_DetachItemFromObject(cJSON *object,const char *string) {cJSON *c=cJSON_GetObjectItem(object,string);if (c) return detach_item(object,c);return 0;}
 void   cJSON_DeleteItemFromObject(cJSON *object,const char *string) {cJSON_Delete(cJSON_DetachItemFromObject(object,string));}
 
 /* Replace array/object items with new ones. */
-void   cJSON_ReplaceItemInArray(cJSON *array,int which,cJSON *newitem)		{cJSON *c=array->child;while (c && which>0) c=c->next,which--;if (!c) return;
+static void replace_item(cJSON *parent,cJSON *c,cJSON *newitem)
+{
 	newitem->next=c->next;newitem->prev=c->prev;if (newitem->next) newitem->next->prev=newitem;
-	if (c==array->child) array->child=newitem; else newitem->prev->next=newitem;c->next=c->prev=0;cJSON_Delete(c);}
-void   cJSON_ReplaceItemInObject(cJSON *object,const char *string,cJSON *newitem){int i=0;cJSON *c=object->child;while(c && cJSON_strcasecmp(c->string,string))i++,c=c->next;if(c){newitem->string=cJSON_strdup(string);cJSON_ReplaceItemInArray(object,i,newitem);}}
+	if (c==parent->child) parent->child=newitem; else newitem->prev->next=newitem;
+	if (c==parent->last) parent->last=newitem;
+	cJSON_DropIndex(parent);
+	c->next=c->prev=0;cJSON_Delete(c);
+}
+void   cJSON_ReplaceItemInArray(cJSON *array,int which,cJSON *newitem)		{cJSON *c=array->child;while (c && which>0) c=c->next,which--;if (!c) return;replace_item(array,c,newitem);}
+void   cJSON_ReplaceItemInObject(cJSON *object,const char *string,cJSON *newitem){cJSON *c=cJSON_GetObjectItem(object,string);if(c){newitem->string=cJSON_strdup(string);replace_item(object,c,newitem);}}
 
 /* Create basic types: */
 cJSON *cJSON_CreateNull()						{cJSON *item=cJSON_New_Item();if(item)item->type=cJSON_NULL;return item;}
@@ -518,7 +625,7 @@ cJSON *cJSON_CreateArray()						{cJSON *item=cJSON_New_Item();if(item)item->type
 cJSON *cJSON_CreateObject()						{cJSON *item=cJSON_New_Item();if(item)item->type=cJSON_Object;return item;}
 
 /* Create Arrays: */
-cJSON *cJSON_CreateIntArray(int *numbers,int count)				{int i;cJSON *n=0,*p=0,*a=cJSON_CreateArray();for(i=0;a && i<count;i++){n=cJSON_CreateNumber(numbers[i]);if(!i)a->child=n;else suffix_object(p,n);p=n;}return a;}
-cJSON *cJSON_CreateFloatArray(float *numbers,int count)			{int i;cJSON *n=0,*p=0,*a=cJSON_CreateArray();for(i=0;a && i<count;i++){n=cJSON_CreateNumber(numbers[i]);if(!i)a->child=n;else suffix_object(p,n);p=n;}return a;}
-cJSON *cJSON_CreateDoubleArray(double *numbers,int count)		{int i;cJSON *n=0,*p=0,*a=cJSON_CreateArray();for(i=0;a && i<count;i++){n=cJSON_CreateNumber(numbers[i]);if(!i)a->child=n;else suffix_object(p,n);p=n;}return a;}
-cJSON *cJSON_CreateStringArray(const char **strings,int count)	{int i;cJSON *n=0,*p=0,*a=cJSON_CreateArray();for(i=0;a && i<count;i++){n=cJSON_CreateString(strings[i]);if(!i)a->child=n;else suffix_object(p,n);p=n;}return a;}
+cJSON *cJSON_CreateIntArray(int *numbers,int count)				{int i;cJSON *n=0,*p=0,*a=cJSON_CreateArray();for(i=0;a && i<count;i++){n=cJSON_CreateNumber(numbers[i]);if(!i)a->child=n;else suffix_object(p,n);p=n;}if(a)a->last=p;return a;}
+cJSON *cJSON_CreateFloatArray(float *numbers,int count)			{int i;cJSON *n=0,*p=0,*a=cJSON_CreateArray();for(i=0;a && i<count;i++){n=cJSON_CreateNumber(numbers[i]);if(!i)a->child=n;else suffix_object(p,n);p=n;}if(a)a->last=p;return a;}
+cJSON *cJSON_CreateDoubleArray(double *numbers,int count)		{int i;cJSON *n=0,*p=0,*a=cJSON_CreateArray();for(i=0;a && i<count;i++){n=cJSON_CreateNumber(numbers[i]);if(!i)a->child=n;else suffix_object(p,n);p=n;}if(a)a->last=p;return a;}
+cJSON *cJSON_CreateStringArray(const char **strings,int count)	{int i;cJSON *n=0,*p=0,*a=cJSON_CreateArray();for(i=0;a && i<count;i++){n=cJSON_CreateString(strings[i]);if(!i)a->child=n;else suffix_object(p,n);p=n;}if(a)a->last=p;return a;}
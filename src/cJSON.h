@@ -51,6 +51,9 @@ typedef struct cJSON {
 	double valuedouble;			/* The item's number, if type==cJSON_Number */
 
 	char *string;				/* The item's name string, if this item is the child of, or is in the list of subitems of an object. */
+
+	struct cJSON *last;			/* Internal: last item of the child chain, for O(1) appends. */
+	struct cJSON_Index *index;	/* Internal: key index of a large object, built lazily by cJSON_GetObjectItem. */
 } cJSON;
 
 typedef struct cJSON_Hooks {
@@ -77,7 +80,7 @@ extern int	  cJSON_GetArraySize(cJSON *array);
 extern char *cJSON_GetArrayItemName(cJSON *array,int item);
 /* Retrieve item number "item" from array "array". Returns NULL if unsuccessful. */
 extern cJSON *cJSON_GetArrayItem(cJSON *array,int item);
-/* Get item "string" from object. Case insensitive. */
+/* Get item "string" from object. Case insensitive, exact case matches take the fast path. Objects with many items are looked up through a hash index built on first use. */
 extern cJSON *cJSON_GetObjectItem(cJSON *object,const char *string);
 
 /* For analysing failed parses. This returns a pointer to the parse error. You'll probably need to look a few chars back to make sense of it. Defined when cJSON_Parse() returns 0. 0 when cJSON_Parse() succeeds. */
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+
+#include "capture.h"
+#include "arena.h"
+#include "logger.h"
+
+#define CAPTURE_MAX_ACTION 255
+
+static int captureFd = -1;
+static int captureBodies = 0;
+static const char *captureKey = NULL;
+
+/* the record of the request being processed by the current thread, body included, the header is filled last */
+static ARENA_THREAD_LOCAL unsigned char *record = NULL;
+static ARENA_THREAD_LOCAL size_t recordBody = 0;
+static ARENA_THREAD_LOCAL long long recordRequestBytes = 0;
+static ARENA_THREAD_LOCAL int recordFlags = 0;
+static ARENA_THREAD_LOCAL int recordKeyLength = 0;
+
+static int write_all(const unsigned char *data, size_t size) {
+    while (size > 0) {
+#ifdef _WIN32
+        int n = _write(captureFd, data, (unsigned int) (size > 0x40000000 ? 0x40000000 : size));
+#else
+        ssize_t n = write(captureFd, data, size);
+#endif
+        if (n < 0 && EINTR == errno) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
+
+int capture_init(const char *path, int withBodies, const char *secretKey) {
+#ifdef _WIN32
+    captureFd = _open(path, _O_WRONLY | _O_APPEND | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    captureFd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+#endif
+    if (captureFd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (0 == fstat(captureFd, &st) && 0 == st.st_size
+        && 0 != write_all((const unsigned char *) CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE)) {
+        return -1;
+    }
+    captureBodies = withBodies;
+    captureKey = secretKey && secretKey[0] && strlen(secretKey) <= 255 ? secretKey : NULL;
+    return 0;
+}
+
+int capture_enabled() {
+    return captureFd >= 0;
+}
+
+/* overwrite every occurrence of the secret key, @return its length if there was one */
+static int blank_key(unsigned char *body, size_t size) {
+    if (!captureKey) {
+        return 0;
+    }
+    size_t keyLength = strlen(captureKey);
+    int found = 0;
+    unsigned char *p = body;
+    unsigned char *end = body + size;
+    while ((size_t) (end - p) >= keyLength && (p = memchr(p, captureKey[0], end - p - keyLength + 1))) {
+        if (0 == memcmp(p, captureKey, keyLength)) {
+            memset(p, '*', keyLength);
+            p += keyLength;
+            found = 1;
+        } else {
+            p++;
+        }
+    }
+    return found ? (int) keyLength : 0;
+}
+
+void capture_message(const char *message, size_t size, long headerLength, int cbor) {
+    if (captureFd < 0) {
+        return;
+    }
+    free(record);
+    recordRequestBytes = (long long) size;
+    recordFlags = cbor ? CAPTURE_FLAG_CBOR : 0;
+    recordKeyLength = 0;
+    recordBody = 0;
+    size_t bodyStart = 0 <= headerLength && (size_t) headerLength <= size ? (size_t) headerLength : 0;
+    size_t body = captureBodies ? size - bodyStart : 0;
+    record = malloc(CAPTURE_HEADER_SIZE + body + CAPTURE_MAX_ACTION);
+    if (!record) {
+        LOG_WARN("No memory to capture a request of %lu bytes", (unsigned long) size);
+        return;
+    }
+    if (captureBodies) {
+        memcpy(record + CAPTURE_HEADER_SIZE, message + bodyStart, body);
+        recordBody = body;
+        recordFlags |= CAPTURE_FLAG_BODY;
+        recordKeyLength = blank_key(record + CAPTURE_HEADER_SIZE, body);
+    }
+}
+
+static unsigned char *put_u64(unsigned char *p, unsigned long long value) {
+    int i;
+    for (i = 0; i < 8; i++) {
+        *p++ = (unsigned char) (value >> (8 * i));
+    }
+    return p;
+}
+
+void capture_request(long long started, long long micros, const char *action, int result) {
+    if (!record) {
+        return;
+    }
+    size_t actionLength = strlen(action);
+    if (actionLength > CAPTURE_MAX_ACTION) {
+        actionLength = CAPTURE_MAX_ACTION;
+    }
+    size_t size = CAPTURE_HEADER_SIZE + recordBody + actionLength;
+    unsigned char *p = record;
+    p = put_u64(p, size - 8);
+    p = put_u64(p, (unsigned long long) started);
+    p = put_u64(p, (unsigned long long) micros);
+    p = put_u64(p, (unsigned long long) recordRequestBytes);
+    int i;
+    for (i = 0; i < 4; i++) {
+        *p++ = (unsigned char) ((unsigned int) result >> (8 * i));
+    }
+    *p++ = (unsigned char) recordFlags;
+    *p++ = (unsigned char) recordKeyLength;
+    *p++ = (unsigned char) actionLength;
+    p = put_u64(p, recordBody);
+    memcpy(p + recordBody, action, actionLength);
+
+    if (0 != write_all(record, size)) {
+        LOG_WARN("Could not capture a request: %s", strerror(errno));
+    }
+    free(record);
+    record = NULL;
+}
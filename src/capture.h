@@ -0,0 +1,70 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+
+/**
+ * Request capture, for replaying the traffic of a server against another build (bench/ck-crowdnode-replay.c).
+ *
+ * With capture_file in the configuration every request except the /metrics scrapes appends one record to the
+ * file when it is done: its start, latency, action, return code and size, and with capture_bodies its HTTP body,
+ * with the server's secret key overwritten by '*'. A record is appended with a single write to a descriptor
+ * opened with O_APPEND, so the worker threads and the request processes of fork mode share the file. The
+ * records are in the order the requests finished.
+ *
+ * File format, integers little endian:
+ *   CAPTURE_MAGIC                      8 bytes
+ *   then per request:
+ *     u64 size of the rest of the record
+ *     u64 start, microseconds of the monotonic clock (metrics_now), only differences are meaningful
+ *     u64 latency, microseconds
+ *     u64 request bytes received, headers included
+ *     u32 return code
+ *     u8  flags, CAPTURE_FLAG_*
+ *     u8  length of the secret key overwritten in the body, 0 if none
+ *     u8  length of the action name
+ *     u64 body length, 0 without CAPTURE_FLAG_BODY
+ *     body, action name
+ */
+
+#define CAPTURE_MAGIC "CKCAPT01"
+#define CAPTURE_MAGIC_SIZE 8
+#define CAPTURE_HEADER_SIZE (8 + 8 + 8 + 8 + 4 + 1 + 1 + 1 + 8)
+
+#define CAPTURE_FLAG_BODY 1     /* the record carries the body */
+#define CAPTURE_FLAG_CBOR 2     /* the body is CBOR, url encoded ck_json= otherwise */
+
+/**
+ * start capturing, the file is created or appended to
+ *
+ * @param path capture file
+ * @param withBodies record the bodies of the requests too
+ * @param secretKey blanked out in the bodies, may be NULL
+ * @return 0 on success, -1 if the file can't be opened
+ */
+int capture_init(const char *path, int withBodies, const char *secretKey);
+
+/**
+ * @return 1 if the requests are captured
+ */
+int capture_enabled();
+
+/**
+ * note the message of the request being processed by the current thread
+ *
+ * @param message HTTP request as received
+ * @param size its length
+ * @param headerLength length of its headers, -1 if there are none
+ * @param cbor the body is CBOR
+ */
+void capture_message(const char *message, size_t size, long headerLength, int cbor);
+
+/**
+ * append the record of the request being processed by the current thread, if capture_message was called
+ *
+ * @param started start of the request, as metrics_now
+ * @param micros latency
+ */
+void capture_request(long long started, long long micros, const char *action, int result);
+
+#endif
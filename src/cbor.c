@@ -0,0 +1,252 @@
+#include <math.h>
+#include <string.h>
+
+#include "cbor.h"
+#include "arena.h"
+
+#define CBOR_UNSIGNED 0
+#define CBOR_NEGATIVE 1
+#define CBOR_BYTES 2
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_TAG 6
+#define CBOR_SIMPLE 7
+
+#define CBOR_INDEFINITE 31
+#define CBOR_BREAK 0xff
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+    int depth;
+} CborCursor;
+
+/**
+ * read the initial byte and the argument of a data item
+ *
+ * @return 1 on success, 0 on malformed data
+ */
+static int cbor_read_head(CborCursor *c, int *major, int *info, unsigned long long *arg) {
+    int i, bytes;
+    if (c->p >= c->end) {
+        return 0;
+    }
+    *major = *c->p >> 5;
+    *info = *c->p & 0x1f;
+    c->p++;
+    *arg = 0;
+    if (*info < 24) {
+        *arg = *info;
+        return 1;
+    }
+    if (*info == CBOR_INDEFINITE) {
+        return 1;
+    }
+    if (*info > 27) {
+        return 0;
+    }
+    bytes = 1 << (*info - 24);
+    if (c->end - c->p < bytes) {
+        return 0;
+    }
+    for (i = 0; i < bytes; i++) {
+        *arg = (*arg << 8) | *c->p++;
+    }
+    return 1;
+}
+
+static double cbor_half_to_double(unsigned int half) {
+    int exponent = (half >> 10) & 0x1f;
+    int mantissa = half & 0x3ff;
+    double value;
+    if (exponent == 0) {
+        value = ldexp(mantissa, -24);
+    } else if (exponent != 31) {
+        value = ldexp(mantissa + 1024, exponent - 25);
+    } else {
+        value = mantissa == 0 ? HUGE_VAL : NAN;
+    }
+    return (half & 0x8000) ? -value : value;
+}
+
+static cJSON *cbor_decode_item(CborCursor *c);
+
+/* Definite or chunked (indefinite) byte/text string, zero terminated */
+static cJSON *cbor_decode_string(CborCursor *c, int major, int info, unsigned long long arg) {
+    size_t len = 0;
+    char *out;
+    if (info != CBOR_INDEFINITE) {
+        if ((unsigned long long) (c->end - c->p) < arg) {
+            return NULL;
+        }
+        len = (size_t) arg;
+        out = ck_alloc(len + 1);
+        if (!out) {
+            return NULL;
+        }
+        memcpy(out, c->p, len);
+        c->p += len;
+    } else {
+        /* first pass over the chunks to get the total length */
+        CborCursor scan = *c;
+        int chunkMajor, chunkInfo;
+        unsigned long long chunkLen;
+        while (scan.p < scan.end && *scan.p != CBOR_BREAK) {
+            if (!cbor_read_head(&scan, &chunkMajor, &chunkInfo, &chunkLen) || chunkMajor != major
+                || chunkInfo == CBOR_INDEFINITE || (unsigned long long) (scan.end - scan.p) < chunkLen) {
+                return NULL;
+            }
+            scan.p += chunkLen;
+            len += (size_t) chunkLen;
+        }
+        if (scan.p >= scan.end) {
+            return NULL;
+        }
+        out = ck_alloc(len + 1);
+        if (!out) {
+            return NULL;
+        }
+        len = 0;
+        while (*c->p != CBOR_BREAK) {
+            cbor_read_head(c, &chunkMajor, &chunkInfo, &chunkLen);
+            memcpy(out + len, c->p, (size_t) chunkLen);
+            c->p += chunkLen;
+            len += (size_t) chunkLen;
+        }
+        c->p++;
+    }
+    out[len] = 0;
+
+    cJSON *item = cJSON_CreateNull();
+    if (!item) {
+        return NULL;
+    }
+    item->type = cJSON_String;
+    item->valuestring = out;
+    if (major == CBOR_BYTES) {
+        item->type |= CBOR_BYTE_STRING;
+        item->valueint = (int) len;
+        item->valuedouble = (double) len;
+    }
+    return item;
+}
+
+static int cbor_at_break(CborCursor *c) {
+    if (c->p < c->end && *c->p == CBOR_BREAK) {
+        c->p++;
+        return 1;
+    }
+    return 0;
+}
+
+static cJSON *cbor_decode_container(CborCursor *c, int major, int info, unsigned long long arg) {
+    cJSON *container = major == CBOR_MAP ? cJSON_CreateObject() : cJSON_CreateArray();
+    unsigned long long i;
+    if (!container) {
+        return NULL;
+    }
+    for (i = 0; info == CBOR_INDEFINITE || i < arg; i++) {
+        char *key = NULL;
+        if (info == CBOR_INDEFINITE && cbor_at_break(c)) {
+            return container;
+        }
+        if (major == CBOR_MAP) {
+            cJSON *keyItem = cbor_decode_item(c);
+            if (!keyItem || keyItem->type != cJSON_String) {
+                cJSON_Delete(keyItem);
+                cJSON_Delete(container);
+                return NULL;
+            }
+            key = keyItem->valuestring;
+            keyItem->valuestring = NULL;
+            cJSON_Delete(keyItem);
+        }
+        cJSON *value = cbor_decode_item(c);
+        if (!value) {
+            ck_free(key);
+            cJSON_Delete(container);
+            return NULL;
+        }
+        value->string = key;
+        cJSON_AddItemToArray(container, value);
+    }
+    return container;
+}
+
+static cJSON *cbor_decode_item(CborCursor *c) {
+    int major, info;
+    unsigned long long arg;
+    cJSON *item = NULL;
+
+    if (c->depth >= CBOR_MAX_DEPTH || !cbor_read_head(c, &major, &info, &arg)) {
+        return NULL;
+    }
+    if (info == CBOR_INDEFINITE && (major == CBOR_UNSIGNED || major == CBOR_NEGATIVE || major == CBOR_TAG)) {
+        return NULL;
+    }
+
+    c->depth++;
+    switch (major) {
+        case CBOR_UNSIGNED:
+            item = cJSON_CreateNumber((double) arg);
+            break;
+        case CBOR_NEGATIVE:
+            item = cJSON_CreateNumber(-1.0 - (double) arg);
+            break;
+        case CBOR_BYTES:
+        case CBOR_TEXT:
+            item = cbor_decode_string(c, major, info, arg);
+            break;
+        case CBOR_ARRAY:
+        case CBOR_MAP:
+            item = cbor_decode_container(c, major, info, arg);
+            break;
+        case CBOR_TAG:
+            /* tags carry no meaning for the protocol, decode the tagged item */
+            item = cbor_decode_item(c);
+            break;
+        case CBOR_SIMPLE:
+            if (info == 20) {
+                item = cJSON_CreateFalse();
+            } else if (info == 21) {
+                item = cJSON_CreateTrue();
+            } else if (info == 22 || info == 23) {
+                item = cJSON_CreateNull();
+            } else if (info == 25) {
+                item = cJSON_CreateNumber(cbor_half_to_double((unsigned int) arg));
+            } else if (info == 26) {
+                float f;
+                unsigned int bits = (unsigned int) arg;
+                memcpy(&f, &bits, sizeof(f));
+                item = cJSON_CreateNumber(f);
+            } else if (info == 27) {
+                double d;
+                memcpy(&d, &arg, sizeof(d));
+                item = cJSON_CreateNumber(d);
+            }
+            break;
+    }
+    c->depth--;
+    return item;
+}
+
+cJSON *cbor_decode(const unsigned char *data, size_t len) {
+    CborCursor c;
+    c.p = data;
+    c.end = data + len;
+    c.depth = 0;
+    return cbor_decode_item(&c);
+}
+
+const unsigned char *cbor_string_bytes(cJSON *item, size_t *len) {
+    if (!item || (item->type & 255) != cJSON_String || !item->valuestring) {
+        return NULL;
+    }
+    if (item->type & CBOR_BYTE_STRING) {
+        *len = (size_t) item->valuedouble;
+    } else {
+        *len = strlen(item->valuestring);
+    }
+    return (const unsigned char *) item->valuestring;
+}
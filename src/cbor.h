@@ -0,0 +1,37 @@
+#ifndef CBOR_H
+#define CBOR_H
+
+#include <stddef.h>
+
+#include "cJSON.h"
+
+/**
+ * cJSON type flag of items decoded from CBOR byte strings: the item is a cJSON_String whose
+ * valuestring holds raw bytes (zero terminated, but may contain zeros), the length is in valueint.
+ */
+#define CBOR_BYTE_STRING 512
+
+#define CBOR_MAX_DEPTH 32
+
+/**
+ * decode CBOR (RFC 7049) data item into cJSON tree
+ *
+ * Maps become objects (keys must be text strings), arrays become arrays, text strings become strings,
+ * byte strings become strings flagged with CBOR_BYTE_STRING, tags are skipped.
+ *
+ * @param data the encoded data
+ * @param len length of the encoded data
+ * @return the decoded item (free with cJSON_Delete), NULL if the data is malformed
+ */
+cJSON *cbor_decode(const unsigned char *data, size_t len);
+
+/**
+ * get raw content of a string item: bytes of CBOR byte strings, the string itself otherwise
+ *
+ * @param item the string item
+ * @param len receives the length of the content
+ * @return the content, NULL if the item is not a string
+ */
+const unsigned char *cbor_string_bytes(cJSON *item, size_t *len);
+
+#endif
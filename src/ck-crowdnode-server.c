@@ -15,6 +15,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
 
 #if defined(__linux__) || defined(__APPLE__)
     #include <unistd.h>
@@ -26,20 +27,13 @@
     #include <sys/stat.h>
     #include <ifaddrs.h>
     #include <sys/ioctl.h>
+    #include <sys/wait.h>
 #elif _WIN32
     #include <winsock2.h>
     #include <ws2tcpip.h>
     #include <windows.h>
     #include <io.h>
 
-    struct thread_win_params {
-      int sock;
-      int newsock;
-      char * baseDir;
-    };
-
-    void doProcessingWin (struct thread_win_params* twp);
-
     #pragma comment(lib,"ws2_32.lib") //Winsock Library
 #else
 #endif
@@ -48,18 +42,54 @@
 #include "base64.h"
 #include "urldecoder.h"
 #include "net_uuid.h"
+#include "jsonwriter.h"
+#include "arena.h"
+#include "cbor.h"
+#include "actions.h"
+#include "ckthread.h"
+#include "filestore.h"
+#include "delta.h"
+#include "fileindex.h"
+#include "pullcache.h"
+#include "durability.h"
+#include "dircache.h"
+#include "paths.h"
+#include "archive.h"
+#include "workspace.h"
+#include "quota.h"
+#include "metrics.h"
+#include "allocprof.h"
+#include "capture.h"
+#include "nodeprofile.h"
+#include "logger.h"
+#include "httpmessage.h"
 
 #include <locale.h>
 
 static char *const CK_JSON_KEY = "ck_json=";
+static char *const METRICS_REQUEST = "GET /metrics";
+static char *const METRICS_CONTENT_TYPE = "text/plain; version=0.0.4; charset=utf-8";
 
 static char *const JSON_PARAM_NAME_COMMAND = "action";
 static char *const JSON_PARAM_PARAMS = "parameters";
 static char *const JSCON_PARAM_VALUE_PUSH = "push";
 static char *const JSON_PARAM_FILE_NAME = "filename";
 static char *const JSON_PARAM_FILE_CONTENT = "file_content_base64";
+static char *const JSON_PARAM_FILE_CONTENT_BYTES = "file_content";
+static char *const JSON_PARAM_FILE_HASH = "file_hash";
+static char *const JSON_PARAM_HASHES = "hashes";
+static char *const JSON_PARAM_BLOCK_SIZE = "block_size";
+static char *const JSON_PARAM_DELTA = "delta_base64";
+static char *const JSON_PARAM_DELTA_BYTES = "delta";
 static char *const JSON_PARAM_EXTRA_PATH = "extra_path";
 static char *const JSON_PARAM_SHELL_COMMAND = "cmd";
+static char *const JSON_PARAM_TARGET_PATH = "target_path";
+static char *const JSON_PARAM_SOURCE_PATH = "source_path";
+static char *const JSON_PARAM_TIMINGS = "timings";
+static char *const JSON_PARAM_ALLOCATIONS = "allocations";
+static char *const JSON_PARAM_LEVEL = "level";
+static char *const JSON_PARAM_PROFILE_HASH = "profile_hash";
+static char *const JSON_PARAM_REFRESH_PROFILE = "refresh_profile";
 
 #define MAX_BUFFER_SIZE 1024
 #define DEFAULT_SERVER_PORT 3333
@@ -69,6 +99,30 @@ static const int MAXPENDING = 5;    /* Maximum outstanding connection requests *
 static char *const JSON_CONFIG_PARAM_PORT = "port";
 static char *const JSON_CONFIG_PARAM_PATH_TO_FILES = "path_to_files";
 static char *const JSON_CONFIG_PARAM_SECRET_KEY = "secret_key";
+static char *const JSON_CONFIG_PARAM_SERVER_MODE = "server_mode";
+static char *const JSON_CONFIG_PARAM_WORKER_THREADS = "worker_threads";
+static char *const JSON_CONFIG_PARAM_MAX_BLOCKING_JOBS = "max_blocking_jobs";
+static char *const JSON_CONFIG_PARAM_PULL_CACHE_MB = "pull_cache_mb";
+static char *const JSON_CONFIG_PARAM_DURABILITY = "durability";
+static char *const JSON_CONFIG_PARAM_BATCH_COMMIT_MS = "batch_commit_ms";
+static char *const JSON_CONFIG_PARAM_DIRECT_IO = "direct_io";
+static char *const JSON_CONFIG_PARAM_QUOTA_MB = "quota_mb";
+static char *const JSON_CONFIG_PARAM_MAX_AGE_HOURS = "max_age_hours";
+static char *const JSON_CONFIG_PARAM_PINNED_PATHS = "pinned_paths";
+static char *const JSON_CONFIG_PARAM_GC_INTERVAL_S = "gc_interval_s";
+static char *const JSON_CONFIG_PARAM_LOG_LEVEL = "log_level";
+static char *const JSON_CONFIG_PARAM_LOG_FORMAT = "log_format";
+static char *const JSON_CONFIG_PARAM_LOG_RATE_LIMIT = "log_rate_limit";
+static char *const JSON_CONFIG_PARAM_CAPTURE_FILE = "capture_file";
+static char *const JSON_CONFIG_PARAM_CAPTURE_BODIES = "capture_bodies";
+
+#define SERVER_MODE_FORK 0
+#define SERVER_MODE_THREAD 1
+#define DEFAULT_WORKER_THREADS 16
+#define DEFAULT_PULL_CACHE_MB 64
+#define DEFAULT_BATCH_COMMIT_MS 5
+#define CONNECTION_QUEUE_SIZE 256
+#define DIR_CACHE_SIZE 256
 
 #ifdef _WIN32
 static char *const DEFAULT_BASE_DIR = "%LOCALAPPDATA%\\ck-crowdnode-files";
@@ -118,12 +172,134 @@ int WSAGetLastError() {
  *   output result JSON:
  *     {"return":"0","return_code":256,"encoding":"UTF-8","stdout_base64":"","stderr_base64":"Y2F0OiBydXMudHh0OiBObyBzdWNoIGZpbGUgb3IgZGlyZWN0b3J5Cg=="}
  *
+ * have command
+ *   input JSON:
+ *     {"action":"have", "secretkey":"<secret key>", "hashes":["<file_hash>", ...]}
+ *
+ *   output result JSON:
+ *     {"return":"0", "missing":["<file_hash not stored at the node>", ...]}
+ *
+ *   Pushed content is stored once per hash (see filestore.h) and the push response carries its "file_hash".
+ *   A push with "file_hash" instead of the file content copies already stored content to the new filename.
+ *
+ * signature command
+ *   input JSON:
+ *     {"action":"signature", "secretkey":"<secret key>", "filename":"file1", "block_size":4096}
+ *
+ *   output result JSON:
+ *     {"return":"0", "block_size":4096, "file_size":<size>, "checksums_base64":"<block checksums, see delta.h>"}
+ *
+ * patch command
+ *   input JSON:
+ *     {"action":"patch", "secretkey":"<secret key>", "filename":"file1", "block_size":4096, "delta_base64":"<delta, see delta.h>"}
+ *
+ *   output result JSON:
+ *     {"return":"0", "file_hash":"<hash of the new content>"}
+ *
+ * list, manifest and stat commands
+ *   input JSON:
+ *     {"action":"list", "secretkey":"<secret key>", "extra_path":"<optional directory>"}
+ *     {"action":"manifest", "secretkey":"<secret key>", "extra_path":"<optional directory>"}
+ *     {"action":"stat", "secretkey":"<secret key>", "filename":"file1", "extra_path":"<optional directory>"}
+ *
+ *   output result JSON:
+ *     {"return":"0", "files":[{"name":"a/file1", "size":<size>, "mtime":<unix time>}, ...]}
+ *     {"return":"0", "files":[{"name":"a/file1", "size":<size>, "mtime":<unix time>, "file_hash":"<hash>"}, ...]}
+ *     {"return":"0", "filename":"a/file1", "size":<size>, "mtime":<unix time>, "file_hash":"<hash>"}
+ *
+ * extract and archive commands
+ *   input JSON:
+ *     {"action":"extract", "secretkey":"<secret key>", "filename":"ck-master.zip", "extra_path":"<optional directory>", "target_path":"<optional directory>"}
+ *     {"action":"archive", "secretkey":"<secret key>", "filename":"out.tar.gz", "extra_path":"<optional directory>", "source_path":"<optional directory>"}
+ *
+ *   output result JSON:
+ *     {"return":"0", "files":<number of files extracted>}
+ *     {"return":"0", "files":<number of files packed>, "file_hash":"<hash of the archive>"}
+ *
+ *   extract unpacks the pushed zip, tar or tar.gz archive into target_path (default extra_path), archive packs
+ *   the files under source_path (default extra_path) into the named archive, its format given by the extension
+ *   (.zip, .tar, .tar.gz or .tgz), to be pulled. See archive.h.
+ *
+ * clone_workspace and drop_workspace commands
+ *   input JSON:
+ *     {"action":"clone_workspace", "secretkey":"<secret key>", "source_path":"<directory>", "target_path":"<new directory>"}
+ *     {"action":"drop_workspace", "secretkey":"<secret key>", "extra_path":"<directory>"}
+ *
+ *   output result JSON:
+ *     {"return":"0", "reflinked":<files>, "linked":<files>, "copied":<files>}
+ *     {"return":"0"}
+ *
+ *   clone_workspace gives a job its own copy of a directory pushed once, sharing the file content where the
+ *   file system allows (see workspace.h); drop_workspace removes the directory in the background.
+ *
  * state command
  *   input JSON:
  *     {"return":"0", "parameters":{"secret_key":"<secret key from config file ck-crowdnode-config.json>"}}
  *
  *   output result JSON:
- *     {"path_to_files":"/home/user/ck-crowdnode-files"}
+ *     {"return":"0", "cfg":{"path_to_files":"/home/user/ck-crowdnode-files"},
+ *      "storage":{"used_bytes":<bytes>, "files":<files>, "quota_bytes":<quota_mb in bytes, 0 if none>,
+ *                 "evicted_files":<files>, "evicted_bytes":<bytes>, "last_pass":<unix time of the last collection>}}
+ *
+ *   Files under path_to_files are evicted least recently used first above quota_mb, or when not used for
+ *   max_age_hours, except the ones under pinned_paths (see quota.h). Without either of them no collector runs
+ *   and "storage" is left out.
+ *
+ *   The response also describes the node, collected once at startup (see nodeprofile.h), so that clients need
+ *   not probe it with shell commands. Its hash changes only with its content: a client sending the hash it
+ *   has seen as "profile_hash" gets the profile only when it differs, "refresh_profile":true collects it again:
+ *     {"action":"state", "secretkey":"<secret key>", "profile_hash":"<optional hash>", "refresh_profile":<optional true>}
+ *     {"return":"0", ..., "profile_hash":"<16 hex digits>",
+ *      "profile":{"os":"Linux", "os_release":"<kernel>", "os_version":"...", "machine":"x86_64", "hostname":"...",
+ *                 "cpu":{"model":"...", "logical_cpus":<n>, "physical_cores":<n>, "sockets":<n>,
+ *                        "caches":[{"level":1, "type":"Data", "size_bytes":<bytes>, "line_size":<bytes>,
+ *                                   "ways":<n>, "shared_cpus":<n>}, ...],
+ *                        "governor":"performance", "min_frequency_khz":<kHz>, "max_frequency_khz":<kHz>},
+ *                 "memory":{"total_bytes":<bytes>, "page_size":<bytes>},
+ *                 "compilers":[{"name":"gcc", "version":"gcc (GCC) 13.2.0"}, ...],
+ *                 "collected":<unix time>}}
+ *   Values not known on the platform are 0 or empty.
+ *
+ * Metrics:
+ *   a plain "GET /metrics" (no secret key) answers in the Prometheus text exposition format: requests by
+ *   action and return code, latency histograms per action, bytes in and out, Base64 bytes encoded and
+ *   decoded, active connections, running shell commands and the depth of the connection queue (see metrics.h).
+ *
+ * Timings:
+ *   every response carries the time spent in the phases of the request so far (recv, url_decode, parse,
+ *   wait for the blocking jobs gate, base64_decode, read, write, ...) in a "Server-Timing" header, and
+ *   every request logs a "timing" info line with all of them, send included. A request with "timings":true
+ *   gets them in the response too, in microseconds:
+ *     {"return":"0", ..., "timings":{"recv":52, "url_decode":31, "parse":40, "wait":3, "base64_decode":210,
+ *                                   "write":702, "total":1116}}
+ *
+ * log_level command
+ *   input JSON:
+ *     {"action":"log_level", "secretkey":"<secret key>", "level":"<optional error, warn, info or debug>"}
+ *
+ *   output result JSON:
+ *     {"return":"0", "level":"debug"}
+ *
+ *   The log goes to stdout at log_level (default info) from the configuration file, as text or as JSON lines
+ *   (log_format "text" or "json"), at most log_rate_limit messages a second if set. The action changes the
+ *   level at runtime, for every request process in fork mode too (see logger.h).
+ *
+ * Binary encoding:
+ *   when the request is sent with "Content-Type: application/cbor", the body is the same command encoded
+ *   as a CBOR map instead of url encoded JSON, and the response is CBOR too. Binary content is carried as
+ *   byte strings: "file_content" instead of "file_content_base64" in push requests and pull responses,
+ *   "stdout"/"stderr" instead of "stdout_base64"/"stderr_base64" in shell responses, "checksums" and "delta"
+ *   instead of "checksums_base64" and "delta_base64" in signature responses and patch requests.
+ *
+ * Capture:
+ *   with capture_file in the configuration file every request is recorded there (start, latency, action,
+ *   return code, size and, with "capture_bodies":true, its body without the secret key) for replaying the
+ *   traffic with ck-crowdnode-replay (see capture.h).
+ *
+ * File paths:
+ *   extra_path is relative to path_to_files and filename a name in it without separators, absolute paths and
+ *   ".." components are rejected and files may not be reached through symbolic links leading outside of it
+ *   (see dircache.h).
  *
  * todo list:
  * - Check/Implement concurrent execution - looks like thread fors well at linus and windows as well
@@ -131,6 +307,66 @@ int WSAGetLastError() {
  */
 
 void doProcessing(int sock, char *baseDir);
+void registerActions();
+void initMetrics(int shared);
+
+/* Format of the responses to the request being processed by the current thread */
+static ARENA_THREAD_LOCAL int responseFormat = RESPONSE_FORMAT_JSON;
+/* Action and return code of the request being processed by the current thread, for the metrics */
+static ARENA_THREAD_LOCAL int requestAction = METRICS_ACTION_NONE;
+static ARENA_THREAD_LOCAL const char *responseResult = "0";
+/* Phase timings requested in the response of the request being processed by the current thread */
+static ARENA_THREAD_LOCAL int responseTimings = 0;
+
+#define SERVER_TIMING_HEADER_SIZE 1024
+
+typedef struct {
+    MetricsPhases phases;
+    AllocStats allocs;
+} ResponseTimings;
+
+static void writeTimings(JsonWriter *w, void *ctx) {
+    ResponseTimings *timings = ctx;
+    MetricsPhases *phases = &timings->phases;
+    int i;
+    jw_key(w, JSON_PARAM_TIMINGS);
+    jw_begin_object(w);
+    for (i = 0; i < phases->count; i++) {
+        jw_int_field(w, phases->phases[i].name, phases->phases[i].micros);
+    }
+    jw_int_field(w, "total", phases->totalMicros);
+    jw_end_object(w);
+
+    if (allocprof_enabled()) {
+        AllocStats *allocs = &timings->allocs;
+        jw_key(w, JSON_PARAM_ALLOCATIONS);
+        jw_begin_object(w);
+        if (0 <= allocs->heapAllocations) {
+            jw_int_field(w, "heap", allocs->heapAllocations);
+            jw_int_field(w, "heap_bytes", allocs->heapBytes);
+            jw_int_field(w, "heap_peak_bytes", allocs->heapPeakBytes);
+        }
+        jw_int_field(w, "json", allocs->jsonAllocations);
+        jw_int_field(w, "json_bytes", allocs->jsonBytes);
+        jw_end_object(w);
+    }
+}
+
+int sendResponse(int sock, JsonBodyWriter body, void *ctx) {
+    // the phases and allocations so far, the same in both passes of the writer
+    ResponseTimings timings;
+    metrics_phases_get(&timings.phases);
+    allocprof_get(&timings.allocs);
+    char headers[SERVER_TIMING_HEADER_SIZE];
+    JsonResponseExtras extras = { headers, responseTimings ? writeTimings : NULL, &timings };
+    if (0 == metrics_server_timing(&timings.phases, headers, sizeof(headers))) {
+        extras.headers = NULL;
+    }
+    long long started = metrics_now();
+    int result = jw_send_response_extra(sock, 200, responseFormat, &extras, body, ctx);
+    metrics_phase("send", started);
+    return result;
+}
 
 int sockSend(int sock, const void* buf, size_t len) {
 #ifdef _WIN32
@@ -142,6 +378,7 @@ int sockSend(int sock, const void* buf, size_t len) {
 
 int sockSendAll(int sock, const void* buf, size_t len) {
     const char* p = buf;
+    metrics_add(METRIC_BYTES_OUT, (long long) len);
     while (0 < len) {
         int n = sockSend(sock, p, len);
         if (0 >= n) {
@@ -153,65 +390,85 @@ int sockSendAll(int sock, const void* buf, size_t len) {
     return 0;
 }
 
-int sendHttpResponse(int sock, int httpStatus, char* payload, int size) {
+int sendTypedHttpResponse(int sock, int httpStatus, const char *contentType, char* payload, int size) {
     // send HTTP headers
-    char buf[300];
-    int n = sprintf(buf, "HTTP/1.1 %d OK\r\nContent-Type: text/html; charset=UTF-8\r\nContent-Length: %d\r\n\r\n", httpStatus, size);
+    MetricsPhases phases;
+    metrics_phases_get(&phases);
+    char serverTiming[SERVER_TIMING_HEADER_SIZE];
+    if (0 == metrics_server_timing(&phases, serverTiming, sizeof(serverTiming))) {
+        serverTiming[0] = '\0';
+    }
+    char buf[SERVER_TIMING_HEADER_SIZE + 300];
+    int n = sprintf(buf, "HTTP/1.1 %d OK\r\nContent-Type: %s\r\nContent-Length: %d\r\n%s\r\n", httpStatus,
+                    contentType, size, serverTiming);
     if (0 >= n) {
-        perror("sprintf failed");
+        LOG_ERROR("Could not format the HTTP response headers");
         return -1;
     }
+    long long started = metrics_now();
     if (0 > sockSendAll(sock, buf, n)) {
-        perror("Failed to send HTTP response headers");
+        LOG_ERROR("Could not send the HTTP response headers: %s", strerror(errno));
         return -1;
     }
 
     // send payload
     if (0 > sockSendAll(sock, payload, size)) {
-        perror("Failed to send HTTP response body");
+        LOG_ERROR("Could not send the HTTP response body: %s", strerror(errno));
         return -1;
     }
+    metrics_phase("send", started);
 
     return 0;
 }
 
-void sendErrorMessage(int sock, char * errorMessage, const char *errorCode) {
-	perror(errorMessage);
+int sendHttpResponse(int sock, int httpStatus, char* payload, int size) {
+    return sendTypedHttpResponse(sock, httpStatus, "text/html; charset=UTF-8", payload, size);
+}
 
-	cJSON *resultJSON = cJSON_CreateObject();
-    if (!resultJSON) {
-        perror("[ERROR]: resultJSON cannot be created");
-        return;
-    }
+typedef struct {
+    const char *errorMessage;
+    const char *errorCode;
+} ErrorResponse;
+
+static void writeErrorResponse(JsonWriter *w, void *ctx) {
+    ErrorResponse *r = ctx;
+    jw_begin_object(w);
+    jw_string_field(w, "return", r->errorCode);
+    jw_string_field(w, "error", r->errorMessage);
+    jw_end_object(w);
+}
 
-    cJSON_AddItemToObject(resultJSON, "return", cJSON_CreateString(errorCode));
-	cJSON_AddItemToObject(resultJSON, "error", cJSON_CreateString(errorMessage));
-	char *resultJSONtext = cJSON_PrintUnformatted(resultJSON);
-    if (!resultJSONtext) {
-        perror("[ERROR]: resultJSONtext cannot be created");
-        return;
+void sendErrorMessage(int sock, char * errorMessage, const char *errorCode) {
+    // failures of the node are logged as errors where they happen, this is the client's view of them
+    LOG_DEBUG("Error response %s: %s", errorCode, errorMessage ? errorMessage : "(no message)");
+    responseResult = errorCode;
+
+    // the message may have failed to be built
+    ErrorResponse r = { errorMessage ? errorMessage : "Memory not allocated for the error message", errorCode };
+    if (sendResponse(sock, writeErrorResponse, &r) < 0) {
+        LOG_ERROR("Could not send the error response: %s", strerror(errno));
     }
-    int n = sendHttpResponse(sock, 200, resultJSONtext, strlen(resultJSONtext));
-    if (n < 0) {
-		perror("ERROR writing to socket");
-		return ;
-	}
-    free(resultJSONtext);
-    cJSON_Delete(resultJSON);
 }
 
+/**
+ * @return str1 followed by str2 in the request arena, NULL when out of memory or either of them is NULL,
+ *         so that a chain of concat calls needs one check at the end
+ */
 char* concat(const char *str1, const char *str2) {
-    size_t totalSize = strlen(str1) + strlen(str2) + sizeof(char);
-    char *message = malloc(totalSize);
-    memset(message, 0, totalSize);
+    if (!str1 || !str2) {
+        return NULL;
+    }
+    size_t len1 = strlen(str1);
+    size_t len2 = strlen(str2);
+    char *message = ck_alloc(len1 + len2 + sizeof(char));
 
     if(!message){
-        printf("[ERROR]: Memory not allocated for concat\n");
-        exit(-1);
+        LOG_ERROR("Memory not allocated for concat");
+        return NULL;
     }
 
-    strcat(message, str1);
-    strcat(message + strlen(str1), str2);
+    memcpy(message, str1, len1);
+    memcpy(message + len1, str2, len2 + 1);
     return message;
 }
 
@@ -225,6 +482,19 @@ typedef struct {
     char *pathToFiles;
     char *secretKey;
 
+    int serverMode;         /* SERVER_MODE_FORK: process per request, SERVER_MODE_THREAD: pool of worker threads */
+    int workerThreads;
+    int maxBlockingJobs;    /* blocking actions running at once, the remaining workers stay free for cheap ones */
+    int pullCacheMb;        /* memory for recently pulled files (thread mode only), 0 disables the cache */
+    int durability;         /* DURABILITY_* sync policy of pushed files */
+    int batchCommitMs;      /* group commit window of DURABILITY_BATCHED */
+    int directIo;           /* write pushed content bypassing the page cache */
+    QuotaConfig quota;      /* storage quotas of path_to_files */
+    int logLevel;           /* LOG_LEVEL_* of the messages written */
+    int logFormat;          /* LOGGER_FORMAT_TEXT or LOGGER_FORMAT_JSON lines */
+    int logRateLimit;       /* log messages a second, 0 for no limit */
+    char *captureFile;      /* requests are recorded there if set, see capture.h */
+    int captureBodies;      /* with their bodies */
 } CKCrowdnodeServerConfig;
 
 CKCrowdnodeServerConfig *ckCrowdnodeServerConfig;
@@ -266,7 +536,7 @@ char *str_replace(char *orig, char *rep, char *with) {
     //    tmp points to the end of the result string
     //    ins points to the next occurrence of rep in orig
     //    orig points to the remainder of orig after "end of rep"
-    tmp = result = malloc(strlen(orig) + (len_with - len_rep) * count + 1);
+    tmp = result = ck_alloc(strlen(orig) + (len_with - len_rep) * count + 1);
 
     if (!result)
         return NULL;
@@ -286,7 +556,7 @@ char *getEnvValue(char *param, char** envp ) {
     char * value;
     while (*envp) {
         if (strstr(*envp, param) != NULL) {
-            value = malloc(strlen(*envp) + 1);
+            value = ck_alloc(strlen(*envp) + 1);
             if (!value) {
                 perror("[ERROR]: Memory not allocated for getEnvValue");
                 return NULL;
@@ -304,21 +574,156 @@ char *getEnvValue(char *param, char** envp ) {
 
 char* getAbsolutePath(char *pathToFiles, char** envp) {
     size_t size = strlen(pathToFiles) + sizeof(char);
-    char * absolutePath = malloc(size);
-    memset(absolutePath, 0, size);
-    strcpy(absolutePath, pathToFiles);
+    char * absolutePath = ck_alloc(size);
+    memcpy(absolutePath, pathToFiles, size);
     if (strstr(absolutePath, HOME_DIR_TEMPLATE) != NULL) {
         return str_replace(absolutePath, HOME_DIR_TEMPLATE, getEnvValue(HOME_DIR_ENV_KEY, envp));
     }
     return absolutePath;
 }
 
+void loadDefaultTuningConfig(CKCrowdnodeServerConfig *ckCrowdnodeServerConfig) {
+#ifdef _WIN32
+    ckCrowdnodeServerConfig->serverMode = SERVER_MODE_THREAD;
+#else
+    ckCrowdnodeServerConfig->serverMode = SERVER_MODE_FORK;
+#endif
+    ckCrowdnodeServerConfig->workerThreads = DEFAULT_WORKER_THREADS;
+    ckCrowdnodeServerConfig->maxBlockingJobs = 0;
+    ckCrowdnodeServerConfig->pullCacheMb = DEFAULT_PULL_CACHE_MB;
+    ckCrowdnodeServerConfig->durability = DURABILITY_NONE;
+    ckCrowdnodeServerConfig->batchCommitMs = DEFAULT_BATCH_COMMIT_MS;
+    ckCrowdnodeServerConfig->directIo = 0;
+    memset(&ckCrowdnodeServerConfig->quota, 0, sizeof(QuotaConfig));
+    ckCrowdnodeServerConfig->quota.intervalSeconds = QUOTA_DEFAULT_INTERVAL_SECONDS;
+    ckCrowdnodeServerConfig->logLevel = LOG_LEVEL_INFO;
+    ckCrowdnodeServerConfig->logFormat = LOGGER_FORMAT_TEXT;
+    ckCrowdnodeServerConfig->logRateLimit = 0;
+    ckCrowdnodeServerConfig->captureFile = NULL;
+    ckCrowdnodeServerConfig->captureBodies = 0;
+}
+
+/**
+ * Optional configuration attributes, the defaults are kept for the ones not present
+ */
+void loadTuningConfig(CKCrowdnodeServerConfig *ckCrowdnodeServerConfig, cJSON *configSON) {
+    cJSON *modeJSON = cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_SERVER_MODE);
+    if (modeJSON && modeJSON->valuestring) {
+        if (strcmp(modeJSON->valuestring, "thread") == 0) {
+            ckCrowdnodeServerConfig->serverMode = SERVER_MODE_THREAD;
+        } else if (strcmp(modeJSON->valuestring, "fork") == 0) {
+#ifndef _WIN32
+            ckCrowdnodeServerConfig->serverMode = SERVER_MODE_FORK;
+#endif
+        } else {
+            LOG_WARN("Unknown %s: %s", JSON_CONFIG_PARAM_SERVER_MODE, modeJSON->valuestring);
+        }
+    }
+
+    cJSON *workersJSON = cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_WORKER_THREADS);
+    if (workersJSON && workersJSON->valueint > 0) {
+        ckCrowdnodeServerConfig->workerThreads = workersJSON->valueint;
+    }
+
+    cJSON *blockingJSON = cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_MAX_BLOCKING_JOBS);
+    if (blockingJSON && blockingJSON->valueint > 0) {
+        ckCrowdnodeServerConfig->maxBlockingJobs = blockingJSON->valueint;
+    }
+
+    cJSON *pullCacheJSON = cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_PULL_CACHE_MB);
+    if (pullCacheJSON && pullCacheJSON->valueint >= 0) {
+        ckCrowdnodeServerConfig->pullCacheMb = pullCacheJSON->valueint;
+    }
+
+    cJSON *durabilityJSON = cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_DURABILITY);
+    if (durabilityJSON && durabilityJSON->valuestring) {
+        int durability = durability_parse(durabilityJSON->valuestring);
+        if (0 <= durability) {
+            ckCrowdnodeServerConfig->durability = durability;
+        } else {
+            LOG_WARN("Unknown %s: %s", JSON_CONFIG_PARAM_DURABILITY, durabilityJSON->valuestring);
+        }
+    }
+
+    cJSON *batchCommitJSON = cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_BATCH_COMMIT_MS);
+    if (batchCommitJSON && batchCommitJSON->valueint >= 0) {
+        ckCrowdnodeServerConfig->batchCommitMs = batchCommitJSON->valueint;
+    }
+
+    cJSON *directIoJSON = cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_DIRECT_IO);
+    if (directIoJSON) {
+        ckCrowdnodeServerConfig->directIo = cJSON_True == directIoJSON->type;
+    }
+
+    QuotaConfig *quota = &ckCrowdnodeServerConfig->quota;
+    cJSON *quotaJSON = cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_QUOTA_MB);
+    if (quotaJSON && quotaJSON->valuedouble >= 0) {
+        quota->quotaBytes = (long long) (quotaJSON->valuedouble * 1024 * 1024);
+    }
+
+    cJSON *maxAgeJSON = cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_MAX_AGE_HOURS);
+    if (maxAgeJSON && maxAgeJSON->valuedouble >= 0) {
+        quota->maxAgeSeconds = (long long) (maxAgeJSON->valuedouble * 3600);
+    }
+
+    cJSON *gcIntervalJSON = cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_GC_INTERVAL_S);
+    if (gcIntervalJSON && gcIntervalJSON->valueint > 0) {
+        quota->intervalSeconds = gcIntervalJSON->valueint;
+    }
+
+    cJSON *pinnedJSON = cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_PINNED_PATHS);
+    if (pinnedJSON && cJSON_Array == pinnedJSON->type) {
+        quota->pinned = malloc(sizeof(char *) * (cJSON_GetArraySize(pinnedJSON) + 1));
+        cJSON *pathJSON;
+        for (pathJSON = pinnedJSON->child; quota->pinned && pathJSON; pathJSON = pathJSON->next) {
+            if (pathJSON->valuestring) {
+                quota->pinned[quota->pinnedCount++] = strdup(pathJSON->valuestring);
+            }
+        }
+    }
+
+    cJSON *logLevelJSON = cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_LOG_LEVEL);
+    if (logLevelJSON && logLevelJSON->valuestring) {
+        int level = logger_level_of(logLevelJSON->valuestring);
+        if (0 <= level) {
+            ckCrowdnodeServerConfig->logLevel = level;
+        } else {
+            LOG_WARN("Unknown %s: %s", JSON_CONFIG_PARAM_LOG_LEVEL, logLevelJSON->valuestring);
+        }
+    }
+
+    cJSON *logFormatJSON = cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_LOG_FORMAT);
+    if (logFormatJSON && logFormatJSON->valuestring) {
+        if (strcmp(logFormatJSON->valuestring, "json") == 0) {
+            ckCrowdnodeServerConfig->logFormat = LOGGER_FORMAT_JSON;
+        } else if (strcmp(logFormatJSON->valuestring, "text") == 0) {
+            ckCrowdnodeServerConfig->logFormat = LOGGER_FORMAT_TEXT;
+        } else {
+            LOG_WARN("Unknown %s: %s", JSON_CONFIG_PARAM_LOG_FORMAT, logFormatJSON->valuestring);
+        }
+    }
+
+    cJSON *logRateJSON = cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_LOG_RATE_LIMIT);
+    if (logRateJSON && logRateJSON->valueint >= 0) {
+        ckCrowdnodeServerConfig->logRateLimit = logRateJSON->valueint;
+    }
+
+    cJSON *captureFileJSON = cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_CAPTURE_FILE);
+    if (captureFileJSON && captureFileJSON->valuestring && captureFileJSON->valuestring[0]) {
+        ckCrowdnodeServerConfig->captureFile = strdup(captureFileJSON->valuestring);
+    }
+    cJSON *captureBodiesJSON = cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_CAPTURE_BODIES);
+    if (captureBodiesJSON) {
+        ckCrowdnodeServerConfig->captureBodies = cJSON_True == captureBodiesJSON->type;
+    }
+}
+
 int loadConfigFromFile(CKCrowdnodeServerConfig *ckCrowdnodeServerConfig, char** envp) {
     char *filePath = getAbsolutePath(DEFAULT_CONFIG_FILE_PATH, envp);
 
     FILE *file=fopen(filePath, "rb");
     if (!file) {
-        printf("[WARN]: File not found at path: %s\n", filePath);
+        LOG_WARN("File not found at path: %s", filePath);
         return 0;
     }
 
@@ -333,13 +738,13 @@ int loadConfigFromFile(CKCrowdnodeServerConfig *ckCrowdnodeServerConfig, char**
 
     cJSON *configSON = cJSON_Parse(fileContent);
     if (!configSON) {
-        printf("[ERROR]: Invalid JSON format for configuration file %s\n", filePath);
+        LOG_ERROR("Invalid JSON format for configuration file %s", filePath);
         return 0;
     }
 
     cJSON *portJSON= cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_PORT);
     if (!portJSON) {
-        printf("[ERROR]: Invalid JSON format for provided message, attribute %s not found\n", JSON_CONFIG_PARAM_PORT);
+        LOG_ERROR("Invalid JSON format for provided message, attribute %s not found", JSON_CONFIG_PARAM_PORT);
         if (configSON != NULL) {
             cJSON_Delete(configSON);
         }
@@ -350,7 +755,7 @@ int loadConfigFromFile(CKCrowdnodeServerConfig *ckCrowdnodeServerConfig, char**
 
     cJSON *pathSON = cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_PATH_TO_FILES);
     if (!pathSON) {
-        printf("[ERROR]: Invalid JSON format for provided message, attribute %s not found\n", JSON_CONFIG_PARAM_PATH_TO_FILES);
+        LOG_ERROR("Invalid JSON format for provided message, attribute %s not found", JSON_CONFIG_PARAM_PATH_TO_FILES);
         if (configSON != NULL) {
             cJSON_Delete(configSON);
         }
@@ -362,7 +767,7 @@ int loadConfigFromFile(CKCrowdnodeServerConfig *ckCrowdnodeServerConfig, char**
     char * secretKey;
     cJSON *secretKeyJSON = cJSON_GetObjectItem(configSON, JSON_CONFIG_PARAM_SECRET_KEY);
     if (!secretKeyJSON) {
-        printf("[ERROR]: Invalid JSON format for provided message, attribute %s not found\n", JSON_CONFIG_PARAM_SECRET_KEY);
+        LOG_ERROR("Invalid JSON format for provided message, attribute %s not found", JSON_CONFIG_PARAM_SECRET_KEY);
         if (configSON != NULL) {
             cJSON_Delete(configSON);
         }
@@ -374,6 +779,7 @@ int loadConfigFromFile(CKCrowdnodeServerConfig *ckCrowdnodeServerConfig, char**
     ckCrowdnodeServerConfig->secretKey = malloc(size);
     memset(ckCrowdnodeServerConfig->secretKey, 0, size);
     strcpy(ckCrowdnodeServerConfig->secretKey, secretKey);
+    loadTuningConfig(ckCrowdnodeServerConfig, configSON);
     cJSON_Delete(configSON);
     return 1;
 }
@@ -429,7 +835,7 @@ void loadDefaultConfig(CKCrowdnodeServerConfig *ckCrowdnodeServerConfig, char**
         exit(1);
     }
 
-    printf("[DEBUG]: Open default configuration file to write %s\n", configFilePath);
+    LOG_DEBUG("Open default configuration file to write %s", configFilePath);
 
     cJSON *defaultConfigJSON = cJSON_CreateObject();
     if (!defaultConfigJSON) {
@@ -442,7 +848,7 @@ void loadDefaultConfig(CKCrowdnodeServerConfig *ckCrowdnodeServerConfig, char**
     cJSON_AddItemToObject(defaultConfigJSON, JSON_CONFIG_PARAM_PATH_TO_FILES, cJSON_CreateString(getAbsolutePath(DEFAULT_BASE_DIR, envp)));
     cJSON_AddItemToObject(defaultConfigJSON, JSON_CONFIG_PARAM_SECRET_KEY, cJSON_CreateString(defaultCrowdnodeServerConfig));
     char *file_content = cJSON_PrintUnformatted(defaultConfigJSON);
-    printf("[INFO]: Default configuration JSON created: %s\n", file_content);
+    LOG_INFO("Default configuration JSON created: %s", file_content);
 
     int results = fwrite(file_content, 1, strlen(file_content), file);
     if (results == EOF) {
@@ -478,7 +884,7 @@ char *getLocalIPv4Adress() {
     struct ifaddrs *ifaddr, *ifa;
     int family, s;
     if (getifaddrs(&ifaddr) == -1) {
-        perror("getifaddrs");
+        LOG_ERROR("getifaddrs() failed: %s", strerror(errno));
         exit(EXIT_FAILURE);
     }
     for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
@@ -489,11 +895,10 @@ char *getLocalIPv4Adress() {
 
         if((strcmp(ifa->ifa_name,"wlan0")==0)&&(ifa->ifa_addr->sa_family==AF_INET)) {
             if (s != 0) {
-                printf("getnameinfo() failed: %s\n", gai_strerror(s));
+                LOG_ERROR("getnameinfo() failed: %s", gai_strerror(s));
                 exit(EXIT_FAILURE);
             }
-            printf("\tInterface : <%s>\n",ifa->ifa_name );
-            printf("\t  Address : <%s>\n", ip);
+            LOG_DEBUG("Interface %s, address %s", ifa->ifa_name, ip);
         }
     }
     freeifaddrs(ifaddr);
@@ -501,35 +906,171 @@ char *getLocalIPv4Adress() {
     return ip;
 }
 
+static char *stdoutEncoding = NULL;
+static int stdoutEncodingDetected = 0;
+
+/**
+ * Detected once (setlocale is not thread safe), call from main before serving requests
+ */
 char * getStdoutEncoding() {
+    if (stdoutEncodingDetected) {
+        return stdoutEncoding;
+    }
     setlocale (LC_ALL, "");
     char *currentLocale = setlocale(LC_ALL, NULL);
     char *encoding;
     char *encodingWithDot = strstr(currentLocale, ".");
     if (encodingWithDot != NULL) {
         encoding = encodingWithDot + sizeof(char);
-        return strdup(encoding);
+        stdoutEncoding = strdup(encoding);
     }
-    return NULL;
+    stdoutEncodingDetected = 1;
+    return stdoutEncoding;
+}
+
+static ck_mutex_t uuidMutex;
+
+/* net_uuid keeps static state, serialize generation between worker threads */
+void generateUuid(char *uuid, size_t size) {
+    ck_mutex_lock(&uuidMutex);
+    get_uuid_string(uuid, size);
+    ck_mutex_unlock(&uuidMutex);
+}
+
+/**
+ * Blocking actions gate: at most blockingJobsLimit blocking actions run at once (0 means no limit),
+ * so that some worker threads always stay available for cheap actions.
+ */
+static ck_mutex_t blockingJobsMutex;
+static ck_cond_t blockingJobsCond;
+static int blockingJobsRunning = 0;
+static int blockingJobsLimit = 0;
+
+void enterBlockingJob() {
+    if (0 >= blockingJobsLimit) {
+        return;
+    }
+    ck_mutex_lock(&blockingJobsMutex);
+    while (blockingJobsRunning >= blockingJobsLimit) {
+        ck_cond_wait(&blockingJobsCond, &blockingJobsMutex);
+    }
+    blockingJobsRunning++;
+    ck_mutex_unlock(&blockingJobsMutex);
+}
+
+void leaveBlockingJob() {
+    if (0 >= blockingJobsLimit) {
+        return;
+    }
+    ck_mutex_lock(&blockingJobsMutex);
+    blockingJobsRunning--;
+    ck_cond_signal(&blockingJobsCond);
+    ck_mutex_unlock(&blockingJobsMutex);
+}
+
+void closeClientSocket(int sock) {
+#ifdef _WIN32
+    shutdown(sock, 2);
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+}
+
+/**
+ * Accepted connections waiting for a worker thread (thread server mode)
+ */
+static int connectionQueue[CONNECTION_QUEUE_SIZE];
+static int connectionQueueHead = 0;
+static int connectionQueueCount = 0;
+static ck_mutex_t connectionQueueMutex;
+static ck_cond_t connectionQueueNotEmpty;
+static ck_cond_t connectionQueueNotFull;
+
+void enqueueConnection(int sock) {
+    ck_mutex_lock(&connectionQueueMutex);
+    while (connectionQueueCount >= CONNECTION_QUEUE_SIZE) {
+        ck_cond_wait(&connectionQueueNotFull, &connectionQueueMutex);
+    }
+    connectionQueue[(connectionQueueHead + connectionQueueCount) % CONNECTION_QUEUE_SIZE] = sock;
+    connectionQueueCount++;
+    ck_cond_signal(&connectionQueueNotEmpty);
+    ck_mutex_unlock(&connectionQueueMutex);
+}
+
+int dequeueConnection() {
+    ck_mutex_lock(&connectionQueueMutex);
+    while (0 == connectionQueueCount) {
+        ck_cond_wait(&connectionQueueNotEmpty, &connectionQueueMutex);
+    }
+    int sock = connectionQueue[connectionQueueHead];
+    connectionQueueHead = (connectionQueueHead + 1) % CONNECTION_QUEUE_SIZE;
+    connectionQueueCount--;
+    ck_cond_signal(&connectionQueueNotFull);
+    ck_mutex_unlock(&connectionQueueMutex);
+    return sock;
+}
+
+void workerThread(void *arg) {
+    char *baseDir = arg;
+    while (1) {
+        int sock = dequeueConnection();
+        doProcessing(sock, baseDir);
+        closeClientSocket(sock);
+    }
+}
+
+void startWorkerThreads(CKCrowdnodeServerConfig *config, char *baseDir) {
+    int i;
+    ck_mutex_init(&connectionQueueMutex);
+    ck_cond_init(&connectionQueueNotEmpty);
+    ck_cond_init(&connectionQueueNotFull);
+
+    ck_mutex_init(&blockingJobsMutex);
+    ck_cond_init(&blockingJobsCond);
+    blockingJobsLimit = config->maxBlockingJobs;
+    if (0 >= blockingJobsLimit) {
+        blockingJobsLimit = config->workerThreads - config->workerThreads / 4;
+    }
+    if (blockingJobsLimit >= config->workerThreads) {
+        blockingJobsLimit = config->workerThreads - 1;
+    }
+    if (0 >= blockingJobsLimit) {
+        blockingJobsLimit = 1;
+    }
+
+    for (i = 0; i < config->workerThreads; i++) {
+        if (0 > ck_thread_start(workerThread, baseDir)) {
+            perror("[ERROR]: Could not start worker thread");
+            exit(1);
+        }
+    }
+    LOG_INFO("Started %i worker threads, at most %i blocking jobs at once", config->workerThreads, blockingJobsLimit);
 }
 
 int main( int argc, char *argv[] , char** envp) {
 
-    printf("[INFO]: CK-crowdnode-server starting ...\n");
-    printf("[INFO]: Server default encoding: %s\n", getStdoutEncoding());
-    printf("[INFO]: %s env value: %s\n", HOME_DIR_TEMPLATE, getEnvValue(HOME_DIR_ENV_KEY, envp));
-    printf("[INFO]: Configuration file absolute path: %s\n", getAbsolutePath(DEFAULT_CONFIG_FILE_PATH, envp));
+    LOG_INFO("CK-crowdnode-server starting ...");
+    arena_install_cjson_hooks();
+    allocprof_init();
+    LOG_INFO("Server default encoding: %s", getStdoutEncoding());
+    LOG_INFO("%s env value: %s", HOME_DIR_TEMPLATE, getEnvValue(HOME_DIR_ENV_KEY, envp));
+    LOG_INFO("Configuration file absolute path: %s", getAbsolutePath(DEFAULT_CONFIG_FILE_PATH, envp));
     ckCrowdnodeServerConfig = malloc(sizeof(CKCrowdnodeServerConfig));
     if (!ckCrowdnodeServerConfig) {
         perror("[ERROR]: Memory not allocated for ckCrowdnodeServerConfig\n");
         exit(1);
     }
+    loadDefaultTuningConfig(ckCrowdnodeServerConfig);
+    ck_mutex_init(&uuidMutex);
+    registerActions();
+    delta_init();
 
     if (!loadConfigFromFile(ckCrowdnodeServerConfig, envp)) {
         loadDefaultConfig(ckCrowdnodeServerConfig, envp);
-        printf("[WARN]: CK-crowdnode-server configuration file problem. Server will be started with default configuration\n");
+        LOG_WARN("CK-crowdnode-server configuration file problem. Server will be started with default configuration");
     } else {
-        printf("[INFO]: CK-crowdnode-server configuration file loaded successfully with configuration\n");
+        LOG_INFO("CK-crowdnode-server configuration file loaded successfully with configuration");
     }
 
     printf("\n");
@@ -551,12 +1092,38 @@ int main( int argc, char *argv[] , char** envp) {
         exit(1);
     }
     strcpy(baseDir, ckCrowdnodeServerConfig->pathToFiles);
-	unsigned long win_thread_id;
 
-#ifdef _WIN32
-	struct thread_win_params twp;
-	struct thread_win_params* ptwp=&twp;
-#endif
+    int serverMode = ckCrowdnodeServerConfig->serverMode;
+    logger_config(ckCrowdnodeServerConfig->logLevel, ckCrowdnodeServerConfig->logFormat,
+                  ckCrowdnodeServerConfig->logRateLimit);
+    logger_init(SERVER_MODE_THREAD != serverMode);
+    if (ckCrowdnodeServerConfig->captureFile) {
+        char *capturePath = getAbsolutePath(ckCrowdnodeServerConfig->captureFile, envp);
+        if (0 != capture_init(capturePath, ckCrowdnodeServerConfig->captureBodies,
+                              ckCrowdnodeServerConfig->secretKey)) {
+            perror("Could not open capture_file");
+            exit(1);
+        }
+        LOG_INFO("Capturing the requests%s to %s", ckCrowdnodeServerConfig->captureBodies ? " with their bodies" : "",
+                 capturePath);
+    }
+    if (0 != dircache_init(baseDir, DIR_CACHE_SIZE)) {
+        perror("Could not open path_to_files");
+        exit(1);
+    }
+    fileindex_init(baseDir, SERVER_MODE_THREAD == serverMode);
+    workspace_init(baseDir, SERVER_MODE_THREAD == serverMode);
+    quota_init(baseDir, &ckCrowdnodeServerConfig->quota, SERVER_MODE_THREAD == serverMode);
+    initMetrics(SERVER_MODE_THREAD != serverMode);
+    nodeprofile_init(SERVER_MODE_THREAD != serverMode);
+    durability_init(ckCrowdnodeServerConfig->durability, ckCrowdnodeServerConfig->batchCommitMs, baseDir,
+                    SERVER_MODE_THREAD == serverMode);
+    filestore_init(ckCrowdnodeServerConfig->directIo);
+    // a forked child exits after its request, caching pulled files there would not help
+    pullcache_init(SERVER_MODE_THREAD == serverMode ? (size_t) ckCrowdnodeServerConfig->pullCacheMb * 1024 * 1024 : 0);
+    if (SERVER_MODE_THREAD == serverMode) {
+        startWorkerThreads(ckCrowdnodeServerConfig, baseDir);
+    }
 
 	struct sockaddr_in serv_addr, cli_addr;
 
@@ -607,6 +1174,10 @@ int main( int argc, char *argv[] , char** envp) {
 		exit(1);
 	}
 
+	// a restarted node must not wait for the connections of the previous one to leave TIME_WAIT
+	int reuseAddress = 1;
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuseAddress, sizeof(reuseAddress));
+
 	memset((char *) &serv_addr, 0, sizeof(serv_addr));
 
 	serv_addr.sin_family = AF_INET;
@@ -617,7 +1188,7 @@ int main( int argc, char *argv[] , char** envp) {
 		perror("ERROR on binding");
 		exit(1);
 	}
-	printf("[INFO]: Server started at port  %i\n", portno);
+	LOG_INFO("Server started at port  %i", portno);
 
 	listen(sockfd,5);
 	clilen = sizeof(cli_addr);
@@ -630,44 +1201,43 @@ int main( int argc, char *argv[] , char** envp) {
 	while (1) {
 
 		/**
-         * Create child process
+         * Hand the connection to a worker thread or create child process
          */
 #ifdef _WIN32
         /* Set the size of the in-out parameter */
         clntLen = sizeof(echoClntAddr);
 
         /* Wait for a client to connect */
-        printf("[INFO] CK-crowdnode-server listen commands on port %i\n", portno);
+        LOG_INFO("CK-crowdnode-server listen commands on port %i", portno);
         if ((clntSock = accept(servSock, (struct sockaddr *) &echoClntAddr, &clntLen)) < 0) {
-            dieWithError("accept() failed");
+            // the connection failed before it was accepted, the server goes on with the next one
+            LOG_ERROR("accept() failed: %i", WSAGetLastError());
+            continue;
         }
 
-        ptwp->sock=servSock;
-		ptwp->newsock=clntSock;
-        ptwp->baseDir=baseDir;
-
-		if (!CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)doProcessingWin,
-						  (struct thread_win_params*) ptwp, 0, &win_thread_id))
-		{
-			perror("ERROR on fork");
-			exit(1);
-		}
-
-/*		closesocket(sockfd); */
+        enqueueConnection(clntSock);
 #else
 
         newsockfd = accept(sockfd, (struct sockaddr *) &cli_addr, &clilen);
 
 		if (newsockfd < 0) {
 			perror("ERROR on accept");
-            printf("WSAGetLastError() %i\n", WSAGetLastError()); //win
-			exit(1);
+            // a connection reset before it was accepted or out of descriptors, not a reason to stop serving
+            if (EMFILE == errno || ENFILE == errno || ENOBUFS == errno || ENOMEM == errno) {
+                sleep(1);
+            }
+			continue;
 		}
+        if (SERVER_MODE_THREAD == serverMode) {
+            enqueueConnection(newsockfd);
+            continue;
+        }
 		pid_t pid = fork();
 
         if (pid < 0) {
             perror("ERROR on fork");
-            exit(1);
+            close(newsockfd);
+            continue;
         }
 
         if (pid == 0) {
@@ -676,261 +1246,633 @@ int main( int argc, char *argv[] , char** envp) {
             exit(0);
         } else {
             close(newsockfd);
+            // reap the request processes finished meanwhile, their CPU time goes to the server's then
+            while (waitpid(-1, NULL, WNOHANG) > 0) {
+            }
         }
 #endif
 	}
 }
 
-#ifdef _WIN32
-void doProcessingWin (struct thread_win_params* ptwp)
-{
-	int sockfd=ptwp->sock;
-	int newsockfd=ptwp->newsock;
-	char *baseDir = ptwp->baseDir;
-
-	// Child process - talk with connected client
-	doProcessing (newsockfd, baseDir);
-
-	if (shutdown (newsockfd, 2)!=0)
-	{
-		perror("Error on fork");
-		exit(1);
-	}
+static void writeOkResponse(JsonWriter *w, void *ctx) {
+    jw_begin_object(w);
+    jw_string_field(w, "return", "0");
+    jw_end_object(w);
+}
 
-	closesocket(newsockfd);
+void sendOkResponse(int sock) {
+    if (sendResponse(sock, writeOkResponse, NULL) < 0) {
+        LOG_ERROR("Could not send the response: %s", strerror(errno));
+    }
+}
 
-	return;
+static void writePushResponse(JsonWriter *w, void *ctx) {
+    jw_begin_object(w);
+    jw_string_field(w, "return", "0");
+    jw_string_field(w, JSON_PARAM_FILE_HASH, ctx);
+    jw_end_object(w);
 }
-#endif
 
 /**
- * Tries to detect message length by the given buffer, which contains the beginning of the message.
- * The buffer passed must be of at least (size+1) length.
- * 
- * Returns -1, if the length is still unknown (in this case the caller must provide a bigger part of the message).
- * 
- * Returns -2, if the length can never be determined, i.e. HTTP headers don't contain 'Content-Length'.
+ * Path of the file named by the request: filename under baseDir and the optional extra_path
  *
- * If 0 or more is returned, it is the total size of the message (size of the headers + size of the body).
+ * The directory part is extra_path only, resolved by the directory cache: a filename with separators could
+ * walk through a symbolic link leading outside of baseDir.
+ *
+ * @param createDirectory create extra_path directories if they do not exist
+ * @return the path, NULL if filename or extra_path lead outside of baseDir or out of memory (error response
+ *         already sent)
  */
-int detectMessageLength(char* buf, int size) {
-    buf[size] = 0;
-    
-    // trying to find where headers end
-    char* s = strstr(buf, "\r\n\r\n");
-    int header_stop_len = 4;
-    if (NULL == s) {
-        s = strstr(buf, "\n\n");
-        header_stop_len = 2;
-    }
-    if (NULL == s) {
-        return -1;
+char *getRequestFilePath(int sock, char *baseDir, cJSON *commandJSON, int createDirectory) {
+    cJSON *filenameJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_FILE_NAME);
+    char *fileName = filenameJSON->valuestring;
+    LOG_DEBUG("File name: %s", fileName);
+    if (!path_valid_name(fileName)) {
+        sendErrorMessage(sock, "Invalid filename", ERROR_CODE);
+        return NULL;
     }
-    const long header_len = (s - buf) + header_stop_len;
 
-    const char* content_len_key = "Content-Length:";
-    // trying to find Content-Length
-    char* content_len_header = strstr(buf, content_len_key);
-    if (NULL == content_len_header || (content_len_header - buf) >= header_len) {
-        return -2;
-    }
+    char *finalBaseDir = concat(baseDir, FILE_SEPARATOR);
+
+    //  Optional param extra_path
+    cJSON *extraPathJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_EXTRA_PATH);
+    if (extraPathJSON && extraPathJSON->valuestring) {
+        char *extraPath = extraPathJSON->valuestring;
+        LOG_DEBUG("Extra path provided: %s", extraPath);
+        if (!path_valid(extraPath)) {
+            sendErrorMessage(sock, "Invalid extra_path", ERROR_CODE);
+            return NULL;
+        }
 
-    long l = strtol(content_len_header + strlen(content_len_key), NULL, 10);
-    return header_len + l;
+        finalBaseDir = concat(finalBaseDir, extraPath);
+        finalBaseDir = concat(finalBaseDir, FILE_SEPARATOR);
+        if (createDirectory) {
+            // mkdir of the components only when the directory is not cached yet
+            DirHandle *dir = dircache_get(extraPath, 1);
+            if (!dir) {
+                char *message = concat("Could not create directory: ", finalBaseDir);
+                LOG_ERROR("%s", message);
+                sendErrorMessage(sock, message, ERROR_CODE);
+                return NULL;
+            }
+            dircache_release(dir);
+        }
+    }
+    char *filePath = concat(finalBaseDir, fileName);
+    if (!filePath) {
+        sendErrorMessage(sock, "Memory not allocated for the file path", ERROR_CODE);
+    }
+    return filePath;
 }
 
-void sendJson(int sock, cJSON* json) {
-    char* txt = cJSON_PrintUnformatted(json);
-    if (NULL == txt) {
-        perror("Failed to convert JSON to string");
-        exit(1);
+/**
+ * Binary parameter of the request: byte string bytesName in CBOR requests, base64 text base64Name otherwise
+ *
+ * @param size receives the decoded size
+ * @param decoded receives the malloc'ed buffer to free when the content was decoded from base64
+ * @return the content, NULL if the parameter is missing or invalid (error response already sent)
+ */
+const unsigned char *getBinaryParam(int sock, cJSON *commandJSON, const char *bytesName, const char *base64Name,
+                                    int *size, unsigned char **decoded) {
+    *decoded = NULL;
+    *size = 0;
+    cJSON *bytesJSON = cJSON_GetObjectItem(commandJSON, bytesName);
+    if (bytesJSON && (bytesJSON->type & CBOR_BYTE_STRING)) {
+        // binary (CBOR) request carries the content as is
+        *size = bytesJSON->valueint;
+        LOG_DEBUG("%s length: %i", bytesName, *size);
+        return (unsigned char *) bytesJSON->valuestring;
+    }
+
+    cJSON *base64JSON = cJSON_GetObjectItem(commandJSON, base64Name);
+    if (!base64JSON || !base64JSON->valuestring) {
+        char *message = concat("Invalid action JSON format for message: no ", base64Name);
+        message = concat(message, " found");
+        LOG_ERROR("%s", message);
+        sendErrorMessage(sock, message, ERROR_CODE);
+        return NULL;
+    }
+    char *content_base64 = base64JSON->valuestring;
+    LOG_DEBUG("%s length: %lu", base64Name, (unsigned long) strlen(content_base64));
+
+    int targetSize = ((unsigned long) strlen(content_base64) + 1) * 4 / 3;
+    *decoded = malloc(targetSize);
+    if (!*decoded) {
+        perror("[ERROR]: Memory not allocated for decoded content");
+        sendErrorMessage(sock, "Memory not allocated for decoded content", ERROR_CODE);
+        return NULL;
     }
-    int n1 = sendHttpResponse(sock, 200, txt, strlen(txt));
-    free(txt);
-    if (n1 < 0) {
-        perror("ERROR sending JSON to socket");
+
+    if (strlen(content_base64) != 0) {
+        long long started = metrics_now();
+        *size = base64_decode(content_base64, *decoded, targetSize);
+        metrics_phase("base64_decode", started);
+        if (*size == 0) {
+            sendErrorMessage(sock, "Failed to Base64 decode file", ERROR_CODE);
+            free(*decoded);
+            *decoded = NULL;
+            return NULL;
+        }
+        (*decoded)[*size] = '\0';
+        metrics_add(METRIC_BASE64_DECODED, *size);
+        LOG_DEBUG("Bytes decoded: %i", *size);
+    } else {
+        LOG_WARN("file content is empty nothing to decode");
     }
+    return *decoded;
 }
 
 void processPush(int sock, char* baseDir, cJSON* commandJSON) {
     //  push file (to send file to CK Node )
-    cJSON *filenameJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_FILE_NAME);
-    if (!filenameJSON) {
-        printf("[ERROR]: Invalid action JSON format for provided message\n");
-        sendErrorMessage(sock, "Invalid action JSON format for message: no filenameJSON found", ERROR_CODE);
+    char *filePath = getRequestFilePath(sock, baseDir, commandJSON, 1);
+    if (!filePath) {
         return;
     }
-    char *fileName = filenameJSON->valuestring;
-    printf("[DEBUG]: File name: %s\n", fileName);
+    char fileHash[FILESTORE_HASH_SIZE];
 
-    char *finalBaseDir = concat(baseDir, FILE_SEPARATOR);
+    unsigned char *file_content = NULL;
+    const unsigned char *content = NULL;
+    int bytesDecoded = 0;
 
-    //  Optional param extra_path
-    cJSON *extraPathJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_EXTRA_PATH);
-    char *extraPath = "";
-    if (extraPathJSON) {
-        extraPath = extraPathJSON->valuestring;
-        printf("[INFO]: Extra path provided: %s\n", extraPath);
+    cJSON *fileHashJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_FILE_HASH);
+    if (fileHashJSON && fileHashJSON->valuestring && !cJSON_GetObjectItem(commandJSON, JSON_PARAM_FILE_CONTENT)
+            && !cJSON_GetObjectItem(commandJSON, JSON_PARAM_FILE_CONTENT_BYTES)) {
+        // content already on the node, only copy it to the new location
+        if (!filestore_has_blob(baseDir, fileHashJSON->valuestring)) {
+            char *message = concat("File content not found for hash: ", fileHashJSON->valuestring);
+            LOG_ERROR("%s", message);
+            sendErrorMessage(sock, message, ERROR_CODE);
+            return;
+        }
+        strcpy(fileHash, fileHashJSON->valuestring);
+    } else {
+        content = getBinaryParam(sock, commandJSON, JSON_PARAM_FILE_CONTENT_BYTES, JSON_PARAM_FILE_CONTENT,
+                                 &bytesDecoded, &file_content);
+        if (!content) {
+            return;
+        }
+    }
 
-        finalBaseDir = concat(finalBaseDir, extraPath);
-        finalBaseDir = concat(finalBaseDir, FILE_SEPARATOR);
-        createCKFilesDirectoryIfDoesnotExist(finalBaseDir);
+    long long writeStarted = metrics_now();
+    if (content) {
+        LOG_DEBUG("Bytes to write %i", bytesDecoded);
+        int stored = filestore_put(baseDir, content, bytesDecoded, fileHash);
+        free(file_content);
+        if (0 != stored) {
+            char *message = concat("Could not write file content to store at: ", baseDir);
+            LOG_ERROR("%s", message);
+            sendErrorMessage(sock, message, ERROR_CODE);
+            return;
+        }
     }
 
-    cJSON *fileContentJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_FILE_CONTENT);
-    if (!fileContentJSON) {
-        printf("[ERROR]: Invalid action JSON format for message: \n");
-        sendErrorMessage(sock, "Invalid action JSON format for message: no fileContentJSON found", ERROR_CODE);
+    if (0 != filestore_place(baseDir, fileHash, filePath, -1)) {
+        char *message = concat("Could not write file at path: ", filePath);
+        LOG_ERROR("%s", message);
+        sendErrorMessage(sock, message, ERROR_CODE);
         return;
     }
-    char *file_content_base64 = fileContentJSON->valuestring;
-    printf("[DEBUG]: File content base64 length: %lu\n", (unsigned long) strlen(file_content_base64));
+    pullcache_invalidate(filePath);
+    fileindex_file_written(filePath, fileHash);
+    metrics_phase("write", writeStarted);
+    LOG_INFO("File saved to: %s (content %s)", filePath, fileHash);
 
-    int targetSize = ((unsigned long) strlen(file_content_base64) + 1) * 4 / 3;
-    unsigned char *file_content = malloc(targetSize);
+    /**
+     * return successful response message, example:
+     *   {"return":0, "file_hash": <hash of the content>}
+     */
+    if (sendResponse(sock, writePushResponse, fileHash) < 0) {
+        LOG_ERROR("Could not send the response: %s", strerror(errno));
+    }
+}
 
-    int bytesDecoded = 0;
-    if (strlen(file_content_base64) != 0) {
-        bytesDecoded = base64_decode(file_content_base64, file_content, targetSize);
-        if (bytesDecoded == 0) {
-            sendErrorMessage(sock, "Failed to Base64 decode file", ERROR_CODE);
-        }
-        file_content[bytesDecoded] = '\0';
-        printf("[INFO]: Bytes decoded: %i\n", bytesDecoded);
+typedef struct {
+    const char *fileName;
+    const unsigned char *content;
+    long long size;
+    const char *encoded;    /* base64 of content if already known */
+} PullResponse;
+
+static void writePullResponse(JsonWriter *w, void *ctx) {
+    PullResponse *r = ctx;
+    jw_begin_object(w);
+    jw_string_field(w, "return", "0");
+    jw_string_field(w, JSON_PARAM_FILE_NAME, r->fileName);
+    if (r->encoded) {
+        jw_base64_encoded_field(w, JSON_PARAM_FILE_CONTENT, r->content, r->size, r->encoded);
     } else {
-        printf("[WARNING]: file content is empty nothing to decode\n");
+        jw_base64_field(w, JSON_PARAM_FILE_CONTENT, r->content, r->size);
     }
+    jw_end_object(w);
+}
 
-    char *filePath = concat(finalBaseDir,fileName);
+void processPull(int sock, char* baseDir, cJSON* commandJSON) {
+    //  pull file (to receive file from CK node)
+    char *fileName = cJSON_GetObjectItem(commandJSON, JSON_PARAM_FILE_NAME)->valuestring;
+    char *filePath = getRequestFilePath(sock, baseDir, commandJSON, 0);
+    if (!filePath) {
+        return;
+    }
 
-    FILE *file = fopen(filePath, "wb");
-    if (!file) {
-        char *message = concat("Could not write file at path: ", filePath);
-        printf("[ERROR]: %s\n", message);
+    // opened relative to the cached directory handle, no walk of the whole path
+    long long readStarted = metrics_now();
+    cJSON *extraPathJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_EXTRA_PATH);
+    DirHandle *dir = dircache_get(extraPathJSON ? extraPathJSON->valuestring : NULL, 0);
+    int fd = dir ? dircache_open(dir, fileName) : -1;
+    if (dir) {
+        dircache_release(dir);
+    }
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        char *message = concat("File not found at path:", filePath);
+        LOG_ERROR("%s", message);
         sendErrorMessage(sock, message, ERROR_CODE);
-        free(file_content);
         return;
     }
 
-    printf("[DEBUG]: Open file to write %s\n", filePath);
-    printf("[DEBUG]: Bytes to write %i\n", bytesDecoded);
-    int results = fwrite(file_content, 1, bytesDecoded, file);
-    if (results == EOF) {
-        sendErrorMessage(sock, "Failed to write file ", ERROR_CODE);
+    quota_file_used(filePath, &st);
+
+    PullResponse r = { fileName, NULL, 0, NULL };
+    unsigned char *fileContent = NULL;
+    PullCacheEntry *cached = pullcache_get(filePath, &st);
+    if (cached) {
+        // hot file: no disk read, and the base64 encoding is kept after the first hit
+        LOG_DEBUG("File taken from cache: %s", filePath);
+        close(fd);
+        r.content = cached->data;
+        r.size = cached->size;
+        if (RESPONSE_FORMAT_JSON == responseFormat) {
+            r.encoded = pullcache_encoded(cached);
+        }
+    } else {
+        LOG_DEBUG("Reading file: %s", filePath);
+        FILE *file = fdopen(fd, "rb");
+        if (!file) {
+            close(fd);
+            char *message = concat("File not found at path:", filePath);
+            LOG_ERROR("%s", message);
+            sendErrorMessage(sock, message, ERROR_CODE);
+            return;
+        }
+
+        fseek(file, 0, SEEK_END);
+        long fsize = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        fileContent = malloc(fsize + 1);
+        if (!fileContent) {
+            perror("[ERROR]: Memory not allocated for fileContent");
+            fclose(file);
+            sendErrorMessage(sock, "Memory not allocated for file content", ERROR_CODE);
+            return;
+        }
+        fread(fileContent, fsize, 1, file);
+        fclose(file);
+        r.content = fileContent;
+        r.size = fsize;
+
+        // cache only what matches the stat the entry is keyed by
+        if (fsize == (long) st.st_size && (cached = pullcache_put(filePath, &st, fileContent)) != NULL) {
+            fileContent = NULL;
+        }
     }
-    fclose(file);
-    free(file_content);
-    printf("[INFO]: File saved to: %s\n", filePath);
+
+    metrics_phase("read", readStarted);
+    LOG_DEBUG("File size: %lld", r.size);
 
     /**
      * return successful response message, example:
-     *   {"return":0, "compileUUID": <generated UID>}
+     *   {"return":0, "filename": <file name from requies>, "file_content_base64":<base 64 encoded requested file content>}
      */
-    cJSON *resultJSON = cJSON_CreateObject();
-    if (!resultJSON) {
-        perror("[ERROR]: Memory not allocated for resultJSON");
-        exit(1);
+    if (sendResponse(sock, writePullResponse, &r) < 0) {
+        LOG_ERROR("Could not send the response: %s", strerror(errno));
+    }
+    free(fileContent);
+    if (cached) {
+        pullcache_release(cached);
     }
-    printf("[INFO]: resultJSON created\n");
-    cJSON_AddItemToObject(resultJSON, "return", cJSON_CreateString("0"));
-    sendJson(sock, resultJSON);
-    cJSON_Delete(resultJSON);
 }
 
-void processPull(int sock, char* baseDir, cJSON* commandJSON) {
-    //  pull file (to receive file from CK node)
-    cJSON *filenameJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_FILE_NAME);
-    if (!filenameJSON) {
-        printf("[ERROR]: Invalid action JSON format for provided message\n");
-        sendErrorMessage(sock, "Invalid action JSON format for message: no filenameJSON found", ERROR_CODE);
+/**
+ * @return block size requested for delta transfer, the default one if not given, 0 if out of range
+ */
+size_t getBlockSize(cJSON *commandJSON) {
+    cJSON *blockSizeJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_BLOCK_SIZE);
+    if (!blockSizeJSON) {
+        return DELTA_DEFAULT_BLOCK_SIZE;
+    }
+    if (blockSizeJSON->valueint < DELTA_MIN_BLOCK_SIZE || blockSizeJSON->valueint > DELTA_MAX_BLOCK_SIZE) {
+        return 0;
+    }
+    return blockSizeJSON->valueint;
+}
+
+static void writeSignatureResponse(JsonWriter *w, void *ctx) {
+    DeltaSignature *signature = ctx;
+    jw_begin_object(w);
+    jw_string_field(w, "return", "0");
+    jw_int_field(w, JSON_PARAM_BLOCK_SIZE, (long long) signature->blockSize);
+    jw_int_field(w, "file_size", signature->fileSize);
+    jw_base64_field(w, "checksums_base64", signature->checksums, (size_t) signature->count * DELTA_CHECKSUM_SIZE);
+    jw_end_object(w);
+}
+
+void processSignature(int sock, char* baseDir, cJSON* commandJSON) {
+    //  signature (block checksums of the file at CK node, to send only the changes with patch)
+    char *filePath = getRequestFilePath(sock, baseDir, commandJSON, 0);
+    if (!filePath) {
+        return;
+    }
+    size_t blockSize = getBlockSize(commandJSON);
+    if (0 == blockSize) {
+        sendErrorMessage(sock, "Invalid block_size", ERROR_CODE);
         return;
     }
 
-    char *fileName = filenameJSON->valuestring;
-    printf("[DEBUG]: File name: %s\n", fileName);
+    DeltaSignature signature;
+    if (0 != delta_signature(filePath, blockSize, &signature)) {
+        // no file yet, the whole content is sent as literal
+        LOG_DEBUG("No signature for %s", filePath);
+        signature.fileSize = 0;
+        signature.count = 0;
+    }
+    LOG_DEBUG("Signature of %s: %i blocks", filePath, signature.count);
+    if (sendResponse(sock, writeSignatureResponse, &signature) < 0) {
+        LOG_ERROR("Could not send the response: %s", strerror(errno));
+    }
+}
 
-    char *finalBaseDir = concat(baseDir,FILE_SEPARATOR);
+static int writeDeltaOutput(void *ctx, const void *data, size_t size) {
+    return filestore_write(ctx, data, size);
+}
 
-    //  Optional param extra_path
-    cJSON *extraPathJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_EXTRA_PATH);
-    char *extraPath = "";
-    if (extraPathJSON) {
-        extraPath = extraPathJSON->valuestring;
-        printf("[INFO]: Extra path provided: %s\n", extraPath);
+void processPatch(int sock, char* baseDir, cJSON* commandJSON) {
+    //  patch (rebuild the file at CK node from its current content and the delta sent by client)
+    char *filePath = getRequestFilePath(sock, baseDir, commandJSON, 1);
+    if (!filePath) {
+        return;
+    }
+    size_t blockSize = getBlockSize(commandJSON);
+    if (0 == blockSize) {
+        sendErrorMessage(sock, "Invalid block_size", ERROR_CODE);
+        return;
+    }
 
-        finalBaseDir = concat(finalBaseDir, extraPath);
-        finalBaseDir = concat(finalBaseDir, FILE_SEPARATOR);
+    int deltaSize = 0;
+    unsigned char *decoded = NULL;
+    const unsigned char *delta = getBinaryParam(sock, commandJSON, JSON_PARAM_DELTA_BYTES, JSON_PARAM_DELTA,
+                                                &deltaSize, &decoded);
+    if (!delta) {
+        return;
     }
 
-    char *filePath = concat(finalBaseDir, fileName);
-    printf("[DEBUG]: Reading file: %s\n", filePath);
-    FILE *file = fopen(filePath, "rb");
-    if (!file) {
-        char *message = concat("File not found at path:", filePath);
-        printf("[ERROR]: %s", message);
-        sendErrorMessage(sock, message, ERROR_CODE);
+    // the new content goes to the store first, the file is replaced only when complete
+    FileStoreWriter writer;
+    const char *error = "Could not write file content to store";
+    char fileHash[FILESTORE_HASH_SIZE];
+    long long writeStarted = metrics_now();
+    int result = filestore_begin(baseDir, &writer, -1);
+    if (0 == result) {
+        result = delta_apply(filePath, blockSize, delta, deltaSize, writeDeltaOutput, &writer, &error);
+    }
+    free(decoded);
+    if (0 != result) {
+        filestore_abort(&writer);
+    } else if (0 != filestore_commit(&writer, fileHash)) {
+        result = -1;
+    } else if (0 != filestore_place(baseDir, fileHash, filePath, -1)) {
+        error = concat("Could not write file at path: ", filePath);
+        result = -1;
+    }
+    if (0 != result) {
+        LOG_ERROR("%s", error);
+        sendErrorMessage(sock, (char *) error, ERROR_CODE);
         return;
     }
+    pullcache_invalidate(filePath);
+    fileindex_file_written(filePath, fileHash);
+    metrics_phase("write", writeStarted);
+    LOG_INFO("File patched: %s (content %s)", filePath, fileHash);
 
-    fseek(file, 0, SEEK_END);
-    long fsize = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    if (sendResponse(sock, writePushResponse, fileHash) < 0) {
+        LOG_ERROR("Could not send the response: %s", strerror(errno));
+    }
+}
 
-    unsigned char *fileContent = malloc(fsize + 1);
-    memset(fileContent, 0, fsize + 1);
-    fread(fileContent, fsize, 1, file);
-    fclose(file);
+typedef struct {
+    int files;
+    const char *fileHash;   /* of the created archive, NULL for extract */
+} ArchiveResponse;
+
+static void writeArchiveResponse(JsonWriter *w, void *ctx) {
+    ArchiveResponse *r = ctx;
+    jw_begin_object(w);
+    jw_string_field(w, "return", "0");
+    jw_int_field(w, "files", r->files);
+    if (r->fileHash) {
+        jw_string_field(w, JSON_PARAM_FILE_HASH, r->fileHash);
+    }
+    jw_end_object(w);
+}
+
+/**
+ * Directory parameter of the request relative to baseDir, extra_path if not given
+ *
+ * @return the directory, "" for baseDir, NULL if it leads outside of baseDir (error response already sent)
+ */
+static const char *getRequestDirectory(int sock, cJSON *commandJSON, const char *name) {
+    cJSON *directoryJSON = cJSON_GetObjectItem(commandJSON, name);
+    if (!directoryJSON || !directoryJSON->valuestring) {
+        directoryJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_EXTRA_PATH);
+    }
+    const char *directory = directoryJSON && directoryJSON->valuestring ? directoryJSON->valuestring : "";
+    if (*directory && !path_valid(directory)) {
+        sendErrorMessage(sock, concat("Invalid ", name), ERROR_CODE);
+        return NULL;
+    }
+    return directory;
+}
 
-    fileContent[fsize] = 0;
-    printf("[DEBUG]: File size: %lu\n", fsize);
+void processExtract(int sock, char* baseDir, cJSON* commandJSON) {
+    //  extract (unpack an archive pushed before, no unzip through shell needed)
+    char *filePath = getRequestFilePath(sock, baseDir, commandJSON, 0);
+    if (!filePath) {
+        return;
+    }
+    const char *targetDir = getRequestDirectory(sock, commandJSON, JSON_PARAM_TARGET_PATH);
+    if (!targetDir) {
+        return;
+    }
 
-    unsigned long targetSize = (unsigned long) ((fsize) * 4 / 3 + 5);
-    printf("[DEBUG]: Target encoded size: %lu\n", targetSize);
-    char *encodedContent = malloc(targetSize);
-    if (!encodedContent) {
-        perror("[ERROR]: Memory not allocated for encodedContent");
-        exit(1);
+    const char *error = NULL;
+    long long started = metrics_now();
+    ArchiveResponse r = { archive_extract(baseDir, filePath, targetDir, &error), NULL };
+    metrics_phase("extract", started);
+    if (r.files < 0) {
+        char *message = concat((char *) error, ": ");
+        message = concat(message, filePath);
+        LOG_ERROR("%s", message);
+        sendErrorMessage(sock, message, ERROR_CODE);
+        return;
     }
+    LOG_INFO("Extracted %i files from %s", r.files, filePath);
 
-    if (fsize > 0) {
-        base64_encode(fileContent, fsize, encodedContent, targetSize);
+    if (sendResponse(sock, writeArchiveResponse, &r) < 0) {
+        LOG_ERROR("Could not send the response: %s", strerror(errno));
     }
+}
 
-    /**
-     * return successful response message, example:
-     *   {"return":0, "filename": <file name from requies>, "file_content_base64":<base 64 encoded requested file content>}
-     */
-    cJSON *resultJSON = cJSON_CreateObject();
-    if (!resultJSON) {
-        perror("[ERROR]: Memory not allocated for resultJSON");
-        exit(1);
+void processArchive(int sock, char* baseDir, cJSON* commandJSON) {
+    //  archive (pack a directory into an archive file to be pulled)
+    int format = archive_format(cJSON_GetObjectItem(commandJSON, JSON_PARAM_FILE_NAME)->valuestring);
+    if (format < 0) {
+        sendErrorMessage(sock, "Unsupported archive format, use .zip, .tar, .tar.gz or .tgz", ERROR_CODE);
+        return;
+    }
+    const char *sourceDir = getRequestDirectory(sock, commandJSON, JSON_PARAM_SOURCE_PATH);
+    if (!sourceDir) {
+        return;
+    }
+    char *filePath = getRequestFilePath(sock, baseDir, commandJSON, 1);
+    if (!filePath) {
+        return;
+    }
+
+    // the archive goes to the store first, an archive replaced inside the source directory is not packed
+    FileStoreWriter writer;
+    const char *error = "Could not write file content to store";
+    char fileHash[FILESTORE_HASH_SIZE];
+    ArchiveResponse r = { -1, fileHash };
+    long long started = metrics_now();
+    if (0 == filestore_begin(baseDir, &writer, -1)) {
+        r.files = archive_create(baseDir, sourceDir, format, filePath, &writer, &error);
+        if (r.files < 0) {
+            filestore_abort(&writer);
+        } else if (0 != filestore_commit(&writer, fileHash)) {
+            error = "Could not write file content to store";
+            r.files = -1;
+        } else if (0 != filestore_place(baseDir, fileHash, filePath, -1)) {
+            error = concat("Could not write file at path: ", filePath);
+            r.files = -1;
+        }
+    } else {
+        filestore_abort(&writer);
+    }
+    metrics_phase("archive", started);
+    if (r.files < 0) {
+        LOG_ERROR("%s", error);
+        sendErrorMessage(sock, (char *) error, ERROR_CODE);
+        return;
+    }
+    pullcache_invalidate(filePath);
+    fileindex_file_written(filePath, fileHash);
+    LOG_INFO("Archived %i files to %s (content %s)", r.files, filePath, fileHash);
+
+    if (sendResponse(sock, writeArchiveResponse, &r) < 0) {
+        LOG_ERROR("Could not send the response: %s", strerror(errno));
     }
-    cJSON_AddItemToObject(resultJSON, "return", cJSON_CreateString("0"));
-    cJSON_AddItemToObject(resultJSON, JSON_PARAM_FILE_NAME, cJSON_CreateString(fileName));
-    cJSON_AddItemToObject(resultJSON, JSON_PARAM_FILE_CONTENT, cJSON_CreateString(encodedContent));
-    sendJson(sock, resultJSON);
-    cJSON_Delete(resultJSON);
-    free(encodedContent);
 }
 
-void processShell(int sock, cJSON* commandJSON, char *baseDir) {
-    //  shell (to execute a shell cmd from request at CK node)
-    // todo: in future could be implemented as async process
+static void writeCloneResponse(JsonWriter *w, void *ctx) {
+    WorkspaceStats *stats = ctx;
+    jw_begin_object(w);
+    jw_string_field(w, "return", "0");
+    jw_int_field(w, "reflinked", stats->reflinked);
+    jw_int_field(w, "linked", stats->linked);
+    jw_int_field(w, "copied", stats->copied);
+    jw_end_object(w);
+}
 
-    cJSON *shellCommandJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_SHELL_COMMAND);
-    if (!shellCommandJSON) {
-        printf("[ERROR]: Invalid action JSON format for provided message\n");
-        sendErrorMessage(sock, "Invalid action JSON format for message: no filenameJSON found", ERROR_CODE);
+/**
+ * @return the workspace directory named by the parameter, NULL if it is not a directory a job may use
+ *         (error response already sent)
+ */
+static const char *getWorkspacePath(int sock, cJSON *commandJSON, const char *name) {
+    const char *path = cJSON_GetObjectItem(commandJSON, name)->valuestring;
+    if (!*path || !path_valid(path) || workspace_reserved(path)) {
+        sendErrorMessage(sock, concat("Invalid ", name), ERROR_CODE);
+        return NULL;
+    }
+    return path;
+}
+
+void processCloneWorkspace(int sock, char* baseDir, cJSON* commandJSON) {
+    //  clone_workspace (copy of a directory for a job, instead of pushing the same files again)
+    const char *source = getWorkspacePath(sock, commandJSON, JSON_PARAM_SOURCE_PATH);
+    const char *target = source ? getWorkspacePath(sock, commandJSON, JSON_PARAM_TARGET_PATH) : NULL;
+    if (!target) {
         return;
     }
 
-    char *shellCommand = shellCommandJSON->valuestring;
+    WorkspaceStats stats;
+    const char *error = NULL;
+    long long started = metrics_now();
+    int cloned = workspace_clone(source, target, &stats, &error);
+    metrics_phase("clone", started);
+    if (0 != cloned) {
+        char *message = concat((char *) error, ": ");
+        message = concat(message, target);
+        LOG_ERROR("%s", message);
+        sendErrorMessage(sock, message, ERROR_CODE);
+        return;
+    }
+    LOG_INFO("Workspace %s cloned to %s (%i reflinked, %i linked, %i copied)", source, target,
+             stats.reflinked, stats.linked, stats.copied);
+
+    if (sendResponse(sock, writeCloneResponse, &stats) < 0) {
+        LOG_ERROR("Could not send the response: %s", strerror(errno));
+    }
+}
 
-    if (!shellCommand) {
-        printf("[ERROR]: Invalid action JSON format for provided message\n");
-        sendErrorMessage(sock, "Invalid action JSON format for message: no filenameJSON found", ERROR_CODE);
+void processDropWorkspace(int sock, char* baseDir, cJSON* commandJSON) {
+    //  drop_workspace (the directory is gone when answered, its files are removed afterwards)
+    const char *path = getWorkspacePath(sock, commandJSON, JSON_PARAM_EXTRA_PATH);
+    if (!path) {
+        return;
+    }
+    const char *error = NULL;
+    if (0 != workspace_drop(path, &error)) {
+        char *message = concat((char *) error, ": ");
+        message = concat(message, path);
+        LOG_ERROR("%s", message);
+        sendErrorMessage(sock, message, ERROR_CODE);
         return;
     }
+    LOG_INFO("Workspace dropped: %s", path);
+
+    sendOkResponse(sock);
+    workspace_collect();
+}
+
+typedef struct {
+    int returnCode;
+    const char *encoding;
+    const unsigned char *stdoutText;
+    long stdoutSize;
+    const unsigned char *stderrText;
+    long stderrSize;
+} ShellResponse;
+
+static void writeShellResponse(JsonWriter *w, void *ctx) {
+    ShellResponse *r = ctx;
+    jw_begin_object(w);
+    jw_string_field(w, "return", "0");
+    jw_int_field(w, "return_code", r->returnCode);
+    jw_string_field(w, "encoding", r->encoding);
+    jw_base64_field(w, "stdout_base64", r->stdoutText, r->stdoutSize);
+    jw_base64_field(w, "stderr_base64", r->stderrText, r->stderrSize);
+    jw_end_object(w);
+}
+
+void processShell(int sock, char *baseDir, cJSON* commandJSON) {
+    //  shell (to execute a shell cmd from request at CK node)
+    // todo: in future could be implemented as async process
+
+    cJSON *shellCommandJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_SHELL_COMMAND);
+    char *shellCommand = shellCommandJSON->valuestring;
 
     chdir(baseDir);
 
@@ -940,38 +1882,56 @@ void processShell(int sock, cJSON* commandJSON, char *baseDir) {
     unsigned char *stdoutText = malloc(MAX_BUFFER_SIZE + 1);
     if (stdoutText == NULL) {
         perror("[ERROR]: Memory not allocated for stdoutText first time");
-        exit(1);
+        sendErrorMessage(sock, "Memory not allocated for the command output", ERROR_CODE);
+        return;
     }
     memset(stdoutText, 0, MAX_BUFFER_SIZE + 1);
 
     char tmpFilename[DEFAULT_UUID_SIZE];
-    get_uuid_string(tmpFilename, sizeof(tmpFilename));
+    generateUuid(tmpFilename, sizeof(tmpFilename));
 
     char *tmpStdErrFilePath = concat(baseDir, FILE_SEPARATOR);
     tmpStdErrFilePath = concat(tmpStdErrFilePath,tmpFilename);
     char *redirectString = concat(" 2>", tmpStdErrFilePath);
     char *shellCommandWithStdErr = concat(shellCommand, redirectString);
-    printf("[INFO]: Run command: %s\n", shellCommandWithStdErr);
+    if (!shellCommandWithStdErr) {
+        free(stdoutText);
+        sendErrorMessage(sock, "Memory not allocated for the command", ERROR_CODE);
+        return;
+    }
+    LOG_INFO("Run command: %s", shellCommandWithStdErr);
     /* Open the command for reading. */
     FILE *fp;
+    long long shellStarted = metrics_now();
+    metrics_add(METRIC_SHELL_STARTED, 1);
 #ifdef _WIN32
     fp = _popen(shellCommandWithStdErr, "r");
 #else
     fp = popen(shellCommandWithStdErr, "r");
 #endif
     if (fp == NULL) {
-        printf("[ERROR]: Failed to run command: %s\n", shellCommand);
-        exit(1);
+        LOG_ERROR("Failed to run command: %s", shellCommand);
+        metrics_add(METRIC_SHELL_FINISHED, 1);
+        free(stdoutText);
+        sendErrorMessage(sock, "Failed to run command", ERROR_CODE);
+        return;
     }
 
     int totalRead = 0;
+    int outputCut = 0;
     while (fgets(path, sizeof(path) - 1, fp) != NULL) {
+        // the command must be read to its end even when its output no longer fits, or pclose would wait forever
+        if (outputCut) {
+            continue;
+        }
         unsigned long pathSize = (unsigned long)(strlen(path));
-        stdoutText = realloc(stdoutText, totalRead + pathSize + 1);
-        if (stdoutText == NULL) {
-            perror("[ERROR]: Memory not allocated stdout");
-            exit(1);
+        unsigned char *grown = realloc(stdoutText, totalRead + pathSize + 1);
+        if (grown == NULL) {
+            LOG_ERROR("Memory not allocated for stdout, the output is cut at %i bytes", totalRead);
+            outputCut = 1;
+            continue;
         }
+        stdoutText = grown;
         memcpy(stdoutText + totalRead, path, pathSize);
         totalRead = totalRead + pathSize;
     }
@@ -981,102 +1941,391 @@ void processShell(int sock, cJSON* commandJSON, char *baseDir) {
 #else
     systemReturnCode = pclose(fp);
 #endif
+    metrics_add(METRIC_SHELL_FINISHED, 1);
+    metrics_phase("shell", shellStarted);
+    // the command may have removed or renamed directories behind the cached handles
+    dircache_invalidate_all();
 
     stdoutText[totalRead] ='\0';
-    printf("[INFO]: total stdout length: %i\n", totalRead);
-    printf("[DEBUG]: stdout: %s\n", stdoutText);
-
-    char *encodedContent = "";
-    if (totalRead > 0) {
-        unsigned long targetSize = (unsigned long) ((totalRead) * 4 / 3 + 5);
-        printf("[DEBUG]: Target stdout encoded size: %lu\n", targetSize);
-        encodedContent = malloc(targetSize);
-        if (!encodedContent) {
-            perror("[ERROR]: Memory not allocated for encoded stdout Content");
-            exit(1);
-        }
-        memset(encodedContent, 0, targetSize);
-        base64_encode(stdoutText, totalRead, encodedContent, targetSize);
-    }
-
-    free(stdoutText);
-
-    cJSON *resultJSON = cJSON_CreateObject();
-    cJSON_AddItemToObject(resultJSON, "return", cJSON_CreateString("0"));
-
-    cJSON_AddNumberToObject(resultJSON, "return_code", systemReturnCode);
-
-    cJSON_AddItemToObject(resultJSON, "encoding", cJSON_CreateString(getStdoutEncoding()));
-    cJSON_AddItemToObject(resultJSON, "stdout_base64", cJSON_CreateString(encodedContent));
+    LOG_DEBUG("total stdout length: %i", totalRead);
+    // the message is cut anyway, do not let the formatting run through all of a large output
+    LOG_DEBUG("stdout: %.*s", LOGGER_MESSAGE_SIZE, stdoutText);
 
     long fsize = 0;
     FILE *stdErrFile = fopen(tmpStdErrFilePath, "rb");
     if (!stdErrFile) {
+        free(stdoutText);
         sendErrorMessage(sock, "can't find stderr tmp file", ERROR_CODE);
         return;
     }
 
-    unsigned char *stdErr = "";
-    if (stdErrFile) {
-        fseek(stdErrFile, 0, SEEK_END);
-        fsize = ftell(stdErrFile);
-        fseek(stdErrFile, 0, SEEK_SET);
+    fseek(stdErrFile, 0, SEEK_END);
+    fsize = ftell(stdErrFile);
+    fseek(stdErrFile, 0, SEEK_SET);
 
-        stdErr = malloc(fsize + 1);
-        memset(stdErr, 0, fsize + 1);
-        fread(stdErr, fsize, 1, stdErrFile);
+    unsigned char *stdErr = malloc(fsize + 1);
+    if (!stdErr) {
+        perror("[ERROR]: Memory not allocated for stderr content\n");
         fclose(stdErrFile);
+        remove(tmpStdErrFilePath);
+        free(stdoutText);
+        sendErrorMessage(sock, "Memory not allocated for the command stderr", ERROR_CODE);
+        return;
     }
-    printf("[DEBUG]: stderr file size: %lu\n", fsize);
+    fread(stdErr, fsize, 1, stdErrFile);
+    fclose(stdErrFile);
+    LOG_DEBUG("stderr file size: %lu", fsize);
 
-    char *encodedStdErr = "";
-    if (fsize > 0) {
-        unsigned long targetSize = (unsigned long) ((fsize) * 4 / 3 + 5);
-        printf("[DEBUG]: Target stderr encoded size: %lu\n", targetSize);
-        encodedStdErr = malloc(targetSize);
-        if (!encodedStdErr) {
-            perror("[ERROR]: Memory not allocated for encoded stderr content\n");
-            exit(1);
-        }
-        memset(encodedStdErr, 0, targetSize);
-        base64_encode(stdErr, fsize, encodedStdErr, targetSize);
-        free(stdErr);
+    ShellResponse r = { systemReturnCode, getStdoutEncoding(), stdoutText, totalRead, stdErr, fsize };
+    if (sendResponse(sock, writeShellResponse, &r) < 0) {
+        LOG_ERROR("Could not send the response: %s", strerror(errno));
     }
-
-    cJSON_AddItemToObject(resultJSON, "stderr_base64", cJSON_CreateString(encodedStdErr));
-
-    sendJson(sock, resultJSON);
-    cJSON_Delete(resultJSON);
+    free(stdoutText);
+    free(stdErr);
 
     int ret = remove(tmpStdErrFilePath);
     if(ret == 0) {
-        printf("[INFO]: tmp stderr file %s deleted successfully\n", tmpStdErrFilePath);
+        LOG_INFO("tmp stderr file %s deleted successfully", tmpStdErrFilePath);
     } else {
         perror("[ERROR]: unable to delete the tmp stderr file\n");
     }
 }
 
-void processState(int sock, const char *baseDir) {
-    cJSON *resultJSON = cJSON_CreateObject();
-    cJSON_AddItemToObject(resultJSON, "return", cJSON_CreateString("0"));
-    cJSON *cfgJSON = cJSON_CreateObject();
-    cJSON_AddItemToObject(cfgJSON, JSON_CONFIG_PARAM_PATH_TO_FILES, cJSON_CreateString(strdup(baseDir)));
-    cJSON_AddItemToObject(resultJSON, "cfg", cfgJSON);
-    sendJson(sock, resultJSON);
-    cJSON_Delete(resultJSON);
+typedef struct {
+    const char *baseDir;
+    NodeProfile profile;
+    int withProfile;
+} StateResponse;
+
+static void writeNodeProfile(JsonWriter *w, const NodeProfile *profile) {
+    jw_begin_object(w);
+    jw_string_field(w, "os", profile->os);
+    jw_string_field(w, "os_release", profile->osRelease);
+    jw_string_field(w, "os_version", profile->osVersion);
+    jw_string_field(w, "machine", profile->machine);
+    jw_string_field(w, "hostname", profile->hostname);
+
+    jw_key(w, "cpu");
+    jw_begin_object(w);
+    jw_string_field(w, "model", profile->cpuModel);
+    jw_int_field(w, "logical_cpus", profile->logicalCpus);
+    jw_int_field(w, "physical_cores", profile->physicalCores);
+    jw_int_field(w, "sockets", profile->sockets);
+    jw_key(w, "caches");
+    jw_begin_array(w);
+    int i;
+    for (i = 0; i < profile->cacheCount; i++) {
+        const NodeCache *cache = &profile->caches[i];
+        jw_begin_object(w);
+        jw_int_field(w, "level", cache->level);
+        jw_string_field(w, "type", cache->type);
+        jw_int_field(w, "size_bytes", cache->sizeBytes);
+        jw_int_field(w, "line_size", cache->lineSize);
+        jw_int_field(w, "ways", cache->ways);
+        jw_int_field(w, "shared_cpus", cache->sharedCpus);
+        jw_end_object(w);
+    }
+    jw_end_array(w);
+    jw_string_field(w, "governor", profile->governor);
+    jw_int_field(w, "min_frequency_khz", profile->minFrequencyKhz);
+    jw_int_field(w, "max_frequency_khz", profile->maxFrequencyKhz);
+    jw_end_object(w);
+
+    jw_key(w, "memory");
+    jw_begin_object(w);
+    jw_int_field(w, "total_bytes", profile->memoryBytes);
+    jw_int_field(w, "page_size", profile->pageSize);
+    jw_end_object(w);
+
+    jw_key(w, "compilers");
+    jw_begin_array(w);
+    for (i = 0; i < profile->compilerCount; i++) {
+        jw_begin_object(w);
+        jw_string_field(w, "name", profile->compilers[i].name);
+        jw_string_field(w, "version", profile->compilers[i].version);
+        jw_end_object(w);
+    }
+    jw_end_array(w);
+    jw_int_field(w, "collected", profile->collected);
+    jw_end_object(w);
+}
+
+static void writeStateResponse(JsonWriter *w, void *ctx) {
+    const StateResponse *r = ctx;
+    jw_begin_object(w);
+    jw_string_field(w, "return", "0");
+    jw_key(w, "cfg");
+    jw_begin_object(w);
+    jw_string_field(w, JSON_CONFIG_PARAM_PATH_TO_FILES, r->baseDir);
+    jw_end_object(w);
+
+    QuotaUsage usage;
+    long long quotaBytes = quota_usage(&usage);
+    if (quotaBytes >= 0) {
+        jw_key(w, "storage");
+        jw_begin_object(w);
+        jw_int_field(w, "used_bytes", usage.usedBytes);
+        jw_int_field(w, "files", usage.files);
+        jw_int_field(w, "quota_bytes", quotaBytes);
+        jw_int_field(w, "evicted_files", usage.evictedFiles);
+        jw_int_field(w, "evicted_bytes", usage.evictedBytes);
+        jw_int_field(w, "last_pass", usage.lastPass);
+        jw_end_object(w);
+    }
+
+    jw_string_field(w, JSON_PARAM_PROFILE_HASH, r->profile.hash);
+    if (r->withProfile) {
+        jw_key(w, "profile");
+        writeNodeProfile(w, &r->profile);
+    }
+    jw_end_object(w);
 }
 
-void doProcessing(int sock, char *baseDir) {
+void processState(int sock, char *baseDir, cJSON* commandJSON) {
+    cJSON *refreshJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_REFRESH_PROFILE);
+    if (refreshJSON && cJSON_True == refreshJSON->type) {
+        // state is cheap, probing the compilers again is not: it waits for a blocking slot like a shell job
+        long long waitStarted = metrics_now();
+        enterBlockingJob();
+        metrics_phase("wait", waitStarted);
+        nodeprofile_refresh();
+        leaveBlockingJob();
+    }
+    // the writer makes two passes, both must see the same profile
+    StateResponse *r = malloc(sizeof(StateResponse));
+    if (!r) {
+        sendErrorMessage(sock, "no memory for the node profile", ERROR_CODE);
+        return;
+    }
+    r->baseDir = baseDir;
+    nodeprofile_get(&r->profile);
+    cJSON *hashJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_PROFILE_HASH);
+    r->withProfile = !hashJSON || !hashJSON->valuestring || 0 != strcmp(hashJSON->valuestring, r->profile.hash);
+    if (sendResponse(sock, writeStateResponse, r) < 0) {
+        LOG_ERROR("Could not send the response: %s", strerror(errno));
+    }
+    free(r);
+}
+
+static void writeFileItem(JsonWriter *w, const FileIndexItem *item, int withHash) {
+    jw_int_field(w, "size", item->size);
+    jw_int_field(w, "mtime", item->mtime);
+    if (withHash && item->hash[0]) {
+        jw_string_field(w, JSON_PARAM_FILE_HASH, item->hash);
+    }
+}
+
+typedef struct {
+    FileIndexItem *items;
+    int count;
+    int withHashes;
+} FileListResponse;
+
+static void writeFileListResponse(JsonWriter *w, void *ctx) {
+    FileListResponse *r = ctx;
+    int i;
+    jw_begin_object(w);
+    jw_string_field(w, "return", "0");
+    jw_key(w, "files");
+    jw_begin_array(w);
+    for (i = 0; i < r->count; i++) {
+        jw_begin_object(w);
+        jw_string_field(w, "name", r->items[i].name);
+        writeFileItem(w, &r->items[i], r->withHashes);
+        jw_end_object(w);
+    }
+    jw_end_array(w);
+    jw_end_object(w);
+}
+
+void sendFileList(int sock, cJSON* commandJSON, int withHashes) {
+    cJSON *extraPathJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_EXTRA_PATH);
+    const char *extraPath = extraPathJSON ? extraPathJSON->valuestring : NULL;
+    FileListResponse r = { NULL, 0, withHashes };
+    r.count = fileindex_list(extraPath, withHashes, &r.items);
+    if (r.count < 0) {
+        sendErrorMessage(sock, "Could not list files", ERROR_CODE);
+        return;
+    }
+    LOG_DEBUG("Listed %i files", r.count);
+    if (sendResponse(sock, writeFileListResponse, &r) < 0) {
+        LOG_ERROR("Could not send the response: %s", strerror(errno));
+    }
+}
+
+void processList(int sock, char* baseDir, cJSON* commandJSON) {
+    //  list (files under path_to_files or its extra_path directory, recursively)
+    sendFileList(sock, commandJSON, 0);
+}
+
+void processManifest(int sock, char* baseDir, cJSON* commandJSON) {
+    //  manifest (list with content hashes)
+    sendFileList(sock, commandJSON, 1);
+}
+
+static void writeStatResponse(JsonWriter *w, void *ctx) {
+    FileIndexItem *item = ctx;
+    jw_begin_object(w);
+    jw_string_field(w, "return", "0");
+    jw_string_field(w, JSON_PARAM_FILE_NAME, item->name);
+    writeFileItem(w, item, 1);
+    jw_end_object(w);
+}
+
+void processStat(int sock, char* baseDir, cJSON* commandJSON) {
+    //  stat (size, modification time and content hash of one file)
+    char *filePath = getRequestFilePath(sock, baseDir, commandJSON, 0);
+    if (!filePath) {
+        return;
+    }
+    FileIndexItem item;
+    if (0 != fileindex_stat(filePath, &item)) {
+        char *message = concat("File not found at path:", filePath);
+        LOG_ERROR("%s", message);
+        sendErrorMessage(sock, message, ERROR_CODE);
+        return;
+    }
+    if (sendResponse(sock, writeStatResponse, &item) < 0) {
+        LOG_ERROR("Could not send the response: %s", strerror(errno));
+    }
+}
+
+typedef struct {
+    const char **missing;
+    int count;
+} HaveResponse;
+
+static void writeHaveResponse(JsonWriter *w, void *ctx) {
+    HaveResponse *r = ctx;
+    int i;
+    jw_begin_object(w);
+    jw_string_field(w, "return", "0");
+    jw_key(w, "missing");
+    jw_begin_array(w);
+    for (i = 0; i < r->count; i++) {
+        jw_string(w, r->missing[i]);
+    }
+    jw_end_array(w);
+    jw_end_object(w);
+}
+
+void processHave(int sock, char *baseDir, cJSON* commandJSON) {
+    //  have (which of the given content hashes are not stored at CK node yet)
+    cJSON *hashesJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_HASHES);
+    HaveResponse r = { ck_alloc(sizeof(char *) * (cJSON_GetArraySize(hashesJSON) + 1)), 0 };
+    if (!r.missing) {
+        sendErrorMessage(sock, "Memory not allocated for hashes", ERROR_CODE);
+        return;
+    }
+    cJSON *hashJSON;
+    for (hashJSON = hashesJSON->child; hashJSON; hashJSON = hashJSON->next) {
+        if (hashJSON->valuestring && !filestore_has_blob(baseDir, hashJSON->valuestring)) {
+            r.missing[r.count++] = hashJSON->valuestring;
+        }
+    }
+    LOG_DEBUG("%i of %i hashes missing", r.count, cJSON_GetArraySize(hashesJSON));
+    if (sendResponse(sock, writeHaveResponse, &r) < 0) {
+        LOG_ERROR("Could not send the response: %s", strerror(errno));
+    }
+}
+
+void sendMetrics(int sock) {
+    size_t size = 0;
+    // a gauge, read without the queue lock (never initialized in fork mode, where the queue stays empty)
+    char *text = metrics_text(connectionQueueCount, &size);
+    if (!text) {
+        sendHttpResponse(sock, 500, "", 0);
+        return;
+    }
+    if (0 > sendTypedHttpResponse(sock, 200, METRICS_CONTENT_TYPE, text, (int) size)) {
+        LOG_ERROR("Could not send the metrics: %s", strerror(errno));
+    }
+    free(text);
+}
+
+static void writeLogLevelResponse(JsonWriter *w, void *ctx) {
+    jw_begin_object(w);
+    jw_string_field(w, "return", "0");
+    jw_string_field(w, JSON_PARAM_LEVEL, logger_level_name(logger_level()));
+    jw_end_object(w);
+}
+
+void processLogLevel(int sock, char *baseDir, cJSON* commandJSON) {
+    //  log_level (change the level of the log at runtime, or only tell it without level)
+    cJSON *levelJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_LEVEL);
+    if (levelJSON) {
+        int level = levelJSON->valuestring ? logger_level_of(levelJSON->valuestring) : -1;
+        if (level < 0) {
+            sendErrorMessage(sock, "Unknown level, use error, warn, info or debug", ERROR_CODE);
+            return;
+        }
+        logger_set_level(level);
+        LOG_INFO("Log level set to %s", levelJSON->valuestring);
+    }
+    if (sendResponse(sock, writeLogLevelResponse, NULL) < 0) {
+        LOG_ERROR("Could not send the response: %s", strerror(errno));
+    }
+}
+
+void processShutdown(int sock, char *baseDir, cJSON* commandJSON) {
+    LOG_DEBUG("Start shutdown CK node");
+    sendHttpResponse(sock, 200, "", 0);
+}
+
+/**
+ * Action table: handler, cost class and required parameters of every supported action.
+ * New actions are added here, the registry is built from this table at startup.
+ */
+static const ActionDescriptor actions[] = {
+    { JSCON_PARAM_VALUE_PUSH, processPush, ACTION_BLOCKING, { { JSON_PARAM_FILE_NAME, cJSON_String } } },
+    { "pull", processPull, ACTION_BLOCKING, { { JSON_PARAM_FILE_NAME, cJSON_String } } },
+    { "signature", processSignature, ACTION_BLOCKING, { { JSON_PARAM_FILE_NAME, cJSON_String } } },
+    { "patch", processPatch, ACTION_BLOCKING, { { JSON_PARAM_FILE_NAME, cJSON_String } } },
+    { "extract", processExtract, ACTION_BLOCKING, { { JSON_PARAM_FILE_NAME, cJSON_String } } },
+    { "archive", processArchive, ACTION_BLOCKING, { { JSON_PARAM_FILE_NAME, cJSON_String } } },
+    { "clone_workspace", processCloneWorkspace, ACTION_BLOCKING,
+        { { JSON_PARAM_SOURCE_PATH, cJSON_String }, { JSON_PARAM_TARGET_PATH, cJSON_String } } },
+    { "drop_workspace", processDropWorkspace, ACTION_BLOCKING, { { JSON_PARAM_EXTRA_PATH, cJSON_String } } },
+    { "list", processList, ACTION_BLOCKING, { { NULL, 0 } } },
+    { "manifest", processManifest, ACTION_BLOCKING, { { NULL, 0 } } },
+    { "stat", processStat, ACTION_BLOCKING, { { JSON_PARAM_FILE_NAME, cJSON_String } } },
+    { "have", processHave, ACTION_BLOCKING, { { JSON_PARAM_HASHES, cJSON_Array } } },
+    { "shell", processShell, ACTION_BLOCKING, { { JSON_PARAM_SHELL_COMMAND, cJSON_String } } },
+    { "state", processState, ACTION_CHEAP, { { NULL, 0 } } },
+    { "log_level", processLogLevel, ACTION_CHEAP, { { NULL, 0 } } },
+    { "shutdown", processShutdown, ACTION_CHEAP, { { NULL, 0 } } },
+};
+
+void registerActions() {
+    action_registry_build(actions, sizeof(actions) / sizeof(actions[0]));
+}
+
+void initMetrics(int shared) {
+    static const char *actionNames[sizeof(actions) / sizeof(actions[0])];
+    int i;
+    for (i = 0; i < (int) (sizeof(actions) / sizeof(actions[0])); i++) {
+        actionNames[i] = actions[i].name;
+    }
+    metrics_init(actionNames, i, shared);
+}
+
+static void processRequest(int sock, char *baseDir) {
+    responseFormat = RESPONSE_FORMAT_JSON;
+
+    // the errors of a request end the request, never the server: in thread mode they share one process
     char *client_message = malloc(MAX_BUFFER_SIZE + 1);
     if (client_message == NULL) {
         perror("[ERROR]: Memory not allocated for client_message first time");
-        exit(1);
+        sendErrorMessage(sock, "Memory not allocated for the request", ERROR_CODE);
+        return;
     }
 
     char *buffer = malloc(MAX_BUFFER_SIZE + 1);
     if (buffer == NULL) {
         perror("[ERROR]: Memory not allocated buffer");
-        exit(1);
+        free(client_message);
+        sendErrorMessage(sock, "Memory not allocated for the request", ERROR_CODE);
+        return;
     }
 
     memset(buffer, 0, MAX_BUFFER_SIZE);
@@ -1085,60 +2334,90 @@ void doProcessing(int sock, char *baseDir) {
     int message_len = -1;
 
     //buffered read from socket
+    long long phaseStarted = metrics_now();
     int i = 0;
     while(1) {
         buffer_read = recv(sock, buffer, MAX_BUFFER_SIZE, 0);
         if (buffer_read > 0) {
-            client_message = realloc(client_message, total_read + buffer_read + 1);
-            if (client_message == NULL) {
+            char *grown = realloc(client_message, total_read + buffer_read + 1);
+            if (grown == NULL) {
                 perror("Error ! Memory not allocated client_message");
-                exit(1);
+                free(client_message);
+                free(buffer);
+                sendErrorMessage(sock, "Memory not allocated for the request", ERROR_CODE);
+                return;
             }
+            client_message = grown;
             buffer[buffer_read] = '\0';
             memcpy(client_message + total_read, buffer, buffer_read);
             total_read = total_read + buffer_read;
             i++;
             if (-1 == message_len) {
-                message_len = detectMessageLength(buffer, total_read);
+                message_len = detectMessageLength(client_message, total_read);
             }
         } else if (buffer_read < 0) {
+            // the client reset the connection or it failed, there is no one to answer
             perror("[ERROR]: reading from socket");
             printf("WSAGetLastError() %i\n", WSAGetLastError()); //win
-            exit(1);
+            free(client_message);
+            free(buffer);
+            responseResult = ERROR_CODE;
+            return;
         }
         if (buffer_read == 0 || total_read >= message_len || -2 == message_len) {
             /* message received successfully */
             break;
         }
     }
-    if (buffer == NULL) {
-        perror("Error ! Try to free not allocated memory buffer");
-        exit(1);
-    }
     free(buffer);
     client_message[total_read] = '\0';
-    printf("[DEBUG]: Post request length: %lu\n", (unsigned long) strlen(client_message));
+    metrics_add(METRIC_BYTES_IN, total_read);
+    phaseStarted = metrics_phase("recv", phaseStarted);
 
-	char *decodedJSON;
-	char *encodedJSONPostData = strstr(client_message, CK_JSON_KEY);
-	if (encodedJSONPostData != NULL) {
-		char *encodedJSON = encodedJSONPostData + strlen(CK_JSON_KEY);
-		decodedJSON = url_decode(encodedJSON, total_read - (encodedJSON - client_message));
+    if (0 == strncmp(client_message, METRICS_REQUEST, strlen(METRICS_REQUEST))
+        && strchr(" ?\r\n", client_message[strlen(METRICS_REQUEST)])) {
         free(client_message);
+        requestAction = METRICS_ACTION_SCRAPE;
+        sendMetrics(sock);
+        return;
+    }
+    LOG_DEBUG("Post request length: %lu", (unsigned long) strlen(client_message));
+
+	cJSON *commandJSON;
+	long header_len = getHeaderLength(client_message);
+	int cborRequest = 0 <= header_len && hasContentType(client_message, header_len, "application/cbor");
+	capture_message(client_message, total_read, header_len, cborRequest);
+	if (cborRequest) {
+		responseFormat = RESPONSE_FORMAT_CBOR;
+		commandJSON = cbor_decode((unsigned char *) client_message + header_len, total_read - header_len);
+		free(client_message);
+		metrics_phase("cbor_decode", phaseStarted);
 	} else {
-		decodedJSON = client_message;
-	}
+		char *decodedJSON;
+		char *encodedJSONPostData = strstr(client_message, CK_JSON_KEY);
+		if (encodedJSONPostData != NULL) {
+			char *encodedJSON = encodedJSONPostData + strlen(CK_JSON_KEY);
+			decodedJSON = url_decode(encodedJSON, total_read - (encodedJSON - client_message));
+			free(client_message);
+			phaseStarted = metrics_phase("url_decode", phaseStarted);
+		} else {
+			decodedJSON = client_message;
+		}
 
-	cJSON *commandJSON = cJSON_Parse(decodedJSON);
-    free(decodedJSON);
+		commandJSON = cJSON_Parse(decodedJSON);
+		free(decodedJSON);
+		metrics_phase("parse", phaseStarted);
+	}
 	if (!commandJSON) {
 		sendErrorMessage(sock, "Invalid action JSON format for message", ERROR_CODE);
 		return;
 	}
+	cJSON *timingsJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_TIMINGS);
+	responseTimings = timingsJSON && cJSON_True == timingsJSON->type;
 
 
     cJSON *secretkeyJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_NAME_SECRETKEY);
-    if (!secretkeyJSON) {
+    if (!secretkeyJSON || (secretkeyJSON->type & 255) != cJSON_String || !secretkeyJSON->valuestring) {
         if (commandJSON != NULL) {
             cJSON_Delete(commandJSON);
         }
@@ -1146,11 +2425,11 @@ void doProcessing(int sock, char *baseDir) {
         return;
     }
     char *clientSecretKey = secretkeyJSON->valuestring;
-    printf("[DEBUG]: Got secretkey: %s from client\n", clientSecretKey);
+    LOG_DEBUG("Got secretkey: %s from client", clientSecretKey);
     if (!serverSecretKey || strncmp(clientSecretKey, serverSecretKey, strlen(serverSecretKey)) == 0 ) {
         cJSON *actionJSON = cJSON_GetObjectItem(commandJSON, JSON_PARAM_NAME_COMMAND);
         if (!actionJSON) {
-            printf("[ERROR]: Invalid action JSON format for message: \n");
+            LOG_ERROR("Invalid action JSON format for message: ");
             if (commandJSON != NULL) {
                 cJSON_Delete(commandJSON);
             }
@@ -1159,27 +2438,100 @@ void doProcessing(int sock, char *baseDir) {
         }
         char *action = actionJSON->valuestring;
 
-        printf("[INFO]: Get action: %s\n", action);
-        char *resultJSONtext;
-        if (strncmp(action, JSCON_PARAM_VALUE_PUSH, 4) == 0) {
-            processPush(sock, baseDir, commandJSON);
-        } else if (strncmp(action, "pull", 4) == 0) {
-            processPull(sock, baseDir, commandJSON);
-        } else if (strncmp(action, "shell", 4) == 0) {
-            processShell(sock, commandJSON, baseDir);
-        } else if (strncmp(action, "state", 4) == 0) {
-            processState(sock, baseDir);
-        } else if (strncmp(action, "shutdown", 4) == 0) {
-            printf("[DEBUG]: Start shutdown CK node");
-            sendHttpResponse(sock, 200, "", 0);
-        } else {
+        LOG_DEBUG("Get action: %s", action);
+        const ActionDescriptor *descriptor = action_registry_find(action);
+        const char *missingParam = descriptor ? action_missing_param(descriptor, commandJSON) : NULL;
+        if (descriptor) {
+            requestAction = (int) (descriptor - actions);
+        }
+        if (!descriptor) {
             sendErrorMessage(sock, "unknown action", ERROR_CODE);
+        } else if (missingParam) {
+            char *message = concat("Invalid action JSON format for message: no ", missingParam);
+            message = concat(message, " found");
+            LOG_ERROR("%s", message);
+            sendErrorMessage(sock, message, ERROR_CODE);
+        } else if (ACTION_BLOCKING == descriptor->cost) {
+            long long waitStarted = metrics_now();
+            enterBlockingJob();
+            metrics_phase("wait", waitStarted);
+            descriptor->handler(sock, baseDir, commandJSON);
+            leaveBlockingJob();
+        } else {
+            descriptor->handler(sock, baseDir, commandJSON);
         }
     } else {
         sendErrorMessage(sock, ERROR_MESSAGE_SECRET_KEY_MISSMATCH, ERROR_CODE_SECRET_KEY_MISMATCH);
     }
 	cJSON_Delete(commandJSON);
 
-	printf("[INFO]: Action completed successfuly\n");
+	LOG_DEBUG("Action completed successfuly");
+}
+
+/**
+ * Per-thread request arena: cJSON nodes and path/string helpers of a request are allocated from it
+ * and released all at once when the request is done.
+ */
+static ARENA_THREAD_LOCAL Arena *requestArena = NULL;
+
+/**
+ * one info line per request with the time spent in its phases, in microseconds:
+ *   [INFO]: timing action=push result=0 total=1204 recv=52 url_decode=31 parse=40 base64_decode=210 write=702 send=88
+ * followed by its allocations when profiled (see allocprof.h):
+ *   ... heap_allocs=41 heap_bytes=150321 heap_peak=139264 json_allocs=12 json_bytes=176
+ */
+static void logTimings(const MetricsPhases *phases, const AllocStats *allocs) {
+    if (!logger_enabled(LOG_LEVEL_INFO)) {
+        return;
+    }
+    char line[SERVER_TIMING_HEADER_SIZE];
+    int used = snprintf(line, sizeof(line), "timing action=%s result=%s total=%lld",
+                        metrics_action_name(requestAction), responseResult, phases->totalMicros);
+    int i;
+    for (i = 0; i < phases->count && 0 < used && used < (int) sizeof(line); i++) {
+        used += snprintf(line + used, sizeof(line) - used, " %s=%lld", phases->phases[i].name, phases->phases[i].micros);
+    }
+    if (allocprof_heap_enabled() && 0 < used && used < (int) sizeof(line)) {
+        used += snprintf(line + used, sizeof(line) - used, " heap_allocs=%lld heap_bytes=%lld heap_peak=%lld",
+                         allocs->heapAllocations, allocs->heapBytes, allocs->heapPeakBytes);
+    }
+    if (allocprof_enabled() && 0 < used && used < (int) sizeof(line)) {
+        snprintf(line + used, sizeof(line) - used, " json_allocs=%lld json_bytes=%lld",
+                 allocs->jsonAllocations, allocs->jsonBytes);
+    }
+    LOG_INFO("%s", line);
+}
+
+void doProcessing(int sock, char *baseDir) {
+    if (!requestArena) {
+        requestArena = arena_create(0);
+        if (!requestArena) {
+            perror("[ERROR]: Memory not allocated for request arena");
+            return;
+        }
+    }
+    long long started = metrics_phases_begin();
+    allocprof_begin();
+    metrics_add(METRIC_CONNECTIONS_OPENED, 1);
+    requestAction = METRICS_ACTION_NONE;
+    responseResult = "0";
+    responseTimings = 0;
+
+    Arena *previousArena = arena_set_current(requestArena);
+    processRequest(sock, baseDir);
+    arena_set_current(previousArena);
+    arena_reset(requestArena);
+
+    MetricsPhases phases;
+    metrics_phases_get(&phases);
+    AllocStats allocs;
+    allocprof_get(&allocs);
+    metrics_request(requestAction, responseResult, phases.totalMicros);
+    if (allocprof_enabled()) {
+        metrics_request_allocations(requestAction, &allocs);
+    }
+    metrics_add(METRIC_CONNECTIONS_CLOSED, 1);
+    capture_request(started, phases.totalMicros, metrics_action_name(requestAction), atoi(responseResult));
+    logTimings(&phases, &allocs);
 }
 
@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <errno.h>
+
+#ifndef _WIN32
+    #include <sys/time.h>
+    #include <unistd.h>
+#endif
+
+#include "ckthread.h"
+
+typedef struct {
+    ck_thread_fn fn;
+    void *arg;
+} ThreadStart;
+
+#ifdef _WIN32
+
+void ck_mutex_init(ck_mutex_t *mutex) { InitializeCriticalSection(mutex); }
+void ck_mutex_lock(ck_mutex_t *mutex) { EnterCriticalSection(mutex); }
+void ck_mutex_unlock(ck_mutex_t *mutex) { LeaveCriticalSection(mutex); }
+void ck_mutex_destroy(ck_mutex_t *mutex) { DeleteCriticalSection(mutex); }
+
+void ck_cond_init(ck_cond_t *cond) { InitializeConditionVariable(cond); }
+void ck_cond_wait(ck_cond_t *cond, ck_mutex_t *mutex) { SleepConditionVariableCS(cond, mutex, INFINITE); }
+void ck_cond_destroy(ck_cond_t *cond) { (void) cond; }
+void ck_cond_signal(ck_cond_t *cond) { WakeConditionVariable(cond); }
+void ck_cond_broadcast(ck_cond_t *cond) { WakeAllConditionVariable(cond); }
+
+int ck_cond_timedwait(ck_cond_t *cond, ck_mutex_t *mutex, long timeoutMs) {
+    if (SleepConditionVariableCS(cond, mutex, (DWORD) timeoutMs)) {
+        return 0;
+    }
+    return 1;
+}
+
+static DWORD WINAPI ck_thread_main(LPVOID param) {
+    ThreadStart start = *(ThreadStart *) param;
+    free(param);
+    start.fn(start.arg);
+    return 0;
+}
+
+int ck_thread_start(ck_thread_fn fn, void *arg) {
+    ThreadStart *start = malloc(sizeof(ThreadStart));
+    if (!start) {
+        return -1;
+    }
+    start->fn = fn;
+    start->arg = arg;
+    HANDLE thread = CreateThread(NULL, 0, ck_thread_main, start, 0, NULL);
+    if (!thread) {
+        free(start);
+        return -1;
+    }
+    CloseHandle(thread);
+    return 0;
+}
+
+int ck_cpu_count() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int) info.dwNumberOfProcessors : 1;
+}
+
+#else
+
+void ck_mutex_init(ck_mutex_t *mutex) { pthread_mutex_init(mutex, NULL); }
+void ck_mutex_lock(ck_mutex_t *mutex) { pthread_mutex_lock(mutex); }
+void ck_mutex_unlock(ck_mutex_t *mutex) { pthread_mutex_unlock(mutex); }
+void ck_mutex_destroy(ck_mutex_t *mutex) { pthread_mutex_destroy(mutex); }
+
+void ck_cond_init(ck_cond_t *cond) { pthread_cond_init(cond, NULL); }
+void ck_cond_wait(ck_cond_t *cond, ck_mutex_t *mutex) { pthread_cond_wait(cond, mutex); }
+void ck_cond_destroy(ck_cond_t *cond) { pthread_cond_destroy(cond); }
+void ck_cond_signal(ck_cond_t *cond) { pthread_cond_signal(cond); }
+void ck_cond_broadcast(ck_cond_t *cond) { pthread_cond_broadcast(cond); }
+
+int ck_cond_timedwait(ck_cond_t *cond, ck_mutex_t *mutex, long timeoutMs) {
+    struct timeval now;
+    struct timespec deadline;
+    gettimeofday(&now, NULL);
+    deadline.tv_sec = now.tv_sec + timeoutMs / 1000;
+    deadline.tv_nsec = now.tv_usec * 1000L + (timeoutMs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return pthread_cond_timedwait(cond, mutex, &deadline) == ETIMEDOUT ? 1 : 0;
+}
+
+static void *ck_thread_main(void *param) {
+    ThreadStart start = *(ThreadStart *) param;
+    free(param);
+    start.fn(start.arg);
+    return NULL;
+}
+
+int ck_thread_start(ck_thread_fn fn, void *arg) {
+    pthread_t thread;
+    ThreadStart *start = malloc(sizeof(ThreadStart));
+    if (!start) {
+        return -1;
+    }
+    start->fn = fn;
+    start->arg = arg;
+    if (pthread_create(&thread, NULL, ck_thread_main, start) != 0) {
+        free(start);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+int ck_cpu_count() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef CKTHREAD_H
+#define CKTHREAD_H
+
+/**
+ * Minimal portable threading primitives: mutex, condition variable and detached threads.
+ */
+
+#ifdef _WIN32
+    #include <windows.h>
+
+    typedef CRITICAL_SECTION ck_mutex_t;
+    typedef CONDITION_VARIABLE ck_cond_t;
+#else
+    #include <pthread.h>
+
+    typedef pthread_mutex_t ck_mutex_t;
+    typedef pthread_cond_t ck_cond_t;
+#endif
+
+typedef void (*ck_thread_fn)(void *arg);
+
+void ck_mutex_init(ck_mutex_t *mutex);
+void ck_mutex_lock(ck_mutex_t *mutex);
+void ck_mutex_unlock(ck_mutex_t *mutex);
+void ck_mutex_destroy(ck_mutex_t *mutex);
+
+void ck_cond_init(ck_cond_t *cond);
+void ck_cond_wait(ck_cond_t *cond, ck_mutex_t *mutex);
+void ck_cond_destroy(ck_cond_t *cond);
+
+/**
+ * wait on the condition variable for at most the given time
+ *
+ * @return 0 if signalled, 1 on timeout
+ */
+int ck_cond_timedwait(ck_cond_t *cond, ck_mutex_t *mutex, long timeoutMs);
+
+void ck_cond_signal(ck_cond_t *cond);
+void ck_cond_broadcast(ck_cond_t *cond);
+
+/**
+ * start detached thread
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int ck_thread_start(ck_thread_fn fn, void *arg);
+
+/**
+ * @return number of online CPUs, at least 1
+ */
+int ck_cpu_count();
+
+#endif
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "delta.h"
+#include "xxhash.h"
+#include "arena.h"
+#include "ckthread.h"
+#include "logger.h"
+
+#ifdef _WIN32
+    #define delta_seek _fseeki64
+#else
+    #define delta_seek fseeko
+#endif
+
+#define DELTA_CACHE_SIZE 32
+
+/**
+ * Signatures of recently requested files. An entry is valid while the file keeps its size, modification time
+ * and inode, so files replaced or modified in any way are checksummed again.
+ */
+typedef struct {
+    char *path;
+    size_t blockSize;
+    long long fileSize;
+    long long mtime;
+    long long mtimeNsec;
+    long long inode;
+    int count;
+    unsigned char *checksums;
+    unsigned long lastUse;
+} DeltaCacheEntry;
+
+static DeltaCacheEntry cache[DELTA_CACHE_SIZE];
+static unsigned long cacheClock = 0;
+static ck_mutex_t cacheMutex;
+
+void delta_init() {
+    ck_mutex_init(&cacheMutex);
+}
+
+uint32_t delta_weak(const unsigned char *data, size_t size) {
+    uint32_t a = 0, b = 0;
+    size_t i;
+    for (i = 0; i < size; i++) {
+        a += data[i];
+        b += (uint32_t) (size - i) * data[i];
+    }
+    return (a & 0xffff) | (b & 0xffff) << 16;
+}
+
+static void put_le(unsigned char *p, uint64_t v, int bytes) {
+    int i;
+    for (i = 0; i < bytes; i++) {
+        p[i] = (unsigned char) (v >> (8 * i));
+    }
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static long long mtime_nsec(const struct stat *st) {
+#ifdef __linux__
+    return st->st_mtim.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+static int cache_matches(const DeltaCacheEntry *entry, const char *path, size_t blockSize, const struct stat *st) {
+    return entry->path && entry->blockSize == blockSize && strcmp(entry->path, path) == 0 &&
+           entry->fileSize == (long long) st->st_size && entry->mtime == (long long) st->st_mtime &&
+           entry->mtimeNsec == mtime_nsec(st) && entry->inode == (long long) st->st_ino;
+}
+
+static int cache_get(const char *path, size_t blockSize, const struct stat *st, DeltaSignature *signature) {
+    int i, found = 0;
+    ck_mutex_lock(&cacheMutex);
+    for (i = 0; i < DELTA_CACHE_SIZE; i++) {
+        if (cache_matches(&cache[i], path, blockSize, st)) {
+            size_t size = (size_t) cache[i].count * DELTA_CHECKSUM_SIZE;
+            signature->checksums = ck_alloc(size ? size : 1);
+            if (signature->checksums) {
+                memcpy(signature->checksums, cache[i].checksums, size);
+                signature->count = cache[i].count;
+                cache[i].lastUse = ++cacheClock;
+                found = 1;
+            }
+            break;
+        }
+    }
+    ck_mutex_unlock(&cacheMutex);
+    return found;
+}
+
+static void cache_put(const char *path, size_t blockSize, const struct stat *st, const DeltaSignature *signature) {
+    int i, victim = 0;
+    size_t size = (size_t) signature->count * DELTA_CHECKSUM_SIZE;
+    unsigned char *checksums = malloc(size ? size : 1);
+    char *pathCopy = strdup(path);
+    if (!checksums || !pathCopy) {
+        free(checksums);
+        free(pathCopy);
+        return;
+    }
+    memcpy(checksums, signature->checksums, size);
+
+    ck_mutex_lock(&cacheMutex);
+    for (i = 0; i < DELTA_CACHE_SIZE; i++) {
+        if (!cache[i].path) {
+            victim = i;
+            break;
+        }
+        if (cache[i].lastUse < cache[victim].lastUse) {
+            victim = i;
+        }
+    }
+    DeltaCacheEntry *entry = &cache[victim];
+    free(entry->path);
+    free(entry->checksums);
+    entry->path = pathCopy;
+    entry->blockSize = blockSize;
+    entry->fileSize = (long long) st->st_size;
+    entry->mtime = (long long) st->st_mtime;
+    entry->mtimeNsec = mtime_nsec(st);
+    entry->inode = (long long) st->st_ino;
+    entry->count = signature->count;
+    entry->checksums = checksums;
+    entry->lastUse = ++cacheClock;
+    ck_mutex_unlock(&cacheMutex);
+}
+
+int delta_signature(const char *path, size_t blockSize, DeltaSignature *signature) {
+    struct stat st;
+    int i;
+
+    memset(signature, 0, sizeof(DeltaSignature));
+    signature->blockSize = blockSize;
+    if (stat(path, &st) != 0) {
+        return -1;
+    }
+    signature->fileSize = (long long) st.st_size;
+    if (cache_get(path, blockSize, &st, signature)) {
+        LOG_DEBUG("Signature of %s taken from cache", path);
+        return 0;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return -1;
+    }
+    int count = (int) ((signature->fileSize + blockSize - 1) / blockSize);
+    unsigned char *block = malloc(blockSize);
+    signature->checksums = ck_alloc((size_t) count * DELTA_CHECKSUM_SIZE + 1);
+    if (!block || !signature->checksums) {
+        free(block);
+        fclose(file);
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        size_t n = fread(block, 1, blockSize, file);
+        if (n == 0) {
+            break;
+        }
+        unsigned char *checksum = signature->checksums + (size_t) i * DELTA_CHECKSUM_SIZE;
+        put_le(checksum, delta_weak(block, n), 4);
+        put_le(checksum + 4, xxh64(block, n, 0), 8);
+    }
+    free(block);
+    fclose(file);
+    if (i != count) {
+        // file changed while reading
+        return -1;
+    }
+    signature->count = count;
+    cache_put(path, blockSize, &st, signature);
+    return 0;
+}
+
+static int copy_blocks(FILE *basis, long long basisSize, size_t blockSize, uint32_t block, uint32_t count,
+                       unsigned char *buffer, DeltaOutput out, void *ctx) {
+    long long offset = (long long) block * blockSize;
+    long long end = offset + (long long) count * blockSize;
+    if (end > basisSize) {
+        // only the last block may be shorter
+        if (end - basisSize >= (long long) blockSize) {
+            return -1;
+        }
+        end = basisSize;
+    }
+    if (offset >= end || 0 != delta_seek(basis, offset, SEEK_SET)) {
+        return -1;
+    }
+    while (offset < end) {
+        size_t chunk = end - offset < (long long) blockSize ? (size_t) (end - offset) : blockSize;
+        if (fread(buffer, 1, chunk, basis) != chunk || 0 != out(ctx, buffer, chunk)) {
+            return -1;
+        }
+        offset += chunk;
+    }
+    return 0;
+}
+
+int delta_apply(const char *basisPath, size_t blockSize, const unsigned char *delta, size_t deltaSize,
+                DeltaOutput out, void *ctx, const char **error) {
+    struct stat st;
+    FILE *basis = NULL;
+    long long basisSize = 0;
+    unsigned char *buffer = NULL;
+    size_t pos = 0;
+    int result = 0;
+
+    if (basisPath && stat(basisPath, &st) == 0) {
+        basis = fopen(basisPath, "rb");
+        basisSize = (long long) st.st_size;
+    }
+
+    while (pos < deltaSize && 0 == result) {
+        unsigned char op = delta[pos++];
+        if (DELTA_OP_COPY == op && pos + 8 <= deltaSize) {
+            uint32_t block = get_le32(delta + pos);
+            uint32_t count = get_le32(delta + pos + 4);
+            pos += 8;
+            if (!basis) {
+                *error = "Block copy without existing file";
+                result = -1;
+            } else if (!buffer && !(buffer = malloc(blockSize))) {
+                *error = "Memory not allocated for delta block";
+                result = -1;
+            } else if (0 != copy_blocks(basis, basisSize, blockSize, block, count, buffer, out, ctx)) {
+                *error = "Invalid block reference in delta";
+                result = -1;
+            }
+        } else if (DELTA_OP_LITERAL == op && pos + 4 <= deltaSize) {
+            uint32_t length = get_le32(delta + pos);
+            pos += 4;
+            if (length > deltaSize - pos) {
+                *error = "Truncated literal in delta";
+                result = -1;
+            } else if (0 != out(ctx, delta + pos, length)) {
+                *error = "Failed to write file";
+                result = -1;
+            }
+            pos += length;
+        } else {
+            *error = "Invalid delta operation";
+            result = -1;
+        }
+    }
+
+    free(buffer);
+    if (basis) {
+        fclose(basis);
+    }
+    return result;
+}
@@ -0,0 +1,62 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * rsync-style delta transfer.
+ *
+ * The signature of a file is one checksum per block of block_size bytes (the last block may be shorter),
+ * DELTA_CHECKSUM_SIZE bytes each, little endian:
+ *   uint32 weak    - rolling checksum, a = sum(x[i]) mod 2^16, b = sum((len - i) * x[i]) mod 2^16, weak = a | b << 16
+ *   uint64 strong  - XXH64 of the block, seed 0
+ *
+ * The delta is a sequence of operations, little endian:
+ *   0x01 uint32 block uint32 count   - copy count blocks of the existing file starting from the given block
+ *   0x02 uint32 length bytes[length] - literal data
+ */
+
+#define DELTA_CHECKSUM_SIZE 12
+#define DELTA_DEFAULT_BLOCK_SIZE 4096
+#define DELTA_MIN_BLOCK_SIZE 64
+#define DELTA_MAX_BLOCK_SIZE (1 << 20)
+
+#define DELTA_OP_COPY 0x01
+#define DELTA_OP_LITERAL 0x02
+
+typedef struct {
+    size_t blockSize;
+    long long fileSize;
+    int count;
+    unsigned char *checksums;   /* count * DELTA_CHECKSUM_SIZE bytes, allocated with ck_alloc */
+} DeltaSignature;
+
+typedef int (*DeltaOutput)(void *ctx, const void *data, size_t size);
+
+void delta_init();
+
+/**
+ * @return weak (rolling) checksum of the block
+ */
+uint32_t delta_weak(const unsigned char *data, size_t size);
+
+/**
+ * compute the signature of the file, or take it from the cache if the file was not modified since
+ *
+ * @return 0 on success, -1 if the file could not be read
+ */
+int delta_signature(const char *path, size_t blockSize, DeltaSignature *signature);
+
+/**
+ * rebuild the new file from the existing file and the delta
+ *
+ * @param basisPath existing file, may be missing if the delta has literals only
+ * @param out receives the content of the new file
+ * @param error set to a description of the failure
+ * @return 0 on success, -1 otherwise
+ */
+int delta_apply(const char *basisPath, size_t blockSize, const unsigned char *delta, size_t deltaSize,
+                DeltaOutput out, void *ctx, const char **error);
+
+#endif
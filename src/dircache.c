@@ -0,0 +1,325 @@
+#ifdef __linux__
+    #define _GNU_SOURCE     /* O_DIRECTORY, O_CLOEXEC */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+    #include <direct.h>
+    #include <io.h>
+#else
+    #include <unistd.h>
+    #if defined(__linux__) && defined(__has_include)
+        #if __has_include(<linux/openat2.h>)
+            #include <sys/syscall.h>
+            #include <linux/openat2.h>
+            #define DIRCACHE_OPENAT2
+        #endif
+    #endif
+#endif
+
+#include "dircache.h"
+#include "paths.h"
+#include "arena.h"
+#include "ckthread.h"
+
+#define DIRCACHE_BUCKETS 256
+#define DIRCACHE_DIR_MODE 0700
+
+static char *baseDirPath = NULL;
+static int capacity = 0;
+static int count = 0;
+static DirHandle root;          /* the files directory, never evicted */
+static DirHandle *buckets[DIRCACHE_BUCKETS];
+static DirHandle *head = NULL;  /* most recently used */
+static DirHandle *tail = NULL;
+static ck_mutex_t cacheMutex;
+#ifdef DIRCACHE_OPENAT2
+static int openat2Supported = 1;
+#endif
+
+static unsigned int path_bucket(const char *path) {
+    unsigned int h = 2166136261u;
+    while (*path) {
+        h = (h ^ (unsigned char) *path++) * 16777619u;
+    }
+    return h & (DIRCACHE_BUCKETS - 1);
+}
+
+static void free_handle(DirHandle *dir) {
+#ifndef _WIN32
+    close(dir->fd);
+#endif
+    free(dir->path);
+    free(dir);
+}
+
+static void list_remove(DirHandle *dir) {
+    if (dir->prev) {
+        dir->prev->next = dir->next;
+    } else {
+        head = dir->next;
+    }
+    if (dir->next) {
+        dir->next->prev = dir->prev;
+    } else {
+        tail = dir->prev;
+    }
+    dir->prev = dir->next = NULL;
+}
+
+static void list_push_front(DirHandle *dir) {
+    dir->prev = NULL;
+    dir->next = head;
+    if (head) {
+        head->prev = dir;
+    }
+    head = dir;
+    if (!tail) {
+        tail = dir;
+    }
+}
+
+static DirHandle *find_handle(const char *path) {
+    DirHandle *dir;
+    for (dir = buckets[path_bucket(path)]; dir; dir = dir->chain) {
+        if (strcmp(dir->path, path) == 0) {
+            return dir;
+        }
+    }
+    return NULL;
+}
+
+/* take the handle out of the cache, call with cacheMutex locked */
+static void unlink_handle(DirHandle *dir) {
+    DirHandle **link = &buckets[path_bucket(dir->path)];
+    while (*link != dir) {
+        link = &(*link)->chain;
+    }
+    *link = dir->chain;
+    list_remove(dir);
+    count--;
+    dir->cached = 0;
+    if (0 == dir->refs) {
+        free_handle(dir);
+    }
+}
+
+static DirHandle *new_handle(const char *path, int fd) {
+    DirHandle *dir = calloc(1, sizeof(DirHandle));
+    if (!dir || !(dir->path = strdup(path))) {
+        free(dir);
+#ifndef _WIN32
+        close(fd);
+#endif
+        return NULL;
+    }
+    dir->fd = fd;
+    dir->refs = 1;
+    if (0 == capacity) {
+        return dir;
+    }
+
+    ck_mutex_lock(&cacheMutex);
+    DirHandle *previous = find_handle(path);
+    if (previous) {
+        // resolved by another thread meanwhile
+        unlink_handle(previous);
+    }
+    unsigned int bucket = path_bucket(path);
+    dir->chain = buckets[bucket];
+    buckets[bucket] = dir;
+    dir->cached = 1;
+    list_push_front(dir);
+    count++;
+    while (count > capacity) {
+        unlink_handle(tail);
+    }
+    ck_mutex_unlock(&cacheMutex);
+    return dir;
+}
+
+#ifndef _WIN32
+
+static int open_beneath(int dirFd, const char *path, int flags) {
+#ifdef DIRCACHE_OPENAT2
+    if (openat2Supported) {
+        struct open_how how;
+        memset(&how, 0, sizeof(how));
+        how.flags = (unsigned long long) (flags | O_CLOEXEC);
+        how.resolve = RESOLVE_BENEATH;
+        int fd = (int) syscall(SYS_openat2, dirFd, path, &how, sizeof(how));
+        if (fd >= 0 || (ENOSYS != errno && EPERM != errno)) {
+            return fd;
+        }
+        // older kernel or filtered system call, ".." is still rejected by path_valid
+        openat2Supported = 0;
+    }
+#endif
+    return openat(dirFd, path, flags | O_CLOEXEC);
+}
+
+static DirHandle *get_handle(const char *path, int create);
+
+/* mkdirat in the parent, resolved (and created) through the cache as well */
+static int create_dir(const char *path) {
+    const char *slash = strrchr(path, PATH_SEPARATOR);
+    DirHandle *parent = &root;
+    const char *name = path;
+    if (slash) {
+        char *parentPath = ck_alloc(slash - path + 1);
+        if (!parentPath) {
+            return -1;
+        }
+        memcpy(parentPath, path, slash - path);
+        parentPath[slash - path] = '\0';
+        parent = get_handle(parentPath, 1);
+        name = slash + 1;
+    }
+    if (!parent) {
+        return -1;
+    }
+    int result = mkdirat(parent->fd, name, DIRCACHE_DIR_MODE);
+    int error = errno;
+    dircache_release(parent);
+    if (0 != result && EEXIST != error) {
+        errno = error;
+        return -1;
+    }
+    return open_beneath(root.fd, path, O_RDONLY | O_DIRECTORY);
+}
+
+/* the directory of the handle was removed */
+static int is_removed(DirHandle *dir) {
+    struct stat st;
+    return fstat(dir->fd, &st) != 0 || 0 == st.st_nlink;
+}
+
+static DirHandle *get_handle(const char *path, int create) {
+    ck_mutex_lock(&cacheMutex);
+    DirHandle *dir = find_handle(path);
+    if (dir) {
+        list_remove(dir);
+        list_push_front(dir);
+        dir->refs++;
+    }
+    ck_mutex_unlock(&cacheMutex);
+    if (dir) {
+        // writers check the directory is still there, it would not be created again otherwise
+        if (!create || !is_removed(dir)) {
+            return dir;
+        }
+        ck_mutex_lock(&cacheMutex);
+        if (dir->cached) {
+            unlink_handle(dir);
+        }
+        ck_mutex_unlock(&cacheMutex);
+        dircache_release(dir);
+    }
+
+    int fd = open_beneath(root.fd, path, O_RDONLY | O_DIRECTORY);
+    if (fd < 0 && ENOENT == errno && create) {
+        fd = create_dir(path);
+    }
+    return fd < 0 ? NULL : new_handle(path, fd);
+}
+
+#else
+
+static DirHandle *get_handle(const char *path, int create) {
+    struct stat st;
+    char *fullPath = path_join(baseDirPath, path);
+    if (!fullPath) {
+        return NULL;
+    }
+    if (create) {
+        char *p;
+        for (p = fullPath + strlen(baseDirPath) + 1; *p; p++) {
+            if (PATH_SEPARATOR == *p) {
+                *p = '\0';
+                _mkdir(fullPath);
+                *p = PATH_SEPARATOR;
+            }
+        }
+        _mkdir(fullPath);
+    }
+    if (stat(fullPath, &st) != 0) {
+        return NULL;
+    }
+    if (!(st.st_mode & S_IFDIR)) {
+        errno = ENOTDIR;
+        return NULL;
+    }
+    return new_handle(path, -1);
+}
+
+#endif
+
+int dircache_init(const char *baseDir, int size) {
+    ck_mutex_init(&cacheMutex);
+    capacity = size;
+    baseDirPath = strdup(baseDir);
+    root.path = "";
+    root.fd = -1;
+#ifndef _WIN32
+    root.fd = open(baseDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root.fd < 0) {
+        return -1;
+    }
+#endif
+    return baseDirPath ? 0 : -1;
+}
+
+DirHandle *dircache_get(const char *path, int create) {
+    if (!path || !*path) {
+        return &root;
+    }
+    if (!path_valid(path)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    char *key = path_normalize(path);
+    if (!key) {
+        return NULL;
+    }
+    return *key ? get_handle(key, create) : &root;
+}
+
+void dircache_release(DirHandle *dir) {
+    if (&root == dir) {
+        return;
+    }
+    ck_mutex_lock(&cacheMutex);
+    dir->refs--;
+    int unused = 0 == dir->refs && !dir->cached;
+    ck_mutex_unlock(&cacheMutex);
+    if (unused) {
+        free_handle(dir);
+    }
+}
+
+int dircache_open(DirHandle *dir, const char *name) {
+    if (!path_valid(name)) {
+        errno = EINVAL;
+        return -1;
+    }
+#ifdef _WIN32
+    char *path = path_join(baseDirPath, path_join(dir->path, name));
+    return path ? _open(path, _O_RDONLY | _O_BINARY) : -1;
+#else
+    return open_beneath(dir->fd, name, O_RDONLY);
+#endif
+}
+
+void dircache_invalidate_all() {
+    ck_mutex_lock(&cacheMutex);
+    while (tail) {
+        unlink_handle(tail);
+    }
+    ck_mutex_unlock(&cacheMutex);
+}
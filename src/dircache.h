@@ -0,0 +1,53 @@
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+/**
+ * Bounded LRU cache of open directory handles under the files directory.
+ *
+ * Request directories (extra_path) are resolved relative to the handle of the files directory and kept open,
+ * so that a directory used again needs no path walk and no mkdir of its components: directories are created
+ * with mkdirat on a cache miss only. Paths are confined to the files directory, ".." components are rejected
+ * and symbolic links may not lead outside of it (RESOLVE_BENEATH where openat2 is available).
+ *
+ * Handles are reference counted, an evicted handle stays open until released. Windows keeps the directory
+ * path only and resolves it on every use.
+ */
+
+typedef struct DirHandle {
+    char *path;             /* relative to the files directory, "" for the files directory itself */
+    int fd;                 /* -1 on Windows */
+    int refs;
+    int cached;             /* still in the cache, closed on last release otherwise */
+    struct DirHandle *prev;
+    struct DirHandle *next;
+    struct DirHandle *chain;
+} DirHandle;
+
+/**
+ * @param capacity number of directory handles kept open, 0 keeps none beyond the files directory
+ * @return 0 on success, -1 if the files directory could not be opened
+ */
+int dircache_init(const char *baseDir, int capacity);
+
+/**
+ * @param path directory relative to the files directory, NULL or "" for the files directory (see paths.h)
+ * @param create create the directory and its parents when missing
+ * @return referenced handle, NULL if the path is invalid or the directory does not exist (errno set)
+ */
+DirHandle *dircache_get(const char *path, int create);
+
+void dircache_release(DirHandle *dir);
+
+/**
+ * open the file for reading, the name is resolved beneath the directory
+ *
+ * @return file descriptor, -1 on failure (errno set)
+ */
+int dircache_open(DirHandle *dir, const char *name);
+
+/**
+ * drop every cached handle, called when directories may have been removed or renamed behind the cache
+ */
+void dircache_invalidate_all();
+
+#endif
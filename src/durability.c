@@ -0,0 +1,187 @@
+#ifdef __linux__
+    #define _GNU_SOURCE     /* syncfs */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <io.h>
+#else
+    #include <unistd.h>
+    #include <fcntl.h>
+#endif
+
+#include "durability.h"
+#include "ckthread.h"
+#include "logger.h"
+
+static int durabilityMode = DURABILITY_NONE;
+static int batchWindowMs = 0;
+static int groupCommitRunning = 0;
+
+static ck_mutex_t commitMutex;
+static ck_cond_t commitRequested;
+static ck_cond_t commitDone;
+static unsigned long requestedCommits = 0;
+static unsigned long completedCommits = 0;
+static int lastCommitResult = 0;
+
+#ifndef _WIN32
+static int baseDirFd = -1;
+#endif
+
+int durability_parse(const char *name) {
+    if (strcmp(name, "none") == 0) {
+        return DURABILITY_NONE;
+    }
+    if (strcmp(name, "fdatasync") == 0) {
+        return DURABILITY_FDATASYNC;
+    }
+    if (strcmp(name, "batched") == 0) {
+        return DURABILITY_BATCHED;
+    }
+    return -1;
+}
+
+static int sync_data(int fd) {
+#ifdef _WIN32
+    return _commit(fd);
+#elif defined(__APPLE__)
+    return fsync(fd);
+#else
+    return fdatasync(fd);
+#endif
+}
+
+/* sync the directory entry of the path (rename/link), nothing to do on Windows */
+static int sync_parent_dir(const char *path) {
+#ifdef _WIN32
+    return 0;
+#else
+    const char *slash = strrchr(path, '/');
+    char *dir = slash ? strndup(path, slash == path ? 1 : slash - path) : strdup(".");
+    if (!dir) {
+        return -1;
+    }
+    int fd = open(dir, O_RDONLY);
+    free(dir);
+    if (fd < 0) {
+        return -1;
+    }
+    int result = fsync(fd);
+    close(fd);
+    return result;
+#endif
+}
+
+static int sync_file_system() {
+#if defined(__linux__)
+    return syncfs(baseDirFd);
+#elif defined(_WIN32)
+    return -1;      /* no group commit on Windows, see durability_init */
+#else
+    sync();
+    return 0;
+#endif
+}
+
+/* one sync of the whole file system covers every writer that asked before it started */
+static void group_commit_thread(void *arg) {
+    while (1) {
+        ck_mutex_lock(&commitMutex);
+        while (requestedCommits == completedCommits) {
+            ck_cond_wait(&commitRequested, &commitMutex);
+        }
+        ck_mutex_unlock(&commitMutex);
+
+        if (batchWindowMs > 0) {
+            // let more writers join the batch
+#ifdef _WIN32
+            Sleep(batchWindowMs);
+#else
+            usleep(batchWindowMs * 1000);
+#endif
+        }
+
+        ck_mutex_lock(&commitMutex);
+        unsigned long batch = requestedCommits;
+        ck_mutex_unlock(&commitMutex);
+
+        int result = sync_file_system();
+
+        ck_mutex_lock(&commitMutex);
+        completedCommits = batch;
+        lastCommitResult = result;
+        ck_cond_broadcast(&commitDone);
+        ck_mutex_unlock(&commitMutex);
+    }
+}
+
+static int group_commit() {
+    ck_mutex_lock(&commitMutex);
+    unsigned long ticket = ++requestedCommits;
+    ck_cond_signal(&commitRequested);
+    while (completedCommits < ticket) {
+        ck_cond_wait(&commitDone, &commitMutex);
+    }
+    int result = lastCommitResult;
+    ck_mutex_unlock(&commitMutex);
+    return result;
+}
+
+void durability_init(int mode, int batchMs, const char *baseDir, int groupCommit) {
+    durabilityMode = mode;
+    batchWindowMs = batchMs;
+#ifdef _WIN32
+    if (DURABILITY_BATCHED == mode) {
+        // flushing a whole volume takes administrator rights: commit every file on its own instead
+        LOG_WARN("Batched durability is not supported on Windows, every file is synced as with fdatasync");
+        durabilityMode = DURABILITY_FDATASYNC;
+        return;
+    }
+#endif
+    if (DURABILITY_BATCHED != mode || !groupCommit) {
+        return;
+    }
+#ifndef _WIN32
+    baseDirFd = open(baseDir, O_RDONLY);
+    if (baseDirFd < 0) {
+        perror("[WARN]: Could not open files directory for group commit");
+        return;
+    }
+#endif
+    ck_mutex_init(&commitMutex);
+    ck_cond_init(&commitRequested);
+    ck_cond_init(&commitDone);
+    if (0 > ck_thread_start(group_commit_thread, NULL)) {
+        perror("[WARN]: Group commit thread not started");
+        return;
+    }
+    groupCommitRunning = 1;
+}
+
+int durability_file_written(int fd) {
+    if (DURABILITY_FDATASYNC == durabilityMode || (DURABILITY_BATCHED == durabilityMode && !groupCommitRunning)) {
+        return sync_data(fd);
+    }
+    return 0;
+}
+
+int durability_file_renamed(const char *path) {
+    if (DURABILITY_NONE == durabilityMode) {
+        return 0;
+    }
+    if (groupCommitRunning) {
+        return group_commit();
+    }
+    return sync_parent_dir(path);
+}
+
+int durability_entry_added(const char *path) {
+    if (DURABILITY_NONE == durabilityMode || groupCommitRunning) {
+        return 0;
+    }
+    return sync_parent_dir(path);
+}
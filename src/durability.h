@@ -0,0 +1,54 @@
+#ifndef DURABILITY_H
+#define DURABILITY_H
+
+/**
+ * Durability of written files, selected with the "durability" configuration attribute:
+ *   DURABILITY_NONE      - "none", write-behind: acknowledged once the data is in the page cache
+ *   DURABILITY_FDATASYNC - "fdatasync", data of every file and its directory entry synced before acknowledging
+ *   DURABILITY_BATCHED   - "batched", group commit: writers finishing within batch_commit_ms share one file
+ *                          system sync (thread server mode; a forked child syncs its own file like fdatasync)
+ *
+ * Windows has no file system sync for a non-administrator process: "batched" falls back to "fdatasync" there,
+ * every file is committed with _commit. Directory entries are not synced on Windows, NTFS journals them.
+ */
+
+#define DURABILITY_NONE 0
+#define DURABILITY_FDATASYNC 1
+#define DURABILITY_BATCHED 2
+
+/**
+ * @return DURABILITY_* mode of the configuration value, -1 if unknown
+ */
+int durability_parse(const char *name);
+
+/**
+ * @param baseDir directory of the synced file system
+ * @param groupCommit start the group commit thread (long living process only)
+ */
+void durability_init(int mode, int batchMs, const char *baseDir, int groupCommit);
+
+/**
+ * called when the content of a temp file is written, before it is closed
+ *
+ * @param fd descriptor of the file, buffered data flushed
+ * @return 0 on success, -1 if the data could not be synced
+ */
+int durability_file_written(int fd);
+
+/**
+ * called when the file is renamed to its final path, before the write is acknowledged
+ *
+ * @return 0 on success, -1 if the file could not be synced
+ */
+int durability_file_renamed(const char *path);
+
+/**
+ * called when a file or directory is created or renamed into place ahead of the rename acknowledging the
+ * write, a blob before the file linked to it: its directory entry is synced now where every rename is synced
+ * on its own, the group commit of the later rename covers it otherwise
+ *
+ * @return 0 on success, -1 if the directory could not be synced
+ */
+int durability_entry_added(const char *path);
+
+#endif
@@ -0,0 +1,537 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+    #include <unistd.h>
+#endif
+
+#ifdef __linux__
+    #include <sys/inotify.h>
+    #define INDEX_WATCH_MASK (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | \
+                              IN_MOVED_FROM | IN_MOVED_TO)
+    #define INDEX_EVENT_BUFFER_SIZE 65536
+#endif
+
+#include "fileindex.h"
+#include "workspace.h"
+#include "paths.h"
+#include "arena.h"
+#include "ckthread.h"
+#include "logger.h"
+
+#define INDEX_INITIAL_BUCKETS 1024
+
+typedef struct IndexEntry {
+    char *name;
+    unsigned int key;
+    long long size;
+    long long mtime;
+    long long mtimeNsec;
+    long long inode;
+    char hash[FILESTORE_HASH_SIZE];
+    int hashValid;
+    unsigned long generation;
+    struct IndexEntry *next;
+} IndexEntry;
+
+static char *rootDir = NULL;
+static size_t rootLen = 0;
+static IndexEntry **buckets = NULL;
+static size_t bucketCount = 0;
+static size_t entryCount = 0;
+static unsigned long generation = 0;
+static int indexValid = 0;      /* the index reflects the tree, no need to walk it */
+static ck_mutex_t indexMutex;
+
+#ifdef __linux__
+static int inotifyFd = -1;
+static char **watchedDirs = NULL;   /* directory of each watch descriptor */
+static int watchedCapacity = 0;
+#endif
+
+static unsigned int name_key(const char *name) {
+    unsigned int h = 2166136261u;
+    while (*name) {
+        h = (h ^ (unsigned char) *name++) * 16777619u;
+    }
+    return h;
+}
+
+static long long mtime_nsec(const struct stat *st) {
+#ifdef __linux__
+    return st->st_mtim.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+static int same_identity(const IndexEntry *entry, const struct stat *st) {
+    return entry->size == (long long) st->st_size && entry->mtime == (long long) st->st_mtime &&
+           entry->mtimeNsec == mtime_nsec(st) && entry->inode == (long long) st->st_ino;
+}
+
+static IndexEntry *find_entry(const char *name) {
+    unsigned int key = name_key(name);
+    IndexEntry *entry;
+    if (!buckets) {
+        return NULL;
+    }
+    for (entry = buckets[key & (bucketCount - 1)]; entry; entry = entry->next) {
+        if (entry->key == key && strcmp(entry->name, name) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void grow_table() {
+    size_t newCount = bucketCount ? bucketCount * 2 : INDEX_INITIAL_BUCKETS;
+    IndexEntry **newBuckets = calloc(newCount, sizeof(IndexEntry *));
+    size_t i;
+    if (!newBuckets) {
+        return;
+    }
+    for (i = 0; i < bucketCount; i++) {
+        IndexEntry *entry = buckets[i];
+        while (entry) {
+            IndexEntry *next = entry->next;
+            entry->next = newBuckets[entry->key & (newCount - 1)];
+            newBuckets[entry->key & (newCount - 1)] = entry;
+            entry = next;
+        }
+    }
+    free(buckets);
+    buckets = newBuckets;
+    bucketCount = newCount;
+}
+
+static void free_entry(IndexEntry *entry) {
+    free(entry->name);
+    free(entry);
+}
+
+/* add or refresh the entry, the cached hash is kept only if the file is the same */
+static IndexEntry *upsert_entry(const char *name, const struct stat *st) {
+    IndexEntry *entry = find_entry(name);
+    if (!entry) {
+        if (entryCount >= bucketCount) {
+            grow_table();
+        }
+        if (!buckets || !(entry = calloc(1, sizeof(IndexEntry))) || !(entry->name = strdup(name))) {
+            free(entry);
+            return NULL;
+        }
+        entry->key = name_key(name);
+        entry->next = buckets[entry->key & (bucketCount - 1)];
+        buckets[entry->key & (bucketCount - 1)] = entry;
+        entryCount++;
+    } else if (!same_identity(entry, st)) {
+        entry->hashValid = 0;
+    }
+    entry->size = (long long) st->st_size;
+    entry->mtime = (long long) st->st_mtime;
+    entry->mtimeNsec = mtime_nsec(st);
+    entry->inode = (long long) st->st_ino;
+    entry->generation = generation;
+    return entry;
+}
+
+/* remove the entry with the given name, and all entries below it if it is a directory */
+static void remove_entries(const char *name) {
+    size_t len = strlen(name), i;
+    for (i = 0; i < bucketCount; i++) {
+        IndexEntry **link = &buckets[i];
+        while (*link) {
+            IndexEntry *entry = *link;
+            if (strncmp(entry->name, name, len) == 0 && (entry->name[len] == '\0' || entry->name[len] == PATH_SEPARATOR)) {
+                *link = entry->next;
+                free_entry(entry);
+                entryCount--;
+            } else {
+                link = &entry->next;
+            }
+        }
+    }
+}
+
+/* remove entries not seen by the last walk */
+static void sweep_entries() {
+    size_t i;
+    for (i = 0; i < bucketCount; i++) {
+        IndexEntry **link = &buckets[i];
+        while (*link) {
+            IndexEntry *entry = *link;
+            if (entry->generation != generation) {
+                *link = entry->next;
+                free_entry(entry);
+                entryCount--;
+            } else {
+                link = &entry->next;
+            }
+        }
+    }
+}
+
+static void watch_dir(const char *name) {
+#ifdef __linux__
+    if (inotifyFd < 0) {
+        return;
+    }
+    char *path = path_join(rootDir, name);
+    int wd = path ? inotify_add_watch(inotifyFd, path, INDEX_WATCH_MASK) : -1;
+    ck_free(path);
+    if (wd < 0) {
+        // e.g. out of watches, the index can not be trusted any more
+        indexValid = 0;
+        return;
+    }
+    if (wd >= watchedCapacity) {
+        int capacity = wd * 2 + 16;
+        char **dirs = realloc(watchedDirs, capacity * sizeof(char *));
+        if (!dirs) {
+            return;
+        }
+        memset(dirs + watchedCapacity, 0, (capacity - watchedCapacity) * sizeof(char *));
+        watchedDirs = dirs;
+        watchedCapacity = capacity;
+    }
+    free(watchedDirs[wd]);
+    watchedDirs[wd] = strdup(name);
+#endif
+}
+
+static int skip_name(const char *dir, const char *name) {
+    return strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+           ('\0' == dir[0] && (strcmp(name, FILESTORE_BLOB_DIR) == 0 || strcmp(name, WORKSPACE_TRASH_DIR) == 0));
+}
+
+static void index_path(const char *name);
+
+static void scan_entry(void *ctx, const char *entry) {
+    const char *dir = ctx;
+    if (!skip_name(dir, entry)) {
+        char *name = path_join(dir, entry);
+        if (name) {
+            index_path(name);
+            ck_free(name);
+        }
+    }
+}
+
+static void scan_dir(const char *dir) {
+    watch_dir(dir);
+    char *path = path_join(rootDir, dir);
+    if (path) {
+        path_for_each_entry(path, scan_entry, (void *) dir);
+    }
+    ck_free(path);
+}
+
+/* add the file, or the whole directory, with the given name */
+static void index_path(const char *name) {
+    struct stat st;
+    char *path = path_join(rootDir, name);
+    int found = path && stat(path, &st) == 0;
+    ck_free(path);
+    if (!found) {
+        remove_entries(name);
+    } else if (S_ISDIR(st.st_mode)) {
+        scan_dir(name);
+    } else if (S_ISREG(st.st_mode)) {
+        upsert_entry(name, &st);
+    }
+}
+
+static int watching() {
+#ifdef __linux__
+    return inotifyFd >= 0;
+#else
+    return 0;
+#endif
+}
+
+/* walk the tree unless the watcher keeps the index up to date, call with indexMutex locked */
+static void ensure_fresh() {
+    if (indexValid) {
+        return;
+    }
+    generation++;
+    indexValid = watching();
+    scan_dir("");
+    sweep_entries();
+}
+
+#ifdef __linux__
+static void handle_event(const struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        LOG_WARN("File index events overflow, the tree will be walked again");
+        indexValid = 0;
+        return;
+    }
+    if (event->wd < 0 || event->wd >= watchedCapacity || !watchedDirs[event->wd]) {
+        return;
+    }
+    char *dir = watchedDirs[event->wd];
+    if (event->mask & IN_IGNORED) {
+        free(dir);
+        watchedDirs[event->wd] = NULL;
+        return;
+    }
+    if (0 == event->len || skip_name(dir, event->name)) {
+        return;
+    }
+    char *name = path_join(dir, event->name);
+    if (!name) {
+        indexValid = 0;
+        return;
+    }
+    if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        remove_entries(name);
+    } else {
+        index_path(name);
+    }
+    ck_free(name);
+}
+
+/* the events can not be read any more: back to walking the tree for every listing */
+static void stop_watching(const char *reason) {
+    LOG_ERROR("File index watcher stopped, %s", reason);
+    ck_mutex_lock(&indexMutex);
+    close(inotifyFd);
+    inotifyFd = -1;
+    indexValid = 0;
+    ck_mutex_unlock(&indexMutex);
+}
+
+static void watcher_thread(void *arg) {
+    char *buffer = malloc(INDEX_EVENT_BUFFER_SIZE);
+    if (!buffer) {
+        stop_watching("no memory for the events");
+        return;
+    }
+    while (1) {
+        ssize_t n = read(inotifyFd, buffer, INDEX_EVENT_BUFFER_SIZE);
+        if (n < 0 && EINTR == errno) {
+            continue;
+        }
+        if (n <= 0) {
+            stop_watching(n < 0 ? strerror(errno) : "no more events");
+            free(buffer);
+            return;
+        }
+        ck_mutex_lock(&indexMutex);
+        char *p = buffer;
+        while (p < buffer + n) {
+            struct inotify_event *event = (struct inotify_event *) p;
+            handle_event(event);
+            p += sizeof(struct inotify_event) + event->len;
+        }
+        ck_mutex_unlock(&indexMutex);
+    }
+}
+#endif
+
+void fileindex_init(const char *baseDir, int watch) {
+    ck_mutex_init(&indexMutex);
+    rootDir = strdup(baseDir);
+    rootLen = strlen(rootDir);
+    while (rootLen > 1 && rootDir[rootLen - 1] == PATH_SEPARATOR) {
+        rootDir[--rootLen] = '\0';
+    }
+#ifdef __linux__
+    if (watch) {
+        inotifyFd = inotify_init();
+        if (inotifyFd < 0 || 0 > ck_thread_start(watcher_thread, NULL)) {
+            perror("[WARN]: File index watcher not started");
+            inotifyFd = -1;
+        }
+    }
+#endif
+}
+
+/* name relative to the root without repeated separators, NULL if the path is not under the root */
+static char *relative_name(const char *path) {
+    if (strncmp(path, rootDir, rootLen) != 0 || (path[rootLen] != '\0' && path[rootLen] != PATH_SEPARATOR)) {
+        return NULL;
+    }
+    const char *p = path + rootLen;
+    char *name = malloc(strlen(p) + 1);
+    char *out = name;
+    if (!name) {
+        return NULL;
+    }
+    while (*p) {
+        if (*p == PATH_SEPARATOR && (out == name || out[-1] == PATH_SEPARATOR)) {
+            p++;
+            continue;
+        }
+        *out++ = *p++;
+    }
+    if (out > name && out[-1] == PATH_SEPARATOR) {
+        out--;
+    }
+    *out = '\0';
+    return name;
+}
+
+/* hash the file if it does not change meanwhile and cache the result, returns 0 on success */
+static int hash_and_cache(const char *name, char *hash, long long *size, long long *mtime) {
+    struct stat before, after;
+    char *path = path_join(rootDir, name);
+    int result = -1;
+    if (path && stat(path, &before) == 0 && 0 == filestore_hash_file(path, hash) && stat(path, &after) == 0) {
+        IndexEntry probe;
+        probe.size = (long long) before.st_size;
+        probe.mtime = (long long) before.st_mtime;
+        probe.mtimeNsec = mtime_nsec(&before);
+        probe.inode = (long long) before.st_ino;
+        *size = probe.size;
+        *mtime = probe.mtime;
+        result = 0;
+        if (same_identity(&probe, &after)) {
+            ck_mutex_lock(&indexMutex);
+            IndexEntry *entry = upsert_entry(name, &after);
+            if (entry) {
+                memcpy(entry->hash, hash, FILESTORE_HASH_SIZE);
+                entry->hashValid = 1;
+            }
+            ck_mutex_unlock(&indexMutex);
+        }
+    }
+    ck_free(path);
+    return result;
+}
+
+static int compare_items(const void *a, const void *b) {
+    return strcmp(((const FileIndexItem *) a)->name, ((const FileIndexItem *) b)->name);
+}
+
+int fileindex_list(const char *prefix, int withHashes, FileIndexItem **items) {
+    char *dir = NULL;
+    size_t dirLen = 0, i;
+    int count = 0;
+
+    if (prefix && prefix[0]) {
+        char *path = path_join(rootDir, prefix);
+        dir = path ? relative_name(path) : NULL;
+        ck_free(path);
+        if (!dir) {
+            return -1;
+        }
+        dirLen = strlen(dir);
+    }
+
+    ck_mutex_lock(&indexMutex);
+    ensure_fresh();
+    *items = ck_alloc(sizeof(FileIndexItem) * (entryCount + 1));
+    if (!*items) {
+        ck_mutex_unlock(&indexMutex);
+        free(dir);
+        return -1;
+    }
+    for (i = 0; i < bucketCount; i++) {
+        IndexEntry *entry;
+        for (entry = buckets[i]; entry; entry = entry->next) {
+            if (dirLen && (strncmp(entry->name, dir, dirLen) != 0 || entry->name[dirLen] != PATH_SEPARATOR)) {
+                continue;
+            }
+            FileIndexItem *item = &(*items)[count++];
+            size_t nameLen = strlen(entry->name);
+            item->name = ck_alloc(nameLen + 1);
+            if (item->name) {
+                memcpy(item->name, entry->name, nameLen + 1);
+            }
+            item->size = entry->size;
+            item->mtime = entry->mtime;
+            item->hash[0] = '\0';
+            if (entry->hashValid) {
+                memcpy(item->hash, entry->hash, FILESTORE_HASH_SIZE);
+            }
+        }
+    }
+    ck_mutex_unlock(&indexMutex);
+    free(dir);
+
+    for (i = 0; i < (size_t) count; i++) {
+        if (!(*items)[i].name) {
+            return -1;
+        }
+    }
+    // hashes are computed outside of the lock, the index stays available meanwhile
+    if (withHashes) {
+        for (i = 0; i < (size_t) count; i++) {
+            FileIndexItem *item = &(*items)[i];
+            if (!item->hash[0] && 0 != hash_and_cache(item->name, item->hash, &item->size, &item->mtime)) {
+                item->hash[0] = '\0';
+            }
+        }
+    }
+    qsort(*items, count, sizeof(FileIndexItem), compare_items);
+    return count;
+}
+
+int fileindex_stat(const char *path, FileIndexItem *item) {
+    struct stat st;
+    char *relative = relative_name(path);
+    int found = relative && stat(path, &st) == 0 && S_ISREG(st.st_mode);
+    if (!found) {
+        free(relative);
+        return -1;
+    }
+
+    item->name = ck_alloc(strlen(relative) + 1);
+    if (!item->name) {
+        free(relative);
+        return -1;
+    }
+    strcpy(item->name, relative);
+    item->size = (long long) st.st_size;
+    item->mtime = (long long) st.st_mtime;
+    item->hash[0] = '\0';
+
+    ck_mutex_lock(&indexMutex);
+    IndexEntry *entry = find_entry(relative);
+    if (entry && entry->hashValid && same_identity(entry, &st)) {
+        memcpy(item->hash, entry->hash, FILESTORE_HASH_SIZE);
+    }
+    ck_mutex_unlock(&indexMutex);
+
+    int result = 0;
+    if (!item->hash[0]) {
+        result = hash_and_cache(relative, item->hash, &item->size, &item->mtime);
+    }
+    free(relative);
+    return result;
+}
+
+void fileindex_file_written(const char *path, const char *hash) {
+    struct stat st;
+    char *name = relative_name(path);
+    if (!name) {
+        return;
+    }
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+        ck_mutex_lock(&indexMutex);
+        IndexEntry *entry = upsert_entry(name, &st);
+        if (entry && hash) {
+            memcpy(entry->hash, hash, FILESTORE_HASH_SIZE);
+            entry->hashValid = 1;
+        }
+        ck_mutex_unlock(&indexMutex);
+    }
+    free(name);
+}
+
+void fileindex_path_removed(const char *path) {
+    char *name = relative_name(path);
+    if (!name) {
+        return;
+    }
+    ck_mutex_lock(&indexMutex);
+    remove_entries(name);
+    ck_mutex_unlock(&indexMutex);
+    free(name);
+}
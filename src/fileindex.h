@@ -0,0 +1,64 @@
+#ifndef FILEINDEX_H
+#define FILEINDEX_H
+
+#include "filestore.h"
+
+/**
+ * In-memory index of the files under path_to_files, used by list, stat and manifest actions.
+ *
+ * The index is filled by walking the tree on first use. With a watcher (inotify, thread server mode on Linux)
+ * it is then kept up to date by file system events and by the server's own writes, without walking the tree
+ * again. Without a watcher, or once its events can not be read any more, the tree is walked for every listing.
+ *
+ * Content hashes (same as file_hash of the content store) are computed on first request and cached
+ * while the file keeps its size, modification time and inode. The content store and workspace trash directories
+ * are not listed.
+ */
+
+typedef struct {
+    char *name;         /* path relative to path_to_files */
+    long long size;
+    long long mtime;
+    char hash[FILESTORE_HASH_SIZE];   /* empty unless requested */
+} FileIndexItem;
+
+/**
+ * @param baseDir path_to_files
+ * @param watch keep the index up to date from file system events if supported (needs a long living process)
+ */
+void fileindex_init(const char *baseDir, int watch);
+
+/**
+ * list files under the directory, recursively, sorted by name
+ *
+ * @param prefix directory relative to path_to_files, NULL or empty for all files
+ * @param withHashes fill in content hashes
+ * @param items receives the array of items, allocated with ck_alloc
+ * @return number of items, -1 on failure
+ */
+int fileindex_list(const char *prefix, int withHashes, FileIndexItem **items);
+
+/**
+ * size, modification time and content hash of the file
+ *
+ * @param path absolute path of a file under path_to_files
+ * @return 0 on success, -1 if the file does not exist
+ */
+int fileindex_stat(const char *path, FileIndexItem *item);
+
+/**
+ * record a file written by the server, with the hash of its content if known
+ *
+ * @param path absolute path of the file
+ * @param hash content hash, NULL if unknown
+ */
+void fileindex_file_written(const char *path, const char *hash);
+
+/**
+ * forget the file, or all files under the directory, removed or moved away by the server
+ *
+ * @param path absolute path
+ */
+void fileindex_path_removed(const char *path);
+
+#endif
@@ -0,0 +1,535 @@
+#ifdef __linux__
+    #define _GNU_SOURCE     /* O_DIRECT, fallocate */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <direct.h>
+    #include <io.h>
+    #include <malloc.h>
+    #define FILESTORE_SEPARATOR "\\"
+    #define close_fd _close
+    #define fileno _fileno
+#else
+    #include <unistd.h>
+    #ifdef __linux__
+        #include <sys/ioctl.h>
+        #include <linux/fs.h>
+    #endif
+    #define FILESTORE_SEPARATOR "/"
+    #define close_fd close
+#endif
+
+#include "filestore.h"
+#include "arena.h"
+#include "durability.h"
+#include "logger.h"
+#include "quota.h"
+
+#define COPY_BUFFER_SIZE 65536
+#define MAX_WRITE_SIZE (1 << 30)
+
+#if defined(__APPLE__)
+    #define MTIME_NSEC(st) ((st)->st_mtimespec.tv_nsec)
+#elif !defined(_WIN32)
+    #define MTIME_NSEC(st) ((st)->st_mtim.tv_nsec)
+#endif
+
+static int directIoRequested = 0;
+
+void filestore_init(int directIo) {
+    directIoRequested = directIo;
+}
+
+static char *join3(const char *a, const char *b, const char *c) {
+    size_t la = strlen(a), lb = strlen(b), lc = strlen(c);
+    char *result = ck_alloc(la + lb + lc + 1);
+    if (!result) {
+        return NULL;
+    }
+    memcpy(result, a, la);
+    memcpy(result + la, b, lb);
+    memcpy(result + la + lb, c, lc + 1);
+    return result;
+}
+
+/* @return 1 if the directory was created, 0 if it exists or could not be created */
+static int make_dir(const char *dir) {
+#ifdef _WIN32
+    return 0 == _mkdir(dir);
+#else
+    return 0 == mkdir(dir, 0700);
+#endif
+}
+
+/* <baseDir>/.ck-blobs/<first two hex digits>/<hash>, directories created (and synced) when missing if create is set */
+static char *blob_path(const char *baseDir, const char *hash, int create) {
+    char prefix[3] = { hash[0], hash[1], '\0' };
+    char *dir = join3(baseDir, FILESTORE_SEPARATOR, FILESTORE_BLOB_DIR);
+    if (dir && create && make_dir(dir) && 0 != durability_entry_added(dir)) {
+        return NULL;
+    }
+    dir = dir ? join3(dir, FILESTORE_SEPARATOR, prefix) : NULL;
+    if (dir && create && make_dir(dir) && 0 != durability_entry_added(dir)) {
+        return NULL;
+    }
+    return dir ? join3(dir, FILESTORE_SEPARATOR, hash) : NULL;
+}
+
+#ifndef _WIN32
+/* nanoseconds of the mtime of a stored blob, derived from its hash, never 0 */
+static long blob_stamp(const char *hash) {
+    unsigned long value = 0;
+    int i;
+    for (i = 0; i < 8; i++) {
+        value = value * 16 + (unsigned long) (hash[i] <= '9' ? hash[i] - '0' : hash[i] - 'a' + 10);
+    }
+    return (long) (value % 999999999UL) + 1;
+}
+
+static int stamped(const struct stat *st, const char *hash) {
+    return MTIME_NSEC(st) == blob_stamp(hash);
+}
+
+/* set the stamp on the blob open as fd, or at path if fd is -1, keeping the seconds given */
+static void stamp_blob(int fd, const char *path, time_t seconds, const char *hash) {
+    struct timespec times[2];
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1].tv_sec = seconds;
+    times[1].tv_nsec = blob_stamp(hash);
+    if (fd >= 0) {
+        futimens(fd, times);
+    } else {
+        utimensat(AT_FDCWD, path, times, 0);
+    }
+}
+#else
+/* no sub-second times to keep a stamp in, every reuse compares the content */
+static int stamped(const struct stat *st, const char *hash) {
+    return 0;
+}
+
+static void stamp_blob(int fd, const char *path, time_t seconds, const char *hash) {
+}
+#endif
+
+void filestore_hash(const unsigned char *content, size_t size, char *hash) {
+    xxh64_hex(xxh64(content, size, 0), hash);
+}
+
+int filestore_hash_file(const char *path, char *hash) {
+    XXH64State state;
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return -1;
+    }
+    unsigned char *buffer = malloc(COPY_BUFFER_SIZE);
+    if (!buffer) {
+        fclose(file);
+        return -1;
+    }
+    size_t n;
+    xxh64_reset(&state, 0);
+    while ((n = fread(buffer, 1, COPY_BUFFER_SIZE, file)) > 0) {
+        xxh64_update(&state, buffer, n);
+    }
+    int failed = ferror(file);
+    free(buffer);
+    fclose(file);
+    if (failed) {
+        return -1;
+    }
+    xxh64_hex(xxh64_digest(&state), hash);
+    return 0;
+}
+
+int filestore_valid_hash(const char *hash) {
+    int i;
+    if (!hash) {
+        return 0;
+    }
+    for (i = 0; i < FILESTORE_HASH_SIZE - 1; i++) {
+        if (!((hash[i] >= '0' && hash[i] <= '9') || (hash[i] >= 'a' && hash[i] <= 'f'))) {
+            return 0;
+        }
+    }
+    return hash[i] == '\0';
+}
+
+/**
+ * Pushed files are copies, but a blob can still be written behind the store (a shell command under
+ * .ck-blobs, a restored backup). Any write sets a new mtime, which no longer carries the stamp the blob was
+ * stored with: the content is hashed again then, and a blob that no longer matches its name is dropped from
+ * the store so that the content is stored again.
+ *
+ * @param size expected size of the content, -1 if not known
+ * @return 1 if the blob is stored with its content, 0 otherwise
+ */
+static int blob_intact(const char *path, const char *hash, long long size) {
+    struct stat st;
+    char actual[FILESTORE_HASH_SIZE];
+    if (stat(path, &st) != 0) {
+        return 0;
+    }
+    int sizeMatches = size < 0 || (long long) st.st_size == size;
+    if (sizeMatches && stamped(&st, hash)) {
+        return 1;
+    }
+    // touched, or stored where the stamp does not hold (no sub-second times): compare the content
+    if (sizeMatches && 0 == filestore_hash_file(path, actual) && 0 == strcmp(actual, hash)) {
+        stamp_blob(-1, path, st.st_mtime, hash);
+        return 1;
+    }
+    LOG_WARN("Blob %s was modified, the content is stored again", hash);
+    remove(path);
+    return 0;
+}
+
+int filestore_has_blob(const char *baseDir, const char *hash) {
+    if (!filestore_valid_hash(hash)) {
+        return 0;
+    }
+    char *path = blob_path(baseDir, hash, 0);
+    return path && blob_intact(path, hash, -1);
+}
+
+/* rename replacing an existing file, atomically where the platform allows */
+static int replace_file(const char *from, const char *to) {
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+#else
+    return rename(from, to);
+#endif
+}
+
+/* open a new uniquely named temp file next to path */
+static int open_temp(const char *path, char **tmpPath) {
+    char *tmp = join3(path, ".tmp.", "XXXXXX");
+    if (!tmp) {
+        return -1;
+    }
+    *tmpPath = tmp;
+#ifdef _WIN32
+    if (_mktemp_s(tmp, strlen(tmp) + 1) != 0) {
+        return -1;
+    }
+    return _open(tmp, _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    int fd = mkstemp(tmp);
+    if (fd >= 0) {
+        fchmod(fd, 0644);
+    }
+    return fd;
+#endif
+}
+
+static int write_all(int fd, const unsigned char *data, size_t size) {
+    while (size > 0) {
+        size_t piece = size < MAX_WRITE_SIZE ? size : MAX_WRITE_SIZE;
+#ifdef _WIN32
+        int n = _write(fd, data, (unsigned int) piece);
+#else
+        ssize_t n = write(fd, data, piece);
+#endif
+        if (n < 0 && EINTR == errno) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        size -= (size_t) n;
+    }
+    return 0;
+}
+
+static unsigned char *alloc_aligned(size_t size) {
+#ifdef _WIN32
+    return _aligned_malloc(size, FILESTORE_ALIGNMENT);
+#else
+    void *buffer = NULL;
+    return posix_memalign(&buffer, FILESTORE_ALIGNMENT, size) == 0 ? buffer : NULL;
+#endif
+}
+
+static void free_aligned(unsigned char *buffer) {
+#ifdef _WIN32
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+/* switch the temp file to uncached writes, see filestore_init */
+static void set_direct_io(FileStoreWriter *writer) {
+#if defined(__linux__)
+    int fd = open(writer->tmpPath, O_WRONLY | O_DIRECT);
+    if (fd >= 0) {
+        close(writer->fd);
+        writer->fd = fd;
+        writer->direct = 1;
+        return;
+    }
+#elif defined(__APPLE__)
+    if (fcntl(writer->fd, F_NOCACHE, 1) == 0) {
+        return;
+    }
+#endif
+    writer->dropCache = 1;
+}
+
+/* reserve the blocks of the whole file at once, the content is written without growing it piece by piece */
+static void preallocate(FileStoreWriter *writer, long long size) {
+#ifdef __linux__
+    if (size > 0 && fallocate(writer->fd, 0, 0, (off_t) size) == 0) {
+        writer->preallocated = size;
+    }
+#endif
+}
+
+/* write the buffered data, all of it when final (padded to the alignment with O_DIRECT) */
+static int flush_buffer(FileStoreWriter *writer, int final) {
+    size_t size = writer->buffered;
+    if (writer->direct) {
+        size_t aligned = (size + FILESTORE_ALIGNMENT - 1) & ~((size_t) FILESTORE_ALIGNMENT - 1);
+        if (final && aligned > size) {
+            memset(writer->buffer + size, 0, aligned - size);
+        }
+        size = aligned;
+    }
+    if (0 != write_all(writer->fd, writer->buffer, size)) {
+        return -1;
+    }
+    writer->buffered = 0;
+    return 0;
+}
+
+int filestore_begin(const char *baseDir, FileStoreWriter *writer, long long expectedSize) {
+    memset(writer, 0, sizeof(FileStoreWriter));
+    writer->baseDir = baseDir;
+    writer->fd = -1;
+    xxh64_reset(&writer->state, 0);
+    char *dir = join3(baseDir, FILESTORE_SEPARATOR, FILESTORE_BLOB_DIR);
+    if (!dir) {
+        return -1;
+    }
+    if (make_dir(dir) && 0 != durability_entry_added(dir)) {
+        return -1;
+    }
+    writer->fd = open_temp(join3(dir, FILESTORE_SEPARATOR, "blob"), &writer->tmpPath);
+    if (writer->fd < 0) {
+        return -1;
+    }
+    if (directIoRequested) {
+        set_direct_io(writer);
+    }
+    preallocate(writer, expectedSize);
+    return 0;
+}
+
+int filestore_write(FileStoreWriter *writer, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    if (writer->failed) {
+        return -1;
+    }
+    xxh64_update(&writer->state, data, size);
+    writer->size += size;
+    while (size > 0) {
+        if (0 == writer->buffered && !writer->direct && size >= FILESTORE_CHUNK_SIZE) {
+            // nothing to gain from copying large pieces
+            if (0 != write_all(writer->fd, bytes, size)) {
+                writer->failed = 1;
+                return -1;
+            }
+            return 0;
+        }
+        if (!writer->buffer && !(writer->buffer = alloc_aligned(FILESTORE_CHUNK_SIZE))) {
+            writer->failed = 1;
+            return -1;
+        }
+        size_t n = FILESTORE_CHUNK_SIZE - writer->buffered;
+        n = n < size ? n : size;
+        memcpy(writer->buffer + writer->buffered, bytes, n);
+        writer->buffered += n;
+        bytes += n;
+        size -= n;
+        if (FILESTORE_CHUNK_SIZE == writer->buffered && 0 != flush_buffer(writer, 0)) {
+            writer->failed = 1;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void close_writer(FileStoreWriter *writer) {
+    free_aligned(writer->buffer);
+    writer->buffer = NULL;
+    if (writer->fd >= 0 && close_fd(writer->fd) != 0) {
+        writer->failed = 1;
+    }
+    writer->fd = -1;
+}
+
+void filestore_abort(FileStoreWriter *writer) {
+    close_writer(writer);
+    if (writer->tmpPath) {
+        remove(writer->tmpPath);
+    }
+}
+
+/* flush, cut the padding or preallocation beyond the content and sync the temp file */
+static int finish_file(FileStoreWriter *writer) {
+    int padded = writer->direct && (writer->buffered % FILESTORE_ALIGNMENT) != 0;
+    if (writer->buffered > 0 && 0 != flush_buffer(writer, 1)) {
+        return -1;
+    }
+#ifndef _WIN32
+    if ((padded || (writer->preallocated && (long long) writer->size != writer->preallocated)) &&
+        ftruncate(writer->fd, (off_t) writer->size) != 0) {
+        return -1;
+    }
+#endif
+    if (0 != durability_file_written(writer->fd)) {
+        return -1;
+    }
+#if defined(POSIX_FADV_DONTNEED) && !defined(__APPLE__)
+    if (writer->dropCache && fdatasync(writer->fd) == 0) {
+        posix_fadvise(writer->fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+#endif
+    return 0;
+}
+
+int filestore_commit(FileStoreWriter *writer, char *hash) {
+    if (!writer->failed && 0 != finish_file(writer)) {
+        writer->failed = 1;
+    }
+    xxh64_hex(xxh64_digest(&writer->state), hash);
+    if (!writer->failed) {
+        stamp_blob(writer->fd, NULL, time(NULL), hash);
+    }
+    close_writer(writer);
+    if (writer->failed) {
+        remove(writer->tmpPath);
+        return -1;
+    }
+    char *path = blob_path(writer->baseDir, hash, 1);
+    if (!path) {
+        remove(writer->tmpPath);
+        return -1;
+    }
+    if (blob_intact(path, hash, (long long) writer->size)) {
+        LOG_DEBUG("Blob %s already stored", hash);
+        remove(writer->tmpPath);
+        return 0;
+    }
+    if (replace_file(writer->tmpPath, path) != 0) {
+        remove(writer->tmpPath);
+        return -1;
+    }
+    // the file copied from the blob is synced by the caller, the blob's name must survive as well
+    return durability_entry_added(path);
+}
+
+int filestore_put(const char *baseDir, const unsigned char *content, size_t size, char *hash) {
+    FileStoreWriter writer;
+
+    filestore_hash(content, size, hash);
+    char *path = blob_path(baseDir, hash, 0);
+    if (path && blob_intact(path, hash, (long long) size)) {
+        LOG_DEBUG("Blob %s already stored", hash);
+        return 0;
+    }
+
+    // write aside and rename, so that a blob is never seen half written
+    if (0 != filestore_begin(baseDir, &writer, (long long) size)) {
+        filestore_abort(&writer);
+        return -1;
+    }
+    filestore_write(&writer, content, size);
+    return filestore_commit(&writer, hash);
+}
+
+/* a new file with fresh times, sharing the extents of the blob where the file system supports it */
+static int copy_file(const char *from, const char *to) {
+    FILE *in = fopen(from, "rb");
+    if (!in) {
+        return -1;
+    }
+    FILE *out = fopen(to, "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+    int result = 0;
+#ifdef FICLONE
+    int reflinked = 0 == ioctl(fileno(out), FICLONE, fileno(in));
+#else
+    int reflinked = 0;
+#endif
+    char *buffer = reflinked ? NULL : malloc(COPY_BUFFER_SIZE);
+    if (!reflinked && !buffer) {
+        result = -1;
+    }
+    size_t n;
+    while (buffer && (n = fread(buffer, 1, COPY_BUFFER_SIZE, in)) > 0) {
+        if (fwrite(buffer, 1, n, out) != n) {
+            result = -1;
+            break;
+        }
+    }
+    free(buffer);
+    fclose(in);
+    if (0 == result && (fflush(out) != 0 || 0 != durability_file_written(fileno(out)))) {
+        result = -1;
+    }
+    if (fclose(out) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+int filestore_place(const char *baseDir, const char *hash, const char *filePath, int mode) {
+    char *tmpPath = NULL;
+    if (!filestore_valid_hash(hash)) {
+        return -1;
+    }
+    char *path = blob_path(baseDir, hash, 0);
+    if (!path) {
+        return -1;
+    }
+
+    // copy next to the file and rename over it: readers see either the old or the new file
+    int fd = open_temp(filePath, &tmpPath);
+    if (fd < 0) {
+        return -1;
+    }
+    close_fd(fd);
+    remove(tmpPath);
+    if (0 != copy_file(path, tmpPath)) {
+        remove(tmpPath);
+        return -1;
+    }
+#ifndef _WIN32
+    if (mode >= 0 && 0 != chmod(tmpPath, (mode_t) mode)) {
+        remove(tmpPath);
+        return -1;
+    }
+#endif
+    if (0 != replace_file(tmpPath, filePath)) {
+        remove(tmpPath);
+        return -1;
+    }
+    // the content is used again, for the storage collector
+    quota_file_used(path, NULL);
+    return durability_file_renamed(filePath);
+}
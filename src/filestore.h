@@ -0,0 +1,118 @@
+#ifndef FILESTORE_H
+#define FILESTORE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "xxhash.h"
+
+/**
+ * Content-addressed blob store under the files directory.
+ *
+ * Every pushed content is kept once as <path_to_files>/.ck-blobs/<2 hex digits>/<XXH64 hex> and copied into
+ * its extra_path/filename location, a reflink sharing the extents of the blob where the file system supports
+ * it (FICLONE). Pushed files are inodes of their own, with fresh times: jobs write them in place without
+ * changing other files of the same content, and build tools see a file pushed again as new.
+ *
+ * Blobs and files are written under a temp name and renamed into place, so readers never see a partial
+ * file. Blobs are stored with a stamp in the nanoseconds of their mtime, a blob found without it (changed
+ * behind the store) is hashed again before it is reused, and dropped from the store if its content changed.
+ * Syncing follows the durability mode.
+ *
+ * Blobs are written in FILESTORE_CHUNK_SIZE pieces from an aligned buffer (large contents straight from the
+ * caller's memory), preallocated with fallocate when the size is known up front.
+ */
+
+#define FILESTORE_HASH_SIZE XXH64_HEX_SIZE
+#define FILESTORE_BLOB_DIR ".ck-blobs"
+#define FILESTORE_CHUNK_SIZE (1 << 20)
+#define FILESTORE_ALIGNMENT 4096
+
+/**
+ * @param directIo write blobs bypassing the page cache ("direct_io" configuration attribute), so that large
+ *                 uploads do not evict the working set of other processes on the node: O_DIRECT on Linux,
+ *                 F_NOCACHE on macOS; where not supported the written blob is synced and dropped from the cache
+ */
+void filestore_init(int directIo);
+
+/**
+ * @param hash output buffer of FILESTORE_HASH_SIZE characters for the content hash
+ */
+void filestore_hash(const unsigned char *content, size_t size, char *hash);
+
+/**
+ * hash the content of the file, same as filestore_hash of its content
+ *
+ * @return 0 on success, -1 if the file could not be read
+ */
+int filestore_hash_file(const char *path, char *hash);
+
+/**
+ * @return 1 if the hash is well formed (16 lower case hex digits), 0 otherwise
+ */
+int filestore_valid_hash(const char *hash);
+
+/**
+ * @return 1 if the blob with the given hash is in the store with its content, 0 otherwise
+ */
+int filestore_has_blob(const char *baseDir, const char *hash);
+
+/**
+ * store the content as blob unless already present
+ *
+ * @param hash output buffer of FILESTORE_HASH_SIZE characters for the content hash
+ * @return 0 on success, -1 otherwise
+ */
+int filestore_put(const char *baseDir, const unsigned char *content, size_t size, char *hash);
+
+/**
+ * Streaming blob writer, for content produced piece by piece: written to a temp file in the store,
+ * hashed on the way and renamed to its blob when committed.
+ */
+typedef struct {
+    const char *baseDir;
+    int fd;
+    char *tmpPath;
+    unsigned char *buffer;      /* FILESTORE_CHUNK_SIZE, aligned to FILESTORE_ALIGNMENT, allocated on first use */
+    size_t buffered;
+    long long preallocated;     /* file size set by fallocate */
+    int direct;                 /* opened with O_DIRECT, only aligned writes */
+    int dropCache;              /* direct I/O requested but not supported */
+    XXH64State state;
+    size_t size;
+    int failed;
+} FileStoreWriter;
+
+/**
+ * @param expectedSize final size of the content when known, -1 otherwise
+ * @return 0 on success, -1 otherwise
+ */
+int filestore_begin(const char *baseDir, FileStoreWriter *writer, long long expectedSize);
+
+/**
+ * @return 0 on success, -1 otherwise (the writer must still be committed or aborted)
+ */
+int filestore_write(FileStoreWriter *writer, const void *data, size_t size);
+
+/**
+ * finish writing and move the content to its blob
+ *
+ * @param hash output buffer of FILESTORE_HASH_SIZE characters for the content hash
+ * @return 0 on success, -1 otherwise (the temp file is removed)
+ */
+int filestore_commit(FileStoreWriter *writer, char *hash);
+
+/**
+ * discard the written content
+ */
+void filestore_abort(FileStoreWriter *writer);
+
+/**
+ * make filePath a copy of the blob with the given hash, replacing the existing file
+ *
+ * @param mode unix mode of the file, -1 for the default one (ignored on Windows)
+ * @return 0 on success, -1 otherwise
+ */
+int filestore_place(const char *baseDir, const char *hash, const char *filePath, int mode);
+
+#endif
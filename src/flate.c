@@ -0,0 +1,699 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flate.h"
+
+#define FLATE_WINDOW 32768
+#define FLATE_RING (2 * FLATE_WINDOW)
+#define FLATE_TABLE_BITS 15
+#define FLATE_IN_BUFFER 65536
+#define FLATE_OUT_BUFFER 65536
+#define FLATE_BLOCK 65536
+#define FLATE_HASH_BITS 15
+#define FLATE_MAX_CHAIN 32
+#define FLATE_MIN_MATCH 3
+#define FLATE_MAX_MATCH 258
+#define FLATE_MAX_STORED 65535
+
+static const unsigned short lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char lengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short distanceBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+    6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char distanceExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const unsigned char codeLengthOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/* CRC-32 (IEEE, reflected) four bits at a time, no table to build */
+static const unsigned long crcNibble[16] = {
+    0x00000000UL, 0x1db71064UL, 0x3b6e20c8UL, 0x26d930acUL, 0x76dc4190UL, 0x6b6b51f4UL, 0x4db26158UL, 0x5005713cUL,
+    0xedb88320UL, 0xf00f9344UL, 0xd6d6a3e8UL, 0xcb61b38cUL, 0x9b64c2b0UL, 0x86d3d2d4UL, 0xa00ae278UL, 0xbdbdf21cUL
+};
+
+unsigned long flate_crc32(unsigned long crc, const void *data, size_t size) {
+    const unsigned char *p = data;
+    crc = ~crc & 0xffffffffUL;
+    while (size--) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ crcNibble[crc & 15];
+        crc = (crc >> 4) ^ crcNibble[crc & 15];
+    }
+    return ~crc & 0xffffffffUL;
+}
+
+static unsigned int reverse_bits(unsigned int code, int length) {
+    unsigned int result = 0;
+    while (length--) {
+        result = (result << 1) | (code & 1);
+        code >>= 1;
+    }
+    return result;
+}
+
+/*
+ * Decompression
+ */
+
+typedef struct {
+    FILE *in;
+    long long inputLeft;            /* bytes the stream may still read from in, -1 for no limit */
+    unsigned char input[FLATE_IN_BUFFER];
+    size_t inputPos;
+    size_t inputSize;
+    unsigned long long bits;
+    int bitCount;
+    int overrun;                    /* zero bits supplied past the end of the input */
+
+    unsigned char ring[FLATE_RING];
+    unsigned long long written;     /* total output */
+    unsigned long long flushed;
+    unsigned long crc;
+    FlateOutput output;
+    void *ctx;
+    int failed;
+
+    unsigned short literals[1 << FLATE_TABLE_BITS];    /* (symbol << 4) | code length, by reversed code */
+    unsigned short distances[1 << FLATE_TABLE_BITS];
+} Inflater;
+
+static int read_byte(Inflater *s) {
+    if (s->inputPos == s->inputSize) {
+        size_t n = s->inputLeft >= 0 && s->inputLeft < FLATE_IN_BUFFER ? (size_t) s->inputLeft : FLATE_IN_BUFFER;
+        s->inputSize = n ? fread(s->input, 1, n, s->in) : 0;
+        s->inputPos = 0;
+        if (0 == s->inputSize) {
+            return -1;
+        }
+        if (s->inputLeft >= 0) {
+            s->inputLeft -= (long long) s->inputSize;
+        }
+    }
+    return s->input[s->inputPos++];
+}
+
+static void fill_bits(Inflater *s, int count) {
+    while (s->bitCount < count) {
+        int c = read_byte(s);
+        if (c < 0) {
+            // decoding may look ahead of the last code, fail only if those bits are used
+            c = 0;
+            s->overrun += 8;
+        }
+        s->bits |= (unsigned long long) c << s->bitCount;
+        s->bitCount += 8;
+    }
+}
+
+static unsigned int get_bits(Inflater *s, int count) {
+    if (0 == count) {
+        return 0;
+    }
+    fill_bits(s, count);
+    unsigned int value = (unsigned int) (s->bits & ((1ULL << count) - 1));
+    s->bits >>= count;
+    s->bitCount -= count;
+    return value;
+}
+
+static int overrun(Inflater *s) {
+    return s->overrun > s->bitCount;
+}
+
+/* input after the end of the deflate stream starts at a byte boundary */
+static void align_input(Inflater *s) {
+    get_bits(s, s->bitCount & 7);
+}
+
+static int flush_output(Inflater *s) {
+    while (s->flushed < s->written && !s->failed) {
+        size_t start = (size_t) (s->flushed % FLATE_RING);
+        size_t size = (size_t) (s->written - s->flushed);
+        if (size > FLATE_RING - start) {
+            size = FLATE_RING - start;
+        }
+        s->crc = flate_crc32(s->crc, s->ring + start, size);
+        if (0 != s->output(s->ctx, s->ring + start, size)) {
+            s->failed = 1;
+        }
+        s->flushed += size;
+    }
+    return s->failed ? -1 : 0;
+}
+
+static void put_byte(Inflater *s, unsigned char c) {
+    s->ring[s->written % FLATE_RING] = c;
+    s->written++;
+    if (s->written - s->flushed == FLATE_WINDOW) {
+        flush_output(s);
+    }
+}
+
+static int build_table(unsigned short *table, const unsigned char *lengths, int count) {
+    int lengthCount[16] = { 0 };
+    unsigned int next[16];
+    unsigned int code = 0;
+    int left = 1;
+    int i;
+    for (i = 0; i < count; i++) {
+        lengthCount[lengths[i]]++;
+    }
+    lengthCount[0] = 0;
+    for (i = 1; i < 16; i++) {
+        left = (left << 1) - lengthCount[i];
+        if (left < 0) {
+            return -1;
+        }
+        code = (code + lengthCount[i - 1]) << 1;
+        next[i] = code;
+    }
+    memset(table, 0, sizeof(unsigned short) << FLATE_TABLE_BITS);
+    for (i = 0; i < count; i++) {
+        int length = lengths[i];
+        if (length) {
+            unsigned int index;
+            for (index = reverse_bits(next[length]++, length); index < (1U << FLATE_TABLE_BITS); index += 1U << length) {
+                table[index] = (unsigned short) ((i << 4) | length);
+            }
+        }
+    }
+    return 0;
+}
+
+static int decode_symbol(Inflater *s, const unsigned short *table) {
+    fill_bits(s, FLATE_TABLE_BITS);
+    unsigned short entry = table[s->bits & ((1U << FLATE_TABLE_BITS) - 1)];
+    int length = entry & 15;
+    if (0 == length) {
+        return -1;
+    }
+    s->bits >>= length;
+    s->bitCount -= length;
+    return entry >> 4;
+}
+
+static int inflate_stored(Inflater *s) {
+    align_input(s);
+    unsigned int length = get_bits(s, 16);
+    unsigned int complement = get_bits(s, 16);
+    if (length != (~complement & 0xffff) || overrun(s)) {
+        return -1;
+    }
+    while (length--) {
+        put_byte(s, (unsigned char) get_bits(s, 8));
+    }
+    return overrun(s) ? -1 : 0;
+}
+
+static int inflate_codes(Inflater *s) {
+    while (!s->failed) {
+        int symbol = decode_symbol(s, s->literals);
+        if (symbol < 0 || overrun(s)) {
+            return -1;
+        }
+        if (symbol < 256) {
+            put_byte(s, (unsigned char) symbol);
+            continue;
+        }
+        if (256 == symbol) {
+            return 0;
+        }
+        symbol -= 257;
+        if (symbol >= 29) {
+            return -1;
+        }
+        unsigned int length = lengthBase[symbol] + get_bits(s, lengthExtra[symbol]);
+        int distanceSymbol = decode_symbol(s, s->distances);
+        if (distanceSymbol < 0 || distanceSymbol >= 30) {
+            return -1;
+        }
+        unsigned int distance = distanceBase[distanceSymbol] + get_bits(s, distanceExtra[distanceSymbol]);
+        if (distance > s->written || overrun(s)) {
+            return -1;
+        }
+        while (length--) {
+            put_byte(s, s->ring[(s->written - distance) % FLATE_RING]);
+        }
+    }
+    return -1;
+}
+
+static int inflate_fixed(Inflater *s) {
+    unsigned char lengths[288];
+    int i;
+    for (i = 0; i < 288; i++) {
+        lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    }
+    build_table(s->literals, lengths, 288);
+    for (i = 0; i < 30; i++) {
+        lengths[i] = 5;
+    }
+    build_table(s->distances, lengths, 30);
+    return inflate_codes(s);
+}
+
+static int inflate_dynamic(Inflater *s) {
+    unsigned char lengths[288 + 32];
+    unsigned char codeLengths[19];
+    int literalCount = (int) get_bits(s, 5) + 257;
+    int distanceCount = (int) get_bits(s, 5) + 1;
+    int codeLengthCount = (int) get_bits(s, 4) + 4;
+    int i;
+    if (literalCount > 286 || distanceCount > 30) {
+        return -1;
+    }
+    memset(codeLengths, 0, sizeof(codeLengths));
+    for (i = 0; i < codeLengthCount; i++) {
+        codeLengths[codeLengthOrder[i]] = (unsigned char) get_bits(s, 3);
+    }
+    if (0 != build_table(s->literals, codeLengths, 19)) {
+        return -1;
+    }
+    for (i = 0; i < literalCount + distanceCount; ) {
+        int symbol = decode_symbol(s, s->literals);
+        int repeat;
+        unsigned char value = 0;
+        if (symbol < 0 || overrun(s)) {
+            return -1;
+        }
+        if (symbol < 16) {
+            lengths[i++] = (unsigned char) symbol;
+            continue;
+        }
+        if (16 == symbol) {
+            if (0 == i) {
+                return -1;
+            }
+            value = lengths[i - 1];
+            repeat = 3 + (int) get_bits(s, 2);
+        } else if (17 == symbol) {
+            repeat = 3 + (int) get_bits(s, 3);
+        } else {
+            repeat = 11 + (int) get_bits(s, 7);
+        }
+        if (i + repeat > literalCount + distanceCount) {
+            return -1;
+        }
+        while (repeat--) {
+            lengths[i++] = value;
+        }
+    }
+    if (0 == lengths[256] || 0 != build_table(s->literals, lengths, literalCount) ||
+        0 != build_table(s->distances, lengths + literalCount, distanceCount)) {
+        return -1;
+    }
+    return inflate_codes(s);
+}
+
+static int skip_gzip_header(Inflater *s) {
+    if (get_bits(s, 8) != 0x1f || get_bits(s, 8) != 0x8b || get_bits(s, 8) != 8) {
+        return -1;
+    }
+    unsigned int flags = get_bits(s, 8);
+    get_bits(s, 16);    // modification time
+    get_bits(s, 16);
+    get_bits(s, 16);    // extra flags, operating system
+    if (flags & 4) {
+        unsigned int extra = get_bits(s, 16);
+        while (extra-- && !overrun(s)) {
+            get_bits(s, 8);
+        }
+    }
+    if (flags & 8) {
+        while (get_bits(s, 8) != 0 && !overrun(s));    // file name
+    }
+    if (flags & 16) {
+        while (get_bits(s, 8) != 0 && !overrun(s));    // comment
+    }
+    if (flags & 2) {
+        get_bits(s, 16);
+    }
+    return overrun(s) ? -1 : 0;
+}
+
+long long flate_inflate(FILE *in, long long inputSize, int gzip, FlateOutput output, void *ctx, unsigned long *crc) {
+    Inflater *s = malloc(sizeof(Inflater));
+    int result = 0;
+    int last = 0;
+    if (!s) {
+        return -1;
+    }
+    s->in = in;
+    s->inputLeft = inputSize;
+    s->inputPos = s->inputSize = 0;
+    s->bits = 0;
+    s->bitCount = 0;
+    s->overrun = 0;
+    s->written = s->flushed = 0;
+    s->crc = 0;
+    s->output = output;
+    s->ctx = ctx;
+    s->failed = 0;
+
+    if (gzip) {
+        result = skip_gzip_header(s);
+    }
+    while (0 == result && !last) {
+        last = (int) get_bits(s, 1);
+        switch (get_bits(s, 2)) {
+            case 0:
+                result = inflate_stored(s);
+                break;
+            case 1:
+                result = inflate_fixed(s);
+                break;
+            case 2:
+                result = inflate_dynamic(s);
+                break;
+            default:
+                result = -1;
+        }
+    }
+    if (0 == result) {
+        result = flush_output(s);
+    }
+    if (0 == result && gzip) {
+        align_input(s);
+        unsigned long expectedCrc = get_bits(s, 16);
+        expectedCrc |= (unsigned long) get_bits(s, 16) << 16;
+        unsigned long expectedSize = get_bits(s, 16);
+        expectedSize |= (unsigned long) get_bits(s, 16) << 16;
+        if (overrun(s) || expectedCrc != s->crc || expectedSize != (unsigned long) (s->written & 0xffffffffUL)) {
+            result = -1;
+        }
+    }
+    long long written = (long long) s->written;
+    if (crc) {
+        *crc = s->crc;
+    }
+    free(s);
+    return 0 == result ? written : -1;
+}
+
+/*
+ * Compression
+ */
+
+typedef struct {
+    unsigned short length;      /* 0 for a literal */
+    unsigned short value;       /* literal byte or match distance */
+} FlateToken;
+
+struct FlateWriter {
+    int gzip;
+    FlateOutput output;
+    void *ctx;
+    int failed;
+    unsigned long crc;
+    unsigned long long size;
+
+    unsigned char window[FLATE_WINDOW + FLATE_BLOCK];    /* history followed by the data to compress */
+    size_t windowSize;
+    size_t pending;                 /* start of the data not compressed yet */
+    int head[1 << FLATE_HASH_BITS]; /* last position of each hash, -1 if none */
+    int chain[FLATE_WINDOW + FLATE_BLOCK];
+    FlateToken tokens[FLATE_WINDOW + FLATE_BLOCK];
+
+    unsigned long long bits;
+    int bitCount;
+    unsigned char out[FLATE_OUT_BUFFER];
+    size_t outSize;
+};
+
+static void flush_out(FlateWriter *w) {
+    if (w->outSize > 0 && !w->failed && 0 != w->output(w->ctx, w->out, w->outSize)) {
+        w->failed = 1;
+    }
+    w->outSize = 0;
+}
+
+static void put_bits(FlateWriter *w, unsigned int value, int count) {
+    w->bits |= (unsigned long long) value << w->bitCount;
+    w->bitCount += count;
+    while (w->bitCount >= 8) {
+        if (FLATE_OUT_BUFFER == w->outSize) {
+            flush_out(w);
+        }
+        w->out[w->outSize++] = (unsigned char) w->bits;
+        w->bits >>= 8;
+        w->bitCount -= 8;
+    }
+}
+
+static void put_aligned_bytes(FlateWriter *w, const unsigned char *data, size_t size) {
+    if (w->bitCount > 0) {
+        put_bits(w, 0, 8 - w->bitCount);
+    }
+    while (size > 0) {
+        if (FLATE_OUT_BUFFER == w->outSize) {
+            flush_out(w);
+        }
+        size_t n = FLATE_OUT_BUFFER - w->outSize;
+        n = n < size ? n : size;
+        memcpy(w->out + w->outSize, data, n);
+        w->outSize += n;
+        data += n;
+        size -= n;
+    }
+}
+
+/* fixed Huffman code of a literal/length symbol, most significant bit first in the stream */
+static void put_symbol(FlateWriter *w, int symbol) {
+    if (symbol < 144) {
+        put_bits(w, reverse_bits(0x30 + symbol, 8), 8);
+    } else if (symbol < 256) {
+        put_bits(w, reverse_bits(0x190 + symbol - 144, 9), 9);
+    } else if (symbol < 280) {
+        put_bits(w, reverse_bits(symbol - 256, 7), 7);
+    } else {
+        put_bits(w, reverse_bits(0xc0 + symbol - 280, 8), 8);
+    }
+}
+
+static int length_index(unsigned int length) {
+    int i = 28;
+    while (lengthBase[i] > length) {
+        i--;
+    }
+    return i;
+}
+
+static int distance_index(unsigned int distance) {
+    int i = 29;
+    while (distanceBase[i] > distance) {
+        i--;
+    }
+    return i;
+}
+
+static void put_match(FlateWriter *w, unsigned int length, unsigned int distance) {
+    int i = length_index(length);
+    put_symbol(w, 257 + i);
+    put_bits(w, length - lengthBase[i], lengthExtra[i]);
+    i = distance_index(distance);
+    put_bits(w, reverse_bits(i, 5), 5);
+    put_bits(w, distance - distanceBase[i], distanceExtra[i]);
+}
+
+/* bits taken by a match with the fixed codes */
+static unsigned int match_cost(unsigned int length, unsigned int distance) {
+    int i = length_index(length);
+    int j = distance_index(distance);
+    return (i < 23 ? 7 : 8) + lengthExtra[i] + 5 + distanceExtra[j];
+}
+
+static void put_stored(FlateWriter *w, const unsigned char *data, size_t size) {
+    while (size > 0) {
+        size_t n = size < FLATE_MAX_STORED ? size : FLATE_MAX_STORED;
+        unsigned char header[4] = { (unsigned char) n, (unsigned char) (n >> 8),
+                                    (unsigned char) ~n, (unsigned char) (~n >> 8) };
+        put_bits(w, 0, 1);
+        put_bits(w, 0, 2);
+        put_aligned_bytes(w, header, sizeof(header));
+        put_aligned_bytes(w, data, n);
+        data += n;
+        size -= n;
+    }
+}
+
+static unsigned int hash3(const unsigned char *p) {
+    return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761U) >> (32 - FLATE_HASH_BITS);
+}
+
+static void insert_hash(FlateWriter *w, size_t pos) {
+    if (pos + FLATE_MIN_MATCH <= w->windowSize) {
+        unsigned int h = hash3(w->window + pos);
+        w->chain[pos] = w->head[h];
+        w->head[h] = (int) pos;
+    }
+}
+
+/* longest earlier match of the data at pos within the window, 0 if none */
+static size_t find_match(FlateWriter *w, size_t pos, size_t *distance) {
+    size_t best = 0;
+    size_t limit = w->windowSize - pos;
+    int candidate;
+    int chainLength = FLATE_MAX_CHAIN;
+    if (limit < FLATE_MIN_MATCH) {
+        return 0;
+    }
+    if (limit > FLATE_MAX_MATCH) {
+        limit = FLATE_MAX_MATCH;
+    }
+    for (candidate = w->head[hash3(w->window + pos)]; candidate >= 0 && chainLength--;
+         candidate = w->chain[candidate]) {
+        if (pos - (size_t) candidate > FLATE_WINDOW) {
+            break;
+        }
+        const unsigned char *a = w->window + candidate;
+        const unsigned char *b = w->window + pos;
+        size_t length = 0;
+        while (length < limit && a[length] == b[length]) {
+            length++;
+        }
+        if (length > best) {
+            best = length;
+            *distance = pos - (size_t) candidate;
+            if (length == limit) {
+                break;
+            }
+        }
+    }
+    return best >= FLATE_MIN_MATCH ? best : 0;
+}
+
+/* one fixed Huffman block of the pending data, stored as is when that would not be smaller */
+static void compress_pending(FlateWriter *w) {
+    size_t start = w->pending;
+    size_t pos = start;
+    size_t count = 0;
+    size_t i;
+    unsigned long long cost = 3 + 7;
+    if (pos == w->windowSize) {
+        return;
+    }
+    while (pos < w->windowSize) {
+        size_t distance = 0;
+        size_t length = find_match(w, pos, &distance);
+        if (length) {
+            w->tokens[count].length = (unsigned short) length;
+            w->tokens[count].value = (unsigned short) distance;
+            cost += match_cost((unsigned int) length, (unsigned int) distance);
+            while (length--) {
+                insert_hash(w, pos++);
+            }
+        } else {
+            w->tokens[count].length = 0;
+            w->tokens[count].value = w->window[pos];
+            cost += w->window[pos] < 144 ? 8 : 9;
+            insert_hash(w, pos++);
+        }
+        count++;
+    }
+    w->pending = pos;
+
+    if (cost > (unsigned long long) (pos - start + 5) * 8) {
+        put_stored(w, w->window + start, pos - start);
+        return;
+    }
+    put_bits(w, 0, 1);
+    put_bits(w, 1, 2);
+    for (i = 0; i < count; i++) {
+        if (w->tokens[i].length) {
+            put_match(w, w->tokens[i].length, w->tokens[i].value);
+        } else {
+            put_symbol(w, w->tokens[i].value);
+        }
+    }
+    put_symbol(w, 256);
+}
+
+/* keep the last FLATE_WINDOW bytes as history for the next block */
+static void slide_window(FlateWriter *w) {
+    size_t shift = w->windowSize - FLATE_WINDOW;
+    size_t i;
+    memmove(w->window, w->window + shift, FLATE_WINDOW);
+    for (i = 0; i < (1 << FLATE_HASH_BITS); i++) {
+        w->head[i] = w->head[i] >= (int) shift ? w->head[i] - (int) shift : -1;
+    }
+    for (i = 0; i < FLATE_WINDOW; i++) {
+        int previous = w->chain[i + shift];
+        w->chain[i] = previous >= (int) shift ? previous - (int) shift : -1;
+    }
+    w->windowSize = FLATE_WINDOW;
+    w->pending = FLATE_WINDOW;
+}
+
+FlateWriter *flate_deflate_begin(int gzip, FlateOutput output, void *ctx) {
+    static const unsigned char gzipHeader[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+    FlateWriter *w = malloc(sizeof(FlateWriter));
+    if (!w) {
+        return NULL;
+    }
+    w->gzip = gzip;
+    w->output = output;
+    w->ctx = ctx;
+    w->failed = 0;
+    w->crc = 0;
+    w->size = 0;
+    w->windowSize = 0;
+    w->pending = 0;
+    memset(w->head, 0xff, sizeof(w->head));
+    w->bits = 0;
+    w->bitCount = 0;
+    w->outSize = 0;
+    if (gzip) {
+        put_aligned_bytes(w, gzipHeader, sizeof(gzipHeader));
+    }
+    return w;
+}
+
+int flate_deflate_write(FlateWriter *w, const void *data, size_t size) {
+    const unsigned char *p = data;
+    w->crc = flate_crc32(w->crc, data, size);
+    w->size += size;
+    while (size > 0 && !w->failed) {
+        size_t n = sizeof(w->window) - w->windowSize;
+        n = n < size ? n : size;
+        memcpy(w->window + w->windowSize, p, n);
+        w->windowSize += n;
+        p += n;
+        size -= n;
+        if (sizeof(w->window) == w->windowSize) {
+            compress_pending(w);
+            slide_window(w);
+        }
+    }
+    return w->failed ? -1 : 0;
+}
+
+int flate_deflate_end(FlateWriter *w) {
+    compress_pending(w);
+    // empty final block
+    put_bits(w, 1, 1);
+    put_bits(w, 1, 2);
+    put_symbol(w, 256);
+    if (w->gzip) {
+        unsigned char trailer[8];
+        int i;
+        for (i = 0; i < 4; i++) {
+            trailer[i] = (unsigned char) (w->crc >> (8 * i));
+            trailer[4 + i] = (unsigned char) (w->size >> (8 * i));
+        }
+        put_aligned_bytes(w, trailer, sizeof(trailer));
+    } else if (w->bitCount > 0) {
+        put_bits(w, 0, 8 - w->bitCount);
+    }
+    flush_out(w);
+    int result = w->failed ? -1 : 0;
+    free(w);
+    return result;
+}
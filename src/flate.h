@@ -0,0 +1,58 @@
+#ifndef FLATE_H
+#define FLATE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/**
+ * DEFLATE (RFC 1951) streams as used by zip entries and gzip files (RFC 1952).
+ *
+ * Decompression handles stored, fixed and dynamic Huffman blocks and writes the output in pieces through
+ * a callback, keeping only the 32K window in memory. Compression is greedy LZ77 with fixed Huffman codes:
+ * fast and without dependencies, at some cost in ratio compared to zlib.
+ */
+
+/**
+ * @return 0 to continue, -1 to stop (the call then fails)
+ */
+typedef int (*FlateOutput)(void *ctx, const void *data, size_t size);
+
+/**
+ * @param crc running CRC-32, 0 for the first piece
+ * @return CRC-32 of everything passed so far
+ */
+unsigned long flate_crc32(unsigned long crc, const void *data, size_t size);
+
+/**
+ * decompress the stream starting at the current position of the file
+ *
+ * @param inputSize bytes of the file the stream may read at most, -1 for up to the end of the file
+ * @param gzip 1 for a gzip file (header and trailer checked), 0 for a raw deflate stream (zip entry)
+ * @param crc receives the CRC-32 of the output, may be NULL
+ * @return number of bytes written to output, -1 on corrupt input, read or output failure
+ */
+long long flate_inflate(FILE *in, long long inputSize, int gzip, FlateOutput output, void *ctx, unsigned long *crc);
+
+typedef struct FlateWriter FlateWriter;
+
+/**
+ * start compressing, the compressed stream is written through output
+ *
+ * @param gzip 1 to produce a gzip file, 0 for a raw deflate stream (zip entry)
+ * @return the writer, NULL if memory could not be allocated
+ */
+FlateWriter *flate_deflate_begin(int gzip, FlateOutput output, void *ctx);
+
+/**
+ * @return 0 on success, -1 if output failed (the writer must still be ended)
+ */
+int flate_deflate_write(FlateWriter *writer, const void *data, size_t size);
+
+/**
+ * finish the stream and release the writer
+ *
+ * @return 0 on success, -1 if output failed
+ */
+int flate_deflate_end(FlateWriter *writer);
+
+#endif
@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #define strncasecmp _strnicmp
+#else
+    #include <strings.h>
+#endif
+
+#include "httpmessage.h"
+
+/**
+ * Returns the size of the HTTP headers (including the empty line which ends them) of the zero terminated
+ * message, or -1 if the end of the headers is not in the buffer yet.
+ */
+long getHeaderLength(const char* buf) {
+    const char* s = strstr(buf, "\r\n\r\n");
+    int header_stop_len = 4;
+    if (NULL == s) {
+        s = strstr(buf, "\n\n");
+        header_stop_len = 2;
+    }
+    if (NULL == s) {
+        return -1;
+    }
+    return (s - buf) + header_stop_len;
+}
+
+/**
+ * Returns 1 if the HTTP headers of the message declare the given content type, 0 otherwise.
+ */
+int hasContentType(const char* buf, long header_len, const char* content_type) {
+    const char* key = "Content-Type:";
+    size_t key_len = strlen(key);
+    const char* line = buf;
+    while (line && line < buf + header_len) {
+        if (0 == strncasecmp(line, key, key_len)) {
+            const char* value = line + key_len;
+            while (' ' == *value || '\t' == *value) {
+                value++;
+            }
+            return 0 == strncasecmp(value, content_type, strlen(content_type));
+        }
+        line = strchr(line, '\n');
+        if (line) {
+            line++;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Tries to detect message length by the given buffer, which contains the beginning of the message.
+ * The buffer passed must be of at least (size+1) length.
+ * 
+ * Returns -1, if the length is still unknown (in this case the caller must provide a bigger part of the message).
+ * 
+ * Returns -2, if the length can never be determined, i.e. HTTP headers don't contain 'Content-Length'.
+ *
+ * If 0 or more is returned, it is the total size of the message (size of the headers + size of the body).
+ */
+int detectMessageLength(char* buf, int size) {
+    buf[size] = 0;
+    
+    const long header_len = getHeaderLength(buf);
+    if (0 > header_len) {
+        return -1;
+    }
+
+    const char* content_len_key = "Content-Length:";
+    // trying to find Content-Length
+    char* content_len_header = strstr(buf, content_len_key);
+    if (NULL == content_len_header || (content_len_header - buf) >= header_len) {
+        return -2;
+    }
+
+    long l = strtol(content_len_header + strlen(content_len_key), NULL, 10);
+    return header_len + l;
+}
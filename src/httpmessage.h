@@ -0,0 +1,25 @@
+#ifndef HTTPMESSAGE_H
+#define HTTPMESSAGE_H
+
+/**
+ * Framing of the HTTP requests read from a client socket
+ */
+
+/**
+ * @return size of the HTTP headers of the zero terminated message, -1 if they are not complete yet
+ */
+long getHeaderLength(const char* buf);
+
+/**
+ * @return 1 if the HTTP headers of the message declare the given content type, 0 otherwise
+ */
+int hasContentType(const char* buf, long header_len, const char* content_type);
+
+/**
+ * @param buf the beginning of the message, at least size + 1 long
+ * @return total size of the message (headers and body), -1 if still unknown, -2 if the headers carry
+ *         no Content-Length
+ */
+int detectMessageLength(char* buf, int size);
+
+#endif
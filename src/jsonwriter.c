@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <winsock2.h>
+#else
+    #include <unistd.h>
+#endif
+
+#include "jsonwriter.h"
+#include "base64.h"
+#include "metrics.h"
+#include "logger.h"
+
+static int jw_sock_send_all(int sock, const char *p, size_t len) {
+    metrics_add(METRIC_BYTES_OUT, (long long) len);
+    while (0 < len) {
+#ifdef _WIN32
+        int n = send(sock, p, (int) len, 0);
+#else
+        int n = write(sock, p, len);
+#endif
+        if (0 >= n) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void jw_flush(JsonWriter *w) {
+    if (w->used > 0 && !w->failed) {
+        if (0 > jw_sock_send_all(w->sock, w->buf, w->used)) {
+            perror("Failed to send HTTP response");
+            w->failed = 1;
+        }
+    }
+    w->used = 0;
+}
+
+static void jw_write(JsonWriter *w, const char *data, size_t len) {
+    w->length += len;
+    if (w->measure) {
+        return;
+    }
+    if (len >= JSON_WRITER_BUFFER_SIZE) {
+        /* large block (e.g. cached file content) goes to the socket without copying */
+        jw_flush(w);
+        if (!w->failed && 0 > jw_sock_send_all(w->sock, data, len)) {
+            perror("Failed to send HTTP response");
+            w->failed = 1;
+        }
+        return;
+    }
+    while (len > 0) {
+        size_t room = JSON_WRITER_BUFFER_SIZE - w->used;
+        if (room == 0) {
+            jw_flush(w);
+            room = JSON_WRITER_BUFFER_SIZE;
+        }
+        size_t n = len < room ? len : room;
+        memcpy(w->buf + w->used, data, n);
+        w->used += n;
+        data += n;
+        len -= n;
+    }
+}
+
+static void jw_putc(JsonWriter *w, char c) {
+    jw_write(w, &c, 1);
+}
+
+/* CBOR major types */
+#define CBOR_UNSIGNED 0
+#define CBOR_NEGATIVE 1
+#define CBOR_BYTES 2
+#define CBOR_TEXT 3
+
+static void cbor_head(JsonWriter *w, int major, unsigned long long value) {
+    unsigned char head[9];
+    int n = 1;
+    int i;
+    if (value < 24) {
+        head[0] = (unsigned char) (major << 5 | value);
+    } else {
+        int bytes = value <= 0xff ? 1 : value <= 0xffff ? 2 : value <= 0xffffffffULL ? 4 : 8;
+        head[0] = (unsigned char) (major << 5 | (bytes == 1 ? 24 : bytes == 2 ? 25 : bytes == 4 ? 26 : 27));
+        for (i = bytes; i > 0; i--) {
+            head[n++] = (unsigned char) (value >> ((i - 1) * 8));
+        }
+    }
+    jw_write(w, (const char *) head, n);
+}
+
+static void cbor_text(JsonWriter *w, const char *str, size_t len) {
+    cbor_head(w, CBOR_TEXT, len);
+    jw_write(w, str, len);
+}
+
+/* Emits separating comma if the current container already has a value */
+static void jw_value_prefix(JsonWriter *w) {
+    if (w->format == RESPONSE_FORMAT_CBOR) {
+        return;
+    }
+    if (w->needComma[w->depth]) {
+        jw_putc(w, ',');
+    }
+    w->needComma[w->depth] = 1;
+}
+
+static void jw_begin(JsonWriter *w, char c) {
+    jw_value_prefix(w);
+    if (w->format == RESPONSE_FORMAT_CBOR) {
+        /* indefinite length map or array */
+        jw_putc(w, (char) (c == '{' ? 0xbf : 0x9f));
+    } else {
+        jw_putc(w, c);
+    }
+    if (w->depth < JSON_WRITER_MAX_DEPTH - 1) {
+        w->depth++;
+    }
+    w->needComma[w->depth] = 0;
+}
+
+static void jw_end(JsonWriter *w, char c) {
+    if (1 == w->depth && '}' == c && w->trailer) {
+        JsonBodyWriter trailer = w->trailer;
+        w->trailer = NULL;
+        trailer(w, w->trailerCtx);
+    }
+    if (w->depth > 0) {
+        w->depth--;
+    }
+    jw_putc(w, (char) (w->format == RESPONSE_FORMAT_CBOR ? 0xff : c));
+}
+
+void jw_begin_object(JsonWriter *w) { jw_begin(w, '{'); }
+void jw_end_object(JsonWriter *w) { jw_end(w, '}'); }
+void jw_begin_array(JsonWriter *w) { jw_begin(w, '['); }
+void jw_end_array(JsonWriter *w) { jw_end(w, ']'); }
+
+static void jw_escaped(JsonWriter *w, const char *str) {
+    const char *run = str;
+    const char *p = str;
+    jw_putc(w, '\"');
+    for (; *p; p++) {
+        unsigned char c = (unsigned char) *p;
+        if (c > 31 && c != '\"' && c != '\\') {
+            continue;
+        }
+        jw_write(w, run, p - run);
+        run = p + 1;
+        char esc[8];
+        switch (c) {
+            case '\\': jw_write(w, "\\\\", 2); break;
+            case '\"': jw_write(w, "\\\"", 2); break;
+            case '\b': jw_write(w, "\\b", 2); break;
+            case '\f': jw_write(w, "\\f", 2); break;
+            case '\n': jw_write(w, "\\n", 2); break;
+            case '\r': jw_write(w, "\\r", 2); break;
+            case '\t': jw_write(w, "\\t", 2); break;
+            default:
+                sprintf(esc, "\\u%04x", c);
+                jw_write(w, esc, 6);
+                break;
+        }
+    }
+    jw_write(w, run, p - run);
+    jw_putc(w, '\"');
+}
+
+void jw_key(JsonWriter *w, const char *key) {
+    if (w->format == RESPONSE_FORMAT_CBOR) {
+        cbor_text(w, key, strlen(key));
+        return;
+    }
+    jw_value_prefix(w);
+    jw_escaped(w, key);
+    jw_putc(w, ':');
+    /* the value following the key must not be prefixed with a comma */
+    w->needComma[w->depth] = 0;
+}
+
+void jw_string(JsonWriter *w, const char *str) {
+    if (w->format == RESPONSE_FORMAT_CBOR) {
+        cbor_text(w, str ? str : "", str ? strlen(str) : 0);
+        return;
+    }
+    jw_value_prefix(w);
+    jw_escaped(w, str ? str : "");
+}
+
+void jw_int(JsonWriter *w, long long value) {
+    if (w->format == RESPONSE_FORMAT_CBOR) {
+        if (value < 0) {
+            cbor_head(w, CBOR_NEGATIVE, (unsigned long long) (-1 - value));
+        } else {
+            cbor_head(w, CBOR_UNSIGNED, (unsigned long long) value);
+        }
+        return;
+    }
+    char num[32];
+    int n = sprintf(num, "%lld", value);
+    jw_value_prefix(w);
+    jw_write(w, num, n);
+}
+
+void jw_double(JsonWriter *w, double value) {
+    if (w->format == RESPONSE_FORMAT_CBOR) {
+        unsigned char encoded[9];
+        unsigned long long bits;
+        int i;
+        memcpy(&bits, &value, sizeof(bits));
+        encoded[0] = 0xfb;
+        for (i = 0; i < 8; i++) {
+            encoded[1 + i] = (unsigned char) (bits >> ((7 - i) * 8));
+        }
+        jw_write(w, (const char *) encoded, sizeof(encoded));
+        return;
+    }
+    char num[64];
+    int n = sprintf(num, "%.17g", value);
+    jw_value_prefix(w);
+    jw_write(w, num, n);
+}
+
+void jw_bool(JsonWriter *w, int value) {
+    if (w->format == RESPONSE_FORMAT_CBOR) {
+        jw_putc(w, (char) (value ? 0xf5 : 0xf4));
+        return;
+    }
+    jw_value_prefix(w);
+    if (value) {
+        jw_write(w, "true", 4);
+    } else {
+        jw_write(w, "false", 5);
+    }
+}
+
+void jw_base64(JsonWriter *w, const unsigned char *data, size_t len) {
+    if (w->format == RESPONSE_FORMAT_CBOR) {
+        cbor_head(w, CBOR_BYTES, len);
+        jw_write(w, (const char *) data, len);
+        return;
+    }
+    jw_value_prefix(w);
+    jw_putc(w, '\"');
+    if (w->measure) {
+        w->length += (len + 2) / 3 * 4;
+    } else {
+        metrics_add(METRIC_BASE64_ENCODED, (long long) len);
+        while (len > 0) {
+            size_t room = JSON_WRITER_BUFFER_SIZE - w->used;
+            if (room < 5) {
+                jw_flush(w);
+                room = JSON_WRITER_BUFFER_SIZE;
+            }
+            /* whole triples only, except for the very last chunk; keep one byte for the terminator */
+            size_t chunk = (room - 1) / 4 * 3;
+            if (chunk >= len) {
+                chunk = len;
+            }
+            base64_encode((unsigned char *) data, chunk, w->buf + w->used, room);
+            size_t encoded = (chunk + 2) / 3 * 4;
+            w->used += encoded;
+            w->length += encoded;
+            data += chunk;
+            len -= chunk;
+        }
+    }
+    jw_putc(w, '\"');
+}
+
+void jw_base64_encoded(JsonWriter *w, const unsigned char *data, size_t len, const char *encoded) {
+    if (w->format == RESPONSE_FORMAT_CBOR) {
+        jw_base64(w, data, len);
+        return;
+    }
+    jw_value_prefix(w);
+    jw_putc(w, '\"');
+    jw_write(w, encoded, (len + 2) / 3 * 4);
+    jw_putc(w, '\"');
+}
+
+void jw_string_field(JsonWriter *w, const char *key, const char *str) {
+    jw_key(w, key);
+    jw_string(w, str);
+}
+
+void jw_int_field(JsonWriter *w, const char *key, long long value) {
+    jw_key(w, key);
+    jw_int(w, value);
+}
+
+/* key of a base64 field, without the "_base64" suffix in CBOR format */
+static void jw_base64_key(JsonWriter *w, const char *key) {
+    static const char suffix[] = "_base64";
+    size_t keyLen = strlen(key);
+    if (w->format == RESPONSE_FORMAT_CBOR && keyLen > sizeof(suffix) - 1
+        && strcmp(key + keyLen - (sizeof(suffix) - 1), suffix) == 0) {
+        cbor_text(w, key, keyLen - (sizeof(suffix) - 1));
+        return;
+    }
+    jw_key(w, key);
+}
+
+void jw_base64_field(JsonWriter *w, const char *key, const unsigned char *data, size_t len) {
+    jw_base64_key(w, key);
+    jw_base64(w, data, len);
+}
+
+void jw_base64_encoded_field(JsonWriter *w, const char *key, const unsigned char *data, size_t len,
+                             const char *encoded) {
+    jw_base64_key(w, key);
+    jw_base64_encoded(w, data, len, encoded);
+}
+
+static void jw_reset(JsonWriter *w, int sock, int format, int measure, const JsonResponseExtras *extras) {
+    w->sock = sock;
+    w->format = format;
+    w->measure = measure;
+    w->failed = 0;
+    w->length = 0;
+    w->used = 0;
+    w->depth = 0;
+    memset(w->needComma, 0, sizeof(w->needComma));
+    w->trailer = extras ? extras->trailer : NULL;
+    w->trailerCtx = extras ? extras->trailerCtx : NULL;
+}
+
+int jw_send_response(int sock, int httpStatus, int format, JsonBodyWriter body, void *ctx) {
+    return jw_send_response_extra(sock, httpStatus, format, NULL, body, ctx);
+}
+
+int jw_send_response_extra(int sock, int httpStatus, int format, const JsonResponseExtras *extras,
+                           JsonBodyWriter body, void *ctx) {
+    JsonWriter *w = malloc(sizeof(JsonWriter));
+    if (!w) {
+        perror("[ERROR]: Memory not allocated for JSON writer");
+        return -1;
+    }
+
+    jw_reset(w, sock, format, 1, extras);
+    body(w, ctx);
+    size_t bodyLength = w->length;
+
+    jw_reset(w, sock, format, 0, extras);
+    w->used = snprintf(w->buf, JSON_WRITER_BUFFER_SIZE,
+                       "HTTP/1.1 %d OK\r\nContent-Type: %s\r\nContent-Length: %lu\r\n%s\r\n", httpStatus, format == RESPONSE_FORMAT_CBOR ? "application/cbor" : "text/html; charset=UTF-8",
+                       (unsigned long) bodyLength, extras && extras->headers ? extras->headers : "");
+    body(w, ctx);
+    jw_flush(w);
+
+    int result = 0;
+    if (w->failed) {
+        result = -1;
+    } else if (w->length != bodyLength) {
+        LOG_ERROR("JSON body length changed between passes: %lu != %lu",
+                  (unsigned long) w->length, (unsigned long) bodyLength);
+        result = -1;
+    }
+    free(w);
+    return result;
+}
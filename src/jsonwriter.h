@@ -0,0 +1,113 @@
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <stddef.h>
+
+#define JSON_WRITER_BUFFER_SIZE 65536
+#define JSON_WRITER_MAX_DEPTH 16
+
+#define RESPONSE_FORMAT_JSON 0
+#define RESPONSE_FORMAT_CBOR 1
+
+/**
+ * Streaming JSON writer which serialises a response straight into a socket output buffer.
+ *
+ * The response is produced by a body callback which is invoked twice: first with 'measure' set
+ * (nothing is written, only the length of the body is counted, so that Content-Length can be sent
+ * up front), then for real. Large byte fields are base64 encoded chunk by chunk into the output
+ * buffer, so the response never exists in full in memory.
+ *
+ * The same calls can produce CBOR (RFC 7049) instead of JSON: objects and arrays become indefinite
+ * length maps and arrays, and base64 fields are carried as native byte strings under the key without
+ * its "_base64" suffix (e.g. "stdout_base64" becomes "stdout").
+ */
+typedef struct JsonWriter JsonWriter;
+
+typedef void (*JsonBodyWriter)(JsonWriter *w, void *ctx);
+
+struct JsonWriter {
+    int sock;
+    int format;
+    int measure;
+    int failed;
+    size_t length;
+    size_t used;
+    int depth;
+    int needComma[JSON_WRITER_MAX_DEPTH];
+    JsonBodyWriter trailer;     /* called once before the top level object is closed */
+    void *trailerCtx;
+    char buf[JSON_WRITER_BUFFER_SIZE];
+};
+
+/**
+ * Additions to a response, independent of its body
+ */
+typedef struct {
+    const char *headers;        /* extra HTTP header lines, each ending with "\r\n", NULL for none */
+    JsonBodyWriter trailer;     /* writes extra fields at the end of the top level object, NULL for none */
+    void *trailerCtx;
+} JsonResponseExtras;
+
+/**
+ * send HTTP response whose JSON body is produced by the given callback
+ *
+ * @param sock the client socket
+ * @param httpStatus HTTP status code
+ * @param format RESPONSE_FORMAT_JSON or RESPONSE_FORMAT_CBOR
+ * @param body the callback writing the response body, called twice (measure and emit)
+ * @param ctx the opaque context passed to the callback
+ * @return 0 on success, -1 otherwise
+ */
+int jw_send_response(int sock, int httpStatus, int format, JsonBodyWriter body, void *ctx);
+
+/**
+ * same as jw_send_response, with extra headers and fields
+ *
+ * @param extras NULL for none; the trailer must write the same both times it is called
+ */
+int jw_send_response_extra(int sock, int httpStatus, int format, const JsonResponseExtras *extras,
+                           JsonBodyWriter body, void *ctx);
+
+void jw_begin_object(JsonWriter *w);
+void jw_end_object(JsonWriter *w);
+void jw_begin_array(JsonWriter *w);
+void jw_end_array(JsonWriter *w);
+
+/**
+ * write object key, the value must follow
+ */
+void jw_key(JsonWriter *w, const char *key);
+
+/**
+ * write escaped string value, NULL is written as an empty string
+ */
+void jw_string(JsonWriter *w, const char *str);
+
+void jw_int(JsonWriter *w, long long value);
+void jw_double(JsonWriter *w, double value);
+void jw_bool(JsonWriter *w, int value);
+
+/**
+ * write binary data as base64 string value, encoded chunk by chunk into the output buffer
+ * (a byte string in CBOR format)
+ *
+ * @param data the source buffer
+ * @param len the length of the source buffer
+ */
+void jw_base64(JsonWriter *w, const unsigned char *data, size_t len);
+
+/**
+ * same as jw_base64 for data whose base64 encoding is already at hand, it is then written as is
+ *
+ * @param encoded base64 encoding of data (without terminating zero requirement), used in JSON format only
+ */
+void jw_base64_encoded(JsonWriter *w, const unsigned char *data, size_t len, const char *encoded);
+
+/* Convenience key/value helpers */
+void jw_string_field(JsonWriter *w, const char *key, const char *str);
+void jw_int_field(JsonWriter *w, const char *key, long long value);
+void jw_base64_field(JsonWriter *w, const char *key, const unsigned char *data, size_t len);
+void jw_base64_encoded_field(JsonWriter *w, const char *key, const unsigned char *data, size_t len,
+                             const char *encoded);
+
+#endif
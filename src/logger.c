@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+#endif
+
+#include "logger.h"
+#include "ckthread.h"
+
+typedef struct {
+    volatile int level;
+    int format;
+    int rateLimit;
+    volatile long long window;      /* second the rate limit counts in */
+    volatile long long count;       /* messages in the window */
+    volatile long long suppressed;  /* by the rate limit, not reported yet */
+    volatile long long dropped;     /* ring full, not reported yet */
+} LoggerState;
+
+typedef struct {
+    volatile long long sequence;    /* position + 1 when filled, position + LOGGER_RING_SLOTS when free again */
+    int level;
+    long long timeMs;
+    char text[LOGGER_MESSAGE_SIZE];
+} LogSlot;
+
+static LoggerState localState = { LOG_LEVEL_INFO, LOGGER_FORMAT_TEXT, 0, 0, 0, 0, 0 };
+static LoggerState *state = &localState;
+
+static LogSlot *ring = NULL;
+static volatile long long enqueuePos = 0;
+static long long dequeuePos = 0;        /* consumer only, under flushMutex */
+static ck_mutex_t flushMutex;
+static ck_cond_t flushCond;
+
+static const char *const LEVEL_NAMES[] = { "error", "warn", "info", "debug" };
+static const char *const LEVEL_TAGS[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+
+#ifdef _WIN32
+static long long atomic_add(volatile long long *p, long long n) {
+    return InterlockedExchangeAdd64(p, n);
+}
+
+static int atomic_cas(volatile long long *p, long long expected, long long desired) {
+    return expected == InterlockedCompareExchange64(p, desired, expected);
+}
+
+static long long atomic_get(volatile long long *p) {
+    return InterlockedCompareExchange64(p, 0, 0);
+}
+
+static void atomic_set(volatile long long *p, long long value) {
+    InterlockedExchange64(p, value);
+}
+
+static long long atomic_take(volatile long long *p) {
+    return InterlockedExchange64(p, 0);
+}
+#else
+static long long atomic_add(volatile long long *p, long long n) {
+    return __atomic_fetch_add(p, n, __ATOMIC_SEQ_CST);
+}
+
+static int atomic_cas(volatile long long *p, long long expected, long long desired) {
+    return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static long long atomic_get(volatile long long *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void atomic_set(volatile long long *p, long long value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static long long atomic_take(volatile long long *p) {
+    return __atomic_exchange_n(p, 0, __ATOMIC_SEQ_CST);
+}
+#endif
+
+static long long now_ms() {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int logger_enabled(LogLevel level) {
+    return (int) level <= state->level;
+}
+
+/* at most rateLimit messages a second, errors always pass */
+static int rate_allowed(LogLevel level, long long timeMs) {
+    if (0 >= state->rateLimit || LOG_LEVEL_ERROR == level) {
+        return 1;
+    }
+    long long second = timeMs / 1000;
+    long long window = atomic_get(&state->window);
+    if (window != second && atomic_cas(&state->window, window, second)) {
+        atomic_set(&state->count, 0);
+    }
+    if (atomic_add(&state->count, 1) < state->rateLimit) {
+        return 1;
+    }
+    atomic_add(&state->suppressed, 1);
+    return 0;
+}
+
+static void emit(int level, long long timeMs, const char *text) {
+    if (LOGGER_FORMAT_TEXT == state->format) {
+        fprintf(stdout, "[%s]: %s\n", LEVEL_TAGS[level], text);
+        return;
+    }
+    fprintf(stdout, "{\"time\":%lld.%03lld,\"level\":\"%s\",\"message\":\"", timeMs / 1000, timeMs % 1000,
+            LEVEL_NAMES[level]);
+    const char *run = text;
+    const char *p = text;
+    for (; *p; p++) {
+        unsigned char c = (unsigned char) *p;
+        if (c > 31 && c != '\"' && c != '\\') {
+            continue;
+        }
+        fwrite(run, 1, p - run, stdout);
+        run = p + 1;
+        switch (c) {
+            case '\"': fputs("\\\"", stdout); break;
+            case '\\': fputs("\\\\", stdout); break;
+            case '\n': fputs("\\n", stdout); break;
+            case '\r': fputs("\\r", stdout); break;
+            case '\t': fputs("\\t", stdout); break;
+            default: fprintf(stdout, "\\u%04x", c); break;
+        }
+    }
+    fwrite(run, 1, p - run, stdout);
+    fputs("\"}\n", stdout);
+}
+
+/* messages lost since the last report */
+static void emit_lost() {
+    char text[128];
+    long long suppressed = atomic_take(&state->suppressed);
+    if (suppressed > 0) {
+        sprintf(text, "%lld log messages suppressed by the rate limit", suppressed);
+        emit(LOG_LEVEL_WARN, now_ms(), text);
+    }
+    long long dropped = atomic_take(&state->dropped);
+    if (dropped > 0) {
+        sprintf(text, "%lld log messages dropped, log buffer full", dropped);
+        emit(LOG_LEVEL_WARN, now_ms(), text);
+    }
+}
+
+void logger_write(LogLevel level, const char *format, ...) {
+    long long timeMs = now_ms();
+    if (!rate_allowed(level, timeMs)) {
+        return;
+    }
+    va_list args;
+    if (!ring) {
+        char text[LOGGER_MESSAGE_SIZE];
+        va_start(args, format);
+        vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+        emit_lost();
+        emit(level, timeMs, text);
+        fflush(stdout);
+        return;
+    }
+
+    // claim the slot at the enqueue position: free when its sequence equals the position
+    long long pos = atomic_get(&enqueuePos);
+    LogSlot *slot;
+    while (1) {
+        slot = &ring[pos & (LOGGER_RING_SLOTS - 1)];
+        long long diff = atomic_get(&slot->sequence) - pos;
+        if (0 == diff) {
+            if (atomic_cas(&enqueuePos, pos, pos + 1)) {
+                break;
+            }
+            pos = atomic_get(&enqueuePos);
+        } else if (diff < 0) {
+            // the consumer is a whole ring behind
+            atomic_add(&state->dropped, 1);
+            return;
+        } else {
+            pos = atomic_get(&enqueuePos);
+        }
+    }
+    va_start(args, format);
+    vsnprintf(slot->text, LOGGER_MESSAGE_SIZE, format, args);
+    va_end(args);
+    slot->level = level;
+    slot->timeMs = timeMs;
+    atomic_set(&slot->sequence, pos + 1);
+}
+
+/* write out the filled slots, under flushMutex */
+static void drain() {
+    emit_lost();
+    while (1) {
+        LogSlot *slot = &ring[dequeuePos & (LOGGER_RING_SLOTS - 1)];
+        if (atomic_get(&slot->sequence) != dequeuePos + 1) {
+            break;
+        }
+        emit(slot->level, slot->timeMs, slot->text);
+        atomic_set(&slot->sequence, dequeuePos + LOGGER_RING_SLOTS);
+        dequeuePos++;
+    }
+    fflush(stdout);
+}
+
+static void flusher_thread(void *arg) {
+    ck_mutex_lock(&flushMutex);
+    while (1) {
+        drain();
+        ck_cond_timedwait(&flushCond, &flushMutex, LOGGER_FLUSH_INTERVAL_MS);
+    }
+}
+
+void logger_config(LogLevel level, int format, int rateLimit) {
+    state->level = level;
+    state->format = format;
+    state->rateLimit = rateLimit > 0 ? rateLimit : 0;
+}
+
+void logger_init(int shared) {
+    if (shared) {
+#ifndef _WIN32
+        LoggerState *sharedState = mmap(NULL, sizeof(LoggerState), PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == sharedState) {
+            perror("[WARN]: Log level not shared between request processes");
+            return;
+        }
+        memcpy(sharedState, &localState, sizeof(LoggerState));
+        state = sharedState;
+#endif
+        return;
+    }
+
+    LogSlot *slots = malloc(sizeof(LogSlot) * LOGGER_RING_SLOTS);
+    if (!slots) {
+        perror("[WARN]: Log written synchronously, no memory for the log buffer");
+        return;
+    }
+    long long i;
+    for (i = 0; i < LOGGER_RING_SLOTS; i++) {
+        slots[i].sequence = i;
+    }
+    ck_mutex_init(&flushMutex);
+    ck_cond_init(&flushCond);
+    fflush(stdout);
+    ring = slots;
+    if (0 != ck_thread_start(flusher_thread, NULL)) {
+        perror("[WARN]: Log written synchronously, flusher thread not started");
+        ring = NULL;
+        free(slots);
+        return;
+    }
+    atexit(logger_flush);
+}
+
+void logger_set_level(LogLevel level) {
+    state->level = level;
+}
+
+LogLevel logger_level() {
+    return (LogLevel) state->level;
+}
+
+int logger_level_of(const char *name) {
+    int level;
+    for (level = LOG_LEVEL_ERROR; level <= LOG_LEVEL_DEBUG; level++) {
+        if (0 == strcmp(LEVEL_NAMES[level], name)) {
+            return level;
+        }
+    }
+    return -1;
+}
+
+const char *logger_level_name(LogLevel level) {
+    return LEVEL_NAMES[level];
+}
+
+void logger_flush() {
+    if (!ring) {
+        fflush(stdout);
+        return;
+    }
+    ck_mutex_lock(&flushMutex);
+    drain();
+    ck_mutex_unlock(&flushMutex);
+}
@@ -0,0 +1,90 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+/**
+ * Leveled logging to stdout.
+ *
+ * The LOG_* macros test the level before anything else, the arguments of a disabled message are not even
+ * evaluated. An enabled message is formatted straight into a slot of a lock-free ring buffer (multiple
+ * producers, one consumer) which a background thread writes out in batches; in a process without one
+ * (fork server mode, startup) it is written at once. Messages longer than LOGGER_MESSAGE_SIZE are cut,
+ * messages finding the ring full are dropped and counted.
+ *
+ * Output is either the classic text lines ("[INFO]: message") or JSON lines
+ * ({"time":1760000000.123,"level":"info","message":"message"}). Above logger_config's rate limit, messages
+ * below LOG_LEVEL_ERROR are suppressed for the rest of the second and counted; the counts are reported
+ * with the next message written.
+ */
+
+#define LOGGER_MESSAGE_SIZE 512
+#define LOGGER_RING_SLOTS 2048      /* power of two */
+#define LOGGER_FLUSH_INTERVAL_MS 20
+
+typedef enum {
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG
+} LogLevel;
+
+#define LOGGER_FORMAT_TEXT 0
+#define LOGGER_FORMAT_JSON 1
+
+#define LOG_ERROR(...) LOGGER_WRITE(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...) LOGGER_WRITE(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...) LOGGER_WRITE(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOGGER_WRITE(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#define LOGGER_WRITE(level, ...) \
+    do { \
+        if (logger_enabled(level)) { \
+            logger_write(level, __VA_ARGS__); \
+        } \
+    } while (0)
+
+/**
+ * @return 1 if messages of the level are written
+ */
+int logger_enabled(LogLevel level);
+
+/**
+ * write a message, use the LOG_* macros instead
+ *
+ * @param format printf format of the message, without level prefix and newline
+ */
+void logger_write(LogLevel level, const char *format, ...);
+
+/**
+ * @param format LOGGER_FORMAT_TEXT or LOGGER_FORMAT_JSON
+ * @param rateLimit messages per second, 0 for no limit
+ */
+void logger_config(LogLevel level, int format, int rateLimit);
+
+/**
+ * start writing through the ring buffer and a background thread
+ *
+ * @param shared keep the level and the rate limit in shared memory for the request processes forked
+ *               after this call instead (no background thread then)
+ */
+void logger_init(int shared);
+
+/**
+ * change the level at runtime, for every request process in fork mode too
+ */
+void logger_set_level(LogLevel level);
+
+LogLevel logger_level();
+
+/**
+ * @return level of the name (error, warn, info, debug), -1 if unknown
+ */
+int logger_level_of(const char *name);
+
+const char *logger_level_name(LogLevel level);
+
+/**
+ * write out the messages still in the ring buffer
+ */
+void logger_flush();
+
+#endif
@@ -0,0 +1,402 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <time.h>
+    #include <sys/mman.h>
+#endif
+
+#include "metrics.h"
+#include "arena.h"
+#include "ckthread.h"
+
+#define METRICS_ACTION_SLOTS (METRICS_MAX_ACTIONS + 2)
+#define METRICS_PREFIX "ck_crowdnode_"
+
+typedef struct MetricsBlock {
+    long long counters[METRIC_COUNTERS];
+    long long requests[METRICS_ACTION_SLOTS][METRICS_MAX_RESULTS];
+    long long latency[METRICS_ACTION_SLOTS][METRICS_LATENCY_BUCKETS + 1];   /* last one is +Inf */
+    long long latencySumUs[METRICS_ACTION_SLOTS];
+    long long heapAllocations[METRICS_ACTION_SLOTS];
+    long long heapBytes[METRICS_ACTION_SLOTS];
+    long long heapPeakBytesMax[METRICS_ACTION_SLOTS];
+    long long jsonAllocations[METRICS_ACTION_SLOTS];
+    long long jsonBytes[METRICS_ACTION_SLOTS];
+    struct MetricsBlock *next;
+} MetricsBlock;
+
+static const char *const *actionNames = NULL;
+static int actionNameCount = 0;
+
+/* the only block in fork mode, counted atomically */
+static MetricsBlock *sharedBlock = NULL;
+
+/* per thread blocks otherwise, never freed: a scrape may still read the block of a finished thread */
+static ck_mutex_t blocksMutex;
+static MetricsBlock *blocks = NULL;
+static ARENA_THREAD_LOCAL MetricsBlock *threadBlock = NULL;
+
+void metrics_init(const char *const *actions, int actionCount, int shared) {
+    actionNames = actions;
+    actionNameCount = actionCount < METRICS_MAX_ACTIONS ? actionCount : METRICS_MAX_ACTIONS;
+    ck_mutex_init(&blocksMutex);
+#ifndef _WIN32
+    if (shared) {
+        sharedBlock = mmap(NULL, sizeof(MetricsBlock), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == sharedBlock) {
+            perror("[WARN]: Metrics not shared between request processes");
+            sharedBlock = NULL;
+        } else {
+            memset(sharedBlock, 0, sizeof(MetricsBlock));
+        }
+    }
+#endif
+}
+
+static MetricsBlock *register_block() {
+    MetricsBlock *block = calloc(1, sizeof(MetricsBlock));
+    if (!block) {
+        return NULL;
+    }
+    ck_mutex_lock(&blocksMutex);
+    block->next = blocks;
+    blocks = block;
+    ck_mutex_unlock(&blocksMutex);
+    threadBlock = block;
+    return block;
+}
+
+static void add(long long *counter, long long n) {
+#ifndef _WIN32
+    if (sharedBlock) {
+        __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+        return;
+    }
+#endif
+    *counter += n;
+}
+
+static void raise_max(long long *max, long long value) {
+#ifndef _WIN32
+    if (sharedBlock) {
+        long long current = __atomic_load_n(max, __ATOMIC_RELAXED);
+        while (current < value
+               && !__atomic_compare_exchange_n(max, &current, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+        return;
+    }
+#endif
+    if (*max < value) {
+        *max = value;
+    }
+}
+
+static MetricsBlock *current_block() {
+    if (sharedBlock) {
+        return sharedBlock;
+    }
+    return threadBlock ? threadBlock : register_block();
+}
+
+void metrics_add(MetricCounter counter, long long n) {
+    MetricsBlock *block = current_block();
+    if (block) {
+        add(&block->counters[counter], n);
+    }
+}
+
+static int action_slot(int action) {
+    if (METRICS_ACTION_SCRAPE == action) {
+        return METRICS_MAX_ACTIONS + 1;
+    }
+    if (0 <= action && action < actionNameCount) {
+        return action;
+    }
+    return METRICS_MAX_ACTIONS;
+}
+
+void metrics_request(int action, const char *result, long long micros) {
+    MetricsBlock *block = current_block();
+    if (!block) {
+        return;
+    }
+    int slot = action_slot(action);
+    int code = result ? atoi(result) : 0;
+    if (code < 0 || code >= METRICS_MAX_RESULTS) {
+        code = METRICS_MAX_RESULTS - 1;
+    }
+    int bucket = 0;
+    while (bucket < METRICS_LATENCY_BUCKETS && ((long long) METRICS_LATENCY_FIRST_BUCKET_US << bucket) < micros) {
+        bucket++;
+    }
+    add(&block->requests[slot][code], 1);
+    add(&block->latency[slot][bucket], 1);
+    add(&block->latencySumUs[slot], micros);
+}
+
+void metrics_request_allocations(int action, const AllocStats *stats) {
+    MetricsBlock *block = current_block();
+    if (!block) {
+        return;
+    }
+    int slot = action_slot(action);
+    if (0 <= stats->heapAllocations) {
+        add(&block->heapAllocations[slot], stats->heapAllocations);
+        add(&block->heapBytes[slot], stats->heapBytes);
+        raise_max(&block->heapPeakBytesMax[slot], stats->heapPeakBytes);
+    }
+    add(&block->jsonAllocations[slot], stats->jsonAllocations);
+    add(&block->jsonBytes[slot], stats->jsonBytes);
+}
+
+long long metrics_now() {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (long long) (counter.QuadPart / frequency.QuadPart * 1000000
+                        + counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
+static ARENA_THREAD_LOCAL long long phasesStarted = 0;
+static ARENA_THREAD_LOCAL int phaseCount = 0;
+static ARENA_THREAD_LOCAL MetricsPhase phases[METRICS_MAX_PHASES];
+
+long long metrics_phases_begin() {
+    phaseCount = 0;
+    phasesStarted = metrics_now();
+    return phasesStarted;
+}
+
+long long metrics_phase(const char *name, long long started) {
+    long long now = metrics_now();
+    int i;
+    for (i = 0; i < phaseCount; i++) {
+        if (phases[i].name == name || 0 == strcmp(phases[i].name, name)) {
+            phases[i].micros += now - started;
+            return now;
+        }
+    }
+    if (phaseCount < METRICS_MAX_PHASES) {
+        phases[phaseCount].name = name;
+        phases[phaseCount].micros = now - started;
+        phaseCount++;
+    }
+    return now;
+}
+
+void metrics_phases_get(MetricsPhases *result) {
+    memcpy(result->phases, phases, sizeof(MetricsPhase) * phaseCount);
+    result->count = phaseCount;
+    result->totalMicros = metrics_now() - phasesStarted;
+}
+
+size_t metrics_server_timing(const MetricsPhases *p, char *buf, size_t size) {
+    size_t used = 0;
+    int i;
+    for (i = 0; i <= p->count; i++) {
+        const char *name = i < p->count ? p->phases[i].name : "total";
+        long long micros = i < p->count ? p->phases[i].micros : p->totalMicros;
+        int n = snprintf(buf + used, size - used, "%s%s;dur=%lld.%03lld", 0 == i ? "Server-Timing: " : ", ",
+                         name, micros / 1000, micros % 1000);
+        if (n < 0 || (size_t) n >= size - used) {
+            return 0;
+        }
+        used += n;
+    }
+    if (size - used < 3) {
+        return 0;
+    }
+    memcpy(buf + used, "\r\n", 3);
+    return used + 2;
+}
+
+typedef struct {
+    char *text;
+    size_t size;
+    size_t capacity;
+    int failed;
+} MetricsText;
+
+static void append(MetricsText *t, const char *format, ...) {
+    if (t->failed) {
+        return;
+    }
+    while (1) {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(t->text + t->size, t->capacity - t->size, format, args);
+        va_end(args);
+        if (n < 0) {
+            t->failed = 1;
+            return;
+        }
+        if ((size_t) n < t->capacity - t->size) {
+            t->size += n;
+            return;
+        }
+        char *text = realloc(t->text, t->capacity * 2 + n);
+        if (!text) {
+            t->failed = 1;
+            return;
+        }
+        t->text = text;
+        t->capacity = t->capacity * 2 + n;
+    }
+}
+
+static const char *slot_name(int slot) {
+    if (slot < actionNameCount) {
+        return actionNames[slot];
+    }
+    return METRICS_MAX_ACTIONS == slot ? "none" : "metrics";
+}
+
+const char *metrics_action_name(int action) {
+    return slot_name(action_slot(action));
+}
+
+/* sum of all blocks, read without stopping the counting threads */
+static void sum_blocks(MetricsBlock *sum) {
+    memset(sum, 0, sizeof(MetricsBlock));
+    MetricsBlock *block;
+    ck_mutex_lock(&blocksMutex);
+    block = sharedBlock ? sharedBlock : blocks;
+    for (; block; block = block == sharedBlock ? NULL : block->next) {
+        int i, j;
+        for (i = 0; i < METRIC_COUNTERS; i++) {
+            sum->counters[i] += block->counters[i];
+        }
+        for (i = 0; i < METRICS_ACTION_SLOTS; i++) {
+            for (j = 0; j < METRICS_MAX_RESULTS; j++) {
+                sum->requests[i][j] += block->requests[i][j];
+            }
+            for (j = 0; j <= METRICS_LATENCY_BUCKETS; j++) {
+                sum->latency[i][j] += block->latency[i][j];
+            }
+            sum->latencySumUs[i] += block->latencySumUs[i];
+            sum->heapAllocations[i] += block->heapAllocations[i];
+            sum->heapBytes[i] += block->heapBytes[i];
+            if (sum->heapPeakBytesMax[i] < block->heapPeakBytesMax[i]) {
+                sum->heapPeakBytesMax[i] = block->heapPeakBytesMax[i];
+            }
+            sum->jsonAllocations[i] += block->jsonAllocations[i];
+            sum->jsonBytes[i] += block->jsonBytes[i];
+        }
+    }
+    ck_mutex_unlock(&blocksMutex);
+}
+
+static void append_counter(MetricsText *t, const char *name, const char *help, long long value) {
+    append(t, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s counter\n" METRICS_PREFIX "%s %lld\n",
+           name, help, name, name, value);
+}
+
+static void append_gauge(MetricsText *t, const char *name, const char *help, long long value) {
+    append(t, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s gauge\n" METRICS_PREFIX "%s %lld\n",
+           name, help, name, name, value);
+}
+
+/* one sample per action, those without a value are left out */
+static void append_by_action(MetricsText *t, const char *name, const char *type,
+                             const char *help, const long long *values) {
+    append(t, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s %s\n", name, help, name, type);
+    int slot;
+    for (slot = 0; slot < METRICS_ACTION_SLOTS; slot++) {
+        if (slot >= actionNameCount && slot < METRICS_MAX_ACTIONS) {
+            continue;
+        }
+        if (values[slot]) {
+            append(t, METRICS_PREFIX "%s{action=\"%s\"} %lld\n", name, slot_name(slot), values[slot]);
+        }
+    }
+}
+
+char *metrics_text(long long queueDepth, size_t *size) {
+    MetricsBlock *sum = malloc(sizeof(MetricsBlock));
+    MetricsText t = { malloc(8192), 0, 8192, 0 };
+    if (!sum || !t.text) {
+        free(sum);
+        free(t.text);
+        return NULL;
+    }
+    sum_blocks(sum);
+    int slot, i;
+
+    append(&t, "# HELP " METRICS_PREFIX "requests_total Requests by action and return code.\n"
+               "# TYPE " METRICS_PREFIX "requests_total counter\n");
+    for (slot = 0; slot < METRICS_ACTION_SLOTS; slot++) {
+        if (slot >= actionNameCount && slot < METRICS_MAX_ACTIONS) {
+            continue;
+        }
+        for (i = 0; i < METRICS_MAX_RESULTS; i++) {
+            if (sum->requests[slot][i]) {
+                append(&t, METRICS_PREFIX "requests_total{action=\"%s\",result=\"%i\"} %lld\n",
+                       slot_name(slot), i, sum->requests[slot][i]);
+            }
+        }
+    }
+
+    append(&t, "# HELP " METRICS_PREFIX "request_duration_seconds Request latency by action.\n"
+               "# TYPE " METRICS_PREFIX "request_duration_seconds histogram\n");
+    for (slot = 0; slot < METRICS_ACTION_SLOTS; slot++) {
+        if (slot >= actionNameCount && slot < METRICS_MAX_ACTIONS) {
+            continue;
+        }
+        const char *name = slot_name(slot);
+        long long count = 0;
+        for (i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+            count += sum->latency[slot][i];
+            append(&t, METRICS_PREFIX "request_duration_seconds_bucket{action=\"%s\",le=\"%g\"} %lld\n",
+                   name, (double) ((long long) METRICS_LATENCY_FIRST_BUCKET_US << i) / 1e6, count);
+        }
+        count += sum->latency[slot][METRICS_LATENCY_BUCKETS];
+        append(&t, METRICS_PREFIX "request_duration_seconds_bucket{action=\"%s\",le=\"+Inf\"} %lld\n"
+                   METRICS_PREFIX "request_duration_seconds_sum{action=\"%s\"} %.6f\n"
+                   METRICS_PREFIX "request_duration_seconds_count{action=\"%s\"} %lld\n",
+               name, count, name, (double) sum->latencySumUs[slot] / 1e6, name, count);
+    }
+
+    if (allocprof_heap_enabled()) {
+        append_by_action(&t, "request_heap_allocations_total", "counter",
+                         "Heap allocations of the requests by action.", sum->heapAllocations);
+        append_by_action(&t, "request_heap_allocated_bytes_total", "counter",
+                         "Bytes allocated on the heap by the requests by action.", sum->heapBytes);
+        append_by_action(&t, "request_heap_peak_bytes_max", "gauge",
+                         "Largest heap peak of a request by action.", sum->heapPeakBytesMax);
+    }
+    if (allocprof_enabled()) {
+        append_by_action(&t, "request_json_allocations_total", "counter",
+                         "cJSON allocations of the requests by action.", sum->jsonAllocations);
+        append_by_action(&t, "request_json_allocated_bytes_total", "counter",
+                         "Bytes allocated by cJSON for the requests by action.", sum->jsonBytes);
+    }
+
+    append_counter(&t, "received_bytes_total", "Bytes of requests received.", sum->counters[METRIC_BYTES_IN]);
+    append_counter(&t, "sent_bytes_total", "Bytes of responses sent.", sum->counters[METRIC_BYTES_OUT]);
+    append_counter(&t, "base64_encoded_bytes_total", "Bytes encoded to Base64.", sum->counters[METRIC_BASE64_ENCODED]);
+    append_counter(&t, "base64_decoded_bytes_total", "Bytes decoded from Base64.", sum->counters[METRIC_BASE64_DECODED]);
+    append_gauge(&t, "active_connections", "Connections being processed.",
+                 sum->counters[METRIC_CONNECTIONS_OPENED] - sum->counters[METRIC_CONNECTIONS_CLOSED]);
+    append_gauge(&t, "shell_jobs_running", "Shell commands running.",
+                 sum->counters[METRIC_SHELL_STARTED] - sum->counters[METRIC_SHELL_FINISHED]);
+    append_gauge(&t, "queue_depth", "Connections waiting for a worker thread.", queueDepth);
+
+    free(sum);
+    if (t.failed) {
+        free(t.text);
+        return NULL;
+    }
+    *size = t.size;
+    return t.text;
+}
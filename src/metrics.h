@@ -0,0 +1,127 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+
+#include "allocprof.h"
+
+/**
+ * Server metrics, exported at GET /metrics in the Prometheus text exposition format.
+ *
+ * Every worker thread counts into its own block, registered on its first use, so that counting is a plain
+ * increment without locks or shared cache lines; a scrape sums the blocks. In fork server mode the
+ * request processes count into one block in shared memory with atomic increments instead.
+ *
+ * Latency is kept per action as a histogram of METRICS_LATENCY_BUCKETS buckets, the upper bound of a
+ * bucket is twice the previous one, starting at METRICS_LATENCY_FIRST_BUCKET_US.
+ */
+
+#define METRICS_MAX_ACTIONS 30
+#define METRICS_MAX_RESULTS 8
+#define METRICS_LATENCY_BUCKETS 18
+#define METRICS_LATENCY_FIRST_BUCKET_US 100
+
+/* requests without a valid action (bad format, wrong secret key, unknown action) */
+#define METRICS_ACTION_NONE -1
+/* the scrapes of /metrics themselves */
+#define METRICS_ACTION_SCRAPE -2
+
+typedef enum {
+    METRIC_BYTES_IN,
+    METRIC_BYTES_OUT,
+    METRIC_BASE64_ENCODED,          /* raw bytes encoded to Base64 */
+    METRIC_BASE64_DECODED,          /* raw bytes decoded from Base64 */
+    METRIC_CONNECTIONS_OPENED,
+    METRIC_CONNECTIONS_CLOSED,
+    METRIC_SHELL_STARTED,
+    METRIC_SHELL_FINISHED,
+    METRIC_COUNTERS
+} MetricCounter;
+
+/**
+ * @param actions names of the actions, indexes of metrics_request; must stay valid
+ * @param actionCount at most METRICS_MAX_ACTIONS
+ * @param shared count in shared memory for request processes forked after this call
+ */
+void metrics_init(const char *const *actions, int actionCount, int shared);
+
+void metrics_add(MetricCounter counter, long long n);
+
+/**
+ * count a finished request
+ *
+ * @param action index in the action names, METRICS_ACTION_NONE or METRICS_ACTION_SCRAPE
+ * @param result return code of the response ("0" for success)
+ * @param micros latency
+ */
+void metrics_request(int action, const char *result, long long micros);
+
+/**
+ * count the allocations of a finished request, see allocprof.h
+ *
+ * @param action as for metrics_request
+ */
+void metrics_request_allocations(int action, const AllocStats *stats);
+
+/**
+ * @return monotonic clock in microseconds
+ */
+long long metrics_now();
+
+/**
+ * Phase timing of the request being processed by the current thread: the time spent in named phases
+ * (recv, parse, base64_decode, write, ...) for the Server-Timing header, the timings field and the log.
+ */
+
+#define METRICS_MAX_PHASES 16
+
+typedef struct {
+    const char *name;       /* static string */
+    long long micros;
+} MetricsPhase;
+
+typedef struct {
+    MetricsPhase phases[METRICS_MAX_PHASES];
+    int count;
+    long long totalMicros;  /* since metrics_phases_begin, the rest of it is spent outside of the phases */
+} MetricsPhases;
+
+/**
+ * start timing a new request in the current thread
+ *
+ * @return now, as metrics_now
+ */
+long long metrics_phases_begin();
+
+/**
+ * add the time since started to the phase, repeated phases are summed
+ *
+ * @return now, to start the next phase with
+ */
+long long metrics_phase(const char *name, long long started);
+
+/**
+ * @param phases receives the phases of the current request so far
+ */
+void metrics_phases_get(MetricsPhases *phases);
+
+/**
+ * @return name of the action as counted by metrics_request
+ */
+const char *metrics_action_name(int action);
+
+/**
+ * write the phases as an HTTP header line: "Server-Timing: recv;dur=0.052, ..., total;dur=1.204\r\n"
+ *
+ * @return length written, 0 if it does not fit into size
+ */
+size_t metrics_server_timing(const MetricsPhases *phases, char *buf, size_t size);
+
+/**
+ * @param queueDepth connections waiting for a worker thread
+ * @param size receives the length of the text
+ * @return exposition text, allocated with malloc, NULL if out of memory
+ */
+char *metrics_text(long long queueDepth, size_t *size);
+
+#endif
@@ -0,0 +1,511 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+    #define popen _popen
+    #define pclose _pclose
+#else
+    #include <unistd.h>
+    #include <sched.h>
+    #include <dirent.h>
+    #include <sys/mman.h>
+    #include <sys/utsname.h>
+#endif
+#ifdef __APPLE__
+    #include <sys/sysctl.h>
+#endif
+
+#include "nodeprofile.h"
+#include "ckthread.h"
+#include "xxhash.h"
+
+typedef struct {
+    long long sequence;     /* odd while the profile is being written */
+    NodeProfile profile;
+} ProfileSlot;
+
+static ProfileSlot localSlot;
+static ProfileSlot *slot = &localSlot;
+#ifdef _WIN32
+static ck_mutex_t slotMutex;
+#endif
+
+typedef struct {
+    const char *name;
+    const char *command;
+    const char *expected;   /* in the first line of a command that may fail without the compiler missing */
+} CompilerProbe;
+
+#ifdef _WIN32
+static const CompilerProbe compilerProbes[] = {
+    { "cl", "cl 2>&1", "Compiler" },
+    { "clang-cl", "clang-cl --version 2>NUL", NULL },
+    { "gcc", "gcc --version 2>NUL", NULL },
+    { "clang", "clang --version 2>NUL", NULL },
+    { "icx", "icx --version 2>NUL", NULL },
+    { "nvcc", "nvcc --version 2>NUL", NULL },
+};
+#else
+static const CompilerProbe compilerProbes[] = {
+    { "cc", "cc --version 2>/dev/null", NULL },
+    { "gcc", "gcc --version 2>/dev/null", NULL },
+    { "g++", "g++ --version 2>/dev/null", NULL },
+    { "clang", "clang --version 2>/dev/null", NULL },
+    { "clang++", "clang++ --version 2>/dev/null", NULL },
+    { "icc", "icc --version 2>/dev/null", NULL },
+    { "icx", "icx --version 2>/dev/null", NULL },
+    { "gfortran", "gfortran --version 2>/dev/null", NULL },
+    { "nvcc", "nvcc --version 2>/dev/null", NULL },
+};
+#endif
+
+/* copy without the surrounding white space, cut to size */
+static void copy_text(char *dst, size_t size, const char *src) {
+    while (' ' == *src || '\t' == *src) {
+        src++;
+    }
+    size_t length = strlen(src);
+    while (length > 0 && strchr(" \t\r\n", src[length - 1])) {
+        length--;
+    }
+    if (length >= size) {
+        length = size - 1;
+    }
+    memcpy(dst, src, length);
+    dst[length] = 0;
+}
+
+static void probe_compilers(NodeProfile *profile) {
+    int i;
+    for (i = 0; i < (int) (sizeof(compilerProbes) / sizeof(compilerProbes[0])); i++) {
+        if (NODEPROFILE_MAX_COMPILERS == profile->compilerCount) {
+            return;
+        }
+        const CompilerProbe *probe = &compilerProbes[i];
+        FILE *out = popen(probe->command, "r");
+        if (!out) {
+            continue;
+        }
+        char line[NODEPROFILE_TEXT_SIZE];
+        line[0] = 0;
+        // the first non-empty line, nvcc starts with its copyright
+        while (fgets(line, sizeof(line), out) && strspn(line, " \t\r\n") == strlen(line)) {
+        }
+        char rest[NODEPROFILE_TEXT_SIZE];
+        while (fgets(rest, sizeof(rest), out)) {
+        }
+        int status = pclose(out);
+        if (probe->expected ? !strstr(line, probe->expected) : 0 != status || !line[0]) {
+            continue;
+        }
+        NodeCompiler *compiler = &profile->compilers[profile->compilerCount++];
+        copy_text(compiler->name, sizeof(compiler->name), probe->name);
+        copy_text(compiler->version, sizeof(compiler->version), line);
+    }
+}
+
+#ifdef __linux__
+/* first line of a file, 0 on success */
+static int read_line(const char *path, char *buf, size_t size) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    char line[NODEPROFILE_TEXT_SIZE];
+    char *read = fgets(line, sizeof(line), file);
+    fclose(file);
+    if (!read) {
+        return -1;
+    }
+    copy_text(buf, size, line);
+    return 0;
+}
+
+/* number with an optional K, M or G suffix (powers of two), -1 if the file can't be read */
+static long long read_number(const char *path) {
+    char text[64];
+    if (0 != read_line(path, text, sizeof(text))) {
+        return -1;
+    }
+    char *end;
+    long long value = strtoll(text, &end, 10);
+    switch (*end) {
+        case 'K': value <<= 10; break;
+        case 'M': value <<= 20; break;
+        case 'G': value <<= 30; break;
+    }
+    return value;
+}
+
+/* CPUs in a list like "0-3,8,10-11" */
+static int count_cpu_list(const char *list) {
+    int count = 0;
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        long last = first;
+        if ('-' == *end) {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+        }
+        count += (int) (last - first + 1);
+        p = ',' == *end ? end + 1 : end;
+        if (end == p && *p) {
+            break;
+        }
+    }
+    return count;
+}
+
+static void read_cpu_model(NodeProfile *profile) {
+    // in order of preference, x86 and most others have a model name, some ARM and POWER kernels only the others
+    static const char *const keys[] = { "model name", "Hardware", "Processor", "cpu model", "cpu" };
+    int found = sizeof(keys) / sizeof(keys[0]);
+    FILE *file = fopen("/proc/cpuinfo", "r");
+    if (!file) {
+        return;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        int i;
+        for (i = 0; i < found; i++) {
+            size_t length = strlen(keys[i]);
+            if (0 == strncmp(line, keys[i], length)) {
+                const char *p = line + length;
+                p += strspn(p, " \t");
+                if (':' == *p) {
+                    copy_text(profile->cpuModel, sizeof(profile->cpuModel), p + 1);
+                    found = i;
+                }
+                break;
+            }
+        }
+    }
+    fclose(file);
+}
+
+static void read_topology(NodeProfile *profile) {
+    DIR *dir = opendir("/sys/devices/system/cpu");
+    if (!dir) {
+        return;
+    }
+    int capacity = 256;
+    int count = 0;
+    long long *cores = malloc(sizeof(long long) * capacity);
+    long long *packages = malloc(sizeof(long long) * capacity);
+    int coreCount = 0;
+    int packageCount = 0;
+    struct dirent *entry;
+    char path[256];
+    while (cores && packages && (entry = readdir(dir))) {
+        int cpu;
+        char rest;
+        if (1 != sscanf(entry->d_name, "cpu%d%c", &cpu, &rest)) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        long long package = read_number(path);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        long long core = read_number(path);
+        if (package < 0 || core < 0) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            long long *grownCores = realloc(cores, sizeof(long long) * capacity);
+            if (grownCores) {
+                cores = grownCores;
+            }
+            long long *grownPackages = grownCores ? realloc(packages, sizeof(long long) * capacity) : NULL;
+            if (!grownPackages) {
+                break;
+            }
+            packages = grownPackages;
+        }
+        count++;
+        // a core is identified by its package and its id in the package
+        long long id = package << 32 | core;
+        int i;
+        for (i = 0; i < coreCount && cores[i] != id; i++) {
+        }
+        if (i == coreCount) {
+            cores[coreCount++] = id;
+        }
+        for (i = 0; i < packageCount && packages[i] != package; i++) {
+        }
+        if (i == packageCount) {
+            packages[packageCount++] = package;
+        }
+    }
+    closedir(dir);
+    free(cores);
+    free(packages);
+    profile->physicalCores = coreCount;
+    profile->sockets = packageCount;
+}
+
+static void read_caches(NodeProfile *profile) {
+    char path[256];
+    int index;
+    for (index = 0; profile->cacheCount < NODEPROFILE_MAX_CACHES; index++) {
+        NodeCache *cache = &profile->caches[profile->cacheCount];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+        long long level = read_number(path);
+        if (level < 0) {
+            return;
+        }
+        cache->level = (int) level;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+        read_line(path, cache->type, sizeof(cache->type));
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+        cache->sizeBytes = read_number(path);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/coherency_line_size", index);
+        cache->lineSize = (int) read_number(path);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/ways_of_associativity", index);
+        cache->ways = (int) read_number(path);
+        char list[NODEPROFILE_TEXT_SIZE];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/shared_cpu_list", index);
+        cache->sharedCpus = 0 == read_line(path, list, sizeof(list)) ? count_cpu_list(list) : 0;
+        if (cache->sizeBytes < 0) {
+            cache->sizeBytes = 0;
+        }
+        if (cache->lineSize < 0) {
+            cache->lineSize = 0;
+        }
+        if (cache->ways < 0) {
+            cache->ways = 0;
+        }
+        profile->cacheCount++;
+    }
+}
+
+static void collect_system(NodeProfile *profile) {
+    read_cpu_model(profile);
+    read_topology(profile);
+    read_caches(profile);
+    read_line("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor", profile->governor, sizeof(profile->governor));
+    long long frequency = read_number("/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_min_freq");
+    profile->minFrequencyKhz = frequency > 0 ? frequency : 0;
+    frequency = read_number("/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq");
+    profile->maxFrequencyKhz = frequency > 0 ? frequency : 0;
+}
+#elif defined(__APPLE__)
+static long long sysctl_number(const char *name) {
+    long long value = 0;
+    size_t size = sizeof(value);
+    if (0 != sysctlbyname(name, &value, &size, NULL, 0)) {
+        return 0;
+    }
+    // some are 32 bits
+    return 4 == size ? (long long) *(int *) &value : value;
+}
+
+static void add_cache(NodeProfile *profile, int level, const char *type, const char *name) {
+    long long size = sysctl_number(name);
+    if (size <= 0 || NODEPROFILE_MAX_CACHES == profile->cacheCount) {
+        return;
+    }
+    NodeCache *cache = &profile->caches[profile->cacheCount++];
+    cache->level = level;
+    copy_text(cache->type, sizeof(cache->type), type);
+    cache->sizeBytes = size;
+    cache->lineSize = (int) sysctl_number("hw.cachelinesize");
+}
+
+static void collect_system(NodeProfile *profile) {
+    size_t size = sizeof(profile->cpuModel);
+    if (0 != sysctlbyname("machdep.cpu.brand_string", profile->cpuModel, &size, NULL, 0)) {
+        profile->cpuModel[0] = 0;
+    }
+    profile->cpuModel[sizeof(profile->cpuModel) - 1] = 0;
+    profile->physicalCores = (int) sysctl_number("hw.physicalcpu");
+    profile->sockets = (int) sysctl_number("hw.packages");
+    add_cache(profile, 1, "Data", "hw.l1dcachesize");
+    add_cache(profile, 1, "Instruction", "hw.l1icachesize");
+    add_cache(profile, 2, "Unified", "hw.l2cachesize");
+    add_cache(profile, 3, "Unified", "hw.l3cachesize");
+    profile->maxFrequencyKhz = sysctl_number("hw.cpufrequency_max") / 1000;
+}
+#elif defined(_WIN32)
+static void registry_text(const char *key, const char *name, char *buf, DWORD size) {
+    if (ERROR_SUCCESS != RegGetValueA(HKEY_LOCAL_MACHINE, key, name, RRF_RT_REG_SZ, NULL, buf, &size)) {
+        buf[0] = 0;
+    }
+}
+
+static void collect_system(NodeProfile *profile) {
+    static const char *const cacheTypes[] = { "Unified", "Instruction", "Data", "Trace" };
+    static const char *const cpuKey = "HARDWARE\\DESCRIPTION\\System\\CentralProcessor\\0";
+    static const char *const versionKey = "SOFTWARE\\Microsoft\\Windows NT\\CurrentVersion";
+    char product[128];
+    char display[64];
+    registry_text(versionKey, "ProductName", product, sizeof(product));
+    registry_text(versionKey, "DisplayVersion", display, sizeof(display));
+    snprintf(profile->osVersion, sizeof(profile->osVersion), "%s%s%s", product, display[0] ? " " : "", display);
+    registry_text(versionKey, "CurrentBuild", profile->osRelease, sizeof(profile->osRelease));
+    registry_text(cpuKey, "ProcessorNameString", profile->cpuModel, sizeof(profile->cpuModel));
+    copy_text(profile->cpuModel, sizeof(profile->cpuModel), profile->cpuModel);
+    DWORD mhz = 0;
+    DWORD size = sizeof(mhz);
+    if (ERROR_SUCCESS == RegGetValueA(HKEY_LOCAL_MACHINE, cpuKey, "~MHz", RRF_RT_REG_DWORD, NULL, &mhz, &size)) {
+        profile->maxFrequencyKhz = (long long) mhz * 1000;
+    }
+
+    DWORD length = 0;
+    GetLogicalProcessorInformation(NULL, &length);
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION *info = length ? malloc(length) : NULL;
+    if (info && GetLogicalProcessorInformation(info, &length)) {
+        DWORD i;
+        for (i = 0; i < length / sizeof(*info); i++) {
+            if (RelationProcessorCore == info[i].Relationship) {
+                profile->physicalCores++;
+            } else if (RelationProcessorPackage == info[i].Relationship) {
+                profile->sockets++;
+            } else if (RelationCache == info[i].Relationship) {
+                CACHE_DESCRIPTOR *descriptor = &info[i].Cache;
+                int c;
+                // one entry per instance, the first describes them all
+                for (c = 0; c < profile->cacheCount; c++) {
+                    if (profile->caches[c].level == descriptor->Level
+                        && 0 == strcmp(profile->caches[c].type, cacheTypes[descriptor->Type & 3])) {
+                        break;
+                    }
+                }
+                if (c < profile->cacheCount || NODEPROFILE_MAX_CACHES == profile->cacheCount) {
+                    continue;
+                }
+                NodeCache *cache = &profile->caches[profile->cacheCount++];
+                cache->level = descriptor->Level;
+                copy_text(cache->type, sizeof(cache->type), cacheTypes[descriptor->Type & 3]);
+                cache->sizeBytes = descriptor->Size;
+                cache->lineSize = descriptor->LineSize;
+                cache->ways = 0xff == descriptor->Associativity ? 0 : descriptor->Associativity;
+                ULONG_PTR mask;
+                for (mask = info[i].ProcessorMask; mask; mask &= mask - 1) {
+                    cache->sharedCpus++;
+                }
+            }
+        }
+    }
+    free(info);
+}
+#else
+static void collect_system(NodeProfile *profile) {
+}
+#endif
+
+static void collect(NodeProfile *profile) {
+    memset(profile, 0, sizeof(NodeProfile));
+#ifdef _WIN32
+    copy_text(profile->os, sizeof(profile->os), "Windows");
+    SYSTEM_INFO info;
+    GetNativeSystemInfo(&info);
+    copy_text(profile->machine, sizeof(profile->machine),
+              PROCESSOR_ARCHITECTURE_AMD64 == info.wProcessorArchitecture ? "x86_64"
+              : PROCESSOR_ARCHITECTURE_ARM64 == info.wProcessorArchitecture ? "arm64"
+              : PROCESSOR_ARCHITECTURE_INTEL == info.wProcessorArchitecture ? "x86" : "unknown");
+    DWORD hostnameSize = sizeof(profile->hostname);
+    if (!GetComputerNameA(profile->hostname, &hostnameSize)) {
+        profile->hostname[0] = 0;
+    }
+    profile->logicalCpus = (int) info.dwNumberOfProcessors;
+    profile->pageSize = info.dwPageSize;
+    MEMORYSTATUSEX memory;
+    memory.dwLength = sizeof(memory);
+    if (GlobalMemoryStatusEx(&memory)) {
+        profile->memoryBytes = (long long) memory.ullTotalPhys;
+    }
+#else
+    struct utsname name;
+    if (0 == uname(&name)) {
+        copy_text(profile->os, sizeof(profile->os), name.sysname);
+        copy_text(profile->osRelease, sizeof(profile->osRelease), name.release);
+        copy_text(profile->osVersion, sizeof(profile->osVersion), name.version);
+        copy_text(profile->machine, sizeof(profile->machine), name.machine);
+        copy_text(profile->hostname, sizeof(profile->hostname), name.nodename);
+    }
+    profile->logicalCpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    profile->pageSize = sysconf(_SC_PAGESIZE);
+    profile->memoryBytes = (long long) sysconf(_SC_PHYS_PAGES) * profile->pageSize;
+#endif
+    collect_system(profile);
+    probe_compilers(profile);
+
+    // the struct is zeroed, padding and unused text included, so equal profiles hash the same
+    xxh64_hex(xxh64(profile, offsetof(NodeProfile, collected), 0), profile->hash);
+    profile->collected = (long long) time(NULL);
+}
+
+static void publish(const NodeProfile *profile) {
+#ifdef _WIN32
+    ck_mutex_lock(&slotMutex);
+    slot->profile = *profile;
+    ck_mutex_unlock(&slotMutex);
+#else
+    // a seqlock, the writers may be request processes
+    long long sequence = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+    while ((sequence & 1) || !__atomic_compare_exchange_n(&slot->sequence, &sequence, sequence + 1, 0,
+                                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        sched_yield();
+        sequence = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+    }
+    memcpy(&slot->profile, profile, sizeof(NodeProfile));
+    __atomic_store_n(&slot->sequence, sequence + 2, __ATOMIC_RELEASE);
+#endif
+}
+
+void nodeprofile_get(NodeProfile *profile) {
+#ifdef _WIN32
+    ck_mutex_lock(&slotMutex);
+    *profile = slot->profile;
+    ck_mutex_unlock(&slotMutex);
+#else
+    while (1) {
+        long long sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (0 == (sequence & 1)) {
+            memcpy(profile, &slot->profile, sizeof(NodeProfile));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (sequence == __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED)) {
+                return;
+            }
+        }
+        sched_yield();
+    }
+#endif
+}
+
+void nodeprofile_refresh() {
+    NodeProfile *profile = malloc(sizeof(NodeProfile));
+    if (!profile) {
+        return;
+    }
+    collect(profile);
+    publish(profile);
+    free(profile);
+}
+
+void nodeprofile_init(int shared) {
+#ifdef _WIN32
+    ck_mutex_init(&slotMutex);
+#else
+    if (shared) {
+        ProfileSlot *sharedSlot = mmap(NULL, sizeof(ProfileSlot), PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == sharedSlot) {
+            perror("[WARN]: Node profile refreshes not shared between request processes");
+        } else {
+            memset(sharedSlot, 0, sizeof(ProfileSlot));
+            slot = sharedSlot;
+        }
+    }
+#endif
+    nodeprofile_refresh();
+}
@@ -0,0 +1,78 @@
+#ifndef NODEPROFILE_H
+#define NODEPROFILE_H
+
+/**
+ * Hardware and software profile of the node, returned by the state action so that clients need not probe
+ * the node with shell commands (uname, lscpu, /proc/meminfo, compiler versions) before every session.
+ *
+ * It is collected once at startup: CPU model and topology, caches, frequency governor, memory, OS and the
+ * versions of the compilers found on the PATH (Linux from /proc and /sys, macOS from sysctl, Windows from the
+ * system API and the registry). nodeprofile_refresh collects it again. The hash identifies the content, it
+ * changes only when the profile does. In fork server mode the profile is kept in shared memory, so a refresh
+ * made by a request process is seen by the later ones.
+ */
+
+#define NODEPROFILE_TEXT_SIZE 256
+#define NODEPROFILE_MAX_CACHES 8
+#define NODEPROFILE_MAX_COMPILERS 12
+
+typedef struct {
+    int level;
+    char type[16];              /* Data, Instruction or Unified */
+    long long sizeBytes;
+    int lineSize;               /* bytes, 0 if not known */
+    int ways;                   /* 0 if not known */
+    int sharedCpus;             /* logical CPUs sharing it, 0 if not known */
+} NodeCache;
+
+typedef struct {
+    char name[32];              /* command, gcc, clang, cl, ... */
+    char version[NODEPROFILE_TEXT_SIZE];   /* first line of its version output */
+} NodeCompiler;
+
+typedef struct {
+    char os[64];                /* Linux, Darwin, Windows */
+    char osRelease[128];        /* kernel release, Windows build */
+    char osVersion[NODEPROFILE_TEXT_SIZE];
+    char machine[64];           /* x86_64, aarch64, ... */
+    char hostname[128];
+
+    char cpuModel[NODEPROFILE_TEXT_SIZE];
+    int logicalCpus;
+    int physicalCores;          /* 0 if not known */
+    int sockets;                /* 0 if not known */
+    NodeCache caches[NODEPROFILE_MAX_CACHES];
+    int cacheCount;
+    char governor[32];          /* cpufreq scaling governor, empty if not known */
+    long long minFrequencyKhz;  /* 0 if not known */
+    long long maxFrequencyKhz;
+
+    long long memoryBytes;
+    long long pageSize;
+
+    NodeCompiler compilers[NODEPROFILE_MAX_COMPILERS];
+    int compilerCount;
+
+    /* not part of the hash */
+    long long collected;        /* unix time */
+    char hash[17];              /* 16 hex digits */
+} NodeProfile;
+
+/**
+ * collect the profile
+ *
+ * @param shared keep it in shared memory, for the request processes forked after this call
+ */
+void nodeprofile_init(int shared);
+
+/**
+ * collect the profile again, it may take a while for the compiler versions
+ */
+void nodeprofile_refresh();
+
+/**
+ * @param profile receives a consistent copy of the current profile
+ */
+void nodeprofile_get(NodeProfile *profile);
+
+#endif
@@ -0,0 +1,117 @@
+#include <string.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <dirent.h>
+#endif
+
+#include "paths.h"
+#include "arena.h"
+
+int path_is_separator(char c) {
+    return '/' == c || PATH_SEPARATOR == c;
+}
+
+int path_valid(const char *path) {
+    if (!path || path_is_separator(path[0])) {
+        return 0;
+    }
+    while (*path) {
+        const char *end = path;
+        while (*end && !path_is_separator(*end)) {
+            end++;
+        }
+        size_t len = end - path;
+        if ((1 == len && '.' == path[0]) || (2 == len && '.' == path[0] && '.' == path[1])) {
+            return 0;
+        }
+        path = *end ? end + 1 : end;
+    }
+    return 1;
+}
+
+int path_valid_name(const char *name) {
+    if (!path_valid(name) || !*name) {
+        return 0;
+    }
+    for (; *name; name++) {
+        if (path_is_separator(*name)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+char *path_normalize(const char *path) {
+    char *result = ck_alloc(strlen(path) + 1);
+    size_t n = 0;
+    if (!result) {
+        return NULL;
+    }
+    for (; *path; path++) {
+        if (!path_is_separator(*path)) {
+            result[n++] = *path;
+        } else if (n > 0 && PATH_SEPARATOR != result[n - 1]) {
+            result[n++] = PATH_SEPARATOR;
+        }
+    }
+    if (n > 0 && PATH_SEPARATOR == result[n - 1]) {
+        n--;
+    }
+    result[n] = '\0';
+    return result;
+}
+
+int path_is_under(const char *path, const char *dir) {
+    size_t len = strlen(dir);
+    return 0 == strncmp(path, dir, len) && ('\0' == path[len] || PATH_SEPARATOR == path[len]);
+}
+
+char *path_join(const char *dir, const char *name) {
+    if (!dir || !name) {
+        return NULL;
+    }
+    size_t dirLen = strlen(dir), nameLen = strlen(name);
+    char *result = ck_alloc(dirLen + nameLen + 2);
+    if (!result) {
+        return NULL;
+    }
+    memcpy(result, dir, dirLen);
+    if (dirLen && nameLen) {
+        result[dirLen++] = PATH_SEPARATOR;
+    }
+    memcpy(result + dirLen, name, nameLen + 1);
+    return result;
+}
+
+int path_for_each_entry(const char *dir, PathEntryFn fn, void *ctx) {
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    char *pattern = path_join(dir, "*");
+    HANDLE find = pattern ? FindFirstFileA(pattern, &data) : INVALID_HANDLE_VALUE;
+    ck_free(pattern);
+    if (find == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+    do {
+        if (strcmp(data.cFileName, ".") != 0 && strcmp(data.cFileName, "..") != 0) {
+            fn(ctx, data.cFileName);
+        }
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    if (!d) {
+        return -1;
+    }
+    while ((de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0) {
+            fn(ctx, de->d_name);
+        }
+    }
+    closedir(d);
+#endif
+    return 0;
+}
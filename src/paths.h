@@ -0,0 +1,56 @@
+#ifndef PATHS_H
+#define PATHS_H
+
+/**
+ * Paths under the files directory.
+ *
+ * Relative paths are named the same way by the directory cache, the file index, the workspaces, the archives
+ * and the storage collector: native single separators, none at the beginning or the end, "" for the files
+ * directory itself. Both separators are accepted on input.
+ *
+ * Strings are allocated with ck_alloc, release them with ck_free.
+ */
+
+#ifdef _WIN32
+    #define PATH_SEPARATOR '\\'
+#else
+    #define PATH_SEPARATOR '/'
+#endif
+
+int path_is_separator(char c);
+
+/**
+ * @return 1 if the path is relative and has no "." or ".." components, 0 otherwise
+ */
+int path_valid(const char *path);
+
+/**
+ * @return 1 if the name is a single valid path component (no separators), 0 otherwise
+ */
+int path_valid_name(const char *name);
+
+/**
+ * @return the path with single native separators and none at the end, NULL if memory could not be allocated
+ */
+char *path_normalize(const char *path);
+
+/**
+ * @return 1 if the normalized path is dir or under it
+ */
+int path_is_under(const char *path, const char *dir);
+
+/**
+ * @return dir/name, the other one if either is "", NULL if either is NULL or memory could not be allocated
+ */
+char *path_join(const char *dir, const char *name);
+
+typedef void (*PathEntryFn)(void *ctx, const char *name);
+
+/**
+ * call fn for every entry of the directory but . and ..
+ *
+ * @return 0 on success, -1 if the directory could not be read
+ */
+int path_for_each_entry(const char *dir, PathEntryFn fn, void *ctx);
+
+#endif
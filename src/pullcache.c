@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pullcache.h"
+#include "base64.h"
+#include "metrics.h"
+#include "ckthread.h"
+
+#define PULLCACHE_BUCKETS 1024
+#define PULLCACHE_MAX_ENTRY_SHARE 8    /* a single file takes at most 1/8 of the budget */
+
+static size_t budget = 0;
+static size_t used = 0;
+static PullCacheEntry *buckets[PULLCACHE_BUCKETS];
+static PullCacheEntry *head = NULL;     /* most recently used */
+static PullCacheEntry *tail = NULL;
+static ck_mutex_t cacheMutex;
+
+static unsigned int path_bucket(const char *path) {
+    unsigned int h = 2166136261u;
+    while (*path) {
+        h = (h ^ (unsigned char) *path++) * 16777619u;
+    }
+    return h & (PULLCACHE_BUCKETS - 1);
+}
+
+static long long mtime_nsec(const struct stat *st) {
+#ifdef __linux__
+    return st->st_mtim.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+static size_t encoded_size(long long size) {
+    return (size_t) (size + 2) / 3 * 4 + 1;
+}
+
+static size_t entry_cost(const PullCacheEntry *entry) {
+    return sizeof(PullCacheEntry) + strlen(entry->path) + (size_t) entry->size +
+           (entry->encoded ? encoded_size(entry->size) : 0);
+}
+
+static void free_entry(PullCacheEntry *entry) {
+    free(entry->path);
+    free(entry->data);
+    free(entry->encoded);
+    free(entry);
+}
+
+static void list_remove(PullCacheEntry *entry) {
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        head = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        tail = entry->prev;
+    }
+    entry->prev = entry->next = NULL;
+}
+
+static void list_push_front(PullCacheEntry *entry) {
+    entry->prev = NULL;
+    entry->next = head;
+    if (head) {
+        head->prev = entry;
+    }
+    head = entry;
+    if (!tail) {
+        tail = entry;
+    }
+}
+
+static PullCacheEntry *find_entry(const char *path) {
+    PullCacheEntry *entry;
+    for (entry = buckets[path_bucket(path)]; entry; entry = entry->chain) {
+        if (strcmp(entry->path, path) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* take the entry out of the cache, call with cacheMutex locked */
+static void unlink_entry(PullCacheEntry *entry) {
+    PullCacheEntry **link = &buckets[path_bucket(entry->path)];
+    while (*link != entry) {
+        link = &(*link)->chain;
+    }
+    *link = entry->chain;
+    list_remove(entry);
+    used -= entry_cost(entry);
+    entry->cached = 0;
+    if (0 == entry->refs) {
+        free_entry(entry);
+    }
+}
+
+static void evict() {
+    while (used > budget && tail) {
+        unlink_entry(tail);
+    }
+}
+
+void pullcache_init(size_t size) {
+    ck_mutex_init(&cacheMutex);
+    budget = size;
+}
+
+int pullcache_accepts(long long size) {
+    return budget > 0 && size >= 0 && (size_t) size <= budget / PULLCACHE_MAX_ENTRY_SHARE;
+}
+
+PullCacheEntry *pullcache_get(const char *path, const struct stat *st) {
+    if (0 == budget) {
+        return NULL;
+    }
+    ck_mutex_lock(&cacheMutex);
+    PullCacheEntry *entry = find_entry(path);
+    if (entry && (entry->size != (long long) st->st_size || entry->mtime != (long long) st->st_mtime ||
+                  entry->mtimeNsec != mtime_nsec(st) || entry->inode != (long long) st->st_ino)) {
+        unlink_entry(entry);
+        entry = NULL;
+    }
+    if (entry) {
+        list_remove(entry);
+        list_push_front(entry);
+        entry->refs++;
+    }
+    ck_mutex_unlock(&cacheMutex);
+    return entry;
+}
+
+PullCacheEntry *pullcache_put(const char *path, const struct stat *st, unsigned char *data) {
+    if (!pullcache_accepts((long long) st->st_size)) {
+        return NULL;
+    }
+    PullCacheEntry *entry = calloc(1, sizeof(PullCacheEntry));
+    if (!entry || !(entry->path = strdup(path))) {
+        free(entry);
+        return NULL;
+    }
+    entry->size = (long long) st->st_size;
+    entry->mtime = (long long) st->st_mtime;
+    entry->mtimeNsec = mtime_nsec(st);
+    entry->inode = (long long) st->st_ino;
+    entry->data = data;
+    entry->refs = 1;
+    entry->cached = 1;
+
+    ck_mutex_lock(&cacheMutex);
+    PullCacheEntry *previous = find_entry(path);
+    if (previous) {
+        unlink_entry(previous);
+    }
+    unsigned int bucket = path_bucket(path);
+    entry->chain = buckets[bucket];
+    buckets[bucket] = entry;
+    list_push_front(entry);
+    used += entry_cost(entry);
+    evict();
+    ck_mutex_unlock(&cacheMutex);
+    return entry;
+}
+
+const char *pullcache_encoded(PullCacheEntry *entry) {
+    ck_mutex_lock(&cacheMutex);
+    char *encoded = entry->encoded;
+    ck_mutex_unlock(&cacheMutex);
+    if (encoded) {
+        return encoded;
+    }
+
+    // encode outside of the lock, the content of an entry never changes
+    size_t size = encoded_size(entry->size);
+    encoded = malloc(size);
+    if (!encoded) {
+        return NULL;
+    }
+    if (entry->size > 0) {
+        base64_encode(entry->data, (size_t) entry->size, encoded, size);
+        metrics_add(METRIC_BASE64_ENCODED, entry->size);
+    } else {
+        encoded[0] = '\0';
+    }
+
+    ck_mutex_lock(&cacheMutex);
+    if (entry->encoded) {
+        free(encoded);
+    } else {
+        entry->encoded = encoded;
+        if (entry->cached) {
+            used += size;
+            evict();
+        }
+    }
+    encoded = entry->encoded;
+    ck_mutex_unlock(&cacheMutex);
+    return encoded;
+}
+
+void pullcache_release(PullCacheEntry *entry) {
+    ck_mutex_lock(&cacheMutex);
+    entry->refs--;
+    int unused = 0 == entry->refs && !entry->cached;
+    ck_mutex_unlock(&cacheMutex);
+    if (unused) {
+        free_entry(entry);
+    }
+}
+
+void pullcache_invalidate(const char *path) {
+    if (0 == budget) {
+        return;
+    }
+    ck_mutex_lock(&cacheMutex);
+    PullCacheEntry *entry = find_entry(path);
+    if (entry) {
+        unlink_entry(entry);
+    }
+    ck_mutex_unlock(&cacheMutex);
+}
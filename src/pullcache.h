@@ -0,0 +1,66 @@
+#ifndef PULLCACHE_H
+#define PULLCACHE_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+/**
+ * Bounded LRU cache of recently pulled files, with their base64 encoding once pulled again.
+ *
+ * An entry is valid while the file keeps its size, modification time and inode; pushes invalidate the
+ * entry of the written path explicitly. Entries are reference counted, so that an entry evicted by
+ * another thread stays alive until its response is sent.
+ */
+
+typedef struct PullCacheEntry {
+    char *path;
+    long long size;
+    long long mtime;
+    long long mtimeNsec;
+    long long inode;
+    unsigned char *data;
+    char *encoded;          /* base64 of data, NULL until requested */
+    int refs;
+    int cached;             /* still in the cache, freed on last release otherwise */
+    struct PullCacheEntry *prev;
+    struct PullCacheEntry *next;
+    struct PullCacheEntry *chain;
+} PullCacheEntry;
+
+/**
+ * @param budget memory for cached content and encodings in bytes, 0 disables the cache
+ */
+void pullcache_init(size_t budget);
+
+/**
+ * @return 1 if a file of the given size may be cached
+ */
+int pullcache_accepts(long long size);
+
+/**
+ * @param st current stat of the file
+ * @return referenced entry for the file, NULL if not cached or modified since
+ */
+PullCacheEntry *pullcache_get(const char *path, const struct stat *st);
+
+/**
+ * cache the content read from the file
+ *
+ * @param data malloc'ed content, owned by the cache on success
+ * @return referenced entry, NULL if not cached (data stays owned by the caller)
+ */
+PullCacheEntry *pullcache_put(const char *path, const struct stat *st, unsigned char *data);
+
+/**
+ * @return base64 encoding of the entry content, encoded and kept in the cache on first use, NULL on failure
+ */
+const char *pullcache_encoded(PullCacheEntry *entry);
+
+void pullcache_release(PullCacheEntry *entry);
+
+/**
+ * drop the entry of the path, called when the file is written
+ */
+void pullcache_invalidate(const char *path);
+
+#endif
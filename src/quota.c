@@ -0,0 +1,450 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <sys/utime.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+#endif
+
+#include "quota.h"
+#include "arena.h"
+#include "ckthread.h"
+#include "dircache.h"
+#include "paths.h"
+#include "filestore.h"
+#include "fileindex.h"
+#include "workspace.h"
+#include "logger.h"
+
+#define QUOTA_PARENT_CHECK_MS 1000
+
+typedef struct {
+    char *name;             /* relative to path_to_files */
+    int next;               /* next link of the same content, -1 at the end */
+} QuotaLink;
+
+typedef struct {
+    long long dev;
+    long long ino;
+    long long size;
+    long long lastUse;
+    int pinned;
+    int firstLink;
+} QuotaContent;
+
+typedef struct {
+    QuotaContent *contents;
+    int count;
+    int capacity;
+    QuotaLink *links;
+    int linkCount;
+    int linkCapacity;
+    int *table;             /* content index + 1 by inode, open addressing */
+    int tableSize;
+    long long usedBytes;
+    long long files;        /* links not evicted */
+} QuotaScan;
+
+static char *rootDir = NULL;
+static QuotaConfig quotaConfig;
+static QuotaUsage *sharedUsage = NULL;
+static ck_mutex_t sleepMutex;
+static ck_cond_t sleepCond;
+
+static int is_pinned(const char *name) {
+    int i;
+    for (i = 0; i < quotaConfig.pinnedCount; i++) {
+        if (path_is_under(name, quotaConfig.pinned[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static long long last_use(const struct stat *st) {
+    return (long long) st->st_atime > (long long) st->st_mtime ? (long long) st->st_atime : (long long) st->st_mtime;
+}
+
+static long long disk_size(const struct stat *st) {
+#ifdef _WIN32
+    return (long long) st->st_size;
+#else
+    return (long long) st->st_blocks * 512;
+#endif
+}
+
+static unsigned int inode_key(long long dev, long long ino) {
+    unsigned long long h = (unsigned long long) ino * 0x9E3779B97F4A7C15ULL ^ (unsigned long long) dev;
+    return (unsigned int) (h ^ (h >> 29));
+}
+
+static int grow_table(QuotaScan *scan) {
+    int size = scan->tableSize ? scan->tableSize * 2 : 1024, i;
+    int *table = ck_alloc(sizeof(int) * size);
+    if (!table) {
+        return -1;
+    }
+    memset(table, 0, sizeof(int) * size);
+    for (i = 0; i < scan->count; i++) {
+        unsigned int slot = inode_key(scan->contents[i].dev, scan->contents[i].ino) & (size - 1);
+        while (table[slot]) {
+            slot = (slot + 1) & (size - 1);
+        }
+        table[slot] = i + 1;
+    }
+    scan->table = table;
+    scan->tableSize = size;
+    return 0;
+}
+
+/* content of the inode, a new one for files without inode numbers */
+static QuotaContent *find_content(QuotaScan *scan, const struct stat *st) {
+    unsigned int slot = 0;
+    if (st->st_ino) {
+        if (scan->count * 2 >= scan->tableSize && 0 != grow_table(scan)) {
+            return NULL;
+        }
+        slot = inode_key((long long) st->st_dev, (long long) st->st_ino) & (scan->tableSize - 1);
+        while (scan->table[slot]) {
+            QuotaContent *content = &scan->contents[scan->table[slot] - 1];
+            if (content->dev == (long long) st->st_dev && content->ino == (long long) st->st_ino) {
+                return content;
+            }
+            slot = (slot + 1) & (scan->tableSize - 1);
+        }
+    }
+    if (scan->count == scan->capacity) {
+        int capacity = scan->capacity ? scan->capacity * 2 : 1024;
+        QuotaContent *contents = ck_alloc(sizeof(QuotaContent) * capacity);
+        if (!contents) {
+            return NULL;
+        }
+        if (scan->count) {
+            memcpy(contents, scan->contents, sizeof(QuotaContent) * scan->count);
+        }
+        scan->contents = contents;
+        scan->capacity = capacity;
+    }
+    QuotaContent *content = &scan->contents[scan->count++];
+    content->dev = (long long) st->st_dev;
+    content->ino = (long long) st->st_ino;
+    content->size = disk_size(st);
+    content->lastUse = 0;
+    content->pinned = 0;
+    content->firstLink = -1;
+    scan->usedBytes += content->size;
+    if (st->st_ino) {
+        scan->table[slot] = scan->count;
+    }
+    return content;
+}
+
+static void add_file(QuotaScan *scan, const char *name, const struct stat *st) {
+    QuotaContent *content = find_content(scan, st);
+    if (!content) {
+        return;
+    }
+    if (scan->linkCount == scan->linkCapacity) {
+        int capacity = scan->linkCapacity ? scan->linkCapacity * 2 : 1024;
+        QuotaLink *links = ck_alloc(sizeof(QuotaLink) * capacity);
+        if (!links) {
+            return;
+        }
+        if (scan->linkCount) {
+            memcpy(links, scan->links, sizeof(QuotaLink) * scan->linkCount);
+        }
+        scan->links = links;
+        scan->linkCapacity = capacity;
+    }
+    scan->files++;
+    QuotaLink *link = &scan->links[scan->linkCount];
+    link->name = (char *) name;
+    link->next = content->firstLink;
+    content->firstLink = scan->linkCount++;
+    long long used = last_use(st);
+    content->lastUse = used > content->lastUse ? used : content->lastUse;
+    content->pinned |= is_pinned(name);
+}
+
+typedef void (*EntryFn)(void *ctx, const char *dir, const char *name);
+
+typedef struct {
+    EntryFn fn;
+    void *ctx;
+    const char *dir;
+} EntryWalk;
+
+static void walk_entry(void *ctx, const char *name) {
+    EntryWalk *walk = ctx;
+    walk->fn(walk->ctx, walk->dir, name);
+}
+
+/* call fn with the name of every entry of the directory, relative to path_to_files */
+static void for_each_entry(const char *dir, EntryFn fn, void *ctx) {
+    EntryWalk walk = { fn, ctx, dir };
+    char *path = path_join(rootDir, dir);
+    if (path) {
+        path_for_each_entry(path, walk_entry, &walk);
+    }
+    ck_free(path);
+}
+
+static int entry_stat(const char *name, struct stat *st) {
+    char *path = path_join(rootDir, name);
+    if (!path) {
+        return -1;
+    }
+#ifdef _WIN32
+    int result = stat(path, st);
+#else
+    int result = lstat(path, st);
+#endif
+    ck_free(path);
+    return result;
+}
+
+static void scan_entry(void *ctx, const char *dir, const char *entry) {
+    struct stat st;
+    if ('\0' == dir[0] && 0 == strcmp(entry, WORKSPACE_TRASH_DIR)) {
+        return;
+    }
+    char *name = path_join(dir, entry);
+    if (!name || 0 != entry_stat(name, &st)) {
+        return;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        for_each_entry(name, scan_entry, ctx);
+    } else if (S_ISREG(st.st_mode)) {
+        add_file(ctx, name, &st);
+    }
+}
+
+static int compare_last_use(const void *a, const void *b) {
+    long long ua = (*(QuotaContent * const *) a)->lastUse, ub = (*(QuotaContent * const *) b)->lastUse;
+    return ua < ub ? -1 : ua > ub;
+}
+
+static void evict(QuotaScan *scan, QuotaContent *content, const char *reason) {
+    int i;
+    for (i = content->firstLink; i >= 0; i = scan->links[i].next) {
+        char *path = path_join(rootDir, scan->links[i].name);
+        if (path && 0 == remove(path)) {
+            LOG_INFO("Evicted (%s): %s", reason, scan->links[i].name);
+            fileindex_path_removed(path);
+            sharedUsage->evictedFiles++;
+            scan->files--;
+        }
+        ck_free(path);
+    }
+    scan->usedBytes -= content->size;
+    sharedUsage->evictedBytes += content->size;
+}
+
+typedef struct {
+    int removed;
+    long long now;
+} PruneContext;
+
+static void prune_dir(PruneContext *ctx, const char *name);
+
+static void prune_entry(void *ctx, const char *dir, const char *entry) {
+    struct stat st;
+    if ('\0' == dir[0] && (0 == strcmp(entry, FILESTORE_BLOB_DIR) || 0 == strcmp(entry, WORKSPACE_TRASH_DIR))) {
+        // blob directories are created once and written without a lookup
+        return;
+    }
+    char *name = path_join(dir, entry);
+    if (name && 0 == entry_stat(name, &st) && S_ISDIR(st.st_mode) && !is_pinned(name)) {
+        prune_dir(ctx, name);
+    }
+}
+
+/* remove the directory, subdirectories first, if it is empty and was not used within the grace period */
+static void prune_dir(PruneContext *ctx, const char *name) {
+    struct stat st;
+    for_each_entry(name, prune_entry, ctx);
+    if (!*name || 0 != entry_stat(name, &st) || last_use(&st) > ctx->now - QUOTA_GRACE_SECONDS) {
+        return;
+    }
+    char *path = path_join(rootDir, name);
+#ifdef _WIN32
+    if (path && RemoveDirectoryA(path)) {
+#else
+    if (path && 0 == rmdir(path)) {
+#endif
+        ctx->removed++;
+    }
+    ck_free(path);
+}
+
+static void collect() {
+    QuotaScan scan;
+    long long now = (long long) time(NULL);
+    int i, candidates = 0;
+
+    memset(&scan, 0, sizeof(scan));
+    for_each_entry("", scan_entry, &scan);
+
+    QuotaContent **lru = ck_alloc(sizeof(QuotaContent *) * (scan.count + 1));
+    for (i = 0; lru && i < scan.count; i++) {
+        if (!scan.contents[i].pinned && scan.contents[i].lastUse <= now - QUOTA_GRACE_SECONDS) {
+            lru[candidates++] = &scan.contents[i];
+        }
+    }
+    qsort(lru, candidates, sizeof(QuotaContent *), compare_last_use);
+
+    int evicted = 0;
+    for (; evicted < candidates && quotaConfig.maxAgeSeconds > 0 &&
+           lru[evicted]->lastUse < now - quotaConfig.maxAgeSeconds; evicted++) {
+        evict(&scan, lru[evicted], "age");
+    }
+    long long target = quotaConfig.quotaBytes / 100 * QUOTA_LOW_WATERMARK_PERCENT;
+    if (quotaConfig.quotaBytes > 0 && scan.usedBytes > quotaConfig.quotaBytes) {
+        for (; evicted < candidates && scan.usedBytes > target; evicted++) {
+            evict(&scan, lru[evicted], "size");
+        }
+        if (scan.usedBytes > quotaConfig.quotaBytes) {
+            LOG_WARN("Storage quota exceeded by files in use or pinned");
+        }
+    }
+    PruneContext prune = { 0, now };
+    if (evicted > 0) {
+        prune_dir(&prune, "");
+    }
+    if (prune.removed > 0) {
+        // cached handles may refer to removed directories
+        dircache_invalidate_all();
+    }
+
+    sharedUsage->usedBytes = scan.usedBytes;
+    sharedUsage->files = scan.files;
+    sharedUsage->lastPass = now;
+}
+
+/* sleep until the next pass, a collector process exits within a second of the server */
+static void wait_next_pass(long parent) {
+    long remaining = (long) quotaConfig.intervalSeconds * 1000;
+    while (remaining > 0) {
+        long step = parent && remaining > QUOTA_PARENT_CHECK_MS ? QUOTA_PARENT_CHECK_MS : remaining;
+        ck_mutex_lock(&sleepMutex);
+        ck_cond_timedwait(&sleepCond, &sleepMutex, step);
+        ck_mutex_unlock(&sleepMutex);
+        remaining -= step;
+#ifndef _WIN32
+        if (parent && (long) getppid() != parent) {
+            exit(0);
+        }
+#endif
+    }
+}
+
+static void collector_loop(long parent) {
+    Arena *arena = arena_create(0);
+    arena_set_current(arena);
+    while (1) {
+        collect();
+        if (arena) {
+            arena_reset(arena);
+        }
+        wait_next_pass(parent);
+    }
+}
+
+static void collector_thread(void *arg) {
+    collector_loop(0);
+}
+
+void quota_init(const char *baseDir, const QuotaConfig *config, int background) {
+    int i;
+    quotaConfig = *config;
+    quotaConfig.pinned = calloc(config->pinnedCount + 1, sizeof(char *));
+    quotaConfig.pinnedCount = 0;
+    for (i = 0; quotaConfig.pinned && i < config->pinnedCount; i++) {
+        char *pinned = path_normalize(config->pinned[i]);
+        if (pinned && *pinned) {
+            quotaConfig.pinned[quotaConfig.pinnedCount++] = strdup(pinned);
+        }
+        ck_free(pinned);
+    }
+    if (0 == quotaConfig.quotaBytes && 0 == quotaConfig.maxAgeSeconds) {
+        LOG_INFO("No storage quota configured, collector not started");
+        return;
+    }
+    if (quotaConfig.intervalSeconds <= 0) {
+        quotaConfig.intervalSeconds = QUOTA_DEFAULT_INTERVAL_SECONDS;
+    }
+    rootDir = strdup(baseDir);
+    size_t rootLen = strlen(rootDir);
+    while (rootLen > 1 && PATH_SEPARATOR == rootDir[rootLen - 1]) {
+        rootDir[--rootLen] = '\0';
+    }
+    ck_mutex_init(&sleepMutex);
+    ck_cond_init(&sleepCond);
+
+#ifdef _WIN32
+    sharedUsage = calloc(1, sizeof(QuotaUsage));
+#else
+    // written by the collector process, read by the request processes in fork mode
+    sharedUsage = mmap(NULL, sizeof(QuotaUsage), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == sharedUsage) {
+        sharedUsage = NULL;
+    }
+#endif
+    if (!sharedUsage) {
+        perror("[WARN]: Storage collector not started");
+        return;
+    }
+    memset(sharedUsage, 0, sizeof(QuotaUsage));
+
+    if (background) {
+        if (0 != ck_thread_start(collector_thread, NULL)) {
+            perror("[WARN]: Storage collector not started");
+        }
+        return;
+    }
+#ifndef _WIN32
+    long parent = (long) getpid();
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("[WARN]: Storage collector not started");
+    } else if (0 == pid) {
+        collector_loop(parent);
+    }
+#endif
+}
+
+void quota_file_used(const char *path, const struct stat *st) {
+    long long now = (long long) time(NULL);
+    if (!sharedUsage || (st && (long long) st->st_atime > now - QUOTA_GRACE_SECONDS)) {
+        return;
+    }
+    // the access time only, a pull is no modification
+#ifdef _WIN32
+    struct stat current;
+    if (!st && 0 != stat(path, &current)) {
+        return;
+    }
+    struct _utimbuf times = { (time_t) now, st ? st->st_mtime : current.st_mtime };
+    _utime(path, &times);
+#else
+    struct timespec times[2] = { { 0, UTIME_NOW }, { 0, UTIME_OMIT } };
+    utimensat(AT_FDCWD, path, times, 0);
+#endif
+}
+
+long long quota_usage(QuotaUsage *usage) {
+    if (!sharedUsage) {
+        memset(usage, 0, sizeof(*usage));
+        return -1;
+    }
+    *usage = *sharedUsage;
+    return quotaConfig.quotaBytes;
+}
@@ -0,0 +1,63 @@
+#ifndef QUOTA_H
+#define QUOTA_H
+
+#include <sys/stat.h>
+
+/**
+ * Storage quotas of path_to_files, enforced by a periodic collector.
+ *
+ * Every pass walks the tree (workspace trash excluded) and groups the files by inode, so that the hard links
+ * of a workspace clone are one content. The last use of a content is the latest access or modification
+ * time of it; pulls, pushes of stored content and workspace clones refresh the access time explicitly.
+ * Contents not used for max_age_hours are evicted, then the least recently used ones until the usage is
+ * back under the low watermark of quota_mb. Nothing used within QUOTA_GRACE_SECONDS is evicted, and no file
+ * under a pinned path (blobs of the store are not pinned with their pushed copies). Directories left empty
+ * are removed.
+ *
+ * The collector is a thread in thread server mode and a child process in fork mode; the usage of its
+ * last pass is kept in shared memory for the state action. Without quota_mb and max_age_hours it is not
+ * started and the usage is not reported.
+ */
+
+#define QUOTA_GRACE_SECONDS 60
+#define QUOTA_LOW_WATERMARK_PERCENT 90
+#define QUOTA_DEFAULT_INTERVAL_SECONDS 300
+
+typedef struct {
+    long long quotaBytes;       /* 0 for no size quota */
+    long long maxAgeSeconds;    /* 0 for no age quota */
+    int intervalSeconds;        /* between collector passes */
+    char **pinned;              /* paths relative to path_to_files */
+    int pinnedCount;
+} QuotaConfig;
+
+typedef struct {
+    long long usedBytes;        /* disk usage found by the last pass */
+    long long files;
+    long long evictedFiles;     /* since start */
+    long long evictedBytes;
+    long long lastPass;         /* unix time, 0 before the first pass */
+} QuotaUsage;
+
+/**
+ * start the collector if a size or age quota is configured
+ *
+ * @param config copied
+ * @param background collector thread (long living process), a collector process is forked otherwise
+ */
+void quota_init(const char *baseDir, const QuotaConfig *config, int background);
+
+/**
+ * record the use of the file, so that it is evicted later (nothing without a collector)
+ *
+ * @param st current stat of the file, NULL if not known
+ */
+void quota_file_used(const char *path, const struct stat *st);
+
+/**
+ * @param usage receives the usage found by the last collector pass
+ * @return configured size quota in bytes, 0 if none, -1 if no collector runs
+ */
+long long quota_usage(QuotaUsage *usage);
+
+#endif
@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <direct.h>
+    #include <io.h>
+    #include <process.h>
+
+    #define getpid _getpid
+#else
+    #include <unistd.h>
+    #include <sys/time.h>
+    #ifdef __linux__
+        #include <sys/ioctl.h>
+        #include <linux/fs.h>
+    #endif
+    #ifdef __APPLE__
+        #include <sys/clonefile.h>
+    #endif
+#endif
+
+#include "workspace.h"
+#include "ckthread.h"
+#include "dircache.h"
+#include "durability.h"
+#include "filestore.h"
+#include "fileindex.h"
+#include "paths.h"
+#include "quota.h"
+#include "arena.h"
+
+#define COPY_BUFFER_SIZE (1 << 20)
+
+static char *rootDir = NULL;
+static int backgroundRemoval = 0;
+static int collectPending = 0;
+static unsigned int dropCounter = 0;
+static ck_mutex_t trashMutex;
+static ck_cond_t trashCond;
+
+int workspace_reserved(const char *path) {
+    char *normalized = path_normalize(path);
+    return !normalized || path_is_under(normalized, FILESTORE_BLOB_DIR) ||
+           path_is_under(normalized, WORKSPACE_TRASH_DIR);
+}
+
+static int entry_stat(const char *path, struct stat *st) {
+#ifdef _WIN32
+    return stat(path, st);
+#else
+    return lstat(path, st);
+#endif
+}
+
+static int make_dir(const char *path, int mode) {
+#ifdef _WIN32
+    return _mkdir(path);
+#else
+    return mkdir(path, (mode_t) mode);
+#endif
+}
+
+/*
+ * Removal
+ */
+
+static void remove_entry(void *ctx, const char *name) {
+    char *path = path_join(ctx, name);
+    struct stat st;
+    if (!path) {
+        return;
+    }
+    if (0 == entry_stat(path, &st) && S_ISDIR(st.st_mode)) {
+        path_for_each_entry(path, remove_entry, path);
+#ifdef _WIN32
+        RemoveDirectoryA(path);
+#else
+        rmdir(path);
+#endif
+    } else {
+#ifdef _WIN32
+        _chmod(path, _S_IREAD | _S_IWRITE);
+#endif
+        remove(path);
+    }
+    ck_free(path);
+}
+
+/* remove everything in the trash, errors (another process collecting as well) are ignored */
+static void empty_trash() {
+    char *trash = path_join(rootDir, WORKSPACE_TRASH_DIR);
+    if (trash) {
+        path_for_each_entry(trash, remove_entry, trash);
+        ck_free(trash);
+    }
+}
+
+static void trash_thread(void *arg) {
+    while (1) {
+        ck_mutex_lock(&trashMutex);
+        while (!collectPending) {
+            ck_cond_wait(&trashCond, &trashMutex);
+        }
+        collectPending = 0;
+        ck_mutex_unlock(&trashMutex);
+        empty_trash();
+    }
+}
+
+void workspace_init(const char *baseDir, int background) {
+    ck_mutex_init(&trashMutex);
+    ck_cond_init(&trashCond);
+    rootDir = strdup(baseDir);
+    size_t rootLen = strlen(rootDir);
+    while (rootLen > 1 && PATH_SEPARATOR == rootDir[rootLen - 1]) {
+        rootDir[--rootLen] = '\0';
+    }
+    if (background) {
+        backgroundRemoval = 0 == ck_thread_start(trash_thread, NULL);
+        if (!backgroundRemoval) {
+            perror("[WARN]: Workspace removal thread not started");
+        }
+    }
+    // leftovers of workspaces dropped before a restart
+    workspace_collect();
+}
+
+void workspace_collect() {
+    if (!backgroundRemoval) {
+        empty_trash();
+        return;
+    }
+    ck_mutex_lock(&trashMutex);
+    collectPending = 1;
+    ck_cond_signal(&trashCond);
+    ck_mutex_unlock(&trashMutex);
+}
+
+int workspace_drop(const char *path, const char **error) {
+    struct stat st;
+    char name[64];
+    char *absolute = path_join(rootDir, path_normalize(path));
+    char *trash = path_join(rootDir, WORKSPACE_TRASH_DIR);
+    if (!absolute || !trash) {
+        *error = "Could not allocate memory for workspace";
+        return -1;
+    }
+    if (0 != entry_stat(absolute, &st) || !S_ISDIR(st.st_mode)) {
+        *error = "Workspace not found";
+        return -1;
+    }
+
+    ck_mutex_lock(&trashMutex);
+    unsigned int counter = ++dropCounter;
+    ck_mutex_unlock(&trashMutex);
+    snprintf(name, sizeof(name), "%ld-%ld-%u", (long) getpid(), (long) time(NULL), counter);
+    char *trashPath = path_join(trash, name);
+    if (!trashPath) {
+        *error = "Could not allocate memory for workspace";
+        return -1;
+    }
+    if ((0 != make_dir(trash, 0700) && EEXIST != errno) || 0 != rename(absolute, trashPath)) {
+        *error = "Could not move workspace to trash";
+        return -1;
+    }
+    // cached handles of directories under the workspace now point into the trash
+    dircache_invalidate_all();
+    fileindex_path_removed(absolute);
+    return 0;
+}
+
+/*
+ * Cloning
+ */
+
+typedef struct {
+    const char *from;       /* absolute directory paths */
+    const char *to;
+    WorkspaceStats *stats;
+    const char *error;
+} CloneJob;
+
+static int copy_times(int fd, const struct stat *st) {
+#if defined(_WIN32)
+    return 0;
+#elif defined(__APPLE__)
+    struct timespec times[2] = { st->st_atimespec, st->st_mtimespec };
+    return futimens(fd, times);
+#else
+    struct timespec times[2] = { st->st_atim, st->st_mtim };
+    return futimens(fd, times);
+#endif
+}
+
+/* reflink where the file system shares extents, the data is copied otherwise */
+static int clone_content(const char *from, const char *to, const struct stat *st, WorkspaceStats *stats) {
+#if defined(_WIN32)
+    if (!CopyFileA(from, to, TRUE)) {
+        return -1;
+    }
+    stats->copied++;
+    return 0;
+#else
+#ifdef __APPLE__
+    if (0 == clonefile(from, to, 0)) {
+        stats->reflinked++;
+        return 0;
+    }
+#endif
+    int in = open(from, O_RDONLY);
+    if (in < 0) {
+        return -1;
+    }
+    int out = open(to, O_WRONLY | O_CREAT | O_EXCL, st->st_mode & 07777);
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+    int result = -1;
+#ifdef FICLONE
+    if (0 == ioctl(out, FICLONE, in)) {
+        stats->reflinked++;
+        result = 0;
+    }
+#endif
+    if (0 != result) {
+        char *buffer = malloc(COPY_BUFFER_SIZE);
+        ssize_t n = 0;
+        result = buffer ? 0 : -1;
+        while (buffer && (n = read(in, buffer, COPY_BUFFER_SIZE)) > 0) {
+            if (write(out, buffer, (size_t) n) != n) {
+                result = -1;
+                break;
+            }
+        }
+        if (n < 0) {
+            result = -1;
+        }
+        free(buffer);
+        if (0 == result) {
+            stats->copied++;
+        }
+    }
+    // build tools compare modification times of the clone as of the source
+    if (0 == result && (0 != copy_times(out, st) || 0 != durability_file_written(out))) {
+        result = -1;
+    }
+    close(in);
+    if (0 != close(out)) {
+        result = -1;
+    }
+    return result;
+#endif
+}
+
+static int clone_file(const char *from, const char *to, const struct stat *st, WorkspaceStats *stats) {
+    if (!(st->st_mode & 0222)) {
+        // read-only inputs are not written by the job, the clone may share the inode
+#ifdef _WIN32
+        int linked = CreateHardLinkA(to, from, NULL) ? 0 : -1;
+#else
+        int linked = link(from, to);
+#endif
+        if (0 == linked) {
+            stats->linked++;
+            return 0;
+        }
+    }
+    return clone_content(from, to, st, stats);
+}
+
+static void clone_entry(void *ctx, const char *name) {
+    CloneJob *job = ctx;
+    struct stat st;
+    if (job->error) {
+        return;
+    }
+    char *from = path_join(job->from, name);
+    char *to = path_join(job->to, name);
+    if (!from || !to) {
+        job->error = "Could not allocate memory for workspace";
+    } else if (0 != entry_stat(from, &st)) {
+        // removed meanwhile
+    } else if (S_ISDIR(st.st_mode)) {
+        CloneJob child = { from, to, job->stats, NULL };
+        if (0 != make_dir(to, (st.st_mode & 07777) | 0700) || 0 != path_for_each_entry(from, clone_entry, &child)) {
+            job->error = "Could not clone directory";
+        } else {
+            job->error = child.error;
+        }
+    } else if (S_ISREG(st.st_mode)) {
+        if (0 != clone_file(from, to, &st, job->stats)) {
+            job->error = "Could not clone file";
+        } else {
+            // a clone keeps the times of its source, it is used from now on all the same
+            quota_file_used(to, NULL);
+            fileindex_file_written(to, NULL);
+        }
+#ifndef _WIN32
+    } else if (S_ISLNK(st.st_mode)) {
+        char target[4096];
+        ssize_t n = readlink(from, target, sizeof(target) - 1);
+        if (n < 0) {
+            job->error = "Could not clone symbolic link";
+        } else {
+            target[n] = '\0';
+            if (0 != symlink(target, to)) {
+                job->error = "Could not clone symbolic link";
+            }
+        }
+#endif
+    }
+    ck_free(from);
+    ck_free(to);
+}
+
+/* the source is resolved beneath path_to_files, the parent of the target created the same way */
+static int resolve_dirs(char *sourceDir, char *targetDir) {
+    DirHandle *dir = dircache_get(sourceDir, 0);
+    if (!dir) {
+        return -1;
+    }
+    dircache_release(dir);
+    char *slash = strrchr(targetDir, PATH_SEPARATOR);
+    if (slash) {
+        *slash = '\0';
+        dir = dircache_get(targetDir, 1);
+        *slash = PATH_SEPARATOR;
+        if (!dir) {
+            return -1;
+        }
+        dircache_release(dir);
+    }
+    return 0;
+}
+
+int workspace_clone(const char *source, const char *target, WorkspaceStats *stats, const char **error) {
+    struct stat st;
+    char *sourceDir = path_normalize(source);
+    char *targetDir = path_normalize(target);
+    char *from = path_join(rootDir, sourceDir);
+    char *to = path_join(rootDir, targetDir);
+
+    memset(stats, 0, sizeof(*stats));
+    if (!from || !to) {
+        *error = "Could not allocate memory for workspace";
+        return -1;
+    }
+    if (path_is_under(targetDir, sourceDir)) {
+        *error = "Target directory is inside of the source directory";
+        return -1;
+    }
+    if (0 != resolve_dirs(sourceDir, targetDir) || 0 != stat(from, &st) || !S_ISDIR(st.st_mode)) {
+        *error = "Workspace not found";
+        return -1;
+    }
+    if (0 != make_dir(to, (st.st_mode & 07777) | 0700)) {
+        *error = EEXIST == errno ? "Target directory already exists" : "Could not create directory for workspace";
+        return -1;
+    }
+
+    CloneJob job = { from, to, stats, NULL };
+    if (0 != path_for_each_entry(from, clone_entry, &job) && !job.error) {
+        job.error = "Could not read source directory";
+    }
+    if (job.error) {
+        // no half cloned workspace is left behind
+        const char *dropError;
+        if (0 == workspace_drop(targetDir, &dropError)) {
+            workspace_collect();
+        }
+        *error = job.error;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+/**
+ * Workspaces: directories under path_to_files cloned from another one for a job, and dropped afterwards.
+ *
+ * A clone shares as much as possible with its source: files are reflinked (FICLONE on Linux, clonefile on
+ * macOS) where the file system supports it, read-only files are hard linked, everything else is copied.
+ * Symbolic links are recreated as they are, devices and sockets skipped.
+ *
+ * A dropped workspace is renamed into WORKSPACE_TRASH_DIR at once and removed from there later: by a
+ * background thread in a long living process, by the request's own process after the response otherwise.
+ */
+
+#define WORKSPACE_TRASH_DIR ".ck-trash"
+
+typedef struct {
+    int reflinked;
+    int linked;
+    int copied;
+} WorkspaceStats;
+
+/**
+ * @param background remove dropped workspaces in a background thread (long living process only)
+ */
+void workspace_init(const char *baseDir, int background);
+
+/**
+ * @return 1 if the path relative to path_to_files is the content store, the trash or a directory under them
+ */
+int workspace_reserved(const char *path);
+
+/**
+ * create the target directory as a copy of the source directory
+ *
+ * @param source existing directory relative to path_to_files
+ * @param target directory relative to path_to_files, must not exist yet, not under source
+ * @param stats receives the number of files cloned each way
+ * @param error receives a message on failure
+ * @return 0 on success, -1 on failure (the partial target is dropped)
+ */
+int workspace_clone(const char *source, const char *target, WorkspaceStats *stats, const char **error);
+
+/**
+ * move the directory out of the way, to be removed by workspace_collect
+ *
+ * @param path directory relative to path_to_files
+ * @param error receives a message on failure
+ * @return 0 on success, -1 on failure
+ */
+int workspace_drop(const char *path, const char **error);
+
+/**
+ * remove dropped workspaces: wakes the background thread, or removes them in the calling thread without one
+ */
+void workspace_collect();
+
+#endif
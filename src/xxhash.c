@@ -0,0 +1,133 @@
+#include <string.h>
+
+#include "xxhash.h"
+
+static const uint64_t PRIME1 = 11400714785074694791ULL;
+static const uint64_t PRIME2 = 14029467366897019727ULL;
+static const uint64_t PRIME3 = 1609587929392839161ULL;
+static const uint64_t PRIME4 = 9650029242287828579ULL;
+static const uint64_t PRIME5 = 2870177450012600261ULL;
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const unsigned char *p) {
+    return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 | (uint64_t) p[3] << 24 |
+           (uint64_t) p[4] << 32 | (uint64_t) p[5] << 40 | (uint64_t) p[6] << 48 | (uint64_t) p[7] << 56;
+}
+
+static uint64_t read32(const unsigned char *p) {
+    return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 | (uint64_t) p[3] << 24;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME1;
+}
+
+static uint64_t xxh64_merge_round(uint64_t acc, uint64_t val) {
+    acc ^= xxh64_round(0, val);
+    return acc * PRIME1 + PRIME4;
+}
+
+static void xxh64_stripe(uint64_t v[4], const unsigned char *p) {
+    v[0] = xxh64_round(v[0], read64(p));
+    v[1] = xxh64_round(v[1], read64(p + 8));
+    v[2] = xxh64_round(v[2], read64(p + 16));
+    v[3] = xxh64_round(v[3], read64(p + 24));
+}
+
+void xxh64_reset(XXH64State *state, uint64_t seed) {
+    memset(state, 0, sizeof(XXH64State));
+    state->seed = seed;
+    state->v[0] = seed + PRIME1 + PRIME2;
+    state->v[1] = seed + PRIME2;
+    state->v[2] = seed;
+    state->v[3] = seed - PRIME1;
+}
+
+void xxh64_update(XXH64State *state, const void *data, size_t len) {
+    const unsigned char *p = data;
+    const unsigned char *end = p + len;
+
+    state->totalLen += len;
+    if (state->memSize + len < 32) {
+        memcpy(state->mem + state->memSize, p, len);
+        state->memSize += len;
+        return;
+    }
+    if (state->memSize) {
+        size_t fill = 32 - state->memSize;
+        memcpy(state->mem + state->memSize, p, fill);
+        xxh64_stripe(state->v, state->mem);
+        p += fill;
+        state->memSize = 0;
+    }
+    while (p + 32 <= end) {
+        xxh64_stripe(state->v, p);
+        p += 32;
+    }
+    if (p < end) {
+        memcpy(state->mem, p, end - p);
+        state->memSize = end - p;
+    }
+}
+
+uint64_t xxh64_digest(const XXH64State *state) {
+    const unsigned char *p = state->mem;
+    const unsigned char *end = p + state->memSize;
+    uint64_t h;
+
+    if (state->totalLen >= 32) {
+        h = rotl64(state->v[0], 1) + rotl64(state->v[1], 7) + rotl64(state->v[2], 12) + rotl64(state->v[3], 18);
+        h = xxh64_merge_round(h, state->v[0]);
+        h = xxh64_merge_round(h, state->v[1]);
+        h = xxh64_merge_round(h, state->v[2]);
+        h = xxh64_merge_round(h, state->v[3]);
+    } else {
+        h = state->seed + PRIME5;
+    }
+    h += state->totalLen;
+
+    while (p + 8 <= end) {
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME1 + PRIME4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= read32(p) * PRIME1;
+        h = rotl64(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= *p * PRIME5;
+        h = rotl64(h, 11) * PRIME1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed) {
+    XXH64State state;
+    xxh64_reset(&state, seed);
+    xxh64_update(&state, data, len);
+    return xxh64_digest(&state);
+}
+
+void xxh64_hex(uint64_t hash, char *out) {
+    static const char digits[] = "0123456789abcdef";
+    int i;
+    for (i = 15; i >= 0; i--) {
+        out[i] = digits[hash & 0xf];
+        hash >>= 4;
+    }
+    out[16] = '\0';
+}
@@ -0,0 +1,38 @@
+#ifndef XXHASH_H
+#define XXHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * XXH64 non-cryptographic hash (https://github.com/Cyan4973/xxHash), one-shot and streaming variants
+ */
+
+#define XXH64_HEX_SIZE 17   /* 16 hex digits and terminating zero */
+
+typedef struct {
+    uint64_t totalLen;
+    uint64_t v[4];
+    unsigned char mem[32];
+    size_t memSize;
+    uint64_t seed;
+} XXH64State;
+
+/**
+ * @return hash of the buffer
+ */
+uint64_t xxh64(const void *data, size_t len, uint64_t seed);
+
+void xxh64_reset(XXH64State *state, uint64_t seed);
+void xxh64_update(XXH64State *state, const void *data, size_t len);
+uint64_t xxh64_digest(const XXH64State *state);
+
+/**
+ * format the hash as 16 lower case hex digits
+ *
+ * @param hash the hash value
+ * @param out buffer of at least XXH64_HEX_SIZE characters
+ */
+void xxh64_hex(uint64_t hash, char *out);
+
+#endif
@@ -0,0 +1,285 @@
+#!/usr/bin/python
+"""
+Minimal client for the crowdnode protocol (ck_json= requests over HTTP), standard library only.
+
+It stands in for the CK kernel in run_tests.py, so the tests need no CK checkout and no network, and doubles as
+a small benchmark driver:
+
+    python crowdnode_client.py call '{"action":"state"}'
+    python crowdnode_client.py bench --action push --size 100000 --requests 2000 --concurrency 8 --json push.json
+
+The secret key and the port default to the server's configuration file ($HOME/.ck-crowdnode on Linux,
+%LOCALAPPDATA%\\.ck-crowdnode on Windows). For many connections and CPU/RSS sampling of the server use the
+native ck-crowdnode-load built with the server.
+"""
+
+from __future__ import print_function
+import argparse
+import base64
+import json
+import os
+import platform
+import sys
+import tempfile
+import threading
+import time
+
+try:
+    from urllib.request import urlopen, Request
+    from urllib.parse import quote_plus
+except ImportError:
+    from urllib2 import urlopen, Request
+    from urllib import quote_plus
+
+now = getattr(time, 'perf_counter', time.time)
+
+def default_config_file():
+    if 'Windows' == platform.system():
+        return os.path.join(os.environ.get('LOCALAPPDATA', ''), '.ck-crowdnode', 'ck-crowdnode-config.json')
+    return os.path.join(os.path.expanduser('~'), '.ck-crowdnode', 'ck-crowdnode-config.json')
+
+def encode_content(content):
+    return base64.urlsafe_b64encode(content).decode('ascii')
+
+def decode_content(text):
+    return base64.urlsafe_b64decode(text.encode('ascii'))
+
+class CrowdnodeClient(object):
+    """
+    Calls one node. Every call opens its own connection, as the node closes it after the response.
+    """
+
+    def __init__(self, url='http://localhost:3333', secret_key=None, timeout=600):
+        self.url = url
+        self.secret_key = secret_key
+        self.timeout = timeout
+
+    def request_body(self, params):
+        """
+        @return ck_json= body of a request, the secret key is added unless given
+        """
+        d = {'secretkey': self.secret_key} if self.secret_key is not None else {}
+        d.update(params)
+        return ('ck_json=' + quote_plus(json.dumps(d))).encode('utf8')
+
+    def post(self, data, content_type='application/x-www-form-urlencoded'):
+        """
+        Send a request body as it is.
+
+        @return headers and body of the response
+        """
+        r = urlopen(Request(self.url, data=data, headers={'Content-Type': content_type}), timeout=self.timeout)
+        try:
+            return r.headers, r.read()
+        finally:
+            r.close()
+
+    def get(self, path):
+        """
+        @return headers and body of the response to a GET of the path, /metrics for instance
+        """
+        r = urlopen(self.url + path, timeout=self.timeout)
+        try:
+            return r.headers, r.read()
+        finally:
+            r.close()
+
+    def call(self, params):
+        """
+        Send one request, the secret key is added unless given. 'return' of the response is an int, like the CK
+        kernel returns it.
+        """
+        _, body = self.post(self.request_body(params))
+        r = json.loads(body.decode('utf8'))
+        if 'return' in r:
+            r['return'] = int(r['return'])
+        return r
+
+    def access(self, params):
+        """
+        The node's side of ck.access on a remote repo: push sends the local file 'filename' under its base name,
+        pull writes the content received to the local file 'filename'.
+        """
+        d = dict(params)
+        for key in ('cid', 'module_uoa', 'data_uoa', 'repo_uoa'):
+            d.pop(key, None)
+        filename = d.get('filename')
+        if 'push' == d.get('action') and filename:
+            with open(filename, 'rb') as f:
+                d['file_content_base64'] = encode_content(f.read())
+            d['filename'] = os.path.basename(filename)
+        r = self.call(d)
+        if 'pull' == d.get('action') and filename and 0 == r['return']:
+            with open(filename, 'wb') as f:
+                f.write(decode_content(r.get('file_content_base64', '')))
+        return r
+
+    def push(self, filename, content, extra_path=None):
+        d = {'action': 'push', 'filename': filename, 'file_content_base64': encode_content(content)}
+        if extra_path is not None:
+            d['extra_path'] = extra_path
+        return self.call(d)
+
+    def pull(self, filename, extra_path=None):
+        """
+        @return content of the file, None if the node failed to send it
+        """
+        d = {'action': 'pull', 'filename': filename}
+        if extra_path is not None:
+            d['extra_path'] = extra_path
+        r = self.call(d)
+        if 0 != r['return']:
+            return None
+        return decode_content(r.get('file_content_base64', ''))
+
+    def shell(self, cmd):
+        return self.call({'action': 'shell', 'cmd': cmd})
+
+    def state(self):
+        return self.call({'action': 'state'})
+
+    def wait_ready(self, timeout=30):
+        """
+        @return True when the node answers a state request within the timeout
+        """
+        deadline = time.time() + timeout
+        while True:
+            try:
+                return 0 == self.state()['return']
+            except Exception:
+                if time.time() > deadline:
+                    return False
+                time.sleep(0.1)
+
+class CkHelpers(object):
+    """
+    The CK kernel functions the tests use besides access.
+    """
+
+    def convert_file_to_upload_string(self, i):
+        with open(i['filename'], 'rb') as f:
+            return {'return': 0, 'file_content_base64': encode_content(f.read())}
+
+    def convert_upload_string_to_file(self, i):
+        filename = i.get('filename')
+        if not filename:
+            fd, filename = tempfile.mkstemp(suffix='.tmp')
+            os.close(fd)
+        with open(filename, 'wb') as f:
+            f.write(decode_content(i['file_content_base64']))
+        return {'return': 0, 'filename': filename}
+
+    def load_text_file(self, i):
+        with open(i['text_file'], 'rb') as f:
+            return {'return': 0, 'string': f.read().decode(i.get('encoding', 'utf8'))}
+
+def percentile(values, p):
+    """nearest rank of the sorted values"""
+    if not values:
+        return 0.0
+    rank = max(1, int(p * len(values) + 0.999999))
+    return values[rank - 1]
+
+def bench(client, action, size=10000, requests=1000, concurrency=4, cmd='echo crowdnode-client'):
+    """
+    Send requests of one action from concurrent connections, closed loop.
+
+    @return dict with requests, errors, seconds, requests_per_s and p50_ms/p99_ms/p999_ms/max_ms
+    """
+    content = os.urandom(size)
+    seed = client.push('crowdnode-client-seed.bin', content)
+    if 0 != seed['return']:
+        raise RuntimeError('pushing the seed file failed: ' + str(seed.get('error', seed)))
+
+    def request(index):
+        if 'push' == action:
+            return client.push('crowdnode-client-%d.bin' % index, content)
+        if 'pull' == action:
+            return client.call({'action': 'pull', 'filename': 'crowdnode-client-seed.bin'})
+        if 'shell' == action:
+            return client.shell(cmd)
+        return client.call({'action': action})
+
+    lock = threading.Lock()
+    latencies = []
+    errors = [0]
+    remaining = [requests]
+
+    def worker(index):
+        while True:
+            with lock:
+                if remaining[0] <= 0:
+                    return
+                remaining[0] -= 1
+            started = now()
+            try:
+                ok = 0 == request(index)['return']
+            except Exception:
+                ok = False
+            elapsed = (now() - started) * 1000
+            with lock:
+                if ok:
+                    latencies.append(elapsed)
+                else:
+                    errors[0] += 1
+
+    started = now()
+    threads = [threading.Thread(target=worker, args=(i,)) for i in range(concurrency)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    seconds = now() - started
+
+    latencies.sort()
+    return {'action': action, 'payload_bytes': size, 'concurrency': concurrency, 'requests': len(latencies),
+            'errors': errors[0], 'seconds': seconds, 'requests_per_s': len(latencies) / seconds,
+            'p50_ms': percentile(latencies, 0.5), 'p99_ms': percentile(latencies, 0.99),
+            'p999_ms': percentile(latencies, 0.999), 'max_ms': latencies[-1] if latencies else 0.0}
+
+def main():
+    parser = argparse.ArgumentParser(description='Crowdnode protocol client')
+    parser.add_argument('--url', default=None, help='node URL, http://localhost:<port from config> by default')
+    parser.add_argument('--secret_key', default=None, help='secret key, from the config file by default')
+    parser.add_argument('--config', default=default_config_file(), help='node configuration file')
+    commands = parser.add_subparsers(dest='command')
+    call_parser = commands.add_parser('call', help='send one request and print the response')
+    call_parser.add_argument('params', help='request JSON, e.g. {"action":"state"}')
+    bench_parser = commands.add_parser('bench', help='measure requests/s and latency of one action')
+    bench_parser.add_argument('--action', default='push', help='push, pull, shell or any action without parameters')
+    bench_parser.add_argument('--size', type=int, default=10000, help='pushed and pulled file size in bytes')
+    bench_parser.add_argument('--requests', type=int, default=1000)
+    bench_parser.add_argument('--concurrency', type=int, default=4)
+    bench_parser.add_argument('--cmd', default='echo crowdnode-client', help='command of the shell requests')
+    bench_parser.add_argument('--json', default=None, help='write the result to this file')
+    args = parser.parse_args()
+    if args.command is None:
+        parser.error('a command is required')
+
+    url, secret_key = args.url, args.secret_key
+    if url is None or secret_key is None:
+        try:
+            with open(args.config) as f:
+                node_cfg = json.load(f)
+        except (IOError, ValueError):
+            node_cfg = {}
+        url = url or 'http://localhost:%s' % node_cfg.get('port', 3333)
+        secret_key = secret_key or node_cfg.get('secret_key')
+    client = CrowdnodeClient(url, secret_key)
+
+    if 'call' == args.command:
+        r = client.call(json.loads(args.params))
+        print(json.dumps(r, indent=1, sort_keys=True))
+        return 0 if 0 == r.get('return', 0) else 1
+
+    r = bench(client, args.action, args.size, args.requests, args.concurrency, args.cmd)
+    print('%s: %d requests, %d errors, %.1f requests/s, p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max %.3f ms' %
+          (r['action'], r['requests'], r['errors'], r['requests_per_s'], r['p50_ms'], r['p99_ms'], r['p999_ms'],
+           r['max_ms']))
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(r, f, indent=1, sort_keys=True)
+    return 0 if 0 == r['errors'] else 2
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,161 @@
+import io
+import os
+import struct
+import tarfile
+import unittest
+import zipfile
+
+# The following variables are initialized by test runner
+ck=None                 # CK kernel
+cfg=None                # test config
+access_test_repo=None   # convenience function to call the test repo without the need to specify its UOA and secretkey.
+                        # You just need to provide 'action' and the action's arguments
+client=None             # CrowdnodeClient of the node under test, see crowdnode_client.py
+
+FILES = {
+    'readme.txt': b'archive test\n' * 100,
+    'src/main.c': b'int main() { return 0; }\n',
+    'src/deep/' + 'long_name_' * 12 + '.bin': os.urandom(100000),
+    'empty.txt': b'',
+}
+
+class TestArchive(unittest.TestCase):
+
+    def assert_extracted(self, target_path):
+        r = client.call({'action': 'manifest', 'extra_path': target_path})
+        self.assertEqual(0, r['return'])
+        sep = '\\' if 'Windows' == cfg['platform'] else '/'
+        names = sorted(f['name'] for f in r['files'])
+        self.assertEqual(sorted(target_path + sep + n.replace('/', sep) for n in FILES), names)
+        for name, content in FILES.items():
+            directory, _, filename = (target_path + '/' + name).rpartition('/')
+            self.assertEqual(content, client.pull(filename, directory.replace('/', sep)))
+
+    def test_extract_zip(self):
+        data = io.BytesIO()
+        with zipfile.ZipFile(data, 'w', zipfile.ZIP_DEFLATED) as z:
+            for name, content in FILES.items():
+                z.writestr(name, content, zipfile.ZIP_STORED if name == 'empty.txt' else zipfile.ZIP_DEFLATED)
+        self.assertEqual(0, client.push('files.zip', data.getvalue(), 'archive-test')['return'])
+
+        r = client.call({'action': 'extract', 'filename': 'files.zip', 'extra_path': 'archive-test',
+                         'target_path': 'archive-test/zip'})
+        self.assertEqual(0, r['return'])
+        self.assertEqual(len(FILES), r['files'])
+        self.assert_extracted('archive-test/zip')
+
+    def test_extract_tar_gz(self):
+        data = io.BytesIO()
+        with tarfile.open(fileobj=data, mode='w:gz', format=tarfile.GNU_FORMAT) as t:
+            for name, content in FILES.items():
+                info = tarfile.TarInfo(name)
+                info.size = len(content)
+                t.addfile(info, io.BytesIO(content))
+        self.assertEqual(0, client.push('files.tar.gz', data.getvalue(), 'archive-test')['return'])
+
+        r = client.call({'action': 'extract', 'filename': 'files.tar.gz', 'extra_path': 'archive-test',
+                         'target_path': 'archive-test/tgz'})
+        self.assertEqual(0, r['return'])
+        self.assertEqual(len(FILES), r['files'])
+        self.assert_extracted('archive-test/tgz')
+
+    def test_extract_executable(self):
+        if 'Windows' == cfg['platform']:
+            return
+        content = b'#!/bin/sh\necho archive test\n'
+        self.assertEqual(0, client.push('run.sh', content, 'archive-mode/plain')['return'])
+        data = io.BytesIO()
+        with zipfile.ZipFile(data, 'w') as z:
+            info = zipfile.ZipInfo('run.sh')
+            info.create_system = 3
+            info.external_attr = 0o100755 << 16
+            z.writestr(info, content)
+        self.assertEqual(0, client.push('script.zip', data.getvalue(), 'archive-mode')['return'])
+
+        r = client.call({'action': 'extract', 'filename': 'script.zip', 'extra_path': 'archive-mode',
+                         'target_path': 'archive-mode/zip'})
+        self.assertEqual(0, r['return'])
+        # the pushed file of the same content does not become executable with the extracted one
+        r = client.shell('test -x archive-mode/zip/run.sh && test ! -x archive-mode/plain/run.sh')
+        self.assertEqual(0, r['return_code'])
+        self.assertEqual(content, client.pull('run.sh', 'archive-mode/zip'))
+
+    def test_extract_outside(self):
+        data = io.BytesIO()
+        with zipfile.ZipFile(data, 'w') as z:
+            z.writestr('../escaped.txt', b'outside')
+        self.assertEqual(0, client.push('slip.zip', data.getvalue(), 'archive-test')['return'])
+
+        r = client.call({'action': 'extract', 'filename': 'slip.zip', 'extra_path': 'archive-test'})
+        self.assertEqual(1, r['return'])
+        r = client.call({'action': 'stat', 'filename': 'escaped.txt'})
+        self.assertEqual(1, r['return'])
+
+    def zip_declaring(self, content, compressed_size=None, size=None):
+        """
+        @return zip of one deflated entry with sizes in the central directory other than the real ones
+        """
+        data = io.BytesIO()
+        with zipfile.ZipFile(data, 'w', zipfile.ZIP_DEFLATED) as z:
+            z.writestr('entry.bin', content)
+        data = bytearray(data.getvalue())
+        central = data.index(b'PK\x01\x02')
+        if compressed_size is not None:
+            struct.pack_into('<I', data, central + 20, compressed_size)
+        if size is not None:
+            struct.pack_into('<I', data, central + 24, size)
+        return bytes(data)
+
+    def test_extract_bomb(self):
+        # 50 MB of zeros declared as 10 bytes: the output stops at the declared size
+        bomb = self.zip_declaring(bytes(50 * 1024 * 1024), size=10)
+        self.assertEqual(0, client.push('bomb.zip', bomb, 'archive-bomb')['return'])
+        r = client.call({'action': 'extract', 'filename': 'bomb.zip', 'extra_path': 'archive-bomb',
+                         'target_path': 'archive-bomb/out'})
+        self.assertEqual(1, r['return'])
+        r = client.call({'action': 'stat', 'filename': 'entry.bin', 'extra_path': 'archive-bomb/out'})
+        self.assertEqual(1, r['return'])
+
+    def test_extract_compressed_size(self):
+        # the deflate stream may not read past the compressed size of its entry
+        content = os.urandom(10000)
+        whole = self.zip_declaring(content)
+        self.assertEqual(0, client.push('whole.zip', whole, 'archive-bounds')['return'])
+        r = client.call({'action': 'extract', 'filename': 'whole.zip', 'extra_path': 'archive-bounds',
+                         'target_path': 'archive-bounds/whole'})
+        self.assertEqual(0, r['return'])
+        self.assertEqual(content, client.pull('entry.bin', 'archive-bounds/whole'))
+
+        with zipfile.ZipFile(io.BytesIO(whole)) as z:
+            compressed_size = z.getinfo('entry.bin').compress_size
+        cut = self.zip_declaring(content, compressed_size=compressed_size // 2)
+        self.assertEqual(0, client.push('cut.zip', cut, 'archive-bounds')['return'])
+        r = client.call({'action': 'extract', 'filename': 'cut.zip', 'extra_path': 'archive-bounds',
+                         'target_path': 'archive-bounds/cut'})
+        self.assertEqual(1, r['return'])
+
+    def test_archive(self):
+        for name, content in FILES.items():
+            directory, _, filename = ('archive-src/' + name).rpartition('/')
+            self.assertEqual(0, client.push(filename, content, directory)['return'])
+
+        r = client.call({'action': 'archive', 'filename': 'out.tar.gz', 'source_path': 'archive-src'})
+        self.assertEqual(0, r['return'])
+        self.assertEqual(len(FILES), r['files'])
+        with tarfile.open(fileobj=io.BytesIO(client.pull('out.tar.gz', '')), mode='r:gz') as t:
+            self.assertEqual(FILES, dict((m.name, t.extractfile(m).read()) for m in t.getmembers()))
+
+        # the archive written into the packed directory is not packed into itself
+        for i in range(2):
+            r = client.call({'action': 'archive', 'filename': 'out.zip', 'extra_path': 'archive-src'})
+            self.assertEqual(0, r['return'])
+            self.assertEqual(len(FILES), r['files'])
+        with zipfile.ZipFile(io.BytesIO(client.pull('out.zip', 'archive-src'))) as z:
+            self.assertIsNone(z.testzip())
+            self.assertEqual(FILES, dict((n, z.read(n)) for n in z.namelist()))
+
+        r = client.call({'action': 'archive', 'filename': 'out.rar', 'source_path': 'archive-src'})
+        self.assertEqual(1, r['return'])
+
+if __name__ == '__main__':
+    unittest.main()
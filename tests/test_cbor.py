@@ -0,0 +1,84 @@
+import struct
+import unittest
+
+# The following variables are initialized by test runner
+ck=None                 # CK kernel
+cfg=None                # test config
+access_test_repo=None   # convenience function to call the test repo without the need to specify its UOA and secretkey.
+                        # You just need to provide 'action' and the action's arguments
+client=None             # CrowdnodeClient of the node under test, see crowdnode_client.py
+
+def cbor_head(major, n):
+    if n < 24:
+        return struct.pack('>B', major << 5 | n)
+    for info, fmt in ((24, '>B'), (25, '>H'), (26, '>I'), (27, '>Q')):
+        if n < (1 << (8 * struct.calcsize(fmt))):
+            return struct.pack('>B', major << 5 | info) + struct.pack(fmt, n)
+
+def cbor_encode(v):
+    if isinstance(v, bool):
+        return b'\xf5' if v else b'\xf4'
+    if isinstance(v, int):
+        return cbor_head(0, v) if v >= 0 else cbor_head(1, -1 - v)
+    if isinstance(v, bytes):
+        return cbor_head(2, len(v)) + v
+    if isinstance(v, dict):
+        return cbor_head(5, len(v)) + b''.join(cbor_encode(k) + cbor_encode(x) for k, x in v.items())
+    s = v.encode('utf8')
+    return cbor_head(3, len(s)) + s
+
+def cbor_decode(data, pos=0):
+    ib = bytearray(data[pos:pos + 1])[0]
+    major, info = ib >> 5, ib & 0x1f
+    pos += 1
+    if major == 7:
+        return {20: False, 21: True, 22: None}.get(info), pos
+    n = info
+    if info == 31:
+        n = None
+    elif info >= 24:
+        fmt = {24: '>B', 25: '>H', 26: '>I', 27: '>Q'}[info]
+        n = struct.unpack(fmt, bytes(data[pos:pos + struct.calcsize(fmt)]))[0]
+        pos += struct.calcsize(fmt)
+    if major == 0:
+        return n, pos
+    if major == 1:
+        return -1 - n, pos
+    if major in (2, 3):
+        v = bytes(data[pos:pos + n])
+        return (v if major == 2 else v.decode('utf8')), pos + n
+    if major == 5:
+        d = {}
+        while bytearray(data[pos:pos + 1])[0] != 0xff if n is None else len(d) < n:
+            k, pos = cbor_decode(data, pos)
+            d[k], pos = cbor_decode(data, pos)
+        return d, pos + (1 if n is None else 0)
+    raise ValueError('unsupported CBOR item')
+
+def cbor_call(params):
+    d = {'secretkey': cfg['secret_key']}
+    d.update(params)
+    _, body = client.post(cbor_encode(d), 'application/cbor')
+    return cbor_decode(body)[0]
+
+class TestCbor(unittest.TestCase):
+
+    def test_push_pull(self):
+        content = bytes(bytearray(range(256))) * 100
+        r = cbor_call({'action': 'push', 'filename': 'cbor-test.bin', 'file_content': content})
+        self.assertEqual('0', r['return'])
+
+        r = cbor_call({'action': 'pull', 'filename': 'cbor-test.bin'})
+        self.assertEqual('0', r['return'])
+        self.assertEqual(content, r['file_content'])
+
+    def test_shell(self):
+        r = cbor_call({'action': 'shell', 'cmd': 'echo test shell stdout'})
+        self.assertEqual(0, r['return_code'])
+        self.assertIn(b'test shell stdout', r['stdout'])
+        self.assertEqual(b'', r['stderr'])
+
+    def test_error(self):
+        r = cbor_call({'action': 'unknown-action'})
+        self.assertEqual('1', r['return'])
+        self.assertIn('error', r)
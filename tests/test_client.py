@@ -0,0 +1,44 @@
+import os
+import unittest
+
+from crowdnode_client import CrowdnodeClient, bench
+
+# The following variables are initialized by test runner
+ck=None                 # CK kernel
+cfg=None                # test config
+access_test_repo=None   # convenience function to call the test repo without the need to specify its UOA and secretkey.
+                        # You just need to provide 'action' and the action's arguments
+client=None             # CrowdnodeClient of the node under test, see crowdnode_client.py
+
+class TestClient(unittest.TestCase):
+
+    def setUp(self):
+        self.client = client
+
+    def test_push_pull(self):
+        content = os.urandom(100000)
+        self.assertEqual(0, self.client.push('client-test.bin', content, extra_path='client')['return'])
+        self.assertEqual(content, self.client.pull('client-test.bin', extra_path='client'))
+        self.assertIsNone(self.client.pull('client-missing.bin'))
+
+    def test_shell_state(self):
+        r = self.client.shell('echo client')
+        self.assertEqual(0, r['return'])
+        self.assertEqual(0, r['return_code'])
+        r = self.client.state()
+        self.assertEqual(0, r['return'])
+        self.assertIn('path_to_files', r['cfg'])
+
+        r = CrowdnodeClient(client.url, 'wrong-secret-key').state()
+        self.assertNotEqual(0, r['return'])
+
+    def test_bench(self):
+        for action in ['push', 'pull', 'state']:
+            r = bench(self.client, action, size=1000, requests=20, concurrency=2)
+            self.assertEqual(20, r['requests'], action)
+            self.assertEqual(0, r['errors'], action)
+            self.assertGreater(r['requests_per_s'], 0)
+            self.assertLessEqual(r['p50_ms'], r['p99_ms'])
+
+if __name__ == '__main__':
+    unittest.main()
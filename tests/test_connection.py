@@ -0,0 +1,50 @@
+import socket
+import struct
+import time
+import unittest
+
+try:
+    from urllib.parse import urlparse
+except ImportError:
+    from urlparse import urlparse
+
+# The following variables are initialized by test runner
+ck=None                 # CK kernel
+cfg=None                # test config
+access_test_repo=None   # convenience function to call the test repo without the need to specify its UOA and secretkey.
+                        # You just need to provide 'action' and the action's arguments
+client=None             # CrowdnodeClient of the node under test, see crowdnode_client.py
+
+class TestConnection(unittest.TestCase):
+
+    def connect(self):
+        url = urlparse(client.url)
+        return socket.create_connection((url.hostname, url.port or 80), timeout=10)
+
+    def test_reset_during_request(self):
+        # a client resetting the connection in the middle of its request loses that request only, in thread
+        # mode the other requests are served by the same process
+        for i in range(3):
+            s = self.connect()
+            body = client.request_body({'action': 'state'})
+            s.sendall(('POST / HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/x-www-form-urlencoded\r\n'
+                       'Content-Length: %d\r\n\r\n' % (len(body) + 100000)).encode('ascii') + body)
+            time.sleep(0.2)
+            # close with RST instead of FIN
+            s.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack('ii', 1, 0))
+            s.close()
+            self.assertEqual(0, client.state()['return'])
+
+    def test_secret_key_not_a_string(self):
+        for key in [None, 1, ['x'], {'a': 'b'}]:
+            r = client.call({'action': 'state', 'secretkey': key})
+            self.assertEqual(3, r['return'])
+        self.assertEqual(0, client.state()['return'])
+
+    def test_closed_before_request(self):
+        s = self.connect()
+        s.close()
+        self.assertEqual(0, client.state()['return'])
+
+if __name__ == '__main__':
+    unittest.main()
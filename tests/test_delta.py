@@ -0,0 +1,75 @@
+import base64
+import random
+import struct
+import unittest
+
+# The following variables are initialized by test runner
+ck=None                 # CK kernel
+cfg=None                # test config
+access_test_repo=None   # convenience function to call the test repo without the need to specify its UOA and secretkey.
+                        # You just need to provide 'action' and the action's arguments
+client=None             # CrowdnodeClient of the node under test, see crowdnode_client.py
+
+def weak(block):
+    a = sum(bytearray(block))
+    b = sum((len(block) - i) * x for i, x in enumerate(bytearray(block)))
+    return (a & 0xffff) | (b & 0xffff) << 16
+
+def make_delta(data, block_size, checksums):
+    """delta against the server copy, blocks are matched by weak checksum and verified by content"""
+    blocks = {}
+    for i in range(len(checksums) // 12):
+        w = struct.unpack('<I', checksums[i * 12:i * 12 + 4])[0]
+        blocks.setdefault(w, i)
+    delta, literal, pos = b'', b'', 0
+    while pos < len(data):
+        block = data[pos:pos + block_size]
+        i = blocks.get(weak(block)) if len(block) == block_size else None
+        if i is not None:
+            if literal:
+                delta += struct.pack('<BI', 2, len(literal)) + literal
+                literal = b''
+            delta += struct.pack('<BII', 1, i, 1)
+            pos += block_size
+        else:
+            literal += data[pos:pos + 1]
+            pos += 1
+    if literal:
+        delta += struct.pack('<BI', 2, len(literal)) + literal
+    return delta
+
+class TestDelta(unittest.TestCase):
+
+    def test_patch(self):
+        rnd = random.Random(1)
+        original = bytes(bytearray(rnd.getrandbits(8) for _ in range(64 * 1024)))
+        r = client.call({'action': 'push', 'filename': 'delta-test.bin',
+                         'file_content_base64': base64.urlsafe_b64encode(original).decode('ascii')})
+        self.assertEqual(0, r['return'])
+
+        r = client.call({'action': 'signature', 'filename': 'delta-test.bin', 'block_size': 1024})
+        self.assertEqual(0, r['return'])
+        self.assertEqual(len(original), r['file_size'])
+        checksums = base64.urlsafe_b64decode(r['checksums_base64'].encode('ascii'))
+        self.assertEqual(64 * 12, len(checksums))
+
+        modified = original[:10000] + b'inserted bytes' + original[10000:50000] + original[51000:]
+        delta = make_delta(modified, 1024, checksums)
+        self.assertTrue(len(delta) < len(modified) // 4)
+
+        r = client.call({'action': 'patch', 'filename': 'delta-test.bin', 'block_size': 1024,
+                         'delta_base64': base64.urlsafe_b64encode(delta).decode('ascii')})
+        self.assertEqual(0, r['return'])
+
+        r = client.call({'action': 'pull', 'filename': 'delta-test.bin'})
+        self.assertEqual(modified, base64.urlsafe_b64decode(r['file_content_base64'].encode('ascii')))
+
+        # the cached signature must follow the new content
+        r = client.call({'action': 'signature', 'filename': 'delta-test.bin', 'block_size': 1024})
+        self.assertEqual(len(modified), r['file_size'])
+
+    def test_invalid_delta(self):
+        delta = struct.pack('<BII', 1, 1000, 1)
+        r = client.call({'action': 'patch', 'filename': 'delta-missing.bin',
+                         'delta_base64': base64.urlsafe_b64encode(delta).decode('ascii')})
+        self.assertEqual(1, r['return'])
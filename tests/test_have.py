@@ -0,0 +1,103 @@
+import base64
+import time
+import unittest
+
+# The following variables are initialized by test runner
+ck=None                 # CK kernel
+cfg=None                # test config
+access_test_repo=None   # convenience function to call the test repo without the need to specify its UOA and secretkey.
+                        # You just need to provide 'action' and the action's arguments
+client=None             # CrowdnodeClient of the node under test, see crowdnode_client.py
+
+class TestHave(unittest.TestCase):
+
+    def test_push_by_hash(self):
+        content = b'same content pushed twice\n' * 1000
+        r = client.call({'action': 'push', 'filename': 'have-test-1.txt',
+                         'file_content_base64': base64.urlsafe_b64encode(content).decode('ascii')})
+        self.assertEqual(0, r['return'])
+        file_hash = r['file_hash']
+
+        r = client.call({'action': 'have', 'hashes': [file_hash, '0123456789abcdef']})
+        self.assertEqual(0, r['return'])
+        self.assertEqual(['0123456789abcdef'], r['missing'])
+
+        # the content is already at the node, only the hash is sent
+        r = client.call({'action': 'push', 'filename': 'have-test-2.txt', 'extra_path': 'have', 'file_hash': file_hash})
+        self.assertEqual(0, r['return'])
+        self.assertEqual(file_hash, r['file_hash'])
+
+        r = client.call({'action': 'pull', 'filename': 'have-test-2.txt', 'extra_path': 'have'})
+        self.assertEqual(0, r['return'])
+        self.assertEqual(content, base64.urlsafe_b64decode(r['file_content_base64'].encode('ascii')))
+
+    def test_unknown_hash(self):
+        r = client.call({'action': 'push', 'filename': 'have-test-3.txt', 'file_hash': 'fedcba9876543210'})
+        self.assertEqual(1, r['return'])
+
+        r = client.call({'action': 'have'})
+        self.assertEqual(1, r['return'])
+
+    def test_modified_in_place(self):
+        if 'Windows' == cfg['platform']:
+            return
+        content = b'original content of a pushed file\n' * 100
+        r = client.push('have-modified-1.txt', content)
+        self.assertEqual(0, r['return'])
+        file_hash = r['file_hash']
+        r = client.push('have-modified-2.txt', content)
+        self.assertEqual(0, r['return'])
+
+        # a job writes a pushed file in place, same size: the other file and the store keep the content
+        r = client.shell("printf 'HACKED!!' | dd of=have-modified-1.txt conv=notrunc 2>/dev/null")
+        self.assertEqual(0, r['return_code'])
+        self.assertEqual(b'HACKED!!' + content[8:], client.pull('have-modified-1.txt'))
+        self.assertEqual(content, client.pull('have-modified-2.txt'))
+
+        r = client.call({'action': 'have', 'hashes': [file_hash]})
+        self.assertEqual([], r['missing'])
+        r = client.call({'action': 'push', 'filename': 'have-modified-3.txt', 'file_hash': file_hash})
+        self.assertEqual(0, r['return'])
+        self.assertEqual(content, client.pull('have-modified-3.txt'))
+
+    def test_blob_modified(self):
+        if 'Windows' == cfg['platform']:
+            return
+        content = b'original content of a stored blob\n' * 100
+        r = client.push('have-blob-1.txt', content)
+        self.assertEqual(0, r['return'])
+        file_hash = r['file_hash']
+
+        # written behind the store, the blob no longer matches its name
+        blob = '.ck-blobs/%s/%s' % (file_hash[:2], file_hash)
+        r = client.shell("printf 'HACKED!!' | dd of=%s conv=notrunc 2>/dev/null" % blob)
+        self.assertEqual(0, r['return_code'])
+
+        r = client.call({'action': 'have', 'hashes': [file_hash]})
+        self.assertEqual([file_hash], r['missing'])
+        r = client.call({'action': 'push', 'filename': 'have-blob-2.txt', 'file_hash': file_hash})
+        self.assertEqual(1, r['return'])
+
+        # the content stored again is reused as usual
+        r = client.push('have-blob-2.txt', content)
+        self.assertEqual(0, r['return'])
+        self.assertEqual(file_hash, r['file_hash'])
+        r = client.push('have-blob-3.txt', content)
+        self.assertEqual(0, r['return'])
+        self.assertEqual(content, client.pull('have-blob-3.txt'))
+        self.assertEqual(content, client.pull('have-blob-1.txt'))
+
+    def test_pushed_again_is_new(self):
+        if 'Windows' == cfg['platform']:
+            return
+        # build tools compare times: old content pushed again must not look older than the file it replaces
+        r = client.push('have-mtime-old.c', b'int version = 1;\n')
+        self.assertEqual(0, r['return'])
+        time.sleep(1.1)
+        r = client.push('have-mtime.c', b'int version = 2;\n')
+        self.assertEqual(0, r['return'])
+        r = client.push('have-mtime.c', b'int version = 1;\n')
+        self.assertEqual(0, r['return'])
+
+        r = client.shell('test have-mtime.c -nt have-mtime-old.c')
+        self.assertEqual(0, r['return_code'])
@@ -0,0 +1,51 @@
+import time
+import unittest
+
+# The following variables are initialized by test runner
+ck=None                 # CK kernel
+cfg=None                # test config
+access_test_repo=None   # convenience function to call the test repo without the need to specify its UOA and secretkey.
+                        # You just need to provide 'action' and the action's arguments
+client=None             # CrowdnodeClient of the node under test, see crowdnode_client.py
+
+class TestList(unittest.TestCase):
+
+    def test_list_manifest_stat(self):
+        sep = '\\' if 'Windows' == cfg['platform'] else '/'
+        extra_path = 'list-test' + sep + 'sub'
+        r = client.push('one.txt', b'first file', extra_path)
+        self.assertEqual(0, r['return'])
+        hash1 = r['file_hash']
+        r = client.push('two.txt', b'second file content', extra_path)
+        self.assertEqual(0, r['return'])
+        hash2 = r['file_hash']
+
+        r = client.call({'action': 'list', 'extra_path': 'list-test'})
+        self.assertEqual(0, r['return'])
+        files = dict((f['name'], f) for f in r['files'])
+        self.assertEqual(sorted(files), [extra_path + sep + 'one.txt', extra_path + sep + 'two.txt'])
+        self.assertEqual(19, files[extra_path + sep + 'two.txt']['size'])
+        self.assertNotIn('file_hash', files[extra_path + sep + 'two.txt'])
+
+        r = client.call({'action': 'manifest', 'extra_path': extra_path})
+        self.assertEqual(0, r['return'])
+        hashes = [f['file_hash'] for f in r['files']]
+        self.assertEqual([hash1, hash2], hashes)
+
+        r = client.call({'action': 'stat', 'filename': 'one.txt', 'extra_path': extra_path})
+        self.assertEqual(0, r['return'])
+        self.assertEqual(10, r['size'])
+        self.assertEqual(hash1, r['file_hash'])
+
+        # changes made outside of push are picked up as well
+        cmd = ('del ' if 'Windows' == cfg['platform'] else 'rm ') + extra_path + sep + 'one.txt'
+        client.call({'action': 'shell', 'cmd': cmd})
+        for i in range(50):
+            r = client.call({'action': 'list', 'extra_path': extra_path})
+            if len(r['files']) == 1:
+                break
+            time.sleep(0.1)
+        self.assertEqual([extra_path + sep + 'two.txt'], [f['name'] for f in r['files']])
+
+        r = client.call({'action': 'stat', 'filename': 'one.txt', 'extra_path': extra_path})
+        self.assertEqual(1, r['return'])
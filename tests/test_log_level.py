@@ -0,0 +1,33 @@
+import unittest
+
+# The following variables are initialized by test runner
+ck=None                 # CK kernel
+cfg=None                # test config
+access_test_repo=None   # convenience function to call the test repo without the need to specify its UOA and secretkey.
+                        # You just need to provide 'action' and the action's arguments
+client=None             # CrowdnodeClient of the node under test, see crowdnode_client.py
+
+class TestLogLevel(unittest.TestCase):
+
+    def test_log_level(self):
+        r = client.call({'action': 'log_level'})
+        self.assertEqual(0, r['return'])
+        previous = r['level']
+        self.assertIn(previous, ['error', 'warn', 'info', 'debug'])
+
+        try:
+            r = client.call({'action': 'log_level', 'level': 'debug'})
+            self.assertEqual(0, r['return'])
+            self.assertEqual('debug', r['level'])
+            # the level holds for the following requests, whichever process or thread serves them
+            self.assertEqual(0, client.call({'action': 'state'})['return'])
+            self.assertEqual('debug', client.call({'action': 'log_level'})['level'])
+
+            r = client.call({'action': 'log_level', 'level': 'verbose'})
+            self.assertEqual(1, r['return'])
+            self.assertEqual('debug', client.call({'action': 'log_level'})['level'])
+        finally:
+            client.call({'action': 'log_level', 'level': previous})
+
+if __name__ == '__main__':
+    unittest.main()
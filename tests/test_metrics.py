@@ -0,0 +1,77 @@
+import base64
+import json
+import re
+import unittest
+
+# The following variables are initialized by test runner
+ck=None                 # CK kernel
+cfg=None                # test config
+access_test_repo=None   # convenience function to call the test repo without the need to specify its UOA and secretkey.
+                        # You just need to provide 'action' and the action's arguments
+client=None             # CrowdnodeClient of the node under test, see crowdnode_client.py
+
+def scrape():
+    headers, body = client.get('/metrics')
+    return headers.get('Content-Type'), body.decode('utf8')
+
+def value(text, sample):
+    m = re.search('^' + re.escape(sample) + r' (\S+)$', text, re.M)
+    return float(m.group(1)) if m else 0.0
+
+class TestMetrics(unittest.TestCase):
+
+    def test_metrics(self):
+        _, before = scrape()
+        self.assertEqual(0, client.call({'action': 'state'})['return'])
+        self.assertEqual(1, client.call({'action': 'pull', 'filename': 'metrics-none.txt'})['return'])
+        content_type, after = scrape()
+
+        self.assertTrue(content_type.startswith('text/plain'))
+        self.assertIn('# TYPE ck_crowdnode_request_duration_seconds histogram', after)
+        for sample in ['ck_crowdnode_requests_total{action="state",result="0"}',
+                       'ck_crowdnode_requests_total{action="pull",result="1"}',
+                       'ck_crowdnode_request_duration_seconds_count{action="state"}',
+                       'ck_crowdnode_request_duration_seconds_bucket{action="pull",le="+Inf"}']:
+            self.assertEqual(value(before, sample) + 1, value(after, sample), sample)
+        self.assertGreater(value(after, 'ck_crowdnode_received_bytes_total'),
+                           value(before, 'ck_crowdnode_received_bytes_total'))
+        self.assertGreater(value(after, 'ck_crowdnode_sent_bytes_total'),
+                           value(before, 'ck_crowdnode_sent_bytes_total'))
+        # the scrape itself is being processed
+        self.assertEqual(1, value(after, 'ck_crowdnode_active_connections'))
+        self.assertEqual(0, value(after, 'ck_crowdnode_shell_jobs_running'))
+
+    def test_timings(self):
+        content = b'0123456789' * 1000
+        d = {'action': 'push', 'filename': 'timings-test.bin', 'timings': True,
+             'file_content_base64': base64.urlsafe_b64encode(content).decode('ascii')}
+        headers, body = client.post(client.request_body(d))
+        server_timing = headers.get('Server-Timing')
+        r = json.loads(body.decode('utf8'))
+        self.assertEqual('0', r['return'])
+
+        timings = r['timings']
+        for phase in ['recv', 'url_decode', 'parse', 'base64_decode', 'write', 'total']:
+            self.assertIn(phase, timings)
+            self.assertGreaterEqual(timings[phase], 0)
+        self.assertLessEqual(timings['base64_decode'] + timings['write'], timings['total'])
+        self.assertIn('base64_decode;dur=', server_timing)
+        self.assertIn('total;dur=', server_timing)
+
+        # only in servers built with -DCK_ALLOC_PROFILE=ON
+        if 'allocations' in r:
+            allocations = r['allocations']
+            self.assertGreater(allocations['json'], 0)
+            self.assertGreaterEqual(allocations['json_bytes'], len(content))
+            if 'heap' in allocations:
+                self.assertGreater(allocations['heap'], 0)
+                self.assertGreaterEqual(allocations['heap_bytes'], len(content))
+                self.assertGreater(allocations['heap_peak_bytes'], 0)
+
+        # only on request
+        r = client.call({'action': 'pull', 'filename': 'timings-test.bin'})
+        self.assertNotIn('timings', r)
+        self.assertEqual(content, base64.urlsafe_b64decode(r['file_content_base64'].encode('ascii')))
+
+if __name__ == '__main__':
+    unittest.main()
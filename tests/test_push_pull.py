@@ -2,6 +2,7 @@
 import shutil
 import os
 import filecmp
+import tempfile
 import unittest
 
 # The following variables are initialized by test runner
@@ -9,6 +10,8 @@ ck=None                 # CK kernel
 cfg=None                # test config
 access_test_repo=None   # convenience function to call the test repo without the need to specify its UOA and secretkey.
                         # You just need to provide 'action' and the action's arguments
+files_dir = None        # Path to files from config
+client=None             # CrowdnodeClient of the node under test, see crowdnode_client.py
 
 class TestPushPull(unittest.TestCase):
 
@@ -60,5 +63,99 @@ class TestPushPull(unittest.TestCase):
         r = access_test_repo({'action': 'push', 'filename': orig_file, 'extra_path': extra_path2}, checkFail=False)
         self.assertEqual(0, r['return'])
 
+    def test_pull_after_push(self):
+        tmp_file = 'ck-push-test.txt'
+        try:
+            # pulled twice so that the node may serve it from memory, then replaced
+            for content in (b'first content', b'second content'):
+                with open(tmp_file, 'wb') as f:
+                    f.write(content)
+                access_test_repo({'action': 'push', 'filename': tmp_file})
+                for i in range(2):
+                    os.remove(tmp_file)
+                    access_test_repo({'action': 'pull', 'filename': tmp_file})
+                    with open(tmp_file, 'rb') as f:
+                        self.assertEqual(content, f.read())
+        finally:
+            try:
+                os.remove(tmp_file)
+            except: pass
+
+    def test_push_same_content(self):
+        tmp_file = 'ck-push-same.txt'
+        try:
+            with open(tmp_file, 'wb') as f:
+                f.write(b'same content')
+            # the node file links the stored content already the second time, nothing may be left behind
+            for i in range(3):
+                access_test_repo({'action': 'push', 'filename': tmp_file})
+            leftovers = [name for name in os.listdir(files_dir) if name.startswith(tmp_file + '.tmp.')]
+            self.assertEqual([], leftovers)
+        finally:
+            try:
+                os.remove(tmp_file)
+            except: pass
+
+    def test_push_pull_large(self):
+        tmp_file = 'ck-push-large.bin'
+        # several write chunks, not a multiple of the block size
+        content = os.urandom(3 * 1024 * 1024 + 1234)
+        try:
+            with open(tmp_file, 'wb') as f:
+                f.write(content)
+            access_test_repo({'action': 'push', 'filename': tmp_file})
 
+            os.remove(tmp_file)
 
+            access_test_repo({'action': 'pull', 'filename': tmp_file})
+            with open(tmp_file, 'rb') as f:
+                self.assertEqual(content, f.read())
+        finally:
+            try:
+                os.remove(tmp_file)
+            except: pass
+
+    def test_extra_path_outside(self):
+        orig_file = 'ck-master.zip'
+        outside = '..\\outside' if 'Windows' == cfg['platform'] else '../outside'
+        r = access_test_repo({'action': 'push', 'filename': orig_file, 'extra_path': outside}, checkFail=False)
+        self.assertNotEqual(0, r['return'])
+
+        r = access_test_repo({'action': 'pull', 'filename': orig_file, 'extra_path': outside}, checkFail=False)
+        self.assertNotEqual(0, r['return'])
+
+    def test_symlink_outside(self):
+        if 'Windows' == cfg['platform']:
+            return
+        outside = tempfile.mkdtemp()
+        link = os.path.join(files_dir, 'link-outside')
+        os.symlink(outside, link)
+        try:
+            # neither through the directory part of filename nor through extra_path
+            r = client.push('link-outside/escaped.txt', b'escaped\n')
+            self.assertNotEqual(0, r['return'])
+            r = client.push('escaped.txt', b'escaped\n', 'link-outside')
+            self.assertNotEqual(0, r['return'])
+            self.assertEqual([], os.listdir(outside))
+        finally:
+            os.remove(link)
+            shutil.rmtree(outside)
+
+    def test_extra_path_removed(self):
+        tmp_file = 'ck-push-test.txt'
+        remove_cmd = 'rmdir /s /q removed-dir' if 'Windows' == cfg['platform'] else 'rm -rf removed-dir'
+        try:
+            # the directory is created again after a shell command removed it
+            for content in (b'before removal', b'after removal'):
+                with open(tmp_file, 'wb') as f:
+                    f.write(content)
+                access_test_repo({'action': 'push', 'filename': tmp_file, 'extra_path': 'removed-dir'})
+                os.remove(tmp_file)
+                access_test_repo({'action': 'pull', 'filename': tmp_file, 'extra_path': 'removed-dir'})
+                with open(tmp_file, 'rb') as f:
+                    self.assertEqual(content, f.read())
+                access_test_repo({'action': 'shell', 'cmd': remove_cmd})
+        finally:
+            try:
+                os.remove(tmp_file)
+            except: pass
@@ -0,0 +1,117 @@
+import os
+import time
+import unittest
+
+# The following variables are initialized by test runner
+ck=None                 # CK kernel
+cfg=None                # test config
+access_test_repo=None   # convenience function to call the test repo without the need to specify its UOA and secretkey.
+                        # You just need to provide 'action' and the action's arguments
+start_custom_node=None  # starts a node with extra configuration, returns its client and path_to_files
+stop_custom_nodes=None
+
+HOUR = 3600
+
+class TestQuota(unittest.TestCase):
+
+    def tearDown(self):
+        stop_custom_nodes()
+
+    def start(self, config):
+        self.node, self.files_dir = start_custom_node(dict(config, gc_interval_s=1))
+
+    def path(self, name):
+        return os.path.join(self.files_dir, *name.split('/'))
+
+    def push(self, name, content, age=0):
+        directory, _, filename = name.rpartition('/')
+        r = self.node.push(filename, content, directory or None)
+        self.assertEqual(0, r['return'])
+        if age:
+            self.age(name, age)
+            self.age(self.blob(r['file_hash']), age)
+        return r['file_hash']
+
+    def blob(self, file_hash):
+        return '.ck-blobs/%s/%s' % (file_hash[:2], file_hash)
+
+    def age(self, name, age):
+        t = time.time() - age
+        os.utime(self.path(name), (t, t))
+
+    def wait_pass(self):
+        """
+        @return storage usage of the first collector pass that starts after the call
+        """
+        start = int(time.time())
+        for i in range(100):
+            storage = self.node.state()['storage']
+            if storage['last_pass'] > start:
+                return storage
+            time.sleep(0.1)
+        self.fail('No collector pass within 10 seconds')
+
+    def test_age(self):
+        self.start({'max_age_hours': 1, 'pinned_paths': ['pinned']})
+        old_hash = self.push('old/old.txt', b'old content\n', 2 * HOUR)
+        self.push('recent.txt', b'recent content\n', HOUR // 2)
+        pinned_hash = self.push('pinned/deep/old.txt', b'pinned content\n', 2 * HOUR)
+        # a push of stored content and a clone of an old file are uses of their content
+        linked_hash = self.push('linked/old.txt', b'old content linked again\n', 2 * HOUR)
+        r = self.node.call({'action': 'push', 'filename': 'again.txt', 'extra_path': 'linked', 'file_hash': linked_hash})
+        self.assertEqual(0, r['return'])
+        self.push('src/old.txt', b'old content cloned\n', 2 * HOUR)
+        r = self.node.call({'action': 'clone_workspace', 'source_path': 'src', 'target_path': 'clone'})
+        self.assertEqual(0, r['return'])
+        # reading the source for the clone is a use of it, unlike the old times the clone keeps
+        self.age('src/old.txt', 2 * HOUR)
+        # the workspace trash is for the workspace to empty
+        os.makedirs(self.path('.ck-trash/1'))
+        with open(self.path('.ck-trash/1/old.txt'), 'wb') as f:
+            f.write(b'dropped\n')
+        self.age('.ck-trash/1/old.txt', 2 * HOUR)
+
+        storage = self.wait_pass()
+        for name in ['old/old.txt', 'linked/old.txt', 'src/old.txt']:
+            self.assertFalse(os.path.exists(self.path(name)), name)
+        for name in ['recent.txt', 'pinned/deep/old.txt', 'linked/again.txt', 'clone/old.txt',
+                     '.ck-trash/1/old.txt']:
+            self.assertTrue(os.path.exists(self.path(name)), name)
+        # pushed files are copies: the blob of pinned content is not pinned, the one pushed again stays
+        r = self.node.call({'action': 'have', 'hashes': [old_hash, pinned_hash, linked_hash]})
+        self.assertEqual([old_hash, pinned_hash], r['missing'])
+        # old/old.txt, linked/old.txt, src/old.txt and the blobs of all but the content pushed again
+        self.assertEqual(6, storage['evicted_files'])
+        self.assertEqual(0, storage['quota_bytes'])
+
+    def test_size(self):
+        # 300 KB, evicted down to 90 %, for files and their blobs
+        self.start({'quota_mb': 0.3, 'pinned_paths': ['pinned']})
+        self.push('pinned/oldest.bin', os.urandom(50000), 4 * HOUR)
+        self.push('oldest.bin', os.urandom(100000), 3 * HOUR)
+        self.push('older.bin', os.urandom(50000), 2 * HOUR)
+        self.push('new.bin', os.urandom(10000), HOUR)
+
+        storage = self.wait_pass()
+        self.assertEqual(int(0.3 * 1024 * 1024), storage['quota_bytes'])
+        self.assertFalse(os.path.exists(self.path('oldest.bin')))
+        for name in ['pinned/oldest.bin', 'older.bin', 'new.bin']:
+            self.assertTrue(os.path.exists(self.path(name)), name)
+        # the pinned blob, then oldest.bin and its blob
+        self.assertEqual(3, storage['evicted_files'])
+        self.assertLessEqual(storage['used_bytes'], storage['quota_bytes'] * 0.9)
+        self.assertGreaterEqual(storage['used_bytes'], 2 * 60000 + 50000)
+        self.assertEqual(5, storage['files'])
+
+    def test_grace(self):
+        # nothing used within the last minute is evicted, over the quota all the same
+        self.start({'quota_mb': 0.05})
+        self.push('fresh.bin', os.urandom(100000))
+
+        storage = self.wait_pass()
+        self.assertTrue(os.path.exists(self.path('fresh.bin')))
+        self.assertEqual(0, storage['evicted_files'])
+        self.assertGreater(storage['used_bytes'], storage['quota_bytes'])
+
+if __name__ == '__main__':
+    unittest.main()
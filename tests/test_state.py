@@ -1,4 +1,6 @@
 
+import threading
+import time
 import unittest
 
 # The following variables are initialized by test runner
@@ -7,6 +9,8 @@ cfg=None                # test config
 access_test_repo=None   # convenience function to call the test repo without the need to specify its UOA and secretkey.
                         # You just need to provide 'action' and the action's arguments
 files_dir = None        # Path to files from config
+start_custom_node=None  # starts a node with extra configuration, returns its client and path_to_files
+stop_custom_nodes=None
 
 class TestPushPull(unittest.TestCase):
 
@@ -18,3 +22,45 @@ class TestPushPull(unittest.TestCase):
         self.assertIn('return', r)
         self.assertEqual(0, r['return'])
 
+    def test_refresh_profile_blocking(self):
+        if 'Windows' == cfg['platform']:
+            return
+        node, _ = start_custom_node({'server_mode': 'thread', 'worker_threads': 4, 'max_blocking_jobs': 1})
+        try:
+            shell = threading.Thread(target=node.shell, args=('sleep 2',))
+            shell.start()
+            time.sleep(0.5)
+            # a plain state is served next to the shell job, the compiler probes wait for its slot
+            started = time.time()
+            self.assertEqual(0, node.state()['return'])
+            self.assertLess(time.time() - started, 1)
+            self.assertEqual(0, node.call({'action': 'state', 'refresh_profile': True})['return'])
+            self.assertGreaterEqual(time.time() - started, 1)
+            shell.join()
+        finally:
+            stop_custom_nodes()
+
+    def test_storage(self):
+        # no quota configured, no collector walks the files
+        r = access_test_repo({'action': 'state'})
+        self.assertNotIn('storage', r)
+
+
+    def test_profile(self):
+        r = access_test_repo({'action': 'state'})
+        profile = r['profile']
+        for key in ['os', 'os_release', 'machine', 'hostname', 'cpu', 'memory', 'compilers', 'collected']:
+            self.assertIn(key, profile)
+        self.assertGreater(profile['cpu']['logical_cpus'], 0)
+        self.assertGreater(profile['memory']['total_bytes'], 0)
+        profile_hash = r['profile_hash']
+        self.assertEqual(16, len(profile_hash))
+        int(profile_hash, 16)
+
+        r = access_test_repo({'action': 'state', 'refresh_profile': True})
+        self.assertEqual(profile_hash, r['profile_hash'])
+        self.assertIn('profile', r)
+
+        r = access_test_repo({'action': 'state', 'profile_hash': profile_hash})
+        self.assertEqual(profile_hash, r['profile_hash'])
+        self.assertNotIn('profile', r)
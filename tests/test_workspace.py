@@ -0,0 +1,61 @@
+import unittest
+
+# The following variables are initialized by test runner
+ck=None                 # CK kernel
+cfg=None                # test config
+access_test_repo=None   # convenience function to call the test repo without the need to specify its UOA and secretkey.
+                        # You just need to provide 'action' and the action's arguments
+client=None             # CrowdnodeClient of the node under test, see crowdnode_client.py
+
+class TestWorkspace(unittest.TestCase):
+
+    def list(self, extra_path):
+        r = client.call({'action': 'list', 'extra_path': extra_path})
+        self.assertEqual(0, r['return'])
+        return sorted(f['name'] for f in r['files'])
+
+    def test_clone_drop(self):
+        sep = '\\' if 'Windows' == cfg['platform'] else '/'
+        self.assertEqual(0, client.push('main.c', b'int main() { return 0; }\n', 'ws-src')['return'])
+        self.assertEqual(0, client.push('input.txt', b'1 2 3\n', 'ws-src' + sep + 'data')['return'])
+
+        r = client.call({'action': 'clone_workspace', 'source_path': 'ws-src', 'target_path': 'ws-jobs/1'})
+        self.assertEqual(0, r['return'])
+        self.assertEqual(2, r['reflinked'] + r['linked'] + r['copied'])
+        self.assertEqual(['ws-jobs' + sep + '1' + sep + 'data' + sep + 'input.txt',
+                          'ws-jobs' + sep + '1' + sep + 'main.c'], self.list('ws-jobs'))
+        self.assertEqual(b'1 2 3\n', client.pull('input.txt', 'ws-jobs/1/data'))
+
+        # the clone is independent of its source
+        self.assertEqual(0, client.push('main.c', b'int main() { return 1; }\n', 'ws-jobs/1')['return'])
+        self.assertEqual(b'int main() { return 0; }\n', client.pull('main.c', 'ws-src'))
+
+        r = client.call({'action': 'clone_workspace', 'source_path': 'ws-src', 'target_path': 'ws-jobs/1'})
+        self.assertEqual(1, r['return'])
+        r = client.call({'action': 'clone_workspace', 'source_path': 'ws-src', 'target_path': 'ws-src/copy'})
+        self.assertEqual(1, r['return'])
+        r = client.call({'action': 'clone_workspace', 'source_path': 'ws-none', 'target_path': 'ws-jobs/2'})
+        self.assertEqual(1, r['return'])
+
+        r = client.call({'action': 'drop_workspace', 'extra_path': 'ws-jobs/1'})
+        self.assertEqual(0, r['return'])
+        self.assertEqual([], self.list('ws-jobs'))
+        r = client.call({'action': 'pull', 'filename': 'main.c', 'extra_path': 'ws-jobs/1'})
+        self.assertEqual(1, r['return'])
+
+        # the name is free again at once
+        r = client.call({'action': 'clone_workspace', 'source_path': 'ws-src', 'target_path': 'ws-jobs/1'})
+        self.assertEqual(0, r['return'])
+        self.assertEqual(b'int main() { return 0; }\n', client.pull('main.c', 'ws-jobs/1'))
+        self.assertEqual(0, client.push('output.txt', b'result', 'ws-jobs/1')['return'])
+        self.assertEqual(b'result', client.pull('output.txt', 'ws-jobs/1'))
+
+    def test_drop_reserved(self):
+        for path in ['.ck-blobs', '.ck-trash', '../outside', '']:
+            r = client.call({'action': 'drop_workspace', 'extra_path': path})
+            self.assertEqual(1, r['return'])
+        r = client.call({'action': 'drop_workspace', 'extra_path': 'ws-none'})
+        self.assertEqual(1, r['return'])
+
+if __name__ == '__main__':
+    unittest.main()